@@ -0,0 +1,482 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ClassificationDaemon.h"
+
+//Local
+#include "q3DMASCTools.h"
+#include "ResultSidecar.h"
+#include "SpatialIndexCache.h"
+
+//qCC_db
+#include <ccPointCloud.h>
+#include <ccLog.h>
+
+//Qt
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonDocument>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QtConcurrent>
+
+//system
+#include <algorithm>
+#include <assert.h>
+
+using namespace masc;
+
+static QJsonObject ErrorReply(const QString& message)
+{
+	QJsonObject answer;
+	answer["status"] = "error";
+	answer["message"] = message;
+	return answer;
+}
+
+ClassificationDaemon::CachedCloud::~CachedCloud()
+{
+	if (cloud)
+	{
+		SpatialIndexCache::ReleaseClassIndexes(cloud);
+		delete cloud;
+	}
+}
+
+ClassificationDaemon::ClassificationDaemon(int maxConcurrentJobs/*=1*/, QObject* parent/*=nullptr*/)
+	: QObject(parent)
+	, m_server(new QLocalServer(this))
+	, m_pendingJobs(0)
+	, m_shutdownRequested(false)
+	, m_allowCompiledForests(false)
+	, m_coordinatesShift(0, 0, 0)
+	, m_coordinatesShiftEnabled(false)
+	, m_processedJobs(0)
+	, m_failedJobs(0)
+	, m_classifierLoads(0)
+	, m_classifierHits(0)
+	, m_cloudLoads(0)
+	, m_cloudHits(0)
+{
+	m_pool.setMaxThreadCount(std::max(1, maxConcurrentJobs));
+	connect(m_server, &QLocalServer::newConnection, this, &ClassificationDaemon::onNewConnection);
+}
+
+ClassificationDaemon::~ClassificationDaemon()
+{
+	m_pool.waitForDone();
+	m_server->close();
+}
+
+ccPointCloud* ClassificationDaemon::loadCloud(const QString& filename, QString& error)
+{
+	//the first cloud defines the global shift (the lock is kept until it is known)
+	QMutexLocker shiftLocker(&m_shiftMutex);
+	CCVector3d coordinatesShift = m_coordinatesShift;
+	bool coordinatesShiftEnabled = m_coordinatesShiftEnabled;
+	bool firstCloud = !coordinatesShiftEnabled;
+	if (!firstCloud)
+	{
+		shiftLocker.unlock();
+	}
+
+	ccPointCloud* cloud = Tools::LoadCloud(filename, error, &coordinatesShift, &coordinatesShiftEnabled);
+	if (firstCloud && cloud)
+	{
+		//(still locked)
+		m_coordinatesShift = coordinatesShift;
+		m_coordinatesShiftEnabled = true;
+	}
+
+	return cloud;
+}
+
+bool ClassificationDaemon::listen(const QString& serverName, QString& error)
+{
+	//don't take over the socket of a running daemon
+	{
+		QLocalSocket probe;
+		probe.connectToServer(serverName);
+		if (probe.waitForConnected(1000))
+		{
+			probe.disconnectFromServer();
+			error = QString("A daemon is already listening on '%1'").arg(serverName);
+			return false;
+		}
+	}
+
+	//nobody answers: remove the stale socket left by a previous instance (if any)
+	QLocalServer::removeServer(serverName);
+
+	if (!m_server->listen(serverName))
+	{
+		error = m_server->errorString();
+		return false;
+	}
+
+	ccLog::Print(QString("[3DMASC] Daemon listening on '%1' (%2 concurrent job(s) max)").arg(m_server->fullServerName()).arg(m_pool.maxThreadCount()));
+	return true;
+}
+
+void ClassificationDaemon::exec()
+{
+	m_loop.exec();
+}
+
+void ClassificationDaemon::onNewConnection()
+{
+	while (QLocalSocket* socket = m_server->nextPendingConnection())
+	{
+		connect(socket, &QLocalSocket::disconnected, socket, &QLocalSocket::deleteLater);
+		connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { onRequest(socket); });
+	}
+}
+
+void ClassificationDaemon::reply(QLocalSocket* socket, const QJsonObject& answer)
+{
+	if (socket->state() != QLocalSocket::ConnectedState)
+	{
+		ccLog::Warning("[3DMASC] Daemon: the client disconnected before the reply");
+		return;
+	}
+	socket->write(QJsonDocument(answer).toJson(QJsonDocument::Compact) + '\n');
+	socket->flush();
+	socket->disconnectFromServer();
+}
+
+void ClassificationDaemon::onRequest(QLocalSocket* socket)
+{
+	//wait for a complete line
+	if (!socket->canReadLine())
+	{
+		return;
+	}
+	QByteArray line = socket->readLine();
+	disconnect(socket, &QLocalSocket::readyRead, this, nullptr); //one request per connection
+
+	QJsonParseError parseError;
+	QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+	if (!doc.isObject())
+	{
+		reply(socket, ErrorReply("Malformed request: " + parseError.errorString()));
+		return;
+	}
+	QJsonObject request = doc.object();
+
+	QString command = request.value("command").toString("classify").toLower();
+	if (command == "status")
+	{
+		QJsonObject answer;
+		answer["status"] = "ok";
+		answer["pending_jobs"] = m_pendingJobs;
+		answer["processed_jobs"] = m_processedJobs;
+		answer["failed_jobs"] = m_failedJobs;
+		QMutexLocker locker(&m_cacheMutex);
+		answer["classifier_loads"] = m_classifierLoads;
+		answer["classifier_hits"] = m_classifierHits;
+		answer["cloud_loads"] = m_cloudLoads;
+		answer["cloud_hits"] = m_cloudHits;
+		answer["cached_clouds"] = m_contextClouds.size();
+		reply(socket, answer);
+		return;
+	}
+	else if (command == "shutdown")
+	{
+		ccLog::Print("[3DMASC] Daemon: shutdown requested");
+		m_shutdownRequested = true;
+		m_server->close(); //no more connections
+		QJsonObject answer;
+		answer["status"] = "ok";
+		answer["pending_jobs"] = m_pendingJobs;
+		reply(socket, answer);
+		checkShutdown();
+		return;
+	}
+	else if (command != "classify")
+	{
+		reply(socket, ErrorReply("Unknown command: " + command));
+		return;
+	}
+
+	if (m_shutdownRequested)
+	{
+		reply(socket, ErrorReply("The daemon is shutting down"));
+		return;
+	}
+
+	//queue the job
+	++m_pendingJobs;
+	QFutureWatcher<QJsonObject>* watcher = new QFutureWatcher<QJsonObject>(this);
+	QPointer<QLocalSocket> client(socket);
+	connect(watcher, &QFutureWatcher<QJsonObject>::finished, this, [this, watcher, client]()
+	{
+		QJsonObject answer = watcher->result();
+		watcher->deleteLater();
+
+		--m_pendingJobs;
+		if (answer.value("status").toString() == "ok")
+			++m_processedJobs;
+		else
+			++m_failedJobs;
+
+		if (client)
+		{
+			reply(client, answer);
+		}
+		checkShutdown();
+	});
+	watcher->setFuture(QtConcurrent::run(&m_pool, [this, request]() { return processJob(request); }));
+}
+
+void ClassificationDaemon::checkShutdown()
+{
+	if (m_shutdownRequested && m_pendingJobs == 0)
+	{
+		ccLog::Print(QString("[3DMASC] Daemon stopped (%1 job(s) processed, %2 failed)").arg(m_processedJobs).arg(m_failedJobs));
+		m_loop.quit();
+	}
+}
+
+QSharedPointer<Classifier> ClassificationDaemon::acquireClassifier(const QString& filename, QString& error)
+{
+	QFileInfo fi(filename);
+	if (!fi.exists())
+	{
+		error = "Can't find classifier file " + filename;
+		return {};
+	}
+	qint64 timestamp = fi.lastModified().toMSecsSinceEpoch();
+
+	{
+		QMutexLocker locker(&m_cacheMutex);
+		if (m_classifierTimestamps.value(filename, timestamp) != timestamp)
+		{
+			//the classifier has been updated since it was loaded
+			m_idleClassifiers.remove(filename);
+		}
+		m_classifierTimestamps[filename] = timestamp;
+
+		auto it = m_idleClassifiers.find(filename);
+		if (it != m_idleClassifiers.end())
+		{
+			QSharedPointer<Classifier> classifier = it.value();
+			m_idleClassifiers.erase(it);
+			++m_classifierHits;
+			return classifier;
+		}
+		++m_classifierLoads;
+	}
+
+	//load a new instance (outside of the lock, as it can be long)
+	QSharedPointer<Classifier> classifier(new Classifier);
+	classifier->allowCompiledForest(m_allowCompiledForests);
+	if (!Tools::LoadFile(filename, nullptr, false, nullptr, nullptr, nullptr, classifier.data()) || !classifier->isValid())
+	{
+		error = "Failed to load the classifier " + filename;
+		return {};
+	}
+	return classifier;
+}
+
+void ClassificationDaemon::releaseClassifier(const QString& filename, QSharedPointer<Classifier> classifier)
+{
+	if (!classifier)
+	{
+		return;
+	}
+	QMutexLocker locker(&m_cacheMutex);
+	m_idleClassifiers.insert(filename, classifier);
+}
+
+QSharedPointer<ClassificationDaemon::CachedCloud> ClassificationDaemon::getContextCloud(const QString& filename, QString& error)
+{
+	QFileInfo fi(filename);
+	if (!fi.exists())
+	{
+		error = "Can't find cloud file " + filename;
+		return {};
+	}
+	qint64 timestamp = fi.lastModified().toMSecsSinceEpoch();
+
+	QMutexLocker locker(&m_cacheMutex);
+	QSharedPointer<CachedCloud> cached = m_contextClouds.value(filename);
+	if (cached && cached->timestamp == timestamp)
+	{
+		++m_cloudHits;
+		return cached;
+	}
+
+	//(the previous version, if any, is released once the jobs using it are done)
+	cached.reset(new CachedCloud);
+	cached->timestamp = timestamp;
+	cached->cloud = loadCloud(filename, error);
+	if (!cached->cloud)
+	{
+		return {};
+	}
+	//the octree is computed right away, as the cloud is then shared by the concurrent jobs
+	if (!SpatialIndexCache::GetOctree(cached->cloud))
+	{
+		error = "Failed to compute the octree of " + filename;
+		return {};
+	}
+	SpatialIndexCache::ShareClassIndexes(cached->cloud, true);
+	++m_cloudLoads;
+	m_contextClouds[filename] = cached;
+
+	return cached;
+}
+
+QJsonObject ClassificationDaemon::processJob(const QJsonObject& job)
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	QString classifierFilename = QFileInfo(job.value("classifier").toString()).absoluteFilePath();
+	QString inputFilename = QFileInfo(job.value("input").toString()).absoluteFilePath();
+	QString outputFilename = job.value("output").toString();
+	if (job.value("classifier").toString().isEmpty() || job.value("input").toString().isEmpty() || outputFilename.isEmpty())
+	{
+		return ErrorReply("A job requires a 'classifier', an 'input' and an 'output'");
+	}
+	ccLog::Print(QString("[3DMASC] Daemon: classifying %1 with %2").arg(inputFilename).arg(classifierFilename));
+
+	//roles
+	QList<QString> cloudLabels;
+	QString corePointsLabel;
+	bool filenamesSpecified = false;
+	if (!Tools::LoadClassifierCloudLabels(classifierFilename, cloudLabels, corePointsLabel, filenamesSpecified))
+	{
+		return ErrorReply("Failed to read the classifier file " + classifierFilename);
+	}
+	QString mainRole = job.value("role").toString(corePointsLabel).toUpper();
+	if (mainRole.isEmpty())
+	{
+		return ErrorReply("The role of the input cloud is not defined (no core points in the classifier file)");
+	}
+
+	QMap<QString, QStringList> contextFilenames; //file -> roles
+	QStringList inputRoles;
+	QJsonObject roles = job.value("roles").toObject();
+	for (auto it = roles.begin(); it != roles.end(); ++it)
+	{
+		QString role = it.key().toUpper();
+		QString filename = QFileInfo(it.value().toString()).absoluteFilePath();
+		if (filename == inputFilename)
+		{
+			inputRoles.push_back(role);
+		}
+		else if (role != mainRole)
+		{
+			contextFilenames[filename].push_back(role);
+		}
+	}
+
+	QString error;
+	QSharedPointer<Classifier> classifier = acquireClassifier(classifierFilename, error);
+	if (!classifier)
+	{
+		return ErrorReply(error);
+	}
+
+	ccPointCloud* cloud = loadCloud(inputFilename, error);
+	if (!cloud)
+	{
+		releaseClassifier(classifierFilename, classifier);
+		return ErrorReply(error);
+	}
+
+	Tools::NamedClouds clouds;
+	clouds.insert(mainRole, cloud);
+	for (const QString& role : inputRoles)
+	{
+		clouds.insert(role, cloud);
+	}
+
+	std::vector< QSharedPointer<CachedCloud> > contextClouds; //(to keep them alive during the job)
+	bool success = true;
+	for (auto it = contextFilenames.begin(); it != contextFilenames.end(); ++it)
+	{
+		QSharedPointer<CachedCloud> cached = getContextCloud(it.key(), error);
+		if (!cached)
+		{
+			success = false;
+			break;
+		}
+		contextClouds.push_back(cached);
+		for (const QString& role : it.value())
+		{
+			clouds.insert(role, cached->cloud);
+		}
+	}
+
+	if (success)
+	{
+		for (const QString& label : cloudLabels)
+		{
+			if (!clouds.contains(label.toUpper()))
+			{
+				error = QString("Role %1 has not been defined").arg(label);
+				success = false;
+				break;
+			}
+		}
+	}
+
+	//classify
+	if (success)
+	{
+		success = Tools::ClassifyCloud(classifierFilename, clouds, mainRole, *classifier, error);
+	}
+
+	contextClouds.clear();
+	releaseClassifier(classifierFilename, classifier);
+
+	//save the result
+	if (success)
+	{
+		cloud->setCurrentDisplayedScalarField(-1);
+		if (QFileInfo(outputFilename).suffix() == ResultSidecar::Extension())
+		{
+			//only the classification results
+			success = ResultSidecar::Save(cloud, outputFilename, job.value("margin").toBool(false), error);
+		}
+		else
+		{
+			success = Tools::SaveCloud(cloud, outputFilename, error);
+		}
+	}
+	delete cloud;
+	cloud = nullptr;
+
+	if (!success)
+	{
+		ccLog::Warning("[3DMASC] Daemon: job failed: " + error);
+		return ErrorReply(error);
+	}
+
+	double duration = timer.elapsed() / 1000.0;
+	ccLog::Print(QString("[3DMASC] Daemon: %1 classified in %2 s").arg(outputFilename).arg(duration, 0, 'f', 1));
+
+	QJsonObject answer;
+	answer["status"] = "ok";
+	answer["output"] = outputFilename;
+	answer["duration"] = duration;
+	return answer;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "q3DMASCClassifier.h"
+
+//CCLib
+#include <CCGeom.h>
+
+//Qt
+#include <QEventLoop>
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+class ccPointCloud;
+class QLocalServer;
+class QLocalSocket;
+
+namespace masc
+{
+	//! Classification daemon
+	/** Long-running local worker: the jobs are received over a local socket (Unix socket
+		or named pipe, see QLocalServer) and processed by a pool of bounded concurrency.
+		The parsed classifiers and the context clouds (with their octree and class indexes)
+		are kept in memory between the jobs, and shared (read-only) by the concurrent jobs.
+
+		Each connection sends one request (a JSON object on a single line) and receives
+		one reply (a JSON object on a single line):
+		- job: {"classifier": "<file>", "input": "<cloud file>", "output": "<cloud file>",
+				"role": "<role of the input cloud>" (optional), "roles": {"<role>": "<cloud file>", ...}}
+		  (if the output has the sidecar extension, only the results are saved, see ResultSidecar,
+		  with the margins if "margin": true)
+		- {"command": "status"}: statistics
+		- {"command": "shutdown"}: stops the daemon (once the pending jobs are done)
+		Reply: {"status": "ok" | "error", "message": "...", ...}
+	**/
+	class ClassificationDaemon : public QObject
+	{
+		Q_OBJECT
+
+	public:
+
+		//! Default constructor
+		/** \param maxConcurrentJobs maximum number of jobs processed at the same time
+		**/
+		explicit ClassificationDaemon(int maxConcurrentJobs = 1, QObject* parent = nullptr);
+
+		//! Destructor
+		~ClassificationDaemon() override;
+
+		//! Starts listening on a local socket
+		bool listen(const QString& serverName, QString& error);
+
+		//! Runs the daemon (returns after a 'shutdown' request)
+		void exec();
+
+		//! Sets whether the compiled forests (next to the classifier files) can be loaded
+		inline void allowCompiledForests(bool state) { m_allowCompiledForests = state; }
+
+		//! Processes a job (thread-safe)
+		/** \return the reply
+		**/
+		QJsonObject processJob(const QJsonObject& job);
+
+	protected:
+
+		//! Handles a new connection
+		void onNewConnection();
+		//! Handles a request
+		void onRequest(QLocalSocket* socket);
+		//! Sends a reply and closes the connection
+		void reply(QLocalSocket* socket, const QJsonObject& answer);
+		//! Stops the daemon once all the jobs are processed
+		void checkShutdown();
+
+		//! Loads the (first) cloud of a file
+		/** All the clouds share the same global shift (the one of the first loaded cloud).
+		**/
+		ccPointCloud* loadCloud(const QString& filename, QString& error);
+
+		//! Takes an idle instance of a classifier (loads it if none is available)
+		QSharedPointer<Classifier> acquireClassifier(const QString& filename, QString& error);
+		//! Gives a classifier back (so that it can be re-used by the next jobs)
+		void releaseClassifier(const QString& filename, QSharedPointer<Classifier> classifier);
+
+		//! Cached context cloud (read-only)
+		struct CachedCloud
+		{
+			~CachedCloud();
+			ccPointCloud* cloud = nullptr;
+			//! Modification time of the file (to detect updates)
+			qint64 timestamp = 0;
+		};
+		//! Returns a cached context cloud (loads it if necessary)
+		QSharedPointer<CachedCloud> getContextCloud(const QString& filename, QString& error);
+
+	protected:
+
+		//! Local server
+		QLocalServer* m_server;
+		//! Job pool
+		QThreadPool m_pool;
+		//! Event loop
+		QEventLoop m_loop;
+		//! Number of pending jobs
+		int m_pendingJobs;
+		//! Whether a shutdown has been requested
+		bool m_shutdownRequested;
+		//! Whether the compiled forests can be loaded
+		bool m_allowCompiledForests;
+
+		//! Global shift mutex
+		QMutex m_shiftMutex;
+		//! Global shift (shared by all the clouds)
+		CCVector3d m_coordinatesShift;
+		//! Whether the global shift has been set
+		bool m_coordinatesShiftEnabled;
+
+		//! Cache mutex
+		QMutex m_cacheMutex;
+		//! Idle classifiers (per classifier file)
+		QMultiMap<QString, QSharedPointer<Classifier>> m_idleClassifiers;
+		//! Modification time of the cached classifier files (to detect updates)
+		QMap<QString, qint64> m_classifierTimestamps;
+		//! Context clouds (per file)
+		QMap<QString, QSharedPointer<CachedCloud>> m_contextClouds;
+
+		//! Statistics
+		int m_processedJobs;
+		int m_failedJobs;
+		int m_classifierLoads;
+		int m_classifierHits;
+		int m_cloudLoads;
+		int m_cloudHits;
+	};
+}
@@ -0,0 +1,308 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "CompiledForest.h"
+
+//Local
+#include "FlatForest.h"
+
+//Qt
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QObject>
+#include <QTextStream>
+
+//system
+#include <assert.h>
+
+using namespace masc;
+
+//exported symbols
+static const char s_abiVersionSymbol[] = "q3dmasc_forest_abi_version";
+static const char s_featureCountSymbol[] = "q3dmasc_forest_feature_count";
+static const char s_treeCountSymbol[] = "q3dmasc_forest_tree_count";
+static const char s_classCountSymbol[] = "q3dmasc_forest_class_count";
+static const char s_classLabelsSymbol[] = "q3dmasc_forest_class_labels";
+static const char s_signatureSymbol[] = "q3dmasc_forest_signature";
+static const char s_votesSymbol[] = "q3dmasc_forest_votes";
+static const char s_treesSymbol[] = "q3dmasc_forest_trees";
+
+QString CompiledForest::ModuleBaseName(const QString& classifierFilename)
+{
+	QFileInfo fi(classifierFilename);
+	return fi.absoluteDir().absoluteFilePath(fi.completeBaseName() + "_forest");
+}
+
+//! Writes a float so that it is read back exactly
+static QString FloatLiteral(float value)
+{
+	//9 significant digits are enough for a float round-trip
+	return QString::asprintf("%.9ef", static_cast<double>(value));
+}
+
+//! Writes the code of a (sub-)tree as nested if/else statements
+static void WriteNode(QTextStream& stream, const std::vector<FlatForest::Node>& nodes, int nodeIndex, int depth)
+{
+	const FlatForest::Node& node = nodes[nodeIndex];
+	QString indent(depth, '\t');
+
+	if (node.feature < 0)
+	{
+		stream << indent << "return " << node.right << ";\n";
+		return;
+	}
+
+	//same rule as FlatForest (and cv::ml::DTrees): NaN values go to the right
+	stream << indent << "if (x[" << node.feature << "] <= " << FloatLiteral(node.threshold) << ") {\n";
+	WriteNode(stream, nodes, nodeIndex + 1, depth + 1);
+	stream << indent << "} else {\n";
+	WriteNode(stream, nodes, node.right, depth + 1);
+	stream << indent << "}\n";
+}
+
+bool CompiledForest::GenerateSource(const FlatForest& forest, const QString& sourceFilename, QString& error)
+{
+	if (!forest.isValid())
+	{
+		error = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	QFile file(sourceFilename);
+	if (!file.open(QFile::WriteOnly | QFile::Text))
+	{
+		error = QObject::tr("Can't open file '%1' for writing").arg(sourceFilename);
+		return false;
+	}
+
+	const std::vector<FlatForest::Node>& nodes = forest.nodes();
+	const std::vector<int>& roots = forest.roots();
+	const std::vector<int>& classLabels = forest.classLabels();
+
+	QTextStream stream(&file);
+	stream << "// 3DMASC compiled random forest (generated file, do not edit)\n";
+	stream << "// " << roots.size() << " trees, " << nodes.size() << " nodes, " << forest.featureCount() << " features, " << classLabels.size() << " classes\n\n";
+	stream << "#include <cstddef>\n\n";
+	stream << "#if defined(_WIN32)\n";
+	stream << "#define Q3DMASC_FOREST_API extern \"C\" __declspec(dllexport)\n";
+	stream << "#else\n";
+	stream << "#define Q3DMASC_FOREST_API extern \"C\" __attribute__((visibility(\"default\")))\n";
+	stream << "#endif\n\n";
+
+	stream << "static const int s_classLabels[] = {";
+	for (size_t i = 0; i < classLabels.size(); ++i)
+	{
+		stream << (i == 0 ? " " : ", ") << classLabels[i];
+	}
+	stream << " };\n\n";
+
+	//one function per tree (returns the class index)
+	for (size_t t = 0; t < roots.size(); ++t)
+	{
+		stream << "static inline int tree" << t << "(const float* x)\n{\n";
+		WriteNode(stream, nodes, roots[t], 1);
+		stream << "}\n\n";
+	}
+
+	//table of the trees (for the early exit mode)
+	stream << "typedef int (*TreeFunc)(const float*);\n";
+	stream << "static TreeFunc const s_trees[] = {";
+	for (size_t t = 0; t < roots.size(); ++t)
+	{
+		stream << (t == 0 ? " " : ", ") << "tree" << t;
+	}
+	stream << " };\n\n";
+
+	stream << "Q3DMASC_FOREST_API int " << s_abiVersionSymbol << "() { return " << ABIVersion << "; }\n";
+	stream << "Q3DMASC_FOREST_API int " << s_featureCountSymbol << "() { return " << forest.featureCount() << "; }\n";
+	stream << "Q3DMASC_FOREST_API int " << s_treeCountSymbol << "() { return " << roots.size() << "; }\n";
+	stream << "Q3DMASC_FOREST_API int " << s_classCountSymbol << "() { return " << classLabels.size() << "; }\n";
+	stream << "Q3DMASC_FOREST_API const int* " << s_classLabelsSymbol << "() { return s_classLabels; }\n";
+	stream << "Q3DMASC_FOREST_API const char* " << s_signatureSymbol << "() { return \"" << forest.signature() << "\"; }\n";
+	stream << "Q3DMASC_FOREST_API const TreeFunc* " << s_treesSymbol << "() { return s_trees; }\n\n";
+
+	stream << "Q3DMASC_FOREST_API void " << s_votesSymbol << "(const float* samples, int rowCount, int rowStride, int* votes)\n{\n";
+	stream << "\tfor (int i = 0; i < rowCount; ++i)\n\t{\n";
+	stream << "\t\tconst float* x = samples + static_cast<size_t>(i) * rowStride;\n";
+	stream << "\t\tint* v = votes + static_cast<size_t>(i) * " << classLabels.size() << ";\n";
+	for (size_t t = 0; t < roots.size(); ++t)
+	{
+		stream << "\t\t++v[tree" << t << "(x)];\n";
+	}
+	stream << "\t}\n}\n";
+
+	stream.flush();
+	if (stream.status() != QTextStream::Ok)
+	{
+		error = QObject::tr("Failed to write file '%1'").arg(sourceFilename);
+		return false;
+	}
+
+	return true;
+}
+
+CompiledForest::CompiledForest()
+	: m_votesFunc(nullptr)
+	, m_trees(nullptr)
+	, m_featureCount(0)
+	, m_treeCount(0)
+{
+}
+
+CompiledForest::~CompiledForest()
+{
+	unload();
+}
+
+void CompiledForest::unload()
+{
+	m_votesFunc = nullptr;
+	m_trees = nullptr;
+	m_featureCount = 0;
+	m_treeCount = 0;
+	m_classLabels.clear();
+	m_signature.clear();
+
+	if (m_library)
+	{
+		m_library->unload();
+		m_library.reset();
+	}
+}
+
+QString CompiledForest::filename() const
+{
+	return m_library ? m_library->fileName() : QString();
+}
+
+bool CompiledForest::load(const QString& filename, QString& error)
+{
+	unload();
+	error.clear();
+
+	m_library.reset(new QLibrary(filename));
+	if (!m_library->load())
+	{
+		//no module (nothing to report)
+		m_library.reset();
+		return false;
+	}
+
+	typedef int (*IntFunc)();
+	typedef const int* (*IntArrayFunc)();
+	typedef const char* (*StringFunc)();
+	typedef const TreeFunc* (*TreesFunc)();
+
+	IntFunc abiVersionFunc = reinterpret_cast<IntFunc>(m_library->resolve(s_abiVersionSymbol));
+	IntFunc featureCountFunc = reinterpret_cast<IntFunc>(m_library->resolve(s_featureCountSymbol));
+	IntFunc treeCountFunc = reinterpret_cast<IntFunc>(m_library->resolve(s_treeCountSymbol));
+	IntFunc classCountFunc = reinterpret_cast<IntFunc>(m_library->resolve(s_classCountSymbol));
+	IntArrayFunc classLabelsFunc = reinterpret_cast<IntArrayFunc>(m_library->resolve(s_classLabelsSymbol));
+	StringFunc signatureFunc = reinterpret_cast<StringFunc>(m_library->resolve(s_signatureSymbol));
+	VotesFunc votesFunc = reinterpret_cast<VotesFunc>(m_library->resolve(s_votesSymbol));
+	TreesFunc treesFunc = reinterpret_cast<TreesFunc>(m_library->resolve(s_treesSymbol));
+
+	if (!abiVersionFunc || !featureCountFunc || !treeCountFunc || !classCountFunc || !classLabelsFunc || !signatureFunc || !votesFunc || !treesFunc)
+	{
+		error = QObject::tr("'%1' is not a compiled forest").arg(m_library->fileName());
+		unload();
+		return false;
+	}
+	if (abiVersionFunc() != ABIVersion)
+	{
+		error = QObject::tr("Compiled forest '%1' has an incompatible version (%2 instead of %3)").arg(m_library->fileName()).arg(abiVersionFunc()).arg(ABIVersion);
+		unload();
+		return false;
+	}
+
+	int classCount = classCountFunc();
+	const int* classLabels = classLabelsFunc();
+	if (classCount <= 0 || !classLabels || featureCountFunc() <= 0 || !treesFunc())
+	{
+		error = QObject::tr("Compiled forest '%1' is invalid").arg(m_library->fileName());
+		unload();
+		return false;
+	}
+
+	m_featureCount = featureCountFunc();
+	m_treeCount = treeCountFunc();
+	m_classLabels.assign(classLabels, classLabels + classCount);
+	m_signature = QByteArray(signatureFunc());
+	m_votesFunc = votesFunc;
+	m_trees = treesFunc();
+
+	return true;
+}
+
+void CompiledForest::getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer) const
+{
+	Q_UNUSED(buffer);
+
+	if (!isValid() || samples.type() != CV_32FC1 || samples.cols != m_featureCount)
+	{
+		assert(false);
+		votes.clear();
+		return;
+	}
+
+	votes.assign(static_cast<size_t>(samples.rows) * m_classLabels.size(), 0);
+	if (samples.rows == 0)
+	{
+		return;
+	}
+
+	m_votesFunc(samples.ptr<float>(0), samples.rows, static_cast<int>(samples.step1()), votes.data());
+}
+
+void CompiledForest::getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions& options, std::vector<int>& treeCounts) const
+{
+	if (!options.enabled)
+	{
+		getVotes(samples, votes, buffer);
+		//all the trees have been evaluated
+		treeCounts.assign(samples.rows, m_treeCount);
+		return;
+	}
+
+	if (!isValid() || samples.type() != CV_32FC1 || samples.cols != m_featureCount)
+	{
+		assert(false);
+		votes.clear();
+		return;
+	}
+
+	size_t classCount = m_classLabels.size();
+	votes.assign(static_cast<size_t>(samples.rows) * classCount, 0);
+	treeCounts.resize(samples.rows);
+
+	//each sample goes through the trees until the vote is decided
+	for (int i = 0; i < samples.rows; ++i)
+	{
+		const float* x = samples.ptr<float>(i);
+		VoteTracker tracker(votes.data() + static_cast<size_t>(i) * classCount);
+		for (int t = 0; t < m_treeCount; ++t)
+		{
+			tracker.add(m_trees[t](x));
+			if (tracker.canStop(m_treeCount, options))
+			{
+				break;
+			}
+		}
+		treeCounts[i] = tracker.treeCount();
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "ForestEngine.h"
+
+//Qt
+#include <QByteArray>
+#include <QLibrary>
+#include <QScopedPointer>
+#include <QString>
+
+namespace masc
+{
+	class FlatForest;
+
+	//! Ahead-of-time compiled random forest
+	/** The trees are converted into C++ code (nested if/else) by GenerateSource.
+		Once compiled as a shared library (module), the forest can be loaded and
+		used instead of the interpreted (OpenCV or flattened) forest.
+	**/
+	class CompiledForest : public ForestEngine
+	{
+	public:
+
+		//! Version of the module interface
+		static const int ABIVersion = 2;
+
+		//! Returns the default module name for a given classifier file (without the platform specific suffix)
+		static QString ModuleBaseName(const QString& classifierFilename);
+
+		//! Generates the C++ source code of a forest
+		static bool GenerateSource(const FlatForest& forest, const QString& sourceFilename, QString& error);
+
+		//! Default constructor
+		CompiledForest();
+
+		//! Destructor
+		~CompiledForest() override;
+
+		//! Loads a compiled forest (module)
+		/** \param filename module filename (the platform specific suffix can be omitted)
+			\param error error message (if the module exists but is invalid)
+			\return success
+		**/
+		bool load(const QString& filename, QString& error);
+
+		//! Unloads the module
+		void unload();
+
+		//! Returns the module filename
+		QString filename() const;
+		//! Returns the signature of the forest the module was generated from
+		inline const QByteArray& signature() const { return m_signature; }
+		//! Returns the number of trees
+		inline int treeCount() const { return m_treeCount; }
+
+		//inherited from ForestEngine
+		inline bool isValid() const override { return m_votesFunc != nullptr; }
+		inline int featureCount() const override { return m_featureCount; }
+		inline int classCount() const override { return static_cast<int>(m_classLabels.size()); }
+		inline const std::vector<int>& classLabels() const override { return m_classLabels; }
+		void getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer) const override;
+		void getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions& options, std::vector<int>& treeCounts) const override;
+
+	protected:
+
+		//! Votes function (exported by the module)
+		typedef void (*VotesFunc)(const float* samples, int rowCount, int rowStride, int* votes);
+		//! Tree function (exported by the module, returns the class index)
+		typedef int (*TreeFunc)(const float* sample);
+
+		//! Module
+		QScopedPointer<QLibrary> m_library;
+		//! Votes function
+		VotesFunc m_votesFunc;
+		//! Tree functions
+		const TreeFunc* m_trees;
+		//! Number of features per sample
+		int m_featureCount;
+		//! Number of trees
+		int m_treeCount;
+		//! Class labels
+		std::vector<int> m_classLabels;
+		//! Forest signature
+		QByteArray m_signature;
+	};
+}
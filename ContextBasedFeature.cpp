@@ -18,6 +18,8 @@
 #include "ContextBasedFeature.h"
 
 //Local
+#include "FeatureKernels.h"
+#include "SpatialIndexCache.h"
 #include "q3DMASCTools.h"
 
 //qCC_db
@@ -107,7 +109,7 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 		//already checked by 'checkValidity'
 		return false;
 	}
-	cloud1->setCurrentOutScalarField(cloud1->getScalarFieldIndexByName(classifSF->getName()));
+	classificationSF = classifSF;
 
 	//build the final SF name
 	QString typeStr = ToString(type);
@@ -138,40 +140,19 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 		unsigned pointCount = corePoints.size();
 		QString logMessage = QString("Computing %1 on cloud %2 with context cloud %3\n(core points: %4)").arg(typeStr).arg(corePoints.cloud->getName()).arg(cloud1Label).arg(pointCount);
 
-		//first: look for the number of points in the relevent class
-		const ScalarType fClass = static_cast<ScalarType>(ctxClassLabel);
-		unsigned classCount = 0;
-		for (unsigned i = 0; i < classifSF->size(); ++i)
+		//the points of the relevant class, and their octree (shared between the tiles/jobs if possible)
+		QSharedPointer<SpatialIndexCache::ClassIndex> classIndex = SpatialIndexCache::GetClassIndex(cloud1, classifSF, ctxClassLabel, progressCb);
+		if (!classIndex)
 		{
-			if (classifSF->getValue(i) == fClass)
-				++classCount;
+			errorMessage = "Failed to compute octree (not enough memory?)";
+			return false;
 		}
+		unsigned classCount = classIndex->cloud.size();
 
 		if (classCount >= static_cast<unsigned>(kNN))
 		{
-			ccPointCloud classCloud;
-			if (!classCloud.reserve(classCount))
-			{
-				errorMessage = "Not enough memory";
-				return false;
-			}
-			
-			for (unsigned i = 0; i < classifSF->size(); ++i)
-			{
-				if (classifSF->getValue(i) == fClass)
-				{
-					classCloud.addPoint(*cloud1->getPoint(i));
-				}
-			}
-
-			//compute the octree
-			ccLog::Print(QString("Computing octree of class %1 points (%2 points)").arg(ctxClassLabel).arg(classCount));
-			ccOctree::Shared classOctree = classCloud.computeOctree(progressCb);
-			if (!classOctree)
-			{
-				errorMessage = "Failed to compute octree (not enough memory?)";
-				return false;
-			}
+			ccPointCloud& classCloud = classIndex->cloud;
+			const ccOctree::Shared& classOctree = classIndex->octree;
 
 			//now extract the neighborhoods
 			unsigned char octreeLevel = classOctree->findBestLevelForAGivenPopulationPerCell(static_cast<unsigned>(std::max(3, kNN)));
@@ -191,8 +172,7 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 			bool cancelled = false;
 #ifndef _DEBUG
 #if defined(_OPENMP)
-			omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
+#pragma omp parallel for num_threads(Tools::MaxThreadCount())
 #endif
 #endif
 			for (int i = 0; i < static_cast<int>(pointCount); ++i)
@@ -290,39 +270,27 @@ bool ContextBasedFeature::prepare(	const CorePoints& corePoints,
 bool ContextBasedFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const CCVector3& queryPoint, ScalarType& outputValue) const
 {
 	const ScalarType fClass = static_cast<ScalarType>(ctxClassLabel);
-
-	CCVector3d sumQ(0, 0, 0);
-	unsigned validCount = 0;
-	for (CCCoreLib::DgmOctree::PointDescriptor& Pd : pointsInNeighbourhood)
-	{
-		//we only consider points with the right class!!!
-		if (cloud1->getPointScalarValue(Pd.pointIndex) != fClass)
-			continue;
-		sumQ += CCVector3d::fromArray(Pd.point->u);
-		++validCount;
-	}
-
-	if (validCount == 0)
+	const CCCoreLib::ScalarField* classSF = classificationSF;
+	if (!classSF)
 	{
+		assert(false);
 		outputValue = CCCoreLib::NAN_VALUE;
-		return true;
+		return false;
 	}
 
 	switch (type)
 	{
 	case DZ:
-		outputValue = static_cast<ScalarType>(queryPoint.z - sumQ.z / validCount);
-		break;
+		return ComputeContextValueT<DZ>(pointsInNeighbourhood, pointsInNeighbourhood.size(), queryPoint, classSF, fClass, outputValue);
 	case DH:
-		outputValue = static_cast<ScalarType>(sqrt(pow(queryPoint.x - sumQ.x / validCount, 2.0) + pow(queryPoint.y - sumQ.y / validCount, 2.0)));
-		break;
+		return ComputeContextValueT<DH>(pointsInNeighbourhood, pointsInNeighbourhood.size(), queryPoint, classSF, fClass, outputValue);
 	default:
 		assert(false);
 		outputValue = CCCoreLib::NAN_VALUE;
-		return false;
+		break;
 	}
 
-	return true;
+	return false;
 }
 
 
@@ -74,6 +74,7 @@ namespace masc
 			: type(p_type)
 			, kNN(p_kNN)
 			, ctxClassLabel(p_ctxClassLabel)
+			, classificationSF(nullptr)
 			, sf(nullptr)
 			, sfWasAlreadyExisting(false)
 		{
@@ -102,6 +103,11 @@ namespace masc
 		int kNN;
 		//! Context class (label)
 		int ctxClassLabel;
+		//! Classification field of the context cloud (set by 'prepare')
+		/** \remark The context cloud may be shared by concurrent jobs: it is not modified
+				(its 'current' scalar fields are left untouched).
+		**/
+		const CCCoreLib::ScalarField* classificationSF;
 		//! The computed scalar
 		CCCoreLib::ScalarField* sf;
 		//! Whether the SF pre-exists
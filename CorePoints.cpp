@@ -16,6 +16,7 @@
 //##########################################################################
 
 #include "CorePoints.h"
+#include "SpatialIndexCache.h"
 
 //qCC_db
 #include <ccPointCloud.h>
@@ -51,7 +52,7 @@ bool CorePoints::prepare(CCCoreLib::GenericProgressCallback* progressCb/*=nullpt
 		//we'll need an octree
 		if (!origin->getOctree())
 		{
-			if (!origin->computeOctree(progressCb))
+			if (!SpatialIndexCache::GetOctree(origin, progressCb))
 			{
 				ccLog::Warning("[CorePoints::prepare] Failed to compute the octree");
 				return false;
@@ -17,21 +17,184 @@
 
 #include "DualCloudFeature.h"
 
+//Local
+#include "FeatureKernels.h"
+#include "q3DMASCTools.h"
+
+//qCC_db
+#include <ccPointCloud.h>
+
+//qPDALIO
+#include "../../../core/IO/qPDALIO/include/LASFields.h"
+
+static const char* s_intensitySFName = LAS_FIELD_NAMES[LAS_INTENSITY];
+
 using namespace masc;
 
+static IScalarFieldWrapper::Shared RetrieveIntensityField(ccPointCloud* cloud, const QString& cloudLabel, QString& error)
+{
+	CCCoreLib::ScalarField* sf = Tools::RetrieveSF(cloud, s_intensitySFName, false);
+	if (!sf)
+	{
+		error = QString("Cloud %1 has no 'intensity' scalar field").arg(cloudLabel);
+		return IScalarFieldWrapper::Shared(nullptr);
+	}
+	return IScalarFieldWrapper::Shared(new ScalarFieldWrapper(sf));
+}
+
 bool DualCloudFeature::prepare(	const CorePoints& corePoints,
 								QString& error,
 								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
                                 SFCollector* generatedScalarFields/*=nullptr*/)
 {
-	//TODO
-	return false;
+	if (!cloud1 || !cloud2 || !corePoints.cloud)
+	{
+		//invalid input
+		assert(false);
+		error = "internal error (no input core points)";
+		return false;
+	}
+
+	if (!checkValidity(corePoints.role, error))
+	{
+		assert(false);
+		return false;
+	}
+
+	//look for the source fields
+	switch (type)
+	{
+	case IDIFF:
+	{
+		assert(!field1 && !field2);
+		field1 = RetrieveIntensityField(cloud1, cloud1Label, error);
+		if (!field1)
+		{
+			return false;
+		}
+		field2 = RetrieveIntensityField(cloud2, cloud2Label, error);
+		if (!field2)
+		{
+			return false;
+		}
+	}
+	break;
+
+	default:
+		assert(false);
+		error = "Unhandled dual-cloud feature type";
+		return false;
+	}
+
+	//build the final SF name
+	QString resultSFName = ToString(type) + "_" + cloud1Label + "_" + cloud2Label + "@" + QString::number(scale);
+
+	//and the scalar field
+	assert(!sf1);
+	sf1WasAlreadyExisting = CheckSFExistence(corePoints.cloud, qPrintable(resultSFName));
+	if (sf1WasAlreadyExisting)
+	{
+		sf1 = PrepareSF(corePoints.cloud, qPrintable(resultSFName), generatedScalarFields, SFCollector::ALWAYS_KEEP);
+		if (generatedScalarFields && generatedScalarFields->scalarFields.contains(sf1)) // i.e. the SF is existing but was not present at the startup of the plugin
+			generatedScalarFields->setBehavior(sf1, SFCollector::CAN_REMOVE);
+	}
+	else
+	{
+		sf1 = PrepareSF(corePoints.cloud, qPrintable(resultSFName), generatedScalarFields, SFCollector::CAN_REMOVE);
+	}
+	if (!sf1)
+	{
+		error = QString("Failed to prepare scalar %1 @ scale %2").arg(resultSFName).arg(scale);
+		return false;
+	}
+	source.name = sf1->getName();
+
+	// sf2 is not needed if sf1 was already existing!
+	if (!sf1WasAlreadyExisting)
+	{
+		//same name as the equivalent MEAN point feature (so that it can be shared)
+		QString resultSFName2 = field2->getName() + "_" + cloud2Label + "_" + Feature::StatToString(Feature::MEAN) + "@" + QString::number(scale);
+
+		//the second cloud mean is directly subtracted during the computation
+		//(we only need the corresponding scalar field if it already exists)
+		assert(!sf2);
+		sf2WasAlreadyExisting = CheckSFExistence(corePoints.cloud, qPrintable(resultSFName2));
+		if (sf2WasAlreadyExisting)
+		{
+			sf2 = PrepareSF(corePoints.cloud, qPrintable(resultSFName2), generatedScalarFields, SFCollector::ALWAYS_KEEP);
+			if (!sf2)
+			{
+				error = QString("Failed to prepare scalar field for %1 @ scale %2").arg(cloud2Label).arg(scale);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool DualCloudFeature::computeValue(const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const IScalarFieldWrapper::Shared& sourceField, double& outputValue) const
+{
+	outputValue = std::numeric_limits<double>::quiet_NaN();
+
+	if (!sourceField)
+	{
+		//invalid input parameters
+		assert(false);
+		return false;
+	}
+
+	size_t kNN = pointsInNeighbourhood.size();
+	if (kNN == 0)
+	{
+		assert(false);
+		return false;
+	}
+
+	switch (type)
+	{
+	case IDIFF:
+		//mean intensity of the neighbors (the difference is made by the caller)
+		return ComputeStatT<Feature::MEAN>(pointsInNeighbourhood, kNN, Accessors::Generic(sourceField.data()), outputValue);
+
+	default:
+	{
+		ccLog::Warning("Unhandled feature");
+		assert(false);
+		return false;
+	}
+	}
+
+	return true;
+}
+
+bool DualCloudFeature::finish(const CorePoints& corePoints, QString& error)
+{
+	if (!corePoints.cloud)
+	{
+		//invalid input
+		assert(false);
+		error = "internal error (no input core points)";
+		return false;
+	}
+
+	if (sf1)
+	{
+		//the difference (IDIFF = mean(I1) - mean(I2)) has already been computed
+		sf1->computeMinAndMax();
+
+		//update display
+		int sfIndex1 = corePoints.cloud->getScalarFieldIndexByName(sf1->getName());
+		corePoints.cloud->setCurrentDisplayedScalarField(sfIndex1);
+	}
+
+	return true;
 }
 
 QString DualCloudFeature::toString() const
 {
-	//use the default keyword + "_SC" + the scale
-	return ToString(type) + "_SC" + QString::number(scale);
+	//use the default keyword + "_SC" + the scale + the two clouds
+	return ToString(type) + "_SC" + QString::number(scale) + "_" + cloud1Label + "_" + cloud2Label;
 }
 
 bool DualCloudFeature::checkValidity(QString corePointRole, QString &error) const
@@ -41,10 +204,17 @@ bool DualCloudFeature::checkValidity(QString corePointRole, QString &error) cons
 		return false;
 	}
 
+	if (type == Invalid)
+	{
+		assert(false);
+		error = "invalid feature type";
+		return false;
+	}
+
 	unsigned char cloudCount = (cloud1 ? (cloud2 ? 2 : 1) : 0);
 	if (cloudCount < 2)
 	{
-		error = "at least two clouds are required to compute context-based features";
+		error = "at least two clouds are required to compute dual-cloud features";
 		return false;
 	}
 
@@ -54,5 +224,25 @@ bool DualCloudFeature::checkValidity(QString corePointRole, QString &error) cons
 		return false;
 	}
 
+	if (!scaled())
+	{
+		error = "dual-cloud features require a scale";
+		return false;
+	}
+
+	if (type == IDIFF)
+	{
+		if (!Tools::RetrieveSF(cloud1, s_intensitySFName, false))
+		{
+			error = QString("Cloud %0 has no '%1' scalar field").arg(cloud1->getName()).arg(s_intensitySFName);
+			return false;
+		}
+		if (!Tools::RetrieveSF(cloud2, s_intensitySFName, false))
+		{
+			error = QString("Cloud %0 has no '%1' scalar field").arg(cloud2->getName()).arg(s_intensitySFName);
+			return false;
+		}
+	}
+
 	return true;
 }
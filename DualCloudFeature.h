@@ -27,6 +27,8 @@ namespace masc
 	{
 	public: //DualCloudFeatureType
 
+		typedef QSharedPointer<DualCloudFeature> Shared;
+
 		enum DualCloudFeatureType
 		{
 			Invalid = 0
@@ -62,6 +64,10 @@ namespace masc
 		//! Default constructor
 		DualCloudFeature(DualCloudFeatureType p_type)
 			: type(p_type)
+			, sf1(nullptr)
+			, sf2(nullptr)
+			, sf1WasAlreadyExisting(false)
+			, sf2WasAlreadyExisting(false)
 		{}
 
 		//inherited from Feature
@@ -69,12 +75,28 @@ namespace masc
 		virtual Feature::Shared clone() const override { return Feature::Shared(new DualCloudFeature(*this)); }
 		virtual bool prepare(const CorePoints& corePoints, QString& error,
                              CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr) override;
+		virtual bool finish(const CorePoints& corePoints, QString& error) override;
 		virtual bool checkValidity(QString corePointRole, QString &error) const override;
 		virtual QString toString() const override;
 
+		//! Compute the feature value on a set of points (of one of the two clouds)
+		bool computeValue(const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const IScalarFieldWrapper::Shared& sourceField, double& outputValue) const;
+
+	public: //members
+
 		//! Dual-cloud feature type
 		/** \warning different from the feature type
 		**/
 		DualCloudFeatureType type;
+
+		//! First cloud 'source' field
+		IScalarFieldWrapper::Shared field1;
+		//! Second cloud 'source' field
+		IScalarFieldWrapper::Shared field2;
+
+		//! Feature values
+		CCCoreLib::ScalarField *sf1, *sf2;
+		bool sf1WasAlreadyExisting;
+		bool sf2WasAlreadyExisting;
 	};
 }
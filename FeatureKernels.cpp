@@ -0,0 +1,180 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FeatureKernels.h"
+
+using namespace masc;
+
+//! Sets the kernel of a task depending on the type of its source field
+template < template <class> class Kernel > static bool SetSourceKernel(FeatureTask& task, const IScalarFieldWrapper::Shared& field)
+{
+	if (!field)
+	{
+		assert(false);
+		return false;
+	}
+	task.field = field.data();
+
+	//resolve the source type once and for all
+	if (const ScalarFieldWrapper* wrapper = dynamic_cast<const ScalarFieldWrapper*>(field.data()))
+	{
+		task.sf = wrapper->sf();
+		task.run = &RunFeatureTask< Kernel<Accessors::SF> >;
+	}
+	else if (const ScalarFieldRatioWrapper* wrapper = dynamic_cast<const ScalarFieldRatioWrapper*>(field.data()))
+	{
+		task.sf = wrapper->sfp();
+		task.sfq = wrapper->sfq();
+		task.run = &RunFeatureTask< Kernel<Accessors::Ratio> >;
+	}
+	else if (const DimScalarFieldWrapper* wrapper = dynamic_cast<const DimScalarFieldWrapper*>(field.data()))
+	{
+		switch (wrapper->dim())
+		{
+		case DimScalarFieldWrapper::DimX:
+			task.run = &RunFeatureTask< Kernel< Accessors::Coord<0> > >;
+			break;
+		case DimScalarFieldWrapper::DimY:
+			task.run = &RunFeatureTask< Kernel< Accessors::Coord<1> > >;
+			break;
+		case DimScalarFieldWrapper::DimZ:
+			task.run = &RunFeatureTask< Kernel< Accessors::Coord<2> > >;
+			break;
+		}
+	}
+	else if (const ColorScalarFieldWrapper* wrapper = dynamic_cast<const ColorScalarFieldWrapper*>(field.data()))
+	{
+		task.cloud = wrapper->cloud();
+		switch (wrapper->band())
+		{
+		case ColorScalarFieldWrapper::Red:
+			task.run = &RunFeatureTask< Kernel< Accessors::Color<0> > >;
+			break;
+		case ColorScalarFieldWrapper::Green:
+			task.run = &RunFeatureTask< Kernel< Accessors::Color<1> > >;
+			break;
+		case ColorScalarFieldWrapper::Blue:
+			task.run = &RunFeatureTask< Kernel< Accessors::Color<2> > >;
+			break;
+		}
+	}
+	else if (const NormDipAndDipDirFieldWrapper* wrapper = dynamic_cast<const NormDipAndDipDirFieldWrapper*>(field.data()))
+	{
+		task.cloud = wrapper->cloud();
+		if (wrapper->mode() == NormDipAndDipDirFieldWrapper::Dip)
+			task.run = &RunFeatureTask< Kernel< Accessors::NormDip<NormDipAndDipDirFieldWrapper::Dip> > >;
+		else
+			task.run = &RunFeatureTask< Kernel< Accessors::NormDip<NormDipAndDipDirFieldWrapper::DipDir> > >;
+	}
+	else
+	{
+		//unknown wrapper: we use the generic (virtual) accessor
+		task.run = &RunFeatureTask< Kernel<Accessors::Generic> >;
+	}
+
+	return task.run != nullptr;
+}
+
+bool masc::SetMomentsKernel(FeatureTask& task, const IScalarFieldWrapper::Shared& field)
+{
+	return SetSourceKernel<MomentsKernel>(task, field);
+}
+
+bool masc::SetValuesKernel(FeatureTask& task, const IScalarFieldWrapper::Shared& field)
+{
+	return SetSourceKernel<ValuesKernel>(task, field);
+}
+
+bool masc::SetNeighborhoodKernel(FeatureTask& task, NeighborhoodFeature::NeighborhoodFeatureType type)
+{
+	switch (type)
+	{
+	case NeighborhoodFeature::PCA1:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::PCA1> >;
+		break;
+	case NeighborhoodFeature::PCA2:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::PCA2> >;
+		break;
+	case NeighborhoodFeature::PCA3:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::PCA3> >;
+		break;
+	case NeighborhoodFeature::SPHER:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::SPHER> >;
+		break;
+	case NeighborhoodFeature::LINEA:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::LINEA> >;
+		break;
+	case NeighborhoodFeature::PLANA:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::PLANA> >;
+		break;
+	case NeighborhoodFeature::Dip:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::Dip> >;
+		break;
+	case NeighborhoodFeature::DipDir:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::DipDir> >;
+		break;
+	case NeighborhoodFeature::ROUGH:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::ROUGH> >;
+		break;
+	case NeighborhoodFeature::NBPTS:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::NBPTS> >;
+		break;
+	case NeighborhoodFeature::CURV:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::CURV> >;
+		break;
+	case NeighborhoodFeature::ZRANGE:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::ZRANGE> >;
+		break;
+	case NeighborhoodFeature::Zmax:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::Zmax> >;
+		break;
+	case NeighborhoodFeature::Zmin:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::Zmin> >;
+		break;
+	case NeighborhoodFeature::ANISO:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::ANISO> >;
+		break;
+	case NeighborhoodFeature::FOM:
+		task.run = &RunFeatureTask< NeighborhoodKernel<NeighborhoodFeature::FOM> >;
+		break;
+	default:
+		assert(false);
+		task.run = nullptr;
+		break;
+	}
+
+	return task.run != nullptr;
+}
+
+bool masc::SetContextKernel(FeatureTask& task, ContextBasedFeature::ContextBasedFeatureType type)
+{
+	switch (type)
+	{
+	case ContextBasedFeature::DZ:
+		task.run = &RunFeatureTask< ContextKernel<ContextBasedFeature::DZ> >;
+		break;
+	case ContextBasedFeature::DH:
+		task.run = &RunFeatureTask< ContextKernel<ContextBasedFeature::DH> >;
+		break;
+	default:
+		assert(false);
+		task.run = nullptr;
+		break;
+	}
+
+	return task.run != nullptr;
+}
@@ -0,0 +1,591 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "PointFeature.h"
+#include "NeighborhoodFeature.h"
+#include "ContextBasedFeature.h"
+#include "ScalarFieldWrappers.h"
+
+//CCCoreLib
+#include <DgmOctree.h>
+#include <DgmOctreeReferenceCloud.h>
+#include <Neighbourhood.h>
+#include <WeibullDistribution.h>
+
+//qCC_db
+#include <ccNormalVectors.h>
+
+//system
+#include <algorithm>
+#include <vector>
+
+namespace masc
+{
+	//! Batch of consecutive core points (and their neighborhoods)
+	struct FeatureBatch
+	{
+		//! Index of the first core point of the batch
+		unsigned firstPointIndex = 0;
+		//! Number of core points in the batch
+		unsigned count = 0;
+		//! Neighbors of each core point (at the largest scale, sorted by increasing distance)
+		std::vector<CCCoreLib::DgmOctree::NeighboursSet> neighbors;
+		//! Core points coordinates
+		std::vector<CCVector3> queryPoints;
+		//! Number of scales of the current cloud
+		size_t scaleCount = 0;
+		//! Number of neighbors of each core point at each scale (from the largest to the smallest)
+		std::vector<unsigned> kNN;
+		//! Number of value slots (per core point)
+		size_t slotCount = 0;
+		//! Values computed for each core point (one per slot)
+		std::vector<double> values;
+
+		inline unsigned& neighborCount(unsigned b, size_t scaleIndex) { return kNN[b * scaleCount + scaleIndex]; }
+		inline double& value(unsigned b, int slot) { return values[b * slotCount + slot]; }
+	};
+
+	//! Primitive computation task (one cloud, one scale)
+	/** The kernel is resolved once, when the execution plan is built. It is then
+		called once per batch of core points, without any virtual call or switch.
+	**/
+	struct FeatureTask
+	{
+		typedef bool (*BatchFunc)(const FeatureTask& task, FeatureBatch& batch, size_t scaleIndex);
+
+		//! Max number of values output by a single task
+		static const int MaxOutputs = 3;
+
+		FeatureTask() { std::fill(slots, slots + MaxOutputs, -1); }
+
+		//! Kernel
+		BatchFunc run = nullptr;
+
+		//! Source field (generic version)
+		const IScalarFieldWrapper* field = nullptr;
+		//! Source scalar field (or numerator for ratios, or classification for context-based features)
+		const CCCoreLib::ScalarField* sf = nullptr;
+		//! Denominator scalar field (for ratios)
+		const CCCoreLib::ScalarField* sfq = nullptr;
+		//! Source cloud (for colors and normals)
+		const ccPointCloud* cloud = nullptr;
+		//! Context class (for context-based features)
+		ScalarType classLabel = 0;
+
+		//! Destination slot of each output value (-1 if not needed)
+		/** Moments: MEAN, STD, RANGE
+			Values: MEDIAN, MODE, SKEW
+			Others: single value
+		**/
+		int slots[MaxOutputs];
+
+		//! Associated feature (for error reporting)
+		const Feature* feature = nullptr;
+	};
+
+	//! Non-virtual source accessors (equivalent to the IScalarFieldWrapper classes)
+	namespace Accessors
+	{
+		//! Generic accessor (relies on the virtual wrapper)
+		struct Generic
+		{
+			explicit Generic(const FeatureTask& task) : field(task.field) {}
+			explicit Generic(const IScalarFieldWrapper* f) : field(f) {}
+			inline double operator()(const CCCoreLib::DgmOctree::PointDescriptor& Pd) const { return field->pointValue(Pd.pointIndex); }
+			const IScalarFieldWrapper* field;
+		};
+
+		//! Scalar field accessor
+		struct SF
+		{
+			explicit SF(const FeatureTask& task) : sf(task.sf) {}
+			inline double operator()(const CCCoreLib::DgmOctree::PointDescriptor& Pd) const { return sf->getValue(Pd.pointIndex); }
+			const CCCoreLib::ScalarField* sf;
+		};
+
+		//! Scalar field ratio accessor
+		struct Ratio
+		{
+			explicit Ratio(const FeatureTask& task) : sfp(task.sf), sfq(task.sfq) {}
+			inline double operator()(const CCCoreLib::DgmOctree::PointDescriptor& Pd) const
+			{
+				ScalarType p = sfp->getValue(Pd.pointIndex);
+				ScalarType q = sfq->getValue(Pd.pointIndex);
+				return (std::abs(q) > std::numeric_limits<ScalarType>::epsilon() ? p / q : CCCoreLib::NAN_VALUE);
+			}
+			const CCCoreLib::ScalarField *sfp, *sfq;
+		};
+
+		//! Coordinate accessor
+		template <int Dim> struct Coord
+		{
+			explicit Coord(const FeatureTask&) {}
+			inline double operator()(const CCCoreLib::DgmOctree::PointDescriptor& Pd) const { return Pd.point->u[Dim]; }
+		};
+
+		//! Color band accessor
+		template <int Band> struct Color
+		{
+			explicit Color(const FeatureTask& task) : cloud(task.cloud) {}
+			inline double operator()(const CCCoreLib::DgmOctree::PointDescriptor& Pd) const { return cloud->getPointColor(Pd.pointIndex).rgba[Band]; }
+			const ccPointCloud* cloud;
+		};
+
+		//! Normal dip / dip direction accessor
+		template <NormDipAndDipDirFieldWrapper::Mode M> struct NormDip
+		{
+			explicit NormDip(const FeatureTask& task) : cloud(task.cloud) {}
+			inline double operator()(const CCCoreLib::DgmOctree::PointDescriptor& Pd) const
+			{
+				const CCVector3& N = cloud->getPointNormal(Pd.pointIndex);
+				PointCoordinateType dip_deg, dipDir_deg;
+				ccNormalVectors::ConvertNormalToDipAndDipDir(N, dip_deg, dipDir_deg);
+				return (M == NormDipAndDipDirFieldWrapper::Dip ? dip_deg : dipDir_deg);
+			}
+			const ccPointCloud* cloud;
+		};
+	}
+
+	//! Computes a 'stat' on the first kNN neighbors of a point
+	template <Feature::Stat S, class Accessor>
+	inline bool ComputeStatT(const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, size_t kNN, const Accessor& accessor, double& outputValue)
+	{
+		outputValue = std::numeric_limits<double>::quiet_NaN();
+
+		if (kNN == 0)
+		{
+			assert(false);
+			return false;
+		}
+
+		if (S == Feature::RANGE)
+		{
+			double minValue = accessor(pointsInNeighbourhood[0]);
+			double maxValue = minValue;
+			for (size_t k = 1; k < kNN; ++k)
+			{
+				double v = accessor(pointsInNeighbourhood[k]);
+
+				//track min and max values
+				if (v < minValue)
+					minValue = v;
+				else if (v > maxValue)
+					maxValue = v;
+			}
+
+			outputValue = maxValue - minValue;
+		}
+		else if (S == Feature::MEAN || S == Feature::STD)
+		{
+			double sum = 0.0;
+			double sum2 = 0.0;
+			for (size_t k = 0; k < kNN; ++k)
+			{
+				double v = accessor(pointsInNeighbourhood[k]);
+				sum += v;
+				if (S == Feature::STD)
+					sum2 += v * v;
+			}
+
+			if (S == Feature::MEAN)
+				outputValue = sum / kNN;
+			else
+				outputValue = sqrt(std::abs(sum2 * kNN - sum * sum)) / kNN;
+		}
+		else if (S == Feature::MEDIAN || S == Feature::MODE || S == Feature::SKEW)
+		{
+			CCCoreLib::WeibullDistribution::ScalarContainer values;
+			try
+			{
+				values.resize(kNN);
+			}
+			catch (const std::bad_alloc&)
+			{
+				ccLog::Warning("Not enough memory");
+				return false;
+			}
+
+			for (size_t k = 0; k < kNN; ++k)
+			{
+				values[k] = static_cast<ScalarType>(accessor(pointsInNeighbourhood[k]));
+			}
+
+			if (S == Feature::MEDIAN)
+			{
+				size_t medianIndex = values.size() / 2;
+				std::nth_element(values.begin(), values.begin() + medianIndex, values.end());
+				outputValue = values[medianIndex];
+			}
+			else
+			{
+				CCCoreLib::WeibullDistribution w;
+				if (w.computeParameters(values))
+					outputValue = (S == Feature::MODE ? w.computeMode() : w.computeSkewness());
+			}
+		}
+		else
+		{
+			ccLog::Warning("Unhandled STAT measure");
+			assert(false);
+			return false;
+		}
+
+		return true;
+	}
+
+	//! Computes the anisotropy (ratio of the distance to the center of mass and the radius of the sphere)
+	inline void ComputeAnisotropy(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, size_t kNN, const CCVector3& queryPoint, double& outputValue)
+	{
+		if (kNN < 3)
+		{
+			return;
+		}
+
+		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
+		CCCoreLib::Neighbourhood Z(&neighboursCloud);
+		const CCVector3* G = Z.getGravityCenter();
+		if (G)
+		{
+			double r = sqrt(pointsInNeighbourhood[kNN - 1].squareDistd);
+			if (r > std::numeric_limits<double>::epsilon())
+			{
+				double d = (queryPoint - *G).normd();
+				outputValue = d / r;
+			}
+		}
+	}
+
+	//! Computes a neighborhood feature on the first kNN neighbors of a point
+	template <NeighborhoodFeature::NeighborhoodFeatureType T>
+	inline bool ComputeNeighborhoodValueT(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, size_t kNN, const CCVector3& queryPoint, double& outputValue)
+	{
+		outputValue = std::numeric_limits<double>::quiet_NaN();
+
+		if (kNN == 0)
+		{
+			assert(false);
+			return false;
+		}
+
+		switch (T)
+		{
+		//features relying on the PCA
+		case NeighborhoodFeature::PCA1:
+		case NeighborhoodFeature::PCA2:
+		case NeighborhoodFeature::PCA3:
+		case NeighborhoodFeature::SPHER:
+		case NeighborhoodFeature::LINEA:
+		case NeighborhoodFeature::PLANA:
+		{
+			CCCoreLib::Neighbourhood::GeomFeature f = (T == NeighborhoodFeature::PCA1 ? CCCoreLib::Neighbourhood::PCA1
+													: T == NeighborhoodFeature::PCA2 ? CCCoreLib::Neighbourhood::PCA2
+													: T == NeighborhoodFeature::PCA3 ? CCCoreLib::Neighbourhood::SurfaceVariation
+													: T == NeighborhoodFeature::SPHER ? CCCoreLib::Neighbourhood::Sphericity
+													: T == NeighborhoodFeature::LINEA ? CCCoreLib::Neighbourhood::Linearity
+													: CCCoreLib::Neighbourhood::Planarity);
+
+			CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
+			CCCoreLib::Neighbourhood Z(&neighboursCloud);
+			outputValue = Z.computeFeature(f);
+		}
+		break;
+
+		case NeighborhoodFeature::FOM:
+		{
+			CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
+			CCCoreLib::Neighbourhood Z(&neighboursCloud);
+			outputValue = Z.computeMomentOrder1(queryPoint);
+		}
+		break;
+
+		case NeighborhoodFeature::Dip:
+		case NeighborhoodFeature::DipDir:
+		if (kNN >= 3)
+		{
+			CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
+			CCCoreLib::Neighbourhood Z(&neighboursCloud);
+			const CCVector3* N = Z.getLSPlaneNormal();
+			if (N)
+			{
+				//force +Z
+				CCVector3 Np = (N->z < 0 ? -CCCoreLib::PC_ONE * *N : *N);
+				PointCoordinateType dip_deg, dipDir_deg;
+				ccNormalVectors::ConvertNormalToDipAndDipDir(Np, dip_deg, dipDir_deg);
+				outputValue = (T == NeighborhoodFeature::Dip ? dip_deg : dipDir_deg);
+			}
+		}
+		break;
+
+		case NeighborhoodFeature::NBPTS:
+			outputValue = static_cast<double>(kNN);
+			break;
+
+		case NeighborhoodFeature::ROUGH:
+		{
+			CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
+			CCCoreLib::Neighbourhood Z(&neighboursCloud);
+			outputValue = Z.computeRoughness(queryPoint);
+		}
+		break;
+
+		case NeighborhoodFeature::CURV:
+		{
+			CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
+			CCCoreLib::Neighbourhood Z(&neighboursCloud);
+			outputValue = Z.computeCurvature(queryPoint, CCCoreLib::Neighbourhood::MEAN_CURV); //TODO: is it really the default one?
+		}
+		break;
+
+		case NeighborhoodFeature::ZRANGE:
+		case NeighborhoodFeature::Zmax:
+		case NeighborhoodFeature::Zmin:
+		{
+			if (kNN >= 2)
+			{
+				PointCoordinateType minZ, maxZ;
+				minZ = maxZ = pointsInNeighbourhood[0].point->z;
+				for (size_t i = 1; i < kNN; ++i)
+				{
+					if (minZ > pointsInNeighbourhood[i].point->z)
+						minZ = pointsInNeighbourhood[i].point->z;
+					else if (maxZ < pointsInNeighbourhood[i].point->z)
+						maxZ = pointsInNeighbourhood[i].point->z;
+				}
+
+				if (T == NeighborhoodFeature::ZRANGE)
+					outputValue = maxZ - minZ;
+				else if (T == NeighborhoodFeature::Zmax)
+					outputValue = maxZ - queryPoint.z;
+				else
+					outputValue = queryPoint.z - minZ;
+			}
+
+			//\warning these features have always been followed by the ANISO computation
+			//(we keep the same behavior so as to remain consistent with the existing classifiers)
+			ComputeAnisotropy(pointsInNeighbourhood, kNN, queryPoint, outputValue);
+		}
+		break;
+
+		case NeighborhoodFeature::ANISO:
+			ComputeAnisotropy(pointsInNeighbourhood, kNN, queryPoint, outputValue);
+			break;
+
+		default:
+		{
+			ccLog::Warning("Unhandled feature");
+			assert(false);
+			return false;
+		}
+		}
+
+		return true;
+	}
+
+	//! Computes a context-based feature on the first kNN neighbors of a point
+	template <ContextBasedFeature::ContextBasedFeatureType T>
+	inline bool ComputeContextValueT(	const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood,
+										size_t kNN,
+										const CCVector3& queryPoint,
+										const CCCoreLib::ScalarField* classSF,
+										ScalarType classLabel,
+										ScalarType& outputValue)
+	{
+		CCVector3d sumQ(0, 0, 0);
+		unsigned validCount = 0;
+		for (size_t k = 0; k < kNN; ++k)
+		{
+			const CCCoreLib::DgmOctree::PointDescriptor& Pd = pointsInNeighbourhood[k];
+			//we only consider points with the right class!!!
+			if (classSF->getValue(Pd.pointIndex) != classLabel)
+				continue;
+			sumQ += CCVector3d::fromArray(Pd.point->u);
+			++validCount;
+		}
+
+		if (validCount == 0)
+		{
+			outputValue = CCCoreLib::NAN_VALUE;
+			return true;
+		}
+
+		switch (T)
+		{
+		case ContextBasedFeature::DZ:
+			outputValue = static_cast<ScalarType>(queryPoint.z - sumQ.z / validCount);
+			break;
+		case ContextBasedFeature::DH:
+			outputValue = static_cast<ScalarType>(sqrt(pow(queryPoint.x - sumQ.x / validCount, 2.0) + pow(queryPoint.y - sumQ.y / validCount, 2.0)));
+			break;
+		default:
+			assert(false);
+			outputValue = CCCoreLib::NAN_VALUE;
+			return false;
+		}
+
+		return true;
+	}
+
+	//! Moments kernel (MEAN, STD and RANGE of a given source)
+	template <class Accessor> struct MomentsKernel
+	{
+		explicit MomentsKernel(const FeatureTask& task) : accessor(task) {}
+		inline bool operator()(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, unsigned kNN, const CCVector3&, double* outputValues) const
+		{
+			double sum = 0.0;
+			double sum2 = 0.0;
+			double minValue = accessor(pointsInNeighbourhood[0]);
+			double maxValue = minValue;
+			for (unsigned k = 0; k < kNN; ++k)
+			{
+				double v = accessor(pointsInNeighbourhood[k]);
+				sum += v;
+				sum2 += v * v;
+
+				//track min and max values
+				if (v < minValue)
+					minValue = v;
+				else if (v > maxValue)
+					maxValue = v;
+			}
+
+			outputValues[0] = sum / kNN;
+			outputValues[1] = sqrt(std::abs(sum2 * kNN - sum * sum)) / kNN;
+			outputValues[2] = maxValue - minValue;
+			return true;
+		}
+		Accessor accessor;
+	};
+
+	//! Gathered values kernel (MEDIAN, MODE and SKEW of a given source)
+	template <class Accessor> struct ValuesKernel
+	{
+		explicit ValuesKernel(const FeatureTask& task)
+			: accessor(task)
+			, withMedian(task.slots[0] >= 0)
+			, withWeibull(task.slots[1] >= 0 || task.slots[2] >= 0)
+		{}
+		inline bool operator()(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, unsigned kNN, const CCVector3&, double* outputValues) const
+		{
+			try
+			{
+				values.resize(kNN);
+			}
+			catch (const std::bad_alloc&)
+			{
+				ccLog::Warning("Not enough memory");
+				return false;
+			}
+
+			for (unsigned k = 0; k < kNN; ++k)
+			{
+				values[k] = static_cast<ScalarType>(accessor(pointsInNeighbourhood[k]));
+			}
+
+			//the Weibull distribution is shared by MODE and SKEW (and must be computed before the values are re-ordered)
+			if (withWeibull)
+			{
+				CCCoreLib::WeibullDistribution w;
+				if (w.computeParameters(values))
+				{
+					outputValues[1] = w.computeMode();
+					outputValues[2] = w.computeSkewness();
+				}
+			}
+
+			if (withMedian)
+			{
+				size_t medianIndex = values.size() / 2;
+				std::nth_element(values.begin(), values.begin() + medianIndex, values.end());
+				outputValues[0] = values[medianIndex];
+			}
+
+			return true;
+		}
+		Accessor accessor;
+		bool withMedian, withWeibull;
+		//! Buffer (re-used for all the points of a batch)
+		mutable CCCoreLib::WeibullDistribution::ScalarContainer values;
+	};
+
+	//! Neighborhood feature kernel
+	template <NeighborhoodFeature::NeighborhoodFeatureType T> struct NeighborhoodKernel
+	{
+		explicit NeighborhoodKernel(const FeatureTask&) {}
+		inline bool operator()(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, unsigned kNN, const CCVector3& queryPoint, double* outputValues) const
+		{
+			return ComputeNeighborhoodValueT<T>(pointsInNeighbourhood, kNN, queryPoint, outputValues[0]);
+		}
+	};
+
+	//! Context-based feature kernel
+	template <ContextBasedFeature::ContextBasedFeatureType T> struct ContextKernel
+	{
+		explicit ContextKernel(const FeatureTask& task) : classSF(task.sf), classLabel(task.classLabel) {}
+		inline bool operator()(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, unsigned kNN, const CCVector3& queryPoint, double* outputValues) const
+		{
+			ScalarType value = CCCoreLib::NAN_VALUE;
+			bool success = ComputeContextValueT<T>(pointsInNeighbourhood, kNN, queryPoint, classSF, classLabel, value);
+			outputValues[0] = value;
+			return success;
+		}
+		const CCCoreLib::ScalarField* classSF;
+		ScalarType classLabel;
+	};
+
+	//! Applies a kernel to all the points of a batch (at a given scale)
+	template <class Kernel> bool RunFeatureTask(const FeatureTask& task, FeatureBatch& batch, size_t scaleIndex)
+	{
+		const Kernel kernel(task);
+		double outputValues[FeatureTask::MaxOutputs];
+		for (unsigned b = 0; b < batch.count; ++b)
+		{
+			unsigned kNN = batch.neighborCount(b, scaleIndex);
+			if (kNN == 0)
+			{
+				continue;
+			}
+
+			std::fill(outputValues, outputValues + FeatureTask::MaxOutputs, std::numeric_limits<double>::quiet_NaN());
+			if (!kernel(batch.neighbors[b], kNN, batch.queryPoints[b], outputValues))
+			{
+				return false;
+			}
+
+			for (int k = 0; k < FeatureTask::MaxOutputs; ++k)
+			{
+				if (task.slots[k] >= 0)
+					batch.value(b, task.slots[k]) = outputValues[k];
+			}
+		}
+		return true;
+	}
+
+	//! Sets the kernel of a task computing the moments (MEAN, STD, RANGE) of a given field
+	bool SetMomentsKernel(FeatureTask& task, const IScalarFieldWrapper::Shared& field);
+
+	//! Sets the kernel of a task computing the MEDIAN, MODE or SKEW of a given field
+	bool SetValuesKernel(FeatureTask& task, const IScalarFieldWrapper::Shared& field);
+
+	//! Sets the kernel of a task computing a neighborhood feature
+	bool SetNeighborhoodKernel(FeatureTask& task, NeighborhoodFeature::NeighborhoodFeatureType type);
+
+	//! Sets the kernel of a task computing a context-based feature
+	bool SetContextKernel(FeatureTask& task, ContextBasedFeature::ContextBasedFeatureType type);
+}
@@ -0,0 +1,933 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FeaturePlan.h"
+
+//Local
+#include "PointFeature.h"
+#include "NeighborhoodFeature.h"
+#include "DualCloudFeature.h"
+#include "ContextBasedFeature.h"
+#include "SpatialIndexCache.h"
+#include "q3DMASCTools.h"
+
+//qCC_db
+#include <ccPointCloud.h>
+#include <ccLog.h>
+
+//Qt
+#include <QMutex>
+#include <QCoreApplication>
+#include <QStringList>
+
+//system
+#include <assert.h>
+#include <atomic>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+//! Number of core points processed in a row (per thread)
+static const unsigned s_batchSize = 64;
+//! Number of core points used to estimate the amount of work
+static const unsigned s_workEstimationSampleCount = 64;
+
+static QString NodeTypeToString(FeaturePlan::NodeType type)
+{
+	switch (type)
+	{
+	case FeaturePlan::Neighborhood:
+		return "NEIGHBORHOOD";
+	case FeaturePlan::Moments:
+		return "MOMENTS";
+	case FeaturePlan::Values:
+		return "VALUES";
+	case FeaturePlan::Statistic:
+		return "STAT";
+	case FeaturePlan::Geometry:
+		return "GEOMETRY";
+	case FeaturePlan::Context:
+		return "CONTEXT";
+	case FeaturePlan::Correspondence:
+		return "CORRESPONDENCE";
+	case FeaturePlan::Operation:
+		return "OPERATION";
+	case FeaturePlan::Output:
+		return "OUTPUT";
+	default:
+		assert(false);
+		break;
+	}
+	return "INVALID";
+}
+
+//! Extracts the neighbors of a point (at the largest scale) and deduces the number of neighbors at each scale
+static unsigned ExtractNeighbors(	const ccOctree& octree,
+									unsigned char octreeLevel,
+									PointCoordinateType largestRadius,
+									const std::vector<double>& scales,
+									const CCVector3& queryPoint,
+									CCCoreLib::DgmOctree::NeighboursSet& neighbors,
+									unsigned* kNNPerScale)
+{
+	//spherical neighborhood extraction structure
+	CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
+	{
+		nNSS.level = octreeLevel;
+		nNSS.queryPoint = queryPoint;
+		octree.getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
+		octree.computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
+	}
+
+	unsigned kNN = octree.findNeighborsInASphereStartingFromCell(nNSS, largestRadius, true);
+	nNSS.pointsInNeighbourhood.resize(kNN);
+	neighbors.swap(nNSS.pointsInNeighbourhood);
+
+	//as the neighbors are sorted, the smaller scales only use the closest ones
+	size_t scaleCount = scales.size();
+	for (size_t scaleIndex = 0; scaleIndex < scaleCount; ++scaleIndex)
+	{
+		if (scaleIndex != 0 && kNN != 0)
+		{
+			double radius = scales[scaleCount - 1 - scaleIndex] / 2; //scale is the diameter!
+			double sqRadius = radius * radius;
+			//remove the farthest points
+			for (; kNN > 0; --kNN)
+			{
+				if (neighbors[kNN - 1].squareDistd <= sqRadius)
+				{
+					break;
+				}
+			}
+		}
+		kNNPerScale[scaleIndex] = kNN;
+	}
+
+	return kNNPerScale[0];
+}
+
+FeaturePlan::FeaturePlan(const CorePoints& corePoints)
+	: m_corePoints(corePoints)
+	, m_slotCount(0)
+	, m_scaledFeatureCount(0)
+	, m_requestCount(0)
+	, m_mergedCount(0)
+{
+}
+
+int FeaturePlan::cloudIndex(ccPointCloud* cloud, double scale)
+{
+	int index = -1;
+	for (size_t i = 0; i < m_clouds.size(); ++i)
+	{
+		if (m_clouds[i].cloud == cloud)
+		{
+			index = static_cast<int>(i);
+			break;
+		}
+	}
+
+	if (index < 0)
+	{
+		PlanCloud planCloud;
+		planCloud.cloud = cloud;
+		m_clouds.push_back(planCloud);
+		index = static_cast<int>(m_clouds.size()) - 1;
+	}
+
+	std::vector<double>& scales = m_clouds[index].scales;
+	if (std::find(scales.begin(), scales.end(), scale) == scales.end())
+	{
+		scales.push_back(scale);
+	}
+
+	return index;
+}
+
+int FeaturePlan::addNode(NodeType type, const QString& signature, const QString& label, const std::vector<int>& inputs, int cloudIndex, double scale, bool& created)
+{
+	QMap<QString, int>::const_iterator it = m_nodeIndexes.constFind(signature);
+	if (it != m_nodeIndexes.constEnd())
+	{
+		//identical node already in the plan
+		created = false;
+		return it.value();
+	}
+
+	Node node;
+	node.type = type;
+	node.signature = signature;
+	node.label = label;
+	node.inputs = inputs;
+	node.cloudIndex = cloudIndex;
+	node.scale = scale;
+	m_nodes.push_back(node);
+
+	int index = static_cast<int>(m_nodes.size()) - 1;
+	m_nodeIndexes.insert(signature, index);
+	created = true;
+	return index;
+}
+
+FeatureTask& FeaturePlan::task(int node)
+{
+	assert(m_nodeTasks.contains(node));
+	const TaskRef& ref = m_nodeTasks[node];
+	return m_clouds[ref.cloudIndex].tasksPerScaleValue[ref.scale][ref.taskIndex];
+}
+
+int FeaturePlan::requestNeighborhood(int cloudIndex, double scale)
+{
+	bool created = false;
+	return addNode(	Neighborhood,
+					QString("NEIGHBORHOOD|%1|%2").arg(cloudIndex).arg(scale, 0, 'g', 12),
+					QString("%1 @ %2").arg(m_clouds[cloudIndex].cloud->getName()).arg(scale),
+					{},
+					cloudIndex,
+					scale,
+					created);
+}
+
+bool FeaturePlan::requestStat(ccPointCloud* cloud, const IScalarFieldWrapper::Shared& field, Feature::Stat stat, double scale, const Feature* feature, int& slot, QString& error)
+{
+	slot = -1;
+	if (!cloud || !field)
+	{
+		//nothing to compute
+		return true;
+	}
+
+	++m_requestCount;
+
+	int ci = cloudIndex(cloud, scale);
+	int neighborhoodNode = requestNeighborhood(ci, scale);
+
+	//moments (MEAN, STD, RANGE) or gathered values (MEDIAN, MODE, SKEW)
+	int outputIndex = -1;
+	bool withMoments = true;
+	switch (stat)
+	{
+	case Feature::MEAN:
+		outputIndex = 0;
+		break;
+	case Feature::STD:
+		outputIndex = 1;
+		break;
+	case Feature::RANGE:
+		outputIndex = 2;
+		break;
+	case Feature::MEDIAN:
+		outputIndex = 0;
+		withMoments = false;
+		break;
+	case Feature::MODE:
+		outputIndex = 1;
+		withMoments = false;
+		break;
+	case Feature::SKEW:
+		outputIndex = 2;
+		withMoments = false;
+		break;
+	default:
+		error = "Unhandled STAT measure: " + feature->toString();
+		return false;
+	}
+
+	QString sourceSignature = QString("%1|%2|%3").arg(field->getName()).arg(ci).arg(scale, 0, 'g', 12);
+	QString sourceLabel = QString("%1 (%2 @ %3)").arg(field->getName()).arg(cloud->getName()).arg(scale);
+
+	bool created = false;
+	int groupNode = addNode(withMoments ? Moments : Values,
+							(withMoments ? "MOMENTS|" : "VALUES|") + sourceSignature,
+							sourceLabel,
+							{ neighborhoodNode },
+							ci,
+							scale,
+							created);
+	if (created)
+	{
+		FeatureTask newTask;
+		newTask.feature = feature;
+		if (!(withMoments ? SetMomentsKernel(newTask, field) : SetValuesKernel(newTask, field)))
+		{
+			error = "Unhandled feature: " + feature->toString();
+			return false;
+		}
+
+		std::vector<FeatureTask>& tasks = m_clouds[ci].tasksPerScaleValue[scale];
+		TaskRef ref;
+		ref.cloudIndex = ci;
+		ref.scale = scale;
+		ref.taskIndex = tasks.size();
+		tasks.push_back(newTask);
+		m_nodeTasks.insert(groupNode, ref);
+	}
+
+	int statNode = addNode(	Statistic,
+							"STAT|" + Feature::StatToString(stat) + "|" + sourceSignature,
+							Feature::StatToString(stat) + " " + sourceLabel,
+							{ groupNode },
+							ci,
+							scale,
+							created);
+	if (created)
+	{
+		m_nodes[statNode].slot = m_slotCount++;
+		task(groupNode).slots[outputIndex] = m_nodes[statNode].slot;
+	}
+	else
+	{
+		++m_mergedCount;
+	}
+
+	slot = m_nodes[statNode].slot;
+	return true;
+}
+
+bool FeaturePlan::requestGeometry(ccPointCloud* cloud, int type, double scale, const Feature* feature, int& slot, QString& error)
+{
+	slot = -1;
+	if (!cloud)
+	{
+		//nothing to compute
+		return true;
+	}
+
+	++m_requestCount;
+
+	int ci = cloudIndex(cloud, scale);
+	int neighborhoodNode = requestNeighborhood(ci, scale);
+
+	NeighborhoodFeature::NeighborhoodFeatureType neighborhoodType = static_cast<NeighborhoodFeature::NeighborhoodFeatureType>(type);
+	bool created = false;
+	int node = addNode(	Geometry,
+						QString("GEOMETRY|%1|%2|%3").arg(NeighborhoodFeature::ToString(neighborhoodType)).arg(ci).arg(scale, 0, 'g', 12),
+						QString("%1 (%2 @ %3)").arg(NeighborhoodFeature::ToString(neighborhoodType)).arg(cloud->getName()).arg(scale),
+						{ neighborhoodNode },
+						ci,
+						scale,
+						created);
+	if (created)
+	{
+		FeatureTask newTask;
+		newTask.feature = feature;
+		if (!SetNeighborhoodKernel(newTask, neighborhoodType))
+		{
+			error = "Unhandled feature: " + feature->toString();
+			return false;
+		}
+		newTask.slots[0] = m_nodes[node].slot = m_slotCount++;
+		m_clouds[ci].tasksPerScaleValue[scale].push_back(newTask);
+	}
+	else
+	{
+		++m_mergedCount;
+	}
+
+	slot = m_nodes[node].slot;
+	return true;
+}
+
+bool FeaturePlan::requestContext(ccPointCloud* cloud, int type, int classLabel, double scale, const Feature* feature, int& slot, QString& error)
+{
+	slot = -1;
+	if (!cloud)
+	{
+		//nothing to compute
+		return true;
+	}
+
+	++m_requestCount;
+
+	int ci = cloudIndex(cloud, scale);
+	int neighborhoodNode = requestNeighborhood(ci, scale);
+
+	ContextBasedFeature::ContextBasedFeatureType contextType = static_cast<ContextBasedFeature::ContextBasedFeatureType>(type);
+	bool created = false;
+	int node = addNode(	Context,
+						QString("CONTEXT|%1|%2|%3|%4").arg(ContextBasedFeature::ToString(contextType)).arg(classLabel).arg(ci).arg(scale, 0, 'g', 12),
+						QString("%1 class %2 (%3 @ %4)").arg(ContextBasedFeature::ToString(contextType)).arg(classLabel).arg(cloud->getName()).arg(scale),
+						{ neighborhoodNode },
+						ci,
+						scale,
+						created);
+	if (created)
+	{
+		FeatureTask newTask;
+		newTask.feature = feature;
+		newTask.sf = static_cast<const ContextBasedFeature*>(feature)->classificationSF; //set by 'prepare'
+		newTask.classLabel = static_cast<ScalarType>(classLabel);
+		if (!newTask.sf || !SetContextKernel(newTask, contextType))
+		{
+			error = "Unhandled feature: " + feature->toString();
+			return false;
+		}
+		newTask.slots[0] = m_nodes[node].slot = m_slotCount++;
+		m_clouds[ci].tasksPerScaleValue[scale].push_back(newTask);
+	}
+	else
+	{
+		++m_mergedCount;
+	}
+
+	slot = m_nodes[node].slot;
+	return true;
+}
+
+void FeaturePlan::addOutput(const Feature& feature, CCCoreLib::ScalarField* sf, int slot1, int slot2/*=-1*/, CCCoreLib::ScalarField* existingSF2/*=nullptr*/, Feature::Operation op/*=Feature::NO_OPERATION*/)
+{
+	if (!sf)
+	{
+		assert(false);
+		return;
+	}
+
+	//retrieve the input nodes (for the report)
+	std::vector<int> inputs;
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		if (m_nodes[i].slot >= 0 && (m_nodes[i].slot == slot1 || m_nodes[i].slot == slot2))
+		{
+			inputs.push_back(static_cast<int>(i));
+		}
+	}
+
+	bool created = false;
+	if (op != Feature::NO_OPERATION)
+	{
+		QString opLabel = Feature::OpToString(op);
+		if (existingSF2)
+			opLabel += QString(" (with existing SF '%1')").arg(existingSF2->getName());
+		int opNode = addNode(	Operation,
+								QString("OPERATION|%1|%2|%3|%4").arg(Feature::OpToString(op)).arg(slot1).arg(slot2).arg(existingSF2 ? existingSF2->getName() : QString()),
+								opLabel,
+								inputs,
+								-1,
+								feature.scale,
+								created);
+		inputs = { opNode };
+	}
+
+	addNode(Output,
+			QString("OUTPUT|%1").arg(sf->getName()),
+			QString("%1 -> '%2'").arg(feature.toString()).arg(sf->getName()),
+			inputs,
+			-1,
+			feature.scale,
+			created);
+
+	PlanOutput output;
+	output.sf = sf;
+	output.slot1 = slot1;
+	output.slot2 = slot2;
+	output.existingSF2 = existingSF2;
+	output.op = op;
+	m_outputs.push_back(output);
+}
+
+bool FeaturePlan::build(Feature::Set& features, QString& error, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/)
+{
+	if (features.empty() || !m_corePoints.origin)
+	{
+		//invalid input parameters
+		assert(false);
+		return false;
+	}
+
+	try
+	{
+		for (const Feature::Shared& feature : features)
+		{
+			QString errorMessage("invalid pointer");
+			assert(!m_corePoints.role.isEmpty());
+			if (!feature || !feature->checkValidity(m_corePoints.role, errorMessage))
+			{
+				error = "Invalid rule/feature: " + errorMessage;
+				return false;
+			}
+
+			//prepare the feature
+			if (!feature->prepare(m_corePoints, error, progressCb, generatedScalarFields))
+			{
+				//something failed (error should be up to date)
+				return false;
+			}
+
+			if (!feature->scaled())
+			{
+				//non scaled features are directly computed by 'prepare'
+				if (feature->getType() == Feature::Type::PointFeature
+					&& feature->cloud1 && feature->cloud2
+					&& feature->op != Feature::NO_OPERATION)
+				{
+					//the MATH operation relies on the nearest neighbors in the second cloud
+					bool created = false;
+					int correspondenceNode = addNode(	Correspondence,
+														QString("CORRESPONDENCE|%1|%2").arg(feature->cloud1Label).arg(feature->cloud2Label),
+														QString("%1 -> %2 (nearest neighbor)").arg(feature->cloud1Label).arg(feature->cloud2Label),
+														{},
+														-1,
+														0,
+														created);
+					int opNode = addNode(	Operation,
+											"OPERATION|" + feature->toString(),
+											Feature::OpToString(feature->op),
+											{ correspondenceNode },
+											-1,
+											0,
+											created);
+					addNode(Output,
+							"OUTPUT|" + feature->toString(),
+							feature->toString(),
+							{ opNode },
+							-1,
+							0,
+							created);
+				}
+				continue;
+			}
+
+			switch (feature->getType())
+			{
+			//Point features
+			case Feature::Type::PointFeature:
+			{
+				PointFeature* pointFeature = static_cast<PointFeature*>(feature.data());
+				if (!feature->cloud1 || !pointFeature->statSF1 || pointFeature->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
+				{
+					break;
+				}
+				++m_scaledFeatureCount;
+
+				int slot1 = -1;
+				if (!requestStat(feature->cloud1, pointFeature->field1, feature->stat, feature->scale, pointFeature, slot1, error))
+				{
+					return false;
+				}
+
+				if (feature->cloud2 && feature->op != Feature::NO_OPERATION)
+				{
+					int slot2 = -1;
+					if (!pointFeature->statSF2WasAlreadyExisting)
+					{
+						if (!requestStat(feature->cloud2, pointFeature->field2, feature->stat, feature->scale, pointFeature, slot2, error))
+						{
+							return false;
+						}
+					}
+					addOutput(*feature, pointFeature->statSF1, slot1, slot2, pointFeature->statSF2WasAlreadyExisting ? pointFeature->statSF2 : nullptr, feature->op);
+				}
+				else
+				{
+					addOutput(*feature, pointFeature->statSF1, slot1);
+				}
+			}
+			break;
+
+			//Neighborhood features
+			case Feature::Type::NeighborhoodFeature:
+			{
+				NeighborhoodFeature* neighborhoodFeature = static_cast<NeighborhoodFeature*>(feature.data());
+				if (!feature->cloud1 || !neighborhoodFeature->sf1 || neighborhoodFeature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
+				{
+					break;
+				}
+				++m_scaledFeatureCount;
+
+				int slot1 = -1;
+				if (!requestGeometry(feature->cloud1, neighborhoodFeature->type, feature->scale, neighborhoodFeature, slot1, error))
+				{
+					return false;
+				}
+
+				if (feature->cloud2 && feature->op != Feature::NO_OPERATION)
+				{
+					int slot2 = -1;
+					if (!neighborhoodFeature->sf2WasAlreadyExisting)
+					{
+						if (!requestGeometry(feature->cloud2, neighborhoodFeature->type, feature->scale, neighborhoodFeature, slot2, error))
+						{
+							return false;
+						}
+					}
+					addOutput(*feature, neighborhoodFeature->sf1, slot1, slot2, neighborhoodFeature->sf2WasAlreadyExisting ? neighborhoodFeature->sf2 : nullptr, feature->op);
+				}
+				else
+				{
+					addOutput(*feature, neighborhoodFeature->sf1, slot1);
+				}
+			}
+			break;
+
+			//Context-based features
+			case Feature::Type::ContextBasedFeature:
+			{
+				ContextBasedFeature* contextBasedFeature = static_cast<ContextBasedFeature*>(feature.data());
+				if (!feature->cloud1 || !contextBasedFeature->sf || contextBasedFeature->sfWasAlreadyExisting) // nothing to compute if the scalar field was already there
+				{
+					break;
+				}
+				++m_scaledFeatureCount;
+
+				int slot = -1;
+				if (!requestContext(feature->cloud1, contextBasedFeature->type, contextBasedFeature->ctxClassLabel, feature->scale, contextBasedFeature, slot, error))
+				{
+					return false;
+				}
+				addOutput(*feature, contextBasedFeature->sf, slot);
+			}
+			break;
+
+			//Dual-cloud features
+			case Feature::Type::DualCloudFeature:
+			{
+				DualCloudFeature* dualCloudFeature = static_cast<DualCloudFeature*>(feature.data());
+				if (!feature->cloud1 || !feature->cloud2 || !dualCloudFeature->sf1 || dualCloudFeature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
+				{
+					break;
+				}
+				++m_scaledFeatureCount;
+
+				//IDIFF = mean(I1) - mean(I2) (the means are shared with the equivalent point features)
+				int slot1 = -1;
+				int slot2 = -1;
+				if (	!requestStat(feature->cloud1, dualCloudFeature->field1, Feature::MEAN, feature->scale, dualCloudFeature, slot1, error)
+					||	(!dualCloudFeature->sf2WasAlreadyExisting && !requestStat(feature->cloud2, dualCloudFeature->field2, Feature::MEAN, feature->scale, dualCloudFeature, slot2, error)))
+				{
+					return false;
+				}
+				addOutput(*feature, dualCloudFeature->sf1, slot1, slot2, dualCloudFeature->sf2WasAlreadyExisting ? dualCloudFeature->sf2 : nullptr, Feature::MINUS);
+			}
+			break;
+
+			default:
+				assert(false);
+				break;
+			}
+		}
+
+		//schedule the tasks: for each cloud, from the largest to the smallest scale
+		for (PlanCloud& planCloud : m_clouds)
+		{
+			std::sort(planCloud.scales.begin(), planCloud.scales.end());
+			planCloud.tasksPerScale.resize(planCloud.scales.size());
+			for (size_t scaleIndex = 0; scaleIndex < planCloud.scales.size(); ++scaleIndex)
+			{
+				double scale = planCloud.scales[planCloud.scales.size() - 1 - scaleIndex];
+				planCloud.tasksPerScale[scaleIndex] = planCloud.tasksPerScaleValue.value(scale);
+			}
+			planCloud.tasksPerScaleValue.clear();
+		}
+		m_nodeTasks.clear();
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	return true;
+}
+
+bool FeaturePlan::prepareClouds(QString& error, CCCoreLib::GenericProgressCallback* progressCb)
+{
+	for (PlanCloud& planCloud : m_clouds)
+	{
+		//get the octree
+		planCloud.octree = planCloud.cloud->getOctree();
+		if (!planCloud.octree)
+		{
+			ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(planCloud.cloud->getName()).arg(planCloud.cloud->size()));
+			if (progressCb)
+				progressCb->start();
+			QCoreApplication::processEvents();
+			planCloud.octree = SpatialIndexCache::GetOctree(planCloud.cloud, progressCb);
+			if (!planCloud.octree)
+			{
+				error = "Failed to compute octree (not enough memory?)";
+				return false;
+			}
+		}
+
+		//the neighborhoods will be extracted from the biggest to the smallest scale
+		double largestScale = planCloud.scales.back();
+		planCloud.largestRadius = static_cast<PointCoordinateType>(largestScale / 2); //scale is the diameter!
+		planCloud.octreeLevel = planCloud.octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(planCloud.largestRadius);
+	}
+
+	return true;
+}
+
+void FeaturePlan::estimateWork()
+{
+	unsigned pointCount = m_corePoints.size();
+	unsigned sampleCount = std::min(pointCount, s_workEstimationSampleCount);
+
+	for (PlanCloud& planCloud : m_clouds)
+	{
+		size_t scaleCount = planCloud.scales.size();
+		planCloud.meanNeighborCount.assign(scaleCount, 0.0);
+		if (sampleCount == 0 || !planCloud.octree)
+		{
+			continue;
+		}
+
+		CCCoreLib::DgmOctree::NeighboursSet neighbors;
+		std::vector<unsigned> kNNPerScale(scaleCount, 0);
+		for (unsigned k = 0; k < sampleCount; ++k)
+		{
+			//evenly spread samples
+			unsigned pointIndex = static_cast<unsigned>((static_cast<uint64_t>(k) * pointCount) / sampleCount);
+			ExtractNeighbors(*planCloud.octree, planCloud.octreeLevel, planCloud.largestRadius, planCloud.scales, *m_corePoints.cloud->getPoint(pointIndex), neighbors, kNNPerScale.data());
+			for (size_t scaleIndex = 0; scaleIndex < scaleCount; ++scaleIndex)
+			{
+				planCloud.meanNeighborCount[scaleIndex] += kNNPerScale[scaleIndex];
+			}
+		}
+
+		for (double& count : planCloud.meanNeighborCount)
+		{
+			count /= sampleCount;
+		}
+	}
+}
+
+void FeaturePlan::report() const
+{
+	size_t valueNodeCount = 0;
+	for (const Node& node : m_nodes)
+	{
+		if (node.slot >= 0)
+			++valueNodeCount;
+	}
+
+	ccLog::Print(QString("[3DMASC] Feature plan: %1 scaled feature(s) --> %2 node(s), %3 value(s) computed per core point (%4 request(s), %5 merged)")
+						.arg(m_scaledFeatureCount)
+						.arg(m_nodes.size())
+						.arg(valueNodeCount)
+						.arg(m_requestCount)
+						.arg(m_mergedCount));
+
+	//nodes
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		const Node& node = m_nodes[i];
+		QStringList inputs;
+		for (int input : node.inputs)
+		{
+			inputs << QString("#%1").arg(input);
+		}
+		ccLog::PrintDebug(QString("[3DMASC] #%1 %2 %3%4").arg(i).arg(NodeTypeToString(node.type)).arg(node.label).arg(inputs.empty() ? QString() : " <-- " + inputs.join(", ")));
+	}
+
+	//schedule and predicted work
+	unsigned pointCount = m_corePoints.size();
+	double predictedVisits = 0.0;
+	for (const PlanCloud& planCloud : m_clouds)
+	{
+		size_t scaleCount = planCloud.scales.size();
+		QStringList perScale;
+		double cloudVisits = 0.0;
+		for (size_t scaleIndex = 0; scaleIndex < scaleCount; ++scaleIndex)
+		{
+			double meanKNN = (scaleIndex < planCloud.meanNeighborCount.size() ? planCloud.meanNeighborCount[scaleIndex] : 0.0);
+			size_t taskCount = planCloud.tasksPerScale[scaleIndex].size();
+			perScale << QString("%1: %2 task(s), ~%3 neighbors").arg(planCloud.scales[scaleCount - 1 - scaleIndex]).arg(taskCount).arg(meanKNN, 0, 'f', 1);
+			cloudVisits += meanKNN * taskCount;
+		}
+		//the neighborhood extraction itself (at the largest scale)
+		if (!planCloud.meanNeighborCount.empty())
+			cloudVisits += planCloud.meanNeighborCount.front();
+		cloudVisits *= pointCount;
+		predictedVisits += cloudVisits;
+
+		ccLog::Print(QString("[3DMASC] Cloud %1: %2").arg(planCloud.cloud->getName()).arg(perScale.join(" | ")));
+	}
+	ccLog::Print(QString("[3DMASC] Predicted work: %1 core points, ~%2 M neighbor visits").arg(pointCount).arg(predictedVisits / 1.0e6, 0, 'f', 1));
+}
+
+bool FeaturePlan::execute(QString& error, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (m_clouds.empty() || m_outputs.empty())
+	{
+		//nothing to do
+		return true;
+	}
+
+	if (!prepareClouds(error, progressCb))
+	{
+		return false;
+	}
+
+	estimateWork();
+	report();
+
+	unsigned pointCount = m_corePoints.size();
+	size_t maxScaleCount = 0;
+	for (const PlanCloud& planCloud : m_clouds)
+	{
+		maxScaleCount = std::max(maxScaleCount, planCloud.scales.size());
+	}
+
+	QString logMessage = QString("Computing %1 features on %2 cloud(s)\n(core points: %3)").arg(m_scaledFeatureCount).arg(m_clouds.size()).arg(pointCount);
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Compute features");
+		progressCb->setInfo(qPrintable(logMessage));
+	}
+	ccLog::Print(logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	//the core points are processed by batches
+	int batchCount = static_cast<int>((pointCount + s_batchSize - 1) / s_batchSize);
+
+	//(the flags are read outside of the mutex by the other threads)
+	std::atomic<bool> success(true);
+	std::atomic<bool> cancelled(false);
+	QMutex mutex;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(Tools::MaxThreadCount())
+#endif
+#endif
+	{
+		FeatureBatch batch;
+		try
+		{
+			batch.neighbors.resize(s_batchSize);
+			batch.queryPoints.resize(s_batchSize);
+			batch.kNN.resize(s_batchSize * maxScaleCount);
+			batch.slotCount = static_cast<size_t>(m_slotCount);
+			batch.values.resize(s_batchSize * batch.slotCount);
+		}
+		catch (const std::bad_alloc&)
+		{
+			mutex.lock();
+			error = "Not enough memory";
+			success = false;
+			mutex.unlock();
+		}
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp for
+#endif
+#endif
+		for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+		{
+			if (!success || cancelled)
+			{
+				//we can't break an OpenMP loop
+				continue;
+			}
+
+			batch.firstPointIndex = static_cast<unsigned>(batchIndex) * s_batchSize;
+			batch.count = std::min(s_batchSize, pointCount - batch.firstPointIndex);
+			std::fill(batch.values.begin(), batch.values.end(), std::numeric_limits<double>::quiet_NaN());
+			for (unsigned b = 0; b < batch.count; ++b)
+			{
+				batch.queryPoints[b] = *m_corePoints.cloud->getPoint(batch.firstPointIndex + b);
+			}
+
+			const FeatureTask* failedTask = nullptr;
+
+			//for each cloud
+			for (const PlanCloud& planCloud : m_clouds)
+			{
+				batch.scaleCount = planCloud.scales.size();
+
+				//we extract the neighbors of each point
+				for (unsigned b = 0; b < batch.count; ++b)
+				{
+					ExtractNeighbors(*planCloud.octree, planCloud.octreeLevel, planCloud.largestRadius, planCloud.scales, batch.queryPoints[b], batch.neighbors[b], &batch.neighborCount(b, 0));
+				}
+
+				//for each scale (from the largest to the smallest)
+				for (size_t scaleIndex = 0; scaleIndex < batch.scaleCount && !failedTask; ++scaleIndex)
+				{
+					for (const FeatureTask& task : planCloud.tasksPerScale[scaleIndex])
+					{
+						if (!task.run(task, batch, scaleIndex))
+						{
+							failedTask = &task;
+							break;
+						}
+					}
+				}
+
+				if (failedTask)
+				{
+					mutex.lock();
+					error = "An error occurred during the computation of feature " + failedTask->feature->toString() + " on cloud " + planCloud.cloud->getName();
+					success = false;
+					mutex.unlock();
+					break;
+				}
+			} //for each cloud
+
+			if (failedTask)
+			{
+				continue;
+			}
+
+			//now that all the values are known, we can fill the output scalar fields (and apply the MATH operations)
+			for (unsigned b = 0; b < batch.count; ++b)
+			{
+				unsigned pointIndex = batch.firstPointIndex + b;
+				for (const PlanOutput& output : m_outputs)
+				{
+					double s1 = (output.slot1 >= 0 ? batch.value(b, output.slot1) : std::numeric_limits<double>::quiet_NaN());
+					if (output.op == Feature::NO_OPERATION)
+					{
+						output.sf->setValue(pointIndex, static_cast<ScalarType>(s1));
+					}
+					else
+					{
+						double s2 = (output.existingSF2 ? output.existingSF2->getValue(pointIndex)
+										: output.slot2 >= 0 ? batch.value(b, output.slot2)
+										: std::numeric_limits<double>::quiet_NaN());
+						output.sf->setValue(pointIndex, Feature::PerformMathOp(s1, s2, output.op));
+					}
+				}
+			}
+
+			if (progressCb)
+			{
+				mutex.lock();
+				if (!nProgress.steps(batch.count))
+				{
+					//process cancelled by the user
+					cancelled = true;
+				}
+				mutex.unlock();
+			}
+
+		} //for each batch
+	}
+
+	if (cancelled)
+	{
+		ccLog::Warning("Process cancelled");
+		error = "Process cancelled";
+		success = false;
+	}
+
+	return success;
+}
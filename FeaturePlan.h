@@ -0,0 +1,170 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FeaturesInterface.h"
+#include "FeatureKernels.h"
+
+//qCC_db
+#include <ccOctree.h>
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QMap>
+#include <QString>
+
+//system
+#include <vector>
+
+class ccPointCloud;
+
+namespace masc
+{
+	//! Feature execution plan
+	/** Turns a set of features into a graph of primitive computations (neighborhoods,
+		moments, gathered values, geometrical features, correspondences and operations).
+		Identical nodes are merged, so that each primitive is only computed once per core point.
+	**/
+	class FeaturePlan
+	{
+	public:
+
+		//! Node type
+		enum NodeType
+		{
+			Neighborhood	//!< spherical neighborhood of the core points in a given cloud, at a given scale
+			, Moments		//!< sum, sum of squares, min and max of a source field
+			, Values		//!< gathered values of a source field (for order statistics)
+			, Statistic		//!< 'stat' derived from moments or gathered values
+			, Geometry		//!< neighborhood (geometrical) feature
+			, Context		//!< context-based feature
+			, Correspondence//!< nearest neighbor correspondence between two clouds (SC0 features)
+			, Operation		//!< MATH operation between two values
+			, Output		//!< feature scalar field
+		};
+
+		//! Plan node
+		struct Node
+		{
+			NodeType type = Output;
+			//! Unique signature (used to merge identical nodes)
+			QString signature;
+			//! Human readable description
+			QString label;
+			//! Input nodes
+			std::vector<int> inputs;
+			//! Cloud index (if any)
+			int cloudIndex = -1;
+			//! Scale (if any)
+			double scale = 0;
+			//! Value slot (for value nodes)
+			int slot = -1;
+		};
+
+		//! Default constructor
+		explicit FeaturePlan(const CorePoints& corePoints);
+
+		//! Prepares the features and builds the plan
+		bool build(Feature::Set& features, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr);
+
+		//! Executes the plan (i.e. computes the scaled features)
+		bool execute(QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Logs the plan (nodes, schedule and predicted work)
+		void report() const;
+
+		//! Returns whether there is something to compute
+		inline bool isEmpty() const { return m_outputs.empty(); }
+
+		//! Returns the plan nodes
+		inline const std::vector<Node>& nodes() const { return m_nodes; }
+
+	protected: //structures
+
+		//! Cloud on which scaled features have to be computed
+		struct PlanCloud
+		{
+			ccPointCloud* cloud = nullptr;
+			//! Scales (sorted in ascending order once the plan is built)
+			std::vector<double> scales;
+			//! Tasks for each scale (during the plan construction)
+			QMap<double, std::vector<FeatureTask> > tasksPerScaleValue;
+			//! Tasks for each scale (from the largest to the smallest)
+			std::vector< std::vector<FeatureTask> > tasksPerScale;
+			//! Estimated mean number of neighbors for each scale (from the largest to the smallest)
+			std::vector<double> meanNeighborCount;
+			//! Octree
+			ccOctree::Shared octree;
+			unsigned char octreeLevel = 0;
+			PointCoordinateType largestRadius = 0;
+		};
+
+		//! Reference to the task producing the values of a node
+		struct TaskRef
+		{
+			int cloudIndex = -1;
+			double scale = 0;
+			size_t taskIndex = 0;
+		};
+
+		//! Output scalar field
+		struct PlanOutput
+		{
+			CCCoreLib::ScalarField* sf = nullptr;
+			//! First side (or single value) slot
+			int slot1 = -1;
+			//! Second side slot (for MATH operations)
+			int slot2 = -1;
+			//! Pre-existing second side scalar field (if any)
+			CCCoreLib::ScalarField* existingSF2 = nullptr;
+			Feature::Operation op = Feature::NO_OPERATION;
+		};
+
+	protected: //methods
+
+		int cloudIndex(ccPointCloud* cloud, double scale);
+		int addNode(NodeType type, const QString& signature, const QString& label, const std::vector<int>& inputs, int cloudIndex, double scale, bool& created);
+		int requestNeighborhood(int cloudIndex, double scale);
+		bool requestStat(ccPointCloud* cloud, const IScalarFieldWrapper::Shared& field, Feature::Stat stat, double scale, const Feature* feature, int& slot, QString& error);
+		bool requestGeometry(ccPointCloud* cloud, int type, double scale, const Feature* feature, int& slot, QString& error);
+		bool requestContext(ccPointCloud* cloud, int type, int classLabel, double scale, const Feature* feature, int& slot, QString& error);
+		void addOutput(const Feature& feature, CCCoreLib::ScalarField* sf, int slot1, int slot2 = -1, CCCoreLib::ScalarField* existingSF2 = nullptr, Feature::Operation op = Feature::NO_OPERATION);
+		FeatureTask& task(int node);
+
+		//! Prepares the clouds (octrees, etc.)
+		bool prepareClouds(QString& error, CCCoreLib::GenericProgressCallback* progressCb);
+		//! Estimates the mean number of neighbors per scale (on a sample of core points)
+		void estimateWork();
+
+	protected: //members
+
+		const CorePoints& m_corePoints;
+		std::vector<Node> m_nodes;
+		QMap<QString, int> m_nodeIndexes;
+		QMap<int, TaskRef> m_nodeTasks;
+		std::vector<PlanCloud> m_clouds;
+		std::vector<PlanOutput> m_outputs;
+		int m_slotCount;
+		size_t m_scaledFeatureCount;
+		size_t m_requestCount;
+		size_t m_mergedCount;
+	};
+}
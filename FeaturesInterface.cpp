@@ -200,7 +200,7 @@ bool Feature::LoadSources(Source::Set& sources, QString filename)
 		Source src;
 		bool ok = false;
 		int sourceType = tokens[0].toInt(&ok);
-		if (!ok || sourceType < Feature::Source::ScalarField || sourceType > Feature::Source::Blue)
+		if (!ok || sourceType < Feature::Source::ScalarField || sourceType > Feature::Source::Placeholder)
 		{
 			ccLog::Warning("Unhandled source type");
 			return false;
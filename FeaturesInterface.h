@@ -131,7 +131,8 @@ namespace masc
 				DimZ,
 				Red,
 				Green,
-				Blue
+				Blue,
+				Placeholder //constant values (feature not used by the classifier)
 			};
 
 			Source(Type t = ScalarField, QString n = QString())
@@ -162,6 +163,7 @@ namespace masc
 			, source(p_source, p_sourceName)
 			, stat(NO_STAT)
 			, op(NO_OPERATION)
+			, unused(false)
 		{}
 
 		//! Returns the type (must be reimplemented by child struct)
@@ -236,5 +238,7 @@ namespace masc
 	
 		Stat stat; //only considered if a scale is defined
 		Operation op; //only considered if 2 clouds are defined
+
+		bool unused; //the feature is not used by the classifier (it won't be computed)
 	};
 }
@@ -0,0 +1,373 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FlatForest.h"
+
+//Qt
+#include <QCryptographicHash>
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+
+using namespace masc;
+
+//! Split rule for raw features (same as cv::ml::DTrees)
+static inline bool GoLeft(const FlatForest::Node& node, float value)
+{
+	return value <= node.threshold;
+}
+
+//! Split rule for 8 bits quantized features
+static inline bool GoLeft(const FlatForest::Node& node, uint8_t rank)
+{
+	return rank <= node.rank;
+}
+
+//! Split rule for 16 bits quantized features
+static inline bool GoLeft(const FlatForest::Node& node, uint16_t rank)
+{
+	return rank <= node.rank;
+}
+
+FlatForest::FlatForest()
+	: m_featureCount(0)
+	, m_quantization(NoQuantization)
+{
+}
+
+void FlatForest::clear()
+{
+	m_nodes.clear();
+	m_roots.clear();
+	m_classLabels.clear();
+	m_thresholds.clear();
+	m_featureCount = 0;
+	m_quantization = NoQuantization;
+}
+
+bool FlatForest::addNode(	const std::vector<cv::ml::DTrees::Node>& cvNodes,
+							const std::vector<cv::ml::DTrees::Split>& cvSplits,
+							int cvNodeIndex,
+							QString& error)
+{
+	if (cvNodeIndex < 0 || cvNodeIndex >= static_cast<int>(cvNodes.size()))
+	{
+		error = QObject::tr("Invalid node index");
+		return false;
+	}
+	const cv::ml::DTrees::Node& cvNode = cvNodes[cvNodeIndex];
+
+	size_t nodeIndex = m_nodes.size();
+	m_nodes.push_back(Node());
+
+	if (cvNode.split < 0)
+	{
+		//leaf
+		if (cvNode.classIdx < 0)
+		{
+			error = QObject::tr("Leaf without class");
+			return false;
+		}
+		if (cvNode.classIdx >= static_cast<int>(m_classLabels.size()))
+		{
+			m_classLabels.resize(cvNode.classIdx + 1, 0);
+		}
+		m_classLabels[cvNode.classIdx] = static_cast<int>(cvNode.value);
+		m_nodes[nodeIndex].right = cvNode.classIdx;
+		return true;
+	}
+
+	if (cvNode.split >= static_cast<int>(cvSplits.size()))
+	{
+		error = QObject::tr("Invalid split index");
+		return false;
+	}
+	const cv::ml::DTrees::Split& cvSplit = cvSplits[cvNode.split];
+	if (cvSplit.subsetOfs >= 0)
+	{
+		error = QObject::tr("Categorical splits are not supported");
+		return false;
+	}
+	if (cvSplit.varIdx < 0 || cvSplit.varIdx >= m_featureCount)
+	{
+		error = QObject::tr("Invalid split variable (%1)").arg(cvSplit.varIdx);
+		return false;
+	}
+
+	m_nodes[nodeIndex].feature = cvSplit.varIdx;
+	m_nodes[nodeIndex].threshold = cvSplit.c;
+	m_thresholds[cvSplit.varIdx].push_back(cvSplit.c);
+
+	//the left child is always stored right after its parent
+	int leftChild = (cvSplit.inversed ? cvNode.right : cvNode.left);
+	int rightChild = (cvSplit.inversed ? cvNode.left : cvNode.right);
+	if (!addNode(cvNodes, cvSplits, leftChild, error))
+	{
+		return false;
+	}
+	m_nodes[nodeIndex].right = static_cast<int32_t>(m_nodes.size());
+
+	return addNode(cvNodes, cvSplits, rightChild, error);
+}
+
+bool FlatForest::build(const cv::ml::RTrees& rtrees, int featureCount, QString& error)
+{
+	clear();
+
+	if (featureCount <= 0)
+	{
+		assert(false);
+		error = QObject::tr("Invalid number of features");
+		return false;
+	}
+
+	const std::vector<int>& cvRoots = rtrees.getRoots();
+	const std::vector<cv::ml::DTrees::Node>& cvNodes = rtrees.getNodes();
+	const std::vector<cv::ml::DTrees::Split>& cvSplits = rtrees.getSplits();
+	if (cvRoots.empty() || cvNodes.empty())
+	{
+		error = QObject::tr("Empty forest");
+		return false;
+	}
+
+	m_featureCount = featureCount;
+	try
+	{
+		m_thresholds.resize(featureCount);
+		m_nodes.reserve(cvNodes.size());
+		m_roots.reserve(cvRoots.size());
+
+		for (int cvRoot : cvRoots)
+		{
+			m_roots.push_back(static_cast<int>(m_nodes.size()));
+			if (!addNode(cvNodes, cvSplits, cvRoot, error))
+			{
+				clear();
+				return false;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		clear();
+		error = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	if (m_classLabels.empty())
+	{
+		clear();
+		error = QObject::tr("No class");
+		return false;
+	}
+
+	//sorted thresholds of each feature
+	for (std::vector<float>& thresholds : m_thresholds)
+	{
+		std::sort(thresholds.begin(), thresholds.end());
+		thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+	}
+
+	//rank of each threshold (value <= threshold <=> rank(value) <= rank(threshold))
+	for (Node& node : m_nodes)
+	{
+		if (node.feature >= 0)
+		{
+			const std::vector<float>& thresholds = m_thresholds[node.feature];
+			node.rank = static_cast<int32_t>(std::lower_bound(thresholds.begin(), thresholds.end(), node.threshold) - thresholds.begin());
+		}
+	}
+
+	return true;
+}
+
+QByteArray FlatForest::signature() const
+{
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	hash.addData(reinterpret_cast<const char*>(&m_featureCount), sizeof(int));
+	hash.addData(reinterpret_cast<const char*>(m_roots.data()), static_cast<int>(m_roots.size() * sizeof(int)));
+	hash.addData(reinterpret_cast<const char*>(m_classLabels.data()), static_cast<int>(m_classLabels.size() * sizeof(int)));
+	for (const Node& node : m_nodes)
+	{
+		//field by field (to ignore the quantization ranks)
+		hash.addData(reinterpret_cast<const char*>(&node.feature), sizeof(int32_t));
+		hash.addData(reinterpret_cast<const char*>(&node.right), sizeof(int32_t));
+		hash.addData(reinterpret_cast<const char*>(&node.threshold), sizeof(float));
+	}
+	return hash.result().toHex();
+}
+
+FlatForest::Quantization FlatForest::bestQuantization() const
+{
+	size_t maxThresholdCount = 0;
+	for (const std::vector<float>& thresholds : m_thresholds)
+	{
+		maxThresholdCount = std::max(maxThresholdCount, thresholds.size());
+	}
+
+	//the rank of a value is in [0 ; thresholds count]
+	if (maxThresholdCount <= 0xFF)
+		return Bins8;
+	else if (maxThresholdCount <= 0xFFFF)
+		return Bins16;
+	else
+		return NoQuantization;
+}
+
+bool FlatForest::setQuantization(Quantization quantization)
+{
+	switch (quantization)
+	{
+	case NoQuantization:
+		break;
+	case Bins8:
+		if (bestQuantization() != Bins8)
+			return false;
+		break;
+	case Bins16:
+		if (bestQuantization() == NoQuantization)
+			return false;
+		break;
+	}
+
+	m_quantization = quantization;
+	return true;
+}
+
+template <typename T> void FlatForest::quantize(const cv::Mat& samples, T* output) const
+{
+	for (int i = 0; i < samples.rows; ++i)
+	{
+		const float* sample = samples.ptr<float>(i);
+		for (int fIndex = 0; fIndex < m_featureCount; ++fIndex)
+		{
+			const std::vector<float>& thresholds = m_thresholds[fIndex];
+			float value = sample[fIndex];
+			//NaN values always go to the right (as with raw features)
+			size_t rank = (std::isnan(value) ? thresholds.size() : static_cast<size_t>(std::lower_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin()));
+			*output++ = static_cast<T>(rank);
+		}
+	}
+}
+
+template <typename T> void FlatForest::vote(const T* samples, int rowCount, size_t rowStride, int* votes, const EarlyExitOptions* earlyExit, int* treeCounts) const
+{
+	const Node* nodes = m_nodes.data();
+	size_t classCount = m_classLabels.size();
+
+	if (!earlyExit)
+	{
+		//each tree is applied to the whole block before switching to the next one (so that it stays in cache)
+		for (int root : m_roots)
+		{
+			const T* sample = samples;
+			int* sampleVotes = votes;
+			for (int i = 0; i < rowCount; ++i, sample += rowStride, sampleVotes += classCount)
+			{
+				const Node* node = nodes + root;
+				while (node->feature >= 0)
+				{
+					node = (GoLeft(*node, sample[node->feature]) ? node + 1 : nodes + node->right);
+				}
+				++sampleVotes[node->right];
+			}
+		}
+		return;
+	}
+
+	//with early exit, each sample goes through the trees until the vote is decided
+	int totalTreeCount = static_cast<int>(m_roots.size());
+	const T* sample = samples;
+	int* sampleVotes = votes;
+	for (int i = 0; i < rowCount; ++i, sample += rowStride, sampleVotes += classCount)
+	{
+		VoteTracker tracker(sampleVotes);
+		for (int root : m_roots)
+		{
+			const Node* node = nodes + root;
+			while (node->feature >= 0)
+			{
+				node = (GoLeft(*node, sample[node->feature]) ? node + 1 : nodes + node->right);
+			}
+			tracker.add(node->right);
+
+			if (tracker.canStop(totalTreeCount, *earlyExit))
+			{
+				break;
+			}
+		}
+		treeCounts[i] = tracker.treeCount();
+	}
+}
+
+void FlatForest::computeVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions* earlyExit, std::vector<int>* treeCounts) const
+{
+	if (!isValid() || samples.type() != CV_32FC1 || samples.cols != m_featureCount)
+	{
+		assert(false);
+		votes.clear();
+		return;
+	}
+
+	votes.assign(static_cast<size_t>(samples.rows) * m_classLabels.size(), 0);
+	if (treeCounts)
+	{
+		treeCounts->resize(samples.rows);
+	}
+	if (samples.rows == 0)
+	{
+		return;
+	}
+	int* treeCountsData = (treeCounts ? treeCounts->data() : nullptr);
+
+	switch (m_quantization)
+	{
+	case NoQuantization:
+		vote<float>(samples.ptr<float>(0), samples.rows, samples.step1(), votes.data(), earlyExit, treeCountsData);
+		break;
+
+	case Bins8:
+		buffer.resize(static_cast<size_t>(samples.rows) * m_featureCount);
+		quantize<uint8_t>(samples, buffer.data());
+		vote<uint8_t>(buffer.data(), samples.rows, m_featureCount, votes.data(), earlyExit, treeCountsData);
+		break;
+
+	case Bins16:
+		buffer.resize(static_cast<size_t>(samples.rows) * m_featureCount * sizeof(uint16_t));
+		quantize<uint16_t>(samples, reinterpret_cast<uint16_t*>(buffer.data()));
+		vote<uint16_t>(reinterpret_cast<const uint16_t*>(buffer.data()), samples.rows, m_featureCount, votes.data(), earlyExit, treeCountsData);
+		break;
+	}
+}
+
+void FlatForest::getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer) const
+{
+	computeVotes(samples, votes, buffer, nullptr, nullptr);
+}
+
+void FlatForest::getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions& options, std::vector<int>& treeCounts) const
+{
+	computeVotes(samples, votes, buffer, options.enabled ? &options : nullptr, &treeCounts);
+	if (!options.enabled)
+	{
+		//all the trees have been evaluated
+		treeCounts.assign(samples.rows, treeCount());
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "ForestEngine.h"
+
+//Qt
+#include <QByteArray>
+#include <QString>
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//system
+#include <cstdint>
+#include <vector>
+
+namespace masc
+{
+	//! Flattened random forest (for fast inference)
+	/** The trees of a cv::ml::RTrees classifier are converted into a single array of
+		compact nodes (depth-first order, the left child of a node is always the next one).
+		The features can optionally be quantized (8 or 16 bits) without changing the
+		predictions: each feature is replaced by its rank among the thresholds of this feature.
+	**/
+	class FlatForest : public ForestEngine
+	{
+	public:
+
+		//! Quantization of the features
+		enum Quantization
+		{
+			NoQuantization	//!< raw (32 bits) features
+			, Bins8			//!< 8 bits feature ranks
+			, Bins16		//!< 16 bits feature ranks
+		};
+
+		//! Compact node
+		struct Node
+		{
+			//! Feature index (or -1 for leaves)
+			int32_t feature = -1;
+			//! Index of the right child (or class index for leaves)
+			int32_t right = 0;
+			//! Split threshold (go left if value <= threshold)
+			float threshold = 0.0f;
+			//! Split threshold rank (for quantized features)
+			int32_t rank = 0;
+		};
+
+		//! Default constructor
+		FlatForest();
+
+		//! Converts a trained forest
+		/** \param rtrees trained random trees
+			\param featureCount number of features per sample
+			\param error error message (if any)
+			\return success
+		**/
+		bool build(const cv::ml::RTrees& rtrees, int featureCount, QString& error);
+
+		//! Clears the forest
+		void clear();
+
+		//! Returns whether the forest is valid
+		inline bool isValid() const override { return !m_roots.empty(); }
+
+		//! Returns the number of trees
+		inline int treeCount() const { return static_cast<int>(m_roots.size()); }
+		//! Returns the number of nodes
+		inline size_t nodeCount() const { return m_nodes.size(); }
+		//! Returns the number of features per sample
+		inline int featureCount() const override { return m_featureCount; }
+		//! Returns the number of classes
+		inline int classCount() const override { return static_cast<int>(m_classLabels.size()); }
+		//! Returns the class labels (sorted as the votes)
+		inline const std::vector<int>& classLabels() const override { return m_classLabels; }
+
+		//! Returns the nodes of all trees
+		inline const std::vector<Node>& nodes() const { return m_nodes; }
+		//! Returns the index of the root node of each tree
+		inline const std::vector<int>& roots() const { return m_roots; }
+
+		//! Returns the signature of the forest (hash of its nodes and classes)
+		QByteArray signature() const;
+
+		//! Sets the quantization of the features
+		/** \return false if the number of thresholds of a feature exceeds the quantization capacity
+		**/
+		bool setQuantization(Quantization quantization);
+		//! Returns the quantization of the features
+		inline Quantization quantization() const { return m_quantization; }
+		//! Returns the most compact quantization that can be used with this forest
+		Quantization bestQuantization() const;
+
+		//inherited from ForestEngine
+		void getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer) const override;
+		void getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions& options, std::vector<int>& treeCounts) const override;
+
+	protected:
+
+		//! Converts a tree (recursive)
+		bool addNode(	const std::vector<cv::ml::DTrees::Node>& cvNodes,
+						const std::vector<cv::ml::DTrees::Split>& cvSplits,
+						int cvNodeIndex,
+						QString& error);
+
+		//! Quantizes a block of samples
+		template <typename T> void quantize(const cv::Mat& samples, T* output) const;
+
+		//! Computes the votes for a block of samples (with or without early exit)
+		void computeVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions* earlyExit, std::vector<int>* treeCounts) const;
+
+		//! Traverses the trees for a block of samples
+		template <typename T> void vote(const T* samples, int rowCount, size_t rowStride, int* votes, const EarlyExitOptions* earlyExit, int* treeCounts) const;
+
+	protected:
+
+		//! Nodes (all trees)
+		std::vector<Node> m_nodes;
+		//! Index of the root node of each tree
+		std::vector<int> m_roots;
+		//! Class labels
+		std::vector<int> m_classLabels;
+		//! Number of features per sample
+		int m_featureCount;
+		//! Sorted (unique) thresholds of each feature
+		std::vector< std::vector<float> > m_thresholds;
+		//! Features quantization
+		Quantization m_quantization;
+	};
+}
@@ -0,0 +1,577 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ForestCompression.h"
+
+//Local
+#include "FlatForest.h"
+
+//Qt
+#include <QElapsedTimer>
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+
+using namespace masc;
+
+//! Number of samples processed at once
+static const int s_blockSize = 1024;
+
+QString ForestCompression::Report::toString() const
+{
+	return QObject::tr("%1 -> %2 trees, depth %3 -> %4, %5 -> %6 nodes, size %7 -> %8 KB, accuracy %9 -> %10, inference speedup x%11")
+		.arg(originalTreeCount).arg(treeCount)
+		.arg(originalDepth).arg(depth)
+		.arg(originalNodeCount).arg(nodeCount)
+		.arg(originalSize / 1024).arg(size / 1024)
+		.arg(originalAccuracy, 0, 'f', 4).arg(accuracy, 0, 'f', 4)
+		.arg(speedup, 0, 'f', 2);
+}
+
+//! Serializes a forest (in memory)
+static std::string Serialize(const cv::ml::RTrees& rtrees)
+{
+	cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+	fs << rtrees.getDefaultName() << "{";
+	rtrees.write(fs);
+	fs << "}";
+	return fs.releaseAndGetString();
+}
+
+size_t ForestCompression::SerializedSize(const cv::ml::RTrees& rtrees)
+{
+	try
+	{
+		return Serialize(rtrees).size();
+	}
+	catch (const cv::Exception&)
+	{
+		return 0;
+	}
+}
+
+//! Copies a (serialized) node as is
+static void CopyNode(cv::FileStorage& fs, const cv::String& name, const cv::FileNode& node)
+{
+	if (!name.empty())
+	{
+		fs << name;
+	}
+
+	if (node.isMap())
+	{
+		if (!node["dt"].empty() && !node["data"].empty())
+		{
+			//matrix
+			cv::Mat mat;
+			node >> mat;
+			fs << mat;
+			return;
+		}
+
+		fs << "{";
+		for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it)
+		{
+			CopyNode(fs, (*it).name(), *it);
+		}
+		fs << "}";
+	}
+	else if (node.isSeq())
+	{
+		fs << "[";
+		for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it)
+		{
+			CopyNode(fs, cv::String(), *it);
+		}
+		fs << "]";
+	}
+	else if (node.isInt())
+	{
+		fs << static_cast<int>(node);
+	}
+	else if (node.isReal())
+	{
+		fs << static_cast<double>(node);
+	}
+	else if (node.isString())
+	{
+		fs << static_cast<cv::String>(node);
+	}
+}
+
+//! Writes the nodes of a (sub-)tree in depth-first order (same format as cv::ml::DTrees)
+static void WriteNodes(	cv::FileStorage& fs,
+						const std::vector<cv::ml::DTrees::Node>& nodes,
+						const std::vector<cv::ml::DTrees::Split>& splits,
+						int nodeIndex,
+						int depth,
+						int depthLimit)
+{
+	const cv::ml::DTrees::Node& node = nodes[nodeIndex];
+	//below the depth limit, the node becomes a leaf (with the majority class of its samples)
+	bool isLeaf = (node.split < 0 || depth >= depthLimit);
+
+	fs << "{";
+	fs << "depth" << depth;
+	fs << "value" << node.value;
+	fs << "norm_class_idx" << node.classIdx;
+	if (!isLeaf)
+	{
+		fs << "splits" << "[";
+		for (int splitIndex = node.split; splitIndex >= 0; splitIndex = splits[splitIndex].next)
+		{
+			const cv::ml::DTrees::Split& split = splits[splitIndex];
+			fs << "{:";
+			fs << "var" << split.varIdx;
+			fs << "quality" << split.quality;
+			fs << (split.inversed ? "gt" : "le") << split.c;
+			fs << "}";
+		}
+		fs << "]";
+	}
+	fs << "}";
+
+	if (!isLeaf)
+	{
+		WriteNodes(fs, nodes, splits, node.left, depth + 1, depthLimit);
+		WriteNodes(fs, nodes, splits, node.right, depth + 1, depthLimit);
+	}
+}
+
+cv::Ptr<cv::ml::RTrees> ForestCompression::Prune(	const cv::ml::RTrees& rtrees,
+													const std::vector<int>& trees,
+													int depthLimit,
+													QString& error)
+{
+	const std::vector<int>& roots = rtrees.getRoots();
+	const std::vector<cv::ml::DTrees::Node>& nodes = rtrees.getNodes();
+	const std::vector<cv::ml::DTrees::Split>& splits = rtrees.getSplits();
+
+	if (trees.empty() || depthLimit < 1)
+	{
+		assert(false);
+		error = QObject::tr("Invalid pruning parameters");
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+	for (const cv::ml::DTrees::Split& split : splits)
+	{
+		if (split.subsetOfs >= 0)
+		{
+			error = QObject::tr("Categorical splits are not supported");
+			return cv::Ptr<cv::ml::RTrees>();
+		}
+	}
+
+	try
+	{
+		//we re-use the parameters of the original forest
+		std::string original = Serialize(rtrees);
+		cv::FileStorage input(original, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+		cv::FileNode model = input.getFirstTopLevelNode();
+
+		cv::FileStorage output(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+		output << rtrees.getDefaultName() << "{";
+		for (cv::FileNodeIterator it = model.begin(); it != model.end(); ++it)
+		{
+			cv::String name = (*it).name();
+			if (name != "ntrees" && name != "trees")
+			{
+				CopyNode(output, name, *it);
+			}
+		}
+
+		output << "ntrees" << static_cast<int>(trees.size());
+		output << "trees" << "[";
+		for (int treeIndex : trees)
+		{
+			if (treeIndex < 0 || treeIndex >= static_cast<int>(roots.size()))
+			{
+				assert(false);
+				error = QObject::tr("Invalid tree index (%1)").arg(treeIndex);
+				return cv::Ptr<cv::ml::RTrees>();
+			}
+			output << "{";
+			output << "nodes" << "[";
+			WriteNodes(output, nodes, splits, roots[treeIndex], 0, depthLimit);
+			output << "]";
+			output << "}";
+		}
+		output << "]";
+		output << "}";
+
+		cv::Ptr<cv::ml::RTrees> pruned = cv::Algorithm::loadFromString<cv::ml::RTrees>(output.releaseAndGetString());
+		if (!pruned || pruned->empty())
+		{
+			error = QObject::tr("Failed to create the pruned forest");
+			return cv::Ptr<cv::ml::RTrees>();
+		}
+		return pruned;
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+}
+
+//! Returns the class index predicted by a tree for a given sample (with a depth limit)
+static inline int TreePrediction(	const std::vector<cv::ml::DTrees::Node>& nodes,
+									const std::vector<cv::ml::DTrees::Split>& splits,
+									int root,
+									const float* sample,
+									int depthLimit)
+{
+	int nodeIndex = root;
+	for (int depth = 0; nodes[nodeIndex].split >= 0 && depth < depthLimit; ++depth)
+	{
+		const cv::ml::DTrees::Node& node = nodes[nodeIndex];
+		const cv::ml::DTrees::Split& split = splits[node.split];
+		//same rule as cv::ml::DTrees
+		bool goLeft = (sample[split.varIdx] <= split.c);
+		if (split.inversed)
+			goLeft = !goLeft;
+		nodeIndex = (goLeft ? node.left : node.right);
+	}
+	return nodes[nodeIndex].classIdx;
+}
+
+//! Returns the index of the predicted class (first class with the max. number of votes, as cv::ml::RTrees)
+static inline int BestClass(const int* votes, int classCount)
+{
+	int bestIndex = 0;
+	for (int i = 1; i < classCount; ++i)
+	{
+		if (votes[i] > votes[bestIndex])
+			bestIndex = i;
+	}
+	return bestIndex;
+}
+
+//! Measures the inference time (in seconds) of a forest on a set of samples
+static double InferenceTime(const cv::ml::RTrees& rtrees, const cv::Mat& samples)
+{
+	QElapsedTimer timer;
+
+	FlatForest forest;
+	QString error;
+	if (forest.build(rtrees, samples.cols, error))
+	{
+		//with the engine used for classification
+		forest.setQuantization(forest.bestQuantization());
+		std::vector<int> votes;
+		std::vector<uint8_t> buffer;
+
+		timer.start();
+		for (int firstIndex = 0; firstIndex < samples.rows; firstIndex += s_blockSize)
+		{
+			int count = std::min(s_blockSize, samples.rows - firstIndex);
+			forest.getVotes(samples.rowRange(firstIndex, firstIndex + count), votes, buffer);
+		}
+	}
+	else
+	{
+		cv::Mat votes;
+		timer.start();
+		for (int firstIndex = 0; firstIndex < samples.rows; firstIndex += s_blockSize)
+		{
+			int count = std::min(s_blockSize, samples.rows - firstIndex);
+			rtrees.getVotes(samples.rowRange(firstIndex, firstIndex + count), votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+		}
+	}
+
+	return std::max(1.0e-9, timer.nsecsElapsed() / 1.0e9);
+}
+
+bool ForestCompression::Compress(	const cv::ml::RTrees& rtrees,
+									const cv::Mat& samples,
+									const std::vector<int>& labels,
+									const Parameters& params,
+									cv::Ptr<cv::ml::RTrees>& compressed,
+									Report& report,
+									QString& error)
+{
+	const std::vector<int>& roots = rtrees.getRoots();
+	const std::vector<cv::ml::DTrees::Node>& nodes = rtrees.getNodes();
+	const std::vector<cv::ml::DTrees::Split>& splits = rtrees.getSplits();
+
+	if (roots.empty() || nodes.empty())
+	{
+		error = QObject::tr("Empty forest");
+		return false;
+	}
+	if (samples.type() != CV_32FC1 || samples.cols != rtrees.getVarCount() || labels.size() != static_cast<size_t>(samples.rows))
+	{
+		assert(false);
+		error = QObject::tr("Invalid validation samples");
+		return false;
+	}
+	if (samples.rows == 0)
+	{
+		error = QObject::tr("No validation sample");
+		return false;
+	}
+	if (params.tolerance < 0.0 || params.maxSampleCount <= 0)
+	{
+		assert(false);
+		error = QObject::tr("Invalid compression parameters");
+		return false;
+	}
+
+	int treeCount = static_cast<int>(roots.size());
+
+	//class labels (all the nodes have a class)
+	std::vector<int> classLabels;
+	for (const cv::ml::DTrees::Node& node : nodes)
+	{
+		if (node.classIdx < 0)
+		{
+			error = QObject::tr("Node without class");
+			return false;
+		}
+		if (node.classIdx >= static_cast<int>(classLabels.size()))
+		{
+			classLabels.resize(node.classIdx + 1, 0);
+		}
+		classLabels[node.classIdx] = static_cast<int>(node.value);
+	}
+	int classCount = static_cast<int>(classLabels.size());
+	if (classCount > 0xFFFF)
+	{
+		error = QObject::tr("Too many classes");
+		return false;
+	}
+
+	//depth of the trees
+	int maxDepth = 0;
+	{
+		std::vector< std::pair<int, int> > stack;
+		for (int root : roots)
+		{
+			stack.push_back({ root, 0 });
+			while (!stack.empty())
+			{
+				std::pair<int, int> current = stack.back();
+				stack.pop_back();
+				const cv::ml::DTrees::Node& node = nodes[current.first];
+				maxDepth = std::max(maxDepth, current.second);
+				if (node.split >= 0)
+				{
+					stack.push_back({ node.left, current.second + 1 });
+					stack.push_back({ node.right, current.second + 1 });
+				}
+			}
+		}
+	}
+
+	//validation samples (regular sub-sampling if necessary)
+	cv::Mat validation;
+	std::vector<int> truth; //class index of each sample (or -1)
+	try
+	{
+		int step = (samples.rows + params.maxSampleCount - 1) / params.maxSampleCount;
+		int sampleCount = (samples.rows + step - 1) / step;
+		validation.create(sampleCount, samples.cols, CV_32FC1);
+		truth.resize(sampleCount);
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			samples.row(i * step).copyTo(validation.row(i));
+			std::vector<int>::const_iterator it = std::find(classLabels.begin(), classLabels.end(), labels[i * step]);
+			truth[i] = (it != classLabels.end() ? static_cast<int>(it - classLabels.begin()) : -1);
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		return false;
+	}
+	int sampleCount = validation.rows;
+
+	//accuracy of the whole forest for each depth limit (in a single pass)
+	std::vector<int> goodGuessPerDepth(maxDepth + 1, 0);
+	try
+	{
+		std::vector<int> votes(static_cast<size_t>(maxDepth + 1) * s_blockSize * classCount);
+		for (int firstIndex = 0; firstIndex < sampleCount; firstIndex += s_blockSize)
+		{
+			int count = std::min(s_blockSize, sampleCount - firstIndex);
+			std::fill(votes.begin(), votes.end(), 0);
+
+			for (int root : roots)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					const float* sample = validation.ptr<float>(firstIndex + i);
+					int nodeIndex = root;
+					int depth = 0;
+					//internal nodes: vote for the corresponding depth limit only
+					while (nodes[nodeIndex].split >= 0)
+					{
+						const cv::ml::DTrees::Node& node = nodes[nodeIndex];
+						++votes[(static_cast<size_t>(depth) * s_blockSize + i) * classCount + node.classIdx];
+
+						const cv::ml::DTrees::Split& split = splits[node.split];
+						bool goLeft = (sample[split.varIdx] <= split.c);
+						if (split.inversed)
+							goLeft = !goLeft;
+						nodeIndex = (goLeft ? node.left : node.right);
+						++depth;
+					}
+					//leaf: vote for all the deeper depth limits
+					for (int d = depth; d <= maxDepth; ++d)
+					{
+						++votes[(static_cast<size_t>(d) * s_blockSize + i) * classCount + nodes[nodeIndex].classIdx];
+					}
+				}
+			}
+
+			for (int d = 0; d <= maxDepth; ++d)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					if (BestClass(votes.data() + (static_cast<size_t>(d) * s_blockSize + i) * classCount, classCount) == truth[firstIndex + i])
+					{
+						++goodGuessPerDepth[d];
+					}
+				}
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	double originalAccuracy = static_cast<double>(goodGuessPerDepth[maxDepth]) / sampleCount;
+	double minAccuracy = originalAccuracy - params.tolerance;
+
+	//smallest depth limit within the tolerance
+	int depthLimit = std::max(maxDepth, 1);
+	if (params.limitDepth)
+	{
+		for (int d = 1; d < maxDepth; ++d)
+		{
+			if (static_cast<double>(goodGuessPerDepth[d]) / sampleCount >= minAccuracy)
+			{
+				depthLimit = d;
+				break;
+			}
+		}
+	}
+	double accuracy = static_cast<double>(goodGuessPerDepth[std::min(depthLimit, maxDepth)]) / sampleCount;
+
+	//smallest subset of the most accurate trees within the tolerance
+	std::vector<int> selectedTrees(treeCount);
+	for (int t = 0; t < treeCount; ++t)
+	{
+		selectedTrees[t] = t;
+	}
+	int minTreeCount = std::max(1, std::min(params.minTreeCount, treeCount));
+	if (params.selectTrees && minTreeCount < treeCount)
+	{
+		try
+		{
+			//prediction of each tree
+			std::vector<uint16_t> predictions(static_cast<size_t>(treeCount) * sampleCount);
+			std::vector<int> treeGoodGuess(treeCount, 0);
+			for (int t = 0; t < treeCount; ++t)
+			{
+				uint16_t* treePredictions = predictions.data() + static_cast<size_t>(t) * sampleCount;
+				for (int i = 0; i < sampleCount; ++i)
+				{
+					int classIndex = TreePrediction(nodes, splits, roots[t], validation.ptr<float>(i), depthLimit);
+					treePredictions[i] = static_cast<uint16_t>(classIndex);
+					if (classIndex == truth[i])
+						++treeGoodGuess[t];
+				}
+			}
+
+			//the most accurate trees first
+			std::vector<int> order = selectedTrees;
+			std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return treeGoodGuess[a] > treeGoodGuess[b]; });
+
+			std::vector<int> votes(static_cast<size_t>(sampleCount) * classCount, 0);
+			for (int k = 0; k < treeCount; ++k)
+			{
+				const uint16_t* treePredictions = predictions.data() + static_cast<size_t>(order[k]) * sampleCount;
+				for (int i = 0; i < sampleCount; ++i)
+				{
+					++votes[static_cast<size_t>(i) * classCount + treePredictions[i]];
+				}
+
+				if (k + 1 < minTreeCount)
+				{
+					continue;
+				}
+
+				int goodGuess = 0;
+				for (int i = 0; i < sampleCount; ++i)
+				{
+					if (BestClass(votes.data() + static_cast<size_t>(i) * classCount, classCount) == truth[i])
+						++goodGuess;
+				}
+				double subsetAccuracy = static_cast<double>(goodGuess) / sampleCount;
+				if (subsetAccuracy >= minAccuracy)
+				{
+					selectedTrees.assign(order.begin(), order.begin() + k + 1);
+					std::sort(selectedTrees.begin(), selectedTrees.end());
+					accuracy = subsetAccuracy;
+					break;
+				}
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			error = QObject::tr("Not enough memory");
+			return false;
+		}
+	}
+
+	//create the compressed forest
+	compressed = Prune(rtrees, selectedTrees, depthLimit, error);
+	if (!compressed)
+	{
+		return false;
+	}
+
+	report.originalTreeCount = treeCount;
+	report.treeCount = static_cast<int>(compressed->getRoots().size());
+	report.originalDepth = maxDepth;
+	report.depth = std::min(depthLimit, maxDepth);
+	report.originalNodeCount = nodes.size();
+	report.nodeCount = compressed->getNodes().size();
+	report.originalSize = SerializedSize(rtrees);
+	report.size = SerializedSize(*compressed);
+	report.originalAccuracy = originalAccuracy;
+	report.accuracy = accuracy;
+	report.speedup = InferenceTime(rtrees, validation) / InferenceTime(*compressed, validation);
+
+	return true;
+}
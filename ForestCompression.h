@@ -0,0 +1,112 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Qt
+#include <QString>
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! Post-training compression of a random forest
+	/** The effective depth of the trees is limited (the nodes below the depth limit
+		are replaced by leaves with the majority class of their parent) and/or only a
+		subset of the trees is kept (the most accurate ones), as long as the accuracy
+		on a validation dataset doesn't drop by more than a given tolerance.
+		The compressed forest is a standard cv::ml::RTrees classifier.
+	**/
+	class ForestCompression
+	{
+	public:
+
+		//! Compression parameters
+		struct Parameters
+		{
+			//! Maximum accuracy loss (ratio, e.g. 0.005 = 0.5%)
+			double tolerance = 0.005;
+			//! Whether the effective depth of the trees can be limited
+			bool limitDepth = true;
+			//! Whether only a subset of the trees can be kept
+			bool selectTrees = true;
+			//! Minimum number of trees to keep
+			int minTreeCount = 10;
+			//! Maximum number of validation samples (to limit the memory consumption)
+			int maxSampleCount = 50000;
+		};
+
+		//! Compression report
+		struct Report
+		{
+			int originalTreeCount = 0;
+			int treeCount = 0;
+			int originalDepth = 0;
+			int depth = 0;
+			size_t originalNodeCount = 0;
+			size_t nodeCount = 0;
+			//! Serialized model size (in bytes)
+			size_t originalSize = 0;
+			//! Serialized model size (in bytes)
+			size_t size = 0;
+			double originalAccuracy = 0.0;
+			double accuracy = 0.0;
+			//! Inference speedup (measured on the validation samples)
+			double speedup = 1.0;
+
+			//! Returns a human readable version of the report
+			QString toString() const;
+		};
+
+		//! Compresses a forest
+		/** \param rtrees trained random trees
+			\param samples validation samples (one per row, CV_32FC1)
+			\param labels validation labels (one per sample)
+			\param params compression parameters
+			\param compressed output compressed forest
+			\param report compression report
+			\param error error message (if any)
+			\return success
+		**/
+		static bool Compress(	const cv::ml::RTrees& rtrees,
+								const cv::Mat& samples,
+								const std::vector<int>& labels,
+								const Parameters& params,
+								cv::Ptr<cv::ml::RTrees>& compressed,
+								Report& report,
+								QString& error);
+
+		//! Copies a forest, keeping only some trees up to a given depth
+		/** \param rtrees trained random trees
+			\param trees indexes of the trees to keep
+			\param depthLimit maximum depth of the trees (the root being at depth 0)
+			\param error error message (if any)
+			\return the new forest (or nullptr on error)
+		**/
+		static cv::Ptr<cv::ml::RTrees> Prune(	const cv::ml::RTrees& rtrees,
+												const std::vector<int>& trees,
+												int depthLimit,
+												QString& error);
+
+		//! Returns the size of a serialized forest (in bytes)
+		static size_t SerializedSize(const cv::ml::RTrees& rtrees);
+	};
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//OpenCV
+#include <opencv2/core.hpp>
+
+//system
+#include <cstdint>
+#include <vector>
+
+namespace masc
+{
+	//! Early exit options (adaptive evaluation of the trees)
+	struct EarlyExitOptions
+	{
+		//! Whether the evaluation of the trees can stop before the last tree
+		bool enabled = false;
+		//! Vote fraction (of the evaluated trees) above which the evaluation stops
+		/** With 0, the evaluation only stops once the predicted class can't change anymore (lossless).
+		**/
+		float confidence = 0.0f;
+		//! Minimum number of trees to evaluate before using the confidence threshold
+		int minTreeCount = 10;
+	};
+
+	//! Votes of a single sample (with early exit bookkeeping)
+	class VoteTracker
+	{
+	public:
+
+		//! Default constructor
+		/** \param votes votes of the sample (should be initialized to 0)
+		**/
+		explicit VoteTracker(int* votes)
+			: m_votes(votes)
+			, m_bestIndex(-1)
+			, m_secondBestCount(0)
+			, m_treeCount(0)
+		{}
+
+		//! Adds the vote of a tree
+		inline void add(int classIndex)
+		{
+			int count = ++m_votes[classIndex];
+			++m_treeCount;
+
+			if (m_bestIndex < 0)
+			{
+				m_bestIndex = classIndex;
+			}
+			else if (classIndex != m_bestIndex)
+			{
+				int bestCount = m_votes[m_bestIndex];
+				//same tie-breaking rule as cv::ml::RTrees (first class with the max. number of votes)
+				if (count > bestCount || (count == bestCount && classIndex < m_bestIndex))
+				{
+					m_secondBestCount = bestCount;
+					m_bestIndex = classIndex;
+				}
+				else if (count > m_secondBestCount)
+				{
+					m_secondBestCount = count;
+				}
+			}
+		}
+
+		//! Returns the number of evaluated trees
+		inline int treeCount() const { return m_treeCount; }
+
+		//! Returns whether the evaluation can stop
+		/** \param totalTreeCount total number of trees
+			\param options early exit options
+		**/
+		inline bool canStop(int totalTreeCount, const EarlyExitOptions& options) const
+		{
+			if (m_bestIndex < 0)
+			{
+				return false;
+			}
+			int bestCount = m_votes[m_bestIndex];
+
+			//the best class can't be caught up anymore
+			int remainingTreeCount = totalTreeCount - m_treeCount;
+			if (bestCount - m_secondBestCount > remainingTreeCount)
+			{
+				return true;
+			}
+
+			//the vote fraction is high enough
+			return (	options.confidence > 0
+					&&	m_treeCount >= options.minTreeCount
+					&&	bestCount >= options.confidence * m_treeCount);
+		}
+
+	protected:
+
+		int* m_votes;
+		int m_bestIndex;
+		int m_secondBestCount;
+		int m_treeCount;
+	};
+
+	//! Random forest inference engine (alternative to cv::ml::RTrees)
+	class ForestEngine
+	{
+	public:
+
+		//! Destructor
+		virtual ~ForestEngine() = default;
+
+		//! Returns whether the engine is ready
+		virtual bool isValid() const = 0;
+
+		//! Returns the number of features per sample
+		virtual int featureCount() const = 0;
+		//! Returns the number of classes
+		virtual int classCount() const = 0;
+		//! Returns the class labels (sorted as the votes)
+		virtual const std::vector<int>& classLabels() const = 0;
+
+		//! Computes the votes of the trees for a block of samples (thread-safe)
+		/** \param samples block of samples (one per row, CV_32FC1)
+			\param votes output votes (samples.rows x classCount())
+			\param buffer working buffer (re-used from one call to the other)
+		**/
+		virtual void getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer) const = 0;
+
+		//! Computes the votes of the trees for a block of samples, with early exit (thread-safe)
+		/** \param samples block of samples (one per row, CV_32FC1)
+			\param votes output votes (samples.rows x classCount())
+			\param buffer working buffer (re-used from one call to the other)
+			\param options early exit options
+			\param treeCounts output number of evaluated trees per sample
+		**/
+		virtual void getVotes(const cv::Mat& samples, std::vector<int>& votes, std::vector<uint8_t>& buffer, const EarlyExitOptions& options, std::vector<int>& treeCounts) const = 0;
+	};
+}
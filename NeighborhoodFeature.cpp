@@ -17,6 +17,9 @@
 
 #include "NeighborhoodFeature.h"
 
+//Local
+#include "FeatureKernels.h"
+
 //CCLib
 #include <DgmOctreeReferenceCloud.h>
 #include <Neighbourhood.h>
@@ -113,15 +116,18 @@ bool NeighborhoodFeature::prepare(	const CorePoints& corePoints,
 		QString resultSFName2 = ToString(type) + "_" + cloud2Label + "@" + QString::number(scale);
 		keepSF2 = (corePoints.cloud->getScalarFieldIndexByName(qPrintable(resultSFName2)) >= 0); //we remember that the scalar field was already existing!
 
+		//the second side values are directly combined with the first side ones during the computation
+		//(we only need the corresponding scalar field if it already exists)
 		assert(!sf2);
-
-		sf2WasAlreadyExisting = CheckSFExistence(corePoints.cloud, qPrintable(resultSFName2));		
-		sf2 = PrepareSF(corePoints.cloud, qPrintable(resultSFName2), generatedScalarFields, sf2WasAlreadyExisting ? SFCollector::ALWAYS_KEEP : SFCollector::ALWAYS_REMOVE);
-
-		if (!sf2)
+		sf2WasAlreadyExisting = CheckSFExistence(corePoints.cloud, qPrintable(resultSFName2));
+		if (sf2WasAlreadyExisting)
 		{
-			error = QString("Failed to prepare scalar field for %1 @ scale %2").arg(cloud2Label).arg(scale);
-			return false;
+			sf2 = PrepareSF(corePoints.cloud, qPrintable(resultSFName2), generatedScalarFields, SFCollector::ALWAYS_KEEP);
+			if (!sf2)
+			{
+				error = QString("Failed to prepare scalar field for %1 @ scale %2").arg(cloud2Label).arg(scale);
+				return false;
+			}
 		}
 	}
 
@@ -138,10 +144,9 @@ bool NeighborhoodFeature::finish(const CorePoints& corePoints, QString& error)
 		return false;
 	}
 
-	bool success = true;
-
 	if (sf1)
 	{
+		//the MATH operation (if any) has already been applied during the computation
 		sf1->computeMinAndMax();
 
 		//update display
@@ -154,39 +159,7 @@ bool NeighborhoodFeature::finish(const CorePoints& corePoints, QString& error)
 		}
 	}
 
-	if (sf2 && !sf1WasAlreadyExisting)
-	{
-		//now perform the math operation
-		if (op != Feature::NO_OPERATION)
-		{
-			if (!PerformMathOp(sf1, sf2, op))
-			{
-				error = "Failed to perform the MATH operation";
-				success = false;
-			}
-		}
-
-//		if (keepSF2)
-//		{
-//			sf2->computeMinAndMax();
-//		}
-//		else
-//		{
-//			int sfIndex2 = corePoints.cloud->getScalarFieldIndexByName(sf2->getName());
-//			if (sfIndex2 >= 0)
-//			{
-//				corePoints.cloud->deleteScalarField(sfIndex2);
-//			}
-//			else
-//			{
-//				assert(false);
-//				sf2->release();
-//			}
-//			sf2 = nullptr;
-//		}
-	}
-
-	return success;
+	return true;
 }
 
 QString NeighborhoodFeature::toString() const
@@ -222,156 +195,47 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 
 	switch (type)
 	{
-	//features relying on the PCA
 	case PCA1:
+		return ComputeNeighborhoodValueT<PCA1>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case PCA2:
+		return ComputeNeighborhoodValueT<PCA2>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case PCA3:
+		return ComputeNeighborhoodValueT<PCA3>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case SPHER:
+		return ComputeNeighborhoodValueT<SPHER>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case LINEA:
+		return ComputeNeighborhoodValueT<LINEA>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case PLANA:
-	{
-		CCCoreLib::Neighbourhood::GeomFeature f;
-		switch (type)
-		{
-		case PCA1:
-			f = CCCoreLib::Neighbourhood::PCA1;
-			break;
-		case PCA2:
-			f = CCCoreLib::Neighbourhood::PCA2;
-			break;
-		case PCA3:
-			f = CCCoreLib::Neighbourhood::SurfaceVariation;
-			break;
-		case SPHER:
-			f = CCCoreLib::Neighbourhood::Sphericity;
-			break;
-		case LINEA:
-			f = CCCoreLib::Neighbourhood::Linearity;
-			break;
-		case PLANA:
-			f = CCCoreLib::Neighbourhood::Planarity;
-			break;
-		default:
-			//impossible
-			assert(false);
-			return false;
-		}
-
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeFeature(f);
-	}
-	break;
-
-	case FOM:
-	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeMomentOrder1(queryPoint);
-	}
-	break;
-
+		return ComputeNeighborhoodValueT<PLANA>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case Dip:
+		return ComputeNeighborhoodValueT<Dip>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case DipDir:
-	if (kNN >= 3)
-	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		const CCVector3* N = Z.getLSPlaneNormal();
-		if (N)
-		{
-			//force +Z
-			CCVector3 Np = (N->z < 0 ? -CCCoreLib::PC_ONE * *N : *N);
-			PointCoordinateType dip_deg, dipDir_deg;
-			ccNormalVectors::ConvertNormalToDipAndDipDir(Np, dip_deg, dipDir_deg);
-			outputValue = (type == Dip ? dip_deg : dipDir_deg);
-		}
-	}
-	break;
-
-	case NBPTS:
-		outputValue = static_cast<double>(kNN);
-		break;
-
+		return ComputeNeighborhoodValueT<DipDir>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case ROUGH:
-	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeRoughness(queryPoint);
-	}
-	break;
-
+		return ComputeNeighborhoodValueT<ROUGH>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
+	case NBPTS:
+		return ComputeNeighborhoodValueT<NBPTS>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case CURV:
-	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeCurvature(queryPoint, CCCoreLib::Neighbourhood::MEAN_CURV); //TODO: is it really the default one?
-	}
-	break;
-
+		return ComputeNeighborhoodValueT<CURV>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case ZRANGE:
+		return ComputeNeighborhoodValueT<ZRANGE>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case Zmax:
+		return ComputeNeighborhoodValueT<Zmax>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case Zmin:
-	if (kNN >= 2)
-	{
-		PointCoordinateType minZ, maxZ;
-		minZ = maxZ = pointsInNeighbourhood[0].point->z;
-		for (size_t i = 1; i < kNN; ++i)
-		{
-			if (minZ > pointsInNeighbourhood[i].point->z)
-				minZ = pointsInNeighbourhood[i].point->z;
-			else if (maxZ < pointsInNeighbourhood[i].point->z)
-				maxZ = pointsInNeighbourhood[i].point->z;
-		}
-
-		if (type == ZRANGE)
-		{
-			outputValue = maxZ - minZ;
-		}
-		else if (type == Zmax)
-		{
-			outputValue = maxZ - queryPoint.z;
-		}
-		else if (type == Zmin)
-		{
-			outputValue = queryPoint.z - minZ;
-		}
-		else
-		{
-			//impossible
-			assert(false);
-		}
-	}
-
+		return ComputeNeighborhoodValueT<Zmin>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	case ANISO:
-	if (kNN >= 3)
-	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		const CCVector3* G = Z.getGravityCenter();
-		if (G)
-		{
-			double r = sqrt(pointsInNeighbourhood.back().squareDistd);
-			if (r > std::numeric_limits<double>::epsilon())
-			{
-				double d = (queryPoint - *G).normd();
-				//Ratio of distance to center of mass and radius of sphere
-				outputValue = d / r;
-			}
-		}
-	}
-	break;
-
+		return ComputeNeighborhoodValueT<ANISO>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
+	case FOM:
+		return ComputeNeighborhoodValueT<FOM>(pointsInNeighbourhood, kNN, queryPoint, outputValue);
 	//case LINEF:
 	//case ORIENF:
 	default:
 	{
 		ccLog::Warning("Unhandled feature");
 		assert(false);
-		return false;
 	}
-
+	break;
 	}
 
-	return true;
+	return false;
 }
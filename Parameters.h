@@ -27,12 +27,30 @@ namespace masc
 		//int maxCategories = 0;		//Normally not important as theres no categorical variable
 		int activeVarCount = 0;		//Use 0 as the default parameter (works best)
 		int maxTreeCount = 100;		//Left as a parameter of the training plugin (default: 100)
+		bool nativeTrainer = false;	//Use the native multi-threaded trainer instead of the OpenCV one (same model format)
+		bool histogramBinning = false;	//Native trainer on binned features (histogram-based split search, for large training sets)
+		unsigned seed = 0;			//Seed of the random generators of the native trainer (the training is reproducible)
 	};
 
 	struct TrainParameters
 	{
 		RandomTreesParams rt;
 		float testDataRatio = 0.2f; //percentage of test data
+		int maxSamplesPerClass = 0; //maximum number of training samples per class (0 = no limit)
+		unsigned seed = 0; //seed of the random selection of the test and training samples (and of the native trainer, see RandomTreesParams)
+		bool outOfBag = false; //evaluate the classifier on the out-of-bag samples (all the samples are used for training, native trainer)
+		bool compressForest = false; //compress the forest after training
+		double compressionTolerance = 0.005; //maximum accuracy loss of the compressed forest
+		bool cascade = false; //also train a first stage classifier on the cheap features
+		double cascadeMaxScale = 1.0; //maximum scale of the cheap features
+		float cascadeThreshold = 0.8f; //confidence below which the points are escalated to the full classifier
+	};
+
+	struct PropagationParameters
+	{
+		int k = 1; //number of core points voting for each point (1 = nearest core point)
+		bool refineBoundaries = false; //classify directly the points close to a class boundary
+		int boundaryNeighborCount = 8; //number of core points inspected to detect the class boundaries
 	};
 
 }; //namespace masc
\ No newline at end of file
@@ -18,6 +18,8 @@
 #include "PointFeature.h"
 
 //Local
+#include "FeatureKernels.h"
+#include "SpatialIndexCache.h"
 #include "q3DMASCTools.h"
 
 #if defined(_OPENMP)
@@ -393,15 +395,11 @@ static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 		return false;
 	}
 	
-	ccOctree::Shared octree = cloud2.getOctree();
+	ccOctree::Shared octree = masc::SpatialIndexCache::GetOctree(&cloud2, progressCb);
 	if (!octree)
 	{
-		octree = cloud2.computeOctree(progressCb);
-		if (!octree)
-		{
-			error = "failed to compute octree on cloud " + cloud2.getName();
-			return false;
-		}
+		error = "failed to compute octree on cloud " + cloud2.getName();
+		return false;
 	}
 
 	//now extract the neighborhoods
@@ -424,8 +422,7 @@ static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 	error.clear();
 #ifndef _DEBUG
 #if defined(_OPENMP)
-	omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
+#pragma omp parallel for num_threads(Tools::MaxThreadCount())
 #endif
 #endif
 	for (int i = 0; i < static_cast<int>(pointCount); ++i)
@@ -604,16 +601,18 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 			QString resultSF2Name = field2->getName() + QString("_") + cloud2Label + "_" + Feature::StatToString(stat) + "@" + QString::number(scale);
 			//keepStatSF2 = (corePoints.cloud->getScalarFieldIndexByName(qPrintable(resultSFName2)) >= 0); //we remember that the scalar field was already existing!
 
+			//the second side values are directly combined with the first side ones during the computation
+			//(we only need the corresponding scalar field if it already exists)
 			assert(!statSF2);
 			statSF2WasAlreadyExisting = CheckSFExistence(corePoints.cloud, qPrintable(resultSF2Name));
 			if (statSF2WasAlreadyExisting)
-				statSF2 = PrepareSF(corePoints.cloud, qPrintable(resultSF2Name), generatedScalarFields, SFCollector::ALWAYS_KEEP);
-			else
-				statSF2 = PrepareSF(corePoints.cloud, qPrintable(resultSF2Name), generatedScalarFields, SFCollector::ALWAYS_REMOVE);
-			if (!statSF2)
 			{
-				error = QString("Failed to prepare scalar field for field '%1' @ scale %2").arg(field2->getName()).arg(scale);
-				return false;
+				statSF2 = PrepareSF(corePoints.cloud, qPrintable(resultSF2Name), generatedScalarFields, SFCollector::ALWAYS_KEEP);
+				if (!statSF2)
+				{
+					error = QString("Failed to prepare scalar field for field '%1' @ scale %2").arg(field2->getName()).arg(scale);
+					return false;
+				}
 			}
 		}
 
@@ -704,129 +703,30 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 		return false;
 	}
 
-	//specific case
-	if (stat == Feature::RANGE)
+	const Accessors::Generic accessor(sourceField.data());
+	switch (stat)
+	{
+	case Feature::MEAN:
+		return ComputeStatT<Feature::MEAN>(pointsInNeighbourhood, kNN, accessor, outputValue);
+	case Feature::MODE:
+		return ComputeStatT<Feature::MODE>(pointsInNeighbourhood, kNN, accessor, outputValue);
+	case Feature::MEDIAN:
+		return ComputeStatT<Feature::MEDIAN>(pointsInNeighbourhood, kNN, accessor, outputValue);
+	case Feature::STD:
+		return ComputeStatT<Feature::STD>(pointsInNeighbourhood, kNN, accessor, outputValue);
+	case Feature::RANGE:
+		return ComputeStatT<Feature::RANGE>(pointsInNeighbourhood, kNN, accessor, outputValue);
+	case Feature::SKEW:
+		return ComputeStatT<Feature::SKEW>(pointsInNeighbourhood, kNN, accessor, outputValue);
+	default:
 	{
-		double minValue = 0;
-		double maxValue = 0;
-
-		for (size_t k = 0; k < kNN; ++k)
-		{
-			unsigned index = pointsInNeighbourhood[k].pointIndex;
-			double v = sourceField->pointValue(index);
-
-			//track min and max values
-			if (k != 0)
-			{
-				if (v < minValue)
-					minValue = v;
-				else if (v > maxValue)
-					maxValue = v;
-			}
-			else
-			{
-				minValue = maxValue = v;
-			}
-		}
-
-		outputValue = maxValue - minValue;
-		return true;
+		ccLog::Warning("Unhandled STAT measure");
+		assert(false);
 	}
-	else
-	{
-		bool withSums = (stat == Feature::MEAN || stat == Feature::STD);
-		bool storeValues = (stat == Feature::MEDIAN || stat == Feature::MODE || stat == Feature::SKEW);
-		double sum = 0.0;
-		double sum2 = 0.0;
-
-		CCCoreLib::WeibullDistribution::ScalarContainer values;
-		if (storeValues)
-		{
-			try
-			{
-				values.resize(kNN);
-			}
-			catch (const std::bad_alloc&)
-			{
-				ccLog::Warning("Not enough memory");
-				return false;
-			}
-		}
-
-		for (unsigned k = 0; k < kNN; ++k)
-		{
-			unsigned index = pointsInNeighbourhood[k].pointIndex;
-			double v = sourceField->pointValue(index);
-
-			if (withSums)
-			{
-				//compute average and std. dev.
-				sum += v;
-				sum2 += v * v;
-			}
-
-			if (storeValues)
-			{
-				values[k] = static_cast<ScalarType>(v);
-			}
-		}
-
-		switch (stat)
-		{
-		case Feature::MEAN:
-		{
-			outputValue = sum / kNN;
-		}
-		break;
-
-		case Feature::MODE:
-		{
-			CCCoreLib::WeibullDistribution w;
-			if (w.computeParameters(values))
-				outputValue = w.computeMode();
-		}
-		break;
-
-		case Feature::MEDIAN:
-		{
-			size_t medianIndex = values.size() / 2;
-			std::nth_element(values.begin(), values.begin() + medianIndex, values.end());
-			outputValue = values[medianIndex];
-		}
-		break;
-
-		case Feature::STD:
-		{
-			outputValue = sqrt(std::abs(sum2 * kNN - sum * sum)) / kNN;
-		}
-		break;
-
-		case Feature::RANGE:
-		{
-			//we can't be here
-			assert(false);
-		}
-		return false;
-
-		case Feature::SKEW:
-		{
-			CCCoreLib::WeibullDistribution w;
-			if (w.computeParameters(values))
-				outputValue = w.computeSkewness();
-		}
-		break;
-
-		default:
-		{
-			ccLog::Warning("Unhandled STAT measure");
-			assert(false);
-		}
-		return false;
-
-		}
+	break;
 	}
 
-	return true;
+	return false;
 }
 
 bool PointFeature::finish(const CorePoints& corePoints, QString& error)
@@ -845,10 +745,9 @@ bool PointFeature::finish(const CorePoints& corePoints, QString& error)
 		return false;
 	}
 
-	bool success = true;
-
 	if (statSF1)
 	{
+		//the MATH operation (if any) has already been applied during the computation
 		statSF1->computeMinAndMax();
 
 		//update display
@@ -861,37 +760,7 @@ bool PointFeature::finish(const CorePoints& corePoints, QString& error)
 		}
 	}
 
-	if (statSF2 && !statSF1WasAlreadyExisting)
-	{
-		//now perform the math operation
-		if (op != Feature::NO_OPERATION)
-		{
-			if (!PerformMathOp(statSF1, statSF2, op))
-			{
-				error = "Failed to perform the MATH operation";
-				success = false;
-			}
-		}
-//		statSF2->computeMinAndMax();
-
-		//DGM: we don't delete it now! As it could be used by other features!
-		//if (!keepStatSF2)
-		//{
-		//	int sfIndex2 = corePoints.cloud->getScalarFieldIndexByName(statSF2->getName());
-		//	if (sfIndex2 >= 0)
-		//	{
-		//		corePoints.cloud->deleteScalarField(sfIndex2);
-		//	}
-		//	else
-		//	{
-		//		assert(false);
-		//		statSF2->release();
-		//	}
-		//	statSF2 = nullptr;
-		//}
-	}
-
-	return success;
+	return true;
 }
 
 QString PointFeature::toString() const
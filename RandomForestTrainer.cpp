@@ -0,0 +1,952 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "RandomForestTrainer.h"
+
+//Local
+#include "q3DMASCTools.h"
+
+//qCC_db
+#include <ccLog.h>
+
+//Qt
+#include <QElapsedTimer>
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+//! Minimum number of samples of a node to parallelize its split search
+static const int s_parallelNodeSize = 20000;
+//! Maximum number of values used to compute the quantiles of a feature
+static const size_t s_maxQuantileSamples = (1 << 20);
+//! Maximum number of out-of-bag samples per tree used for the permutation importance
+static const size_t s_maxPermutationSamples = 100000;
+
+typedef RandomForestTrainer::BinnedSamples BinnedSamples;
+
+bool RandomForestTrainer::BinnedSamples::addFeature(const std::vector<float>& values)
+{
+	if (!m_bins.empty() && values.size() != m_bins.front().size())
+	{
+		assert(false);
+		return false;
+	}
+
+	try
+	{
+		//quantiles (on a regular subset of the values if there are too many)
+		std::vector<float> sorted;
+		size_t step = std::max<size_t>(1, values.size() / s_maxQuantileSamples);
+		sorted.reserve(values.size() / step + 1);
+		for (size_t i = 0; i < values.size(); i += step)
+		{
+			if (!std::isnan(values[i]))
+			{
+				sorted.push_back(values[i]);
+			}
+		}
+		std::sort(sorted.begin(), sorted.end());
+
+		//the last value bin has no upper bound, and the last bin is reserved to NaN values
+		static const int maxUpperBoundCount = MaxBinCount - 2;
+		std::vector<float> upperBounds;
+		upperBounds.reserve(maxUpperBoundCount);
+		for (int i = 1; i <= maxUpperBoundCount && !sorted.empty(); ++i)
+		{
+			float bound = sorted[std::min(sorted.size() - 1, i * sorted.size() / (maxUpperBoundCount + 1))];
+			if (bound < sorted.back() && (upperBounds.empty() || bound > upperBounds.back()))
+			{
+				upperBounds.push_back(bound);
+			}
+		}
+
+		std::vector<uint8_t> bins(values.size());
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			float value = values[i];
+			if (std::isnan(value))
+			{
+				bins[i] = NaNBin;
+			}
+			else
+			{
+				bins[i] = static_cast<uint8_t>(std::lower_bound(upperBounds.begin(), upperBounds.end(), value) - upperBounds.begin());
+			}
+		}
+
+		m_bins.push_back(std::move(bins));
+		m_upperBounds.push_back(std::move(upperBounds));
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+namespace
+{
+	//! Tree node
+	struct TreeNode
+	{
+		int depth = 0;
+		int classIdx = 0;
+		//split (if any)
+		int var = -1;
+		float threshold = 0.0f;
+		//! Last bin of the left side (binned samples only)
+		int bin = -1;
+		double quality = 0.0;
+		int left = -1;
+		int right = -1;
+	};
+
+	//! Best split of a node (for a given feature)
+	struct SplitCandidate
+	{
+		int var = -1;
+		float threshold = 0.0f;
+		//! Last bin of the left side (binned samples only)
+		int bin = -1;
+		//! Split criterion (the sum of the squared class counts of each side, divided by the side size)
+		double quality = -1.0;
+	};
+
+	//! Class histograms of the samples of a node (per feature, only for the candidate features)
+	typedef std::vector<std::vector<int>> Histograms;
+
+	//! Tree builder (one per tree)
+	class TreeBuilder
+	{
+	public:
+
+		//! Default constructor
+		/** Either 'samples' or 'binnedSamples' must be defined.
+		**/
+		TreeBuilder(const cv::Mat* samples,
+					const BinnedSamples* binnedSamples,
+					const std::vector<int>& classIndexes,
+					int classCount,
+					const RandomTreesParams& params,
+					int activeVarCount,
+					int splitThreads,
+					unsigned seed)
+			: m_samples(samples)
+			, m_binnedSamples(binnedSamples)
+			, m_classIndexes(classIndexes)
+			, m_classCount(classCount)
+			, m_params(params)
+			, m_activeVarCount(activeVarCount)
+			, m_splitThreads(splitThreads)
+			, m_generator(seed)
+		{
+			assert(samples || binnedSamples);
+			int featureCount = (samples ? samples->cols : binnedSamples->featureCount());
+			m_importance.resize(featureCount, 0.0);
+			m_features.resize(featureCount);
+			std::iota(m_features.begin(), m_features.end(), 0);
+		}
+
+		//! Builds the tree on a bootstrap sample
+		void build()
+		{
+			int sampleCount = static_cast<int>(m_classIndexes.size());
+			std::uniform_int_distribution<int> sampleDistribution(0, sampleCount - 1);
+			m_indexes.resize(sampleCount);
+			for (int& index : m_indexes)
+			{
+				index = sampleDistribution(m_generator);
+			}
+
+			m_nodes.clear();
+			m_nodes.emplace_back();
+			split(0, 0, sampleCount, nullptr, 0, 0);
+		}
+
+		const std::vector<TreeNode>& nodes() const { return m_nodes; }
+		const std::vector<double>& importance() const { return m_importance; }
+
+		//! Returns the samples that were not drawn in the bootstrap sample (once the tree is built)
+		void outOfBagSamples(std::vector<int>& samples) const
+		{
+			std::vector<bool> inBag(m_classIndexes.size(), false);
+			for (int index : m_indexes)
+			{
+				inBag[index] = true;
+			}
+			samples.clear();
+			for (size_t i = 0; i < inBag.size(); ++i)
+			{
+				if (!inBag[i])
+				{
+					samples.push_back(static_cast<int>(i));
+				}
+			}
+		}
+
+		//! Classifies a training sample
+		/** \param sampleIndex sample index
+			\param permutedVar feature to take from another sample (permutation importance), or -1
+			\param permutedSampleIndex sample from which the permuted feature is taken
+			\return the class index
+		**/
+		int predict(int sampleIndex, int permutedVar = -1, int permutedSampleIndex = -1) const
+		{
+			int nodeIndex = 0;
+			while (m_nodes[nodeIndex].var >= 0)
+			{
+				const TreeNode& node = m_nodes[nodeIndex];
+				int source = (node.var == permutedVar ? permutedSampleIndex : sampleIndex);
+				bool left = (m_binnedSamples ? m_binnedSamples->bin(node.var, source) <= node.bin : m_samples->at<float>(source, node.var) <= node.threshold);
+				nodeIndex = (left ? node.left : node.right);
+			}
+			return m_nodes[nodeIndex].classIdx;
+		}
+
+		//! Computes the permutation importance of the features used by the tree
+		/** For each feature, the out-of-bag accuracy decrease when the values of the feature are
+			randomly permuted between the out-of-bag samples.
+		**/
+		void permutationImportance(const std::vector<int>& outOfBagSamples, std::vector<double>& importance)
+		{
+			importance.assign(m_importance.size(), 0.0);
+
+			//on a random subset of the out-of-bag samples if there are too many
+			std::vector<int> samples = outOfBagSamples;
+			if (samples.size() > s_maxPermutationSamples)
+			{
+				std::shuffle(samples.begin(), samples.end(), m_generator);
+				samples.resize(s_maxPermutationSamples);
+			}
+			if (samples.empty())
+			{
+				return;
+			}
+
+			int correct = 0;
+			for (int sampleIndex : samples)
+			{
+				if (predict(sampleIndex) == m_classIndexes[sampleIndex])
+				{
+					++correct;
+				}
+			}
+
+			std::vector<bool> usedVars(m_importance.size(), false);
+			for (const TreeNode& node : m_nodes)
+			{
+				if (node.var >= 0)
+				{
+					usedVars[node.var] = true;
+				}
+			}
+
+			std::vector<int> permuted = samples;
+			for (size_t var = 0; var < usedVars.size(); ++var)
+			{
+				if (!usedVars[var])
+				{
+					continue;
+				}
+				std::shuffle(permuted.begin(), permuted.end(), m_generator);
+				int permutedCorrect = 0;
+				for (size_t i = 0; i < samples.size(); ++i)
+				{
+					if (predict(samples[i], static_cast<int>(var), permuted[i]) == m_classIndexes[samples[i]])
+					{
+						++permutedCorrect;
+					}
+				}
+				importance[var] = static_cast<double>(correct - permutedCorrect) / samples.size();
+			}
+		}
+
+	protected:
+
+		//! Sum of the squared class counts divided by the number of samples
+		static double SquaredSum(const std::vector<int>& counts, int total)
+		{
+			double sum = 0.0;
+			for (int count : counts)
+			{
+				sum += static_cast<double>(count) * count;
+			}
+			return (total > 0 ? sum / total : 0.0);
+		}
+
+		//! Finds the best split of a range of samples along a feature (exact search)
+		SplitCandidate bestSplit(int var, int begin, int end, const std::vector<int>& counts) const
+		{
+			int n = end - begin;
+			std::vector<std::pair<float, int>> values(n);
+			for (int i = 0; i < n; ++i)
+			{
+				int sampleIndex = m_indexes[begin + i];
+				values[i] = { m_samples->at<float>(sampleIndex, var), m_classIndexes[sampleIndex] };
+			}
+			//NaN values are put at the end (they always go to the right side)
+			std::sort(values.begin(), values.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b)
+			{
+				if (std::isnan(a.first))
+					return false;
+				if (std::isnan(b.first))
+					return true;
+				return a.first < b.first;
+			});
+
+			SplitCandidate best;
+			best.var = var;
+
+			std::vector<int> leftCounts(m_classCount, 0);
+			//incremental sums of the squared counts
+			double leftSquares = 0.0;
+			double rightSquares = 0.0;
+			for (int count : counts)
+			{
+				rightSquares += static_cast<double>(count) * count;
+			}
+
+			for (int i = 0; i + 1 < n; ++i)
+			{
+				int classIdx = values[i].second;
+				int leftCount = leftCounts[classIdx]++;
+				int rightCount = counts[classIdx] - leftCount;
+				leftSquares += 2.0 * leftCount + 1.0;
+				rightSquares -= 2.0 * rightCount - 1.0;
+
+				float value = values[i].first;
+				float nextValue = values[i + 1].first;
+				if (std::isnan(nextValue))
+				{
+					break;
+				}
+				if (!(value < nextValue))
+				{
+					continue;
+				}
+
+				int nl = i + 1;
+				int nr = n - nl;
+				if (nl < m_params.minSampleCount || nr < m_params.minSampleCount)
+				{
+					continue;
+				}
+
+				double quality = leftSquares / nl + rightSquares / nr;
+				if (quality > best.quality)
+				{
+					best.quality = quality;
+					best.threshold = (value + nextValue) / 2;
+					if (!(best.threshold < nextValue)) //rounding
+					{
+						best.threshold = value;
+					}
+				}
+			}
+
+			return best;
+		}
+
+		//! Computes the class histogram of a range of samples along a feature (binned samples)
+		/** If the histogram of the parent node is available and the sibling node is smaller,
+			the histogram is deduced from them (parent - sibling).
+		**/
+		void computeHistogram(	int var,
+								int begin,
+								int end,
+								const Histograms* parentHistograms,
+								int siblingBegin,
+								int siblingEnd,
+								std::vector<int>& histogram) const
+		{
+			int nanBin = m_binnedSamples->binCount(var);
+			if (parentHistograms && !(*parentHistograms)[var].empty() && siblingEnd - siblingBegin < end - begin)
+			{
+				histogram = (*parentHistograms)[var];
+				for (int i = siblingBegin; i < siblingEnd; ++i)
+				{
+					int sampleIndex = m_indexes[i];
+					uint8_t bin = m_binnedSamples->bin(var, sampleIndex);
+					--histogram[(bin == BinnedSamples::NaNBin ? nanBin : bin) * m_classCount + m_classIndexes[sampleIndex]];
+				}
+			}
+			else
+			{
+				histogram.assign((nanBin + 1) * m_classCount, 0);
+				for (int i = begin; i < end; ++i)
+				{
+					int sampleIndex = m_indexes[i];
+					uint8_t bin = m_binnedSamples->bin(var, sampleIndex);
+					++histogram[(bin == BinnedSamples::NaNBin ? nanBin : bin) * m_classCount + m_classIndexes[sampleIndex]];
+				}
+			}
+		}
+
+		//! Finds the best split of a node along a feature from its class histogram (binned samples)
+		SplitCandidate bestBinnedSplit(int var, const std::vector<int>& histogram, const std::vector<int>& counts, int n) const
+		{
+			SplitCandidate best;
+			best.var = var;
+
+			std::vector<int> leftCounts(m_classCount, 0);
+			double leftSquares = 0.0;
+			double rightSquares = 0.0;
+			for (int count : counts)
+			{
+				rightSquares += static_cast<double>(count) * count;
+			}
+
+			int nl = 0;
+			//the last (value) bin can't be on the left side, and the NaN values are always on the right side
+			int binCount = m_binnedSamples->binCount(var);
+			for (int bin = 0; bin + 1 < binCount; ++bin)
+			{
+				const int* binHistogram = histogram.data() + bin * m_classCount;
+				int binTotal = 0;
+				for (int c = 0; c < m_classCount; ++c)
+				{
+					int h = binHistogram[c];
+					if (h != 0)
+					{
+						double l = leftCounts[c];
+						double r = counts[c] - l;
+						leftSquares += (2.0 * l + h) * h;
+						rightSquares -= (2.0 * r - h) * h;
+						leftCounts[c] += h;
+						binTotal += h;
+					}
+				}
+				if (binTotal == 0)
+				{
+					//same split as the previous bin
+					continue;
+				}
+				nl += binTotal;
+
+				int nr = n - nl;
+				if (nl < m_params.minSampleCount || nr < m_params.minSampleCount || nr == 0)
+				{
+					continue;
+				}
+
+				double quality = leftSquares / nl + rightSquares / nr;
+				if (quality > best.quality)
+				{
+					best.quality = quality;
+					best.bin = bin;
+					best.threshold = m_binnedSamples->upperBound(var, bin);
+				}
+			}
+
+			return best;
+		}
+
+		//! Splits a node (recursively)
+		/** \param parentHistograms histograms of the parent node (binned samples only)
+			\param siblingBegin first sample of the sibling node
+			\param siblingEnd last sample (excluded) of the sibling node
+		**/
+		void split(int nodeIndex, int begin, int end, const Histograms* parentHistograms, int siblingBegin, int siblingEnd)
+		{
+			int n = end - begin;
+			int depth = m_nodes[nodeIndex].depth;
+
+			std::vector<int> counts(m_classCount, 0);
+			for (int i = begin; i < end; ++i)
+			{
+				++counts[m_classIndexes[m_indexes[i]]];
+			}
+			int majorityClass = static_cast<int>(std::max_element(counts.begin(), counts.end()) - counts.begin());
+			m_nodes[nodeIndex].classIdx = majorityClass;
+
+			//stop criteria (same as OpenCV)
+			if (n <= m_params.minSampleCount || depth >= m_params.maxDepth || counts[majorityClass] == n)
+			{
+				return;
+			}
+
+			//random subset of the features
+			for (int i = 0; i < m_activeVarCount; ++i)
+			{
+				std::uniform_int_distribution<int> featureDistribution(i, static_cast<int>(m_features.size()) - 1);
+				std::swap(m_features[i], m_features[featureDistribution(m_generator)]);
+			}
+
+			Histograms histograms;
+			if (m_binnedSamples)
+			{
+				histograms.resize(m_features.size());
+			}
+
+			std::vector<SplitCandidate> candidates(m_activeVarCount);
+			bool parallel = (m_splitThreads > 1 && n >= s_parallelNodeSize);
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(m_splitThreads) if(parallel)
+#endif
+			for (int i = 0; i < m_activeVarCount; ++i)
+			{
+				int var = m_features[i];
+				if (m_binnedSamples)
+				{
+					computeHistogram(var, begin, end, parentHistograms, siblingBegin, siblingEnd, histograms[var]);
+					candidates[i] = bestBinnedSplit(var, histograms[var], counts, n);
+				}
+				else
+				{
+					candidates[i] = bestSplit(var, begin, end, counts);
+				}
+			}
+			(void)parallel;
+
+			//the first best candidate wins (deterministic)
+			SplitCandidate best;
+			for (const SplitCandidate& candidate : candidates)
+			{
+				if (candidate.quality > best.quality)
+				{
+					best = candidate;
+				}
+			}
+			if (best.var < 0)
+			{
+				//no valid split (constant features)
+				return;
+			}
+
+			//split the samples (value <= threshold --> left)
+			int var = best.var;
+			std::vector<int>::iterator middleIt;
+			if (m_binnedSamples)
+			{
+				int lastLeftBin = best.bin;
+				middleIt = std::partition(m_indexes.begin() + begin, m_indexes.begin() + end, [&](int sampleIndex)
+				{
+					return m_binnedSamples->bin(var, sampleIndex) <= lastLeftBin;
+				});
+			}
+			else
+			{
+				float threshold = best.threshold;
+				middleIt = std::partition(m_indexes.begin() + begin, m_indexes.begin() + end, [&](int sampleIndex)
+				{
+					return m_samples->at<float>(sampleIndex, var) <= threshold;
+				});
+			}
+			int middle = static_cast<int>(middleIt - m_indexes.begin());
+			if (middle == begin || middle == end)
+			{
+				assert(false);
+				return;
+			}
+
+			//mean decrease of impurity (weighted by the number of samples)
+			m_importance[var] += best.quality - SquaredSum(counts, n);
+
+			TreeNode left, right;
+			left.depth = right.depth = depth + 1;
+			int leftIndex = static_cast<int>(m_nodes.size());
+			m_nodes.push_back(left);
+			int rightIndex = static_cast<int>(m_nodes.size());
+			m_nodes.push_back(right);
+
+			TreeNode& node = m_nodes[nodeIndex];
+			node.var = var;
+			node.bin = best.bin;
+			node.threshold = best.threshold;
+			node.quality = best.quality;
+			node.left = leftIndex;
+			node.right = rightIndex;
+
+			if (m_binnedSamples)
+			{
+				//the smallest child first (its histograms are computed directly, the ones of the largest child are deduced)
+				if (middle - begin <= end - middle)
+				{
+					split(leftIndex, begin, middle, nullptr, 0, 0);
+					split(rightIndex, middle, end, &histograms, begin, middle);
+				}
+				else
+				{
+					split(rightIndex, middle, end, nullptr, 0, 0);
+					split(leftIndex, begin, middle, &histograms, middle, end);
+				}
+			}
+			else
+			{
+				split(leftIndex, begin, middle, nullptr, 0, 0);
+				split(rightIndex, middle, end, nullptr, 0, 0);
+			}
+		}
+
+	protected:
+
+		const cv::Mat* m_samples;
+		const BinnedSamples* m_binnedSamples;
+		const std::vector<int>& m_classIndexes;
+		int m_classCount;
+		const RandomTreesParams& m_params;
+		int m_activeVarCount;
+		int m_splitThreads;
+		std::mt19937 m_generator;
+
+		//! Sample indexes (bootstrap)
+		std::vector<int> m_indexes;
+		//! Feature indexes (shuffled)
+		std::vector<int> m_features;
+		std::vector<TreeNode> m_nodes;
+		std::vector<double> m_importance;
+	};
+}
+
+//! Writes the nodes of a tree in depth-first order (same format as cv::ml::DTrees)
+static void WriteNodes(cv::FileStorage& fs, const std::vector<TreeNode>& nodes, const std::vector<int>& classLabels, int nodeIndex)
+{
+	const TreeNode& node = nodes[nodeIndex];
+
+	fs << "{";
+	fs << "depth" << node.depth;
+	fs << "value" << static_cast<double>(classLabels[node.classIdx]);
+	fs << "norm_class_idx" << node.classIdx;
+	if (node.var >= 0)
+	{
+		fs << "splits" << "[";
+		fs << "{:";
+		fs << "var" << node.var;
+		fs << "quality" << node.quality;
+		fs << "le" << node.threshold;
+		fs << "}";
+		fs << "]";
+	}
+	fs << "}";
+
+	if (node.var >= 0)
+	{
+		WriteNodes(fs, nodes, classLabels, node.left);
+		WriteNodes(fs, nodes, classLabels, node.right);
+	}
+}
+
+//! Trains a forest on raw or binned samples
+static cv::Ptr<cv::ml::RTrees> TrainForest(	const cv::Mat* samples,
+											const BinnedSamples* binnedSamples,
+											const cv::Mat& responses,
+											const RandomTreesParams& params,
+											QString& error,
+											RandomForestTrainer::OutOfBagMetrics* outOfBag)
+{
+	int sampleCount = (samples ? samples->rows : binnedSamples->sampleCount());
+	int featureCount = (samples ? samples->cols : binnedSamples->featureCount());
+	if (	sampleCount == 0
+		||	featureCount == 0
+		||	responses.total() != static_cast<size_t>(sampleCount)
+		||	responses.type() != CV_32FC1
+		||	params.maxTreeCount < 1
+		||	params.maxDepth < 1)
+	{
+		assert(false);
+		error = QObject::tr("Invalid training data or parameters");
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	int treeCount = params.maxTreeCount;
+
+	//classes
+	std::vector<int> classLabels;
+	std::vector<int> classIndexes(sampleCount);
+	try
+	{
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			classIndexes[i] = cvRound(responses.at<float>(i));
+		}
+		classLabels = classIndexes;
+		std::sort(classLabels.begin(), classLabels.end());
+		classLabels.erase(std::unique(classLabels.begin(), classLabels.end()), classLabels.end());
+		for (int& classIdx : classIndexes)
+		{
+			classIdx = static_cast<int>(std::lower_bound(classLabels.begin(), classLabels.end(), classIdx) - classLabels.begin());
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+	int classCount = static_cast<int>(classLabels.size());
+
+	//same default as OpenCV
+	int activeVarCount = (params.activeVarCount > 0 ? params.activeVarCount : cvRound(std::sqrt(static_cast<double>(featureCount))));
+	activeVarCount = std::min(std::max(activeVarCount, 1), featureCount);
+
+	//trees in parallel, and the remaining threads for the split search (if any)
+	int threadCount = 1;
+	int splitThreads = 1;
+#if defined(_OPENMP)
+	threadCount = Tools::MaxThreadCount();
+	int treeThreads = std::min(threadCount, treeCount);
+	splitThreads = std::max(1, threadCount / treeThreads);
+#endif
+
+	//out-of-bag votes (per sample and per class)
+	std::vector<uint16_t> votes;
+	std::vector<double> permutationImportance;
+	if (outOfBag)
+	{
+		if (treeCount > std::numeric_limits<uint16_t>::max())
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] Too many trees to compute the out-of-bag metrics"));
+			outOfBag = nullptr;
+		}
+		else try
+		{
+			votes.resize(static_cast<size_t>(sampleCount) * classCount, 0);
+			permutationImportance.resize(featureCount, 0.0);
+		}
+		catch (const std::bad_alloc&)
+		{
+			error = QObject::tr("Not enough memory");
+			return cv::Ptr<cv::ml::RTrees>();
+		}
+	}
+
+	std::vector<std::vector<TreeNode>> trees(treeCount);
+	std::vector<double> importance(featureCount, 0.0);
+	std::atomic<bool> failed(false);
+
+#if defined(_OPENMP)
+	//the split search is nested in the tree loop (the OpenMP setting is restored afterwards)
+	int maxActiveLevels = omp_get_max_active_levels();
+	if (splitThreads > 1 && maxActiveLevels < 2)
+	{
+		omp_set_max_active_levels(2);
+	}
+#pragma omp parallel for schedule(dynamic) num_threads(treeThreads)
+#endif
+	for (int treeIndex = 0; treeIndex < treeCount; ++treeIndex)
+	{
+		try
+		{
+			TreeBuilder builder(samples, binnedSamples, classIndexes, classCount, params, activeVarCount, splitThreads, params.seed + treeIndex);
+			builder.build();
+			trees[treeIndex] = builder.nodes();
+
+			std::vector<double> treePermutationImportance;
+			if (outOfBag)
+			{
+				std::vector<int> outOfBagSamples;
+				builder.outOfBagSamples(outOfBagSamples);
+				for (int sampleIndex : outOfBagSamples)
+				{
+					size_t voteIndex = static_cast<size_t>(sampleIndex) * classCount + builder.predict(sampleIndex);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+					++votes[voteIndex];
+				}
+				builder.permutationImportance(outOfBagSamples, treePermutationImportance);
+			}
+
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+			{
+				for (int i = 0; i < featureCount; ++i)
+				{
+					importance[i] += builder.importance()[i];
+				}
+				for (size_t i = 0; i < treePermutationImportance.size(); ++i)
+				{
+					permutationImportance[i] += treePermutationImportance[i];
+				}
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			failed = true;
+		}
+	}
+#if defined(_OPENMP)
+	omp_set_max_active_levels(maxActiveLevels);
+#endif
+
+	if (failed)
+	{
+		error = QObject::tr("Not enough memory");
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+
+	double oobError = 0.0;
+	if (outOfBag)
+	{
+		outOfBag->actual.clear();
+		outOfBag->predicted.clear();
+		outOfBag->goodGuess = 0;
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			const uint16_t* sampleVotes = votes.data() + static_cast<size_t>(i) * classCount;
+			int predictedClass = static_cast<int>(std::max_element(sampleVotes, sampleVotes + classCount) - sampleVotes);
+			if (sampleVotes[predictedClass] == 0)
+			{
+				//never out-of-bag
+				continue;
+			}
+			outOfBag->actual.push_back(classLabels[classIndexes[i]]);
+			outOfBag->predicted.push_back(classLabels[predictedClass]);
+			if (predictedClass == classIndexes[i])
+			{
+				++outOfBag->goodGuess;
+			}
+		}
+		outOfBag->sampleCount = static_cast<unsigned>(outOfBag->actual.size());
+		outOfBag->ratio = (outOfBag->sampleCount != 0 ? static_cast<float>(outOfBag->goodGuess) / outOfBag->sampleCount : 0.0f);
+		oobError = 1.0 - outOfBag->ratio;
+
+		outOfBag->importance.resize(featureCount);
+		for (int i = 0; i < featureCount; ++i)
+		{
+			outOfBag->importance[i] = static_cast<float>(permutationImportance[i] / treeCount);
+		}
+
+		//the variable importance of the model is then the permutation importance (as with OpenCV)
+		for (int i = 0; i < featureCount; ++i)
+		{
+			importance[i] = std::max(0.0, permutationImportance[i]);
+		}
+
+		ccLog::Print(QObject::tr("[3DMASC] Out-of-bag accuracy: %1 (%2 / %3 samples)").arg(outOfBag->ratio, 0, 'f', 4).arg(outOfBag->goodGuess).arg(outOfBag->sampleCount));
+	}
+
+	double importanceSum = std::accumulate(importance.begin(), importance.end(), 0.0);
+	std::vector<float> varImportance(featureCount, 0.0f);
+	for (int i = 0; i < featureCount; ++i)
+	{
+		varImportance[i] = (importanceSum > 0 ? static_cast<float>(importance[i] / importanceSum) : 0.0f);
+	}
+
+	size_t nodeCount = 0;
+	for (const std::vector<TreeNode>& tree : trees)
+	{
+		nodeCount += tree.size();
+	}
+
+	//write the forest in the OpenCV format
+	try
+	{
+		std::vector<uchar> varTypes(featureCount + 1, static_cast<uchar>(cv::ml::VAR_ORDERED));
+		varTypes.back() = static_cast<uchar>(cv::ml::VAR_CATEGORICAL);
+
+		cv::Ptr<cv::ml::RTrees> model = cv::ml::RTrees::create();
+		cv::FileStorage fs(".yml", cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+		fs << model->getDefaultName() << "{";
+		fs << "format" << 3;
+		fs << "is_classifier" << 1;
+		fs << "var_all" << featureCount + 1;
+		fs << "var_count" << featureCount;
+		fs << "ord_var_count" << featureCount;
+		fs << "cat_var_count" << 0;
+		fs << "training_params" << "{";
+		{
+			fs << "use_surrogates" << 0;
+			fs << "max_categories" << model->getMaxCategories();
+			fs << "regression_accuracy" << 0.0f;
+			fs << "max_depth" << params.maxDepth;
+			fs << "min_sample_count" << params.minSampleCount;
+			fs << "cross_validation_folds" << 0;
+			fs << "nactive_vars" << activeVarCount;
+		}
+		fs << "}";
+		fs << "var_type" << varTypes;
+		fs << "class_labels" << classLabels;
+		fs << "oob_error" << oobError;
+		fs << "var_importance" << varImportance;
+		fs << "ntrees" << treeCount;
+		fs << "trees" << "[";
+		for (const std::vector<TreeNode>& tree : trees)
+		{
+			fs << "{";
+			fs << "nodes" << "[";
+			WriteNodes(fs, tree, classLabels, 0);
+			fs << "]";
+			fs << "}";
+		}
+		fs << "]";
+		fs << "}";
+
+		model = cv::Algorithm::loadFromString<cv::ml::RTrees>(fs.releaseAndGetString());
+		if (!model || model->empty() || !model->isClassifier())
+		{
+			error = QObject::tr("Failed to create the forest");
+			return cv::Ptr<cv::ml::RTrees>();
+		}
+
+		ccLog::Print(QObject::tr("[3DMASC] Native trainer%1: %2 trees (%3 nodes, %4 classes) trained in %5 s with %6 thread(s)")
+			.arg(binnedSamples ? QObject::tr(" (histograms)") : QString())
+			.arg(treeCount)
+			.arg(nodeCount)
+			.arg(classCount)
+			.arg(timer.elapsed() / 1000.0, 0, 'f', 1)
+			.arg(threadCount));
+
+		return model;
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+}
+
+cv::Ptr<cv::ml::RTrees> RandomForestTrainer::Train(	const cv::Mat& samples,
+														const cv::Mat& responses,
+														const RandomTreesParams& params,
+														QString& error,
+														OutOfBagMetrics* outOfBag/*=nullptr*/)
+{
+	if (samples.type() != CV_32FC1)
+	{
+		assert(false);
+		error = QObject::tr("Invalid training data or parameters");
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+	return TrainForest(&samples, nullptr, responses, params, error, outOfBag);
+}
+
+cv::Ptr<cv::ml::RTrees> RandomForestTrainer::Train(	const BinnedSamples& samples,
+														const cv::Mat& responses,
+														const RandomTreesParams& params,
+														QString& error,
+														OutOfBagMetrics* outOfBag/*=nullptr*/)
+{
+	return TrainForest(nullptr, &samples, responses, params, error, outOfBag);
+}
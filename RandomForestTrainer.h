@@ -0,0 +1,139 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "Parameters.h"
+
+//Qt
+#include <QString>
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//system
+#include <cstdint>
+#include <vector>
+
+namespace masc
+{
+	//! Native (multi-threaded) random forest trainer
+	/** Alternative to the training of cv::ml::RTrees: the trees are built in parallel, and
+		the best split search is also parallelized (per feature) in the large nodes when
+		there are less trees than threads. The trees are grown as OpenCV does (bootstrap
+		samples, a random subset of the features per node, Gini impurity, no surrogates).
+		The result is a standard cv::ml::RTrees classifier (same file format).
+		The variable importance is the (normalized) mean decrease of impurity.
+
+		For large training sets, the features can be binned beforehand (at most 256 quantile
+		bins per feature, see BinnedSamples): the splits are then searched on histograms, and
+		the histograms of the largest child of a node are deduced from the ones of its parent
+		and its sibling (parent - sibling).
+
+		The accuracy can be estimated during the training on the out-of-bag samples (see
+		OutOfBagMetrics), in which case the variable importance is the permutation importance.
+	**/
+	class RandomForestTrainer
+	{
+	public:
+
+		//! Out-of-bag metrics
+		/** Each sample is classified by the trees that were not trained on it (i.e. the trees
+			for which it wasn't drawn in the bootstrap sample).
+		**/
+		struct OutOfBagMetrics
+		{
+			//! Number of samples with an out-of-bag prediction
+			unsigned sampleCount = 0;
+			//! Number of samples whose out-of-bag prediction is correct
+			unsigned goodGuess = 0;
+			//! Out-of-bag accuracy (goodGuess / sampleCount)
+			float ratio = 0.0f;
+			//! Actual classes (of the samples with an out-of-bag prediction)
+			std::vector<int> actual;
+			//! Predicted classes (majority vote of the out-of-bag trees)
+			std::vector<int> predicted;
+			//! Permutation importance of each feature (mean out-of-bag accuracy decrease)
+			std::vector<float> importance;
+		};
+
+		//! Binned training samples
+		class BinnedSamples
+		{
+		public:
+
+			//! Maximum number of bins per feature (the last one is reserved to NaN values)
+			static const int MaxBinCount = 256;
+			//! Bin of the NaN values
+			static const uint8_t NaNBin = 255;
+
+			//! Bins a feature (column) and adds it
+			/** The bin bounds are the quantiles of the values.
+				\return false if there's not enough memory
+			**/
+			bool addFeature(const std::vector<float>& values);
+
+			//! Returns the number of samples
+			int sampleCount() const { return m_bins.empty() ? 0 : static_cast<int>(m_bins.front().size()); }
+			//! Returns the number of features
+			int featureCount() const { return static_cast<int>(m_bins.size()); }
+
+			//! Returns the bin of a sample
+			inline uint8_t bin(int featureIndex, int sampleIndex) const { return m_bins[featureIndex][sampleIndex]; }
+			//! Returns the number of bins of a feature (except the NaN one)
+			inline int binCount(int featureIndex) const { return static_cast<int>(m_upperBounds[featureIndex].size()) + 1; }
+			//! Returns the upper bound (included) of a bin (all bins but the last one)
+			inline float upperBound(int featureIndex, int binIndex) const { return m_upperBounds[featureIndex][binIndex]; }
+
+		protected:
+
+			//! Bin of each sample (per feature)
+			std::vector<std::vector<uint8_t>> m_bins;
+			//! Upper bounds of the bins (per feature)
+			std::vector<std::vector<float>> m_upperBounds;
+		};
+
+		//! Trains a forest
+		/** \param samples training samples (one sample per row, CV_32FC1)
+			\param responses sample classes (one per sample, CV_32FC1)
+			\param params training parameters
+			\param error error message (if any)
+			\param outOfBag out-of-bag metrics (optional, computed if not null)
+			\return the trained classifier (or null on error)
+		**/
+		static cv::Ptr<cv::ml::RTrees> Train(	const cv::Mat& samples,
+												const cv::Mat& responses,
+												const RandomTreesParams& params,
+												QString& error,
+												OutOfBagMetrics* outOfBag = nullptr);
+
+		//! Trains a forest on binned samples (histogram-based split search)
+		/** \param samples binned training samples
+			\param responses sample classes (one per sample, CV_32FC1)
+			\param params training parameters
+			\param error error message (if any)
+			\param outOfBag out-of-bag metrics (optional, computed if not null)
+			\return the trained classifier (or null on error)
+		**/
+		static cv::Ptr<cv::ml::RTrees> Train(	const BinnedSamples& samples,
+												const cv::Mat& responses,
+												const RandomTreesParams& params,
+												QString& error,
+												OutOfBagMetrics* outOfBag = nullptr);
+	};
+}
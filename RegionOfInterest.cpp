@@ -0,0 +1,178 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "RegionOfInterest.h"
+
+//Qt
+#include <QStringList>
+
+//system
+#include <algorithm>
+#include <cmath>
+
+using namespace masc;
+
+//! Returns the squared distance between a point and a segment (2D)
+static double SquareDistToSegment(const CCVector2d& P, const CCVector2d& A, const CCVector2d& B)
+{
+	CCVector2d AB = B - A;
+	CCVector2d AP = P - A;
+	double sqLength = AB.norm2();
+	double t = (sqLength > 0.0 ? std::max(0.0, std::min(1.0, AP.dot(AB) / sqLength)) : 0.0);
+	CCVector2d H = A + AB * t;
+	return (P - H).norm2();
+}
+
+bool RegionOfInterest::contains(const CCVector3d& P, double margin/*=0.0*/) const
+{
+	switch (type)
+	{
+	case BOX:
+		return	P.x >= boxMin.x - margin && P.x <= boxMax.x + margin
+			&&	P.y >= boxMin.y - margin && P.y <= boxMax.y + margin
+			&&	P.z >= boxMin.z - margin && P.z <= boxMax.z + margin;
+
+	case POLYGON:
+	{
+		//even-odd rule
+		CCVector2d Q(P.x, P.y);
+		bool inside = false;
+		size_t vertexCount = polygon.size();
+		for (size_t i = 0, j = vertexCount - 1; i < vertexCount; j = i++)
+		{
+			const CCVector2d& A = polygon[i];
+			const CCVector2d& B = polygon[j];
+			if ((A.y > Q.y) != (B.y > Q.y) && Q.x < (B.x - A.x) * (Q.y - A.y) / (B.y - A.y) + A.x)
+			{
+				inside = !inside;
+			}
+		}
+		if (inside || margin <= 0.0)
+		{
+			return inside;
+		}
+
+		//close enough to the polygon border?
+		double sqMargin = margin * margin;
+		for (size_t i = 0, j = vertexCount - 1; i < vertexCount; j = i++)
+		{
+			if (SquareDistToSegment(Q, polygon[j], polygon[i]) <= sqMargin)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	case NONE:
+	default:
+		break;
+	}
+
+	return false;
+}
+
+bool RegionOfInterest::FromString(const QString& description, RegionOfInterest& roi, QString& error)
+{
+	roi = RegionOfInterest();
+
+	int colonIndex = description.indexOf(':');
+	if (colonIndex < 0)
+	{
+		error = "Malformed region of interest (expecting BOX:xmin,ymin,zmin,xmax,ymax,zmax or POLY:x1,y1,x2,y2,x3,y3,...)";
+		return false;
+	}
+	QString keyword = description.left(colonIndex).trimmed().toUpper();
+	QStringList tokens = description.mid(colonIndex + 1).split(',', QString::SkipEmptyParts);
+
+	std::vector<double> values;
+	values.reserve(tokens.size());
+	for (const QString& token : tokens)
+	{
+		bool ok = false;
+		values.push_back(token.trimmed().toDouble(&ok));
+		if (!ok)
+		{
+			error = QString("Invalid value in region of interest: '%1'").arg(token);
+			return false;
+		}
+	}
+
+	if (keyword == "BOX")
+	{
+		if (values.size() != 6)
+		{
+			error = "A box region of interest expects 6 values (xmin,ymin,zmin,xmax,ymax,zmax)";
+			return false;
+		}
+		roi.boxMin = CCVector3d(values[0], values[1], values[2]);
+		roi.boxMax = CCVector3d(values[3], values[4], values[5]);
+		if (roi.boxMin.x > roi.boxMax.x || roi.boxMin.y > roi.boxMax.y || roi.boxMin.z > roi.boxMax.z)
+		{
+			error = "Invalid box region of interest (min > max)";
+			return false;
+		}
+		roi.type = BOX;
+	}
+	else if (keyword == "POLY")
+	{
+		if (values.size() < 6 || (values.size() % 2) != 0)
+		{
+			error = "A polygon region of interest expects at least 3 vertices (x1,y1,x2,y2,x3,y3,...)";
+			return false;
+		}
+		for (size_t i = 0; i < values.size(); i += 2)
+		{
+			roi.polygon.push_back(CCVector2d(values[i], values[i + 1]));
+		}
+		roi.type = POLYGON;
+	}
+	else
+	{
+		error = QString("Unknown region of interest type '%1' (expecting BOX or POLY)").arg(keyword);
+		return false;
+	}
+
+	return true;
+}
+
+QString RegionOfInterest::toString() const
+{
+	QStringList values;
+	switch (type)
+	{
+	case BOX:
+		for (const CCVector3d& P : { boxMin, boxMax })
+		{
+			values << QString::number(P.x, 'f', 6) << QString::number(P.y, 'f', 6) << QString::number(P.z, 'f', 6);
+		}
+		return "BOX:" + values.join(',');
+
+	case POLYGON:
+		for (const CCVector2d& P : polygon)
+		{
+			values << QString::number(P.x, 'f', 6) << QString::number(P.y, 'f', 6);
+		}
+		return "POLY:" + values.join(',');
+
+	case NONE:
+	default:
+		break;
+	}
+
+	return QString();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//CCLib
+#include <CCGeom.h>
+
+//Qt
+#include <QString>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! Region of interest (3D box or 2D polygon, in global coordinates)
+	struct RegionOfInterest
+	{
+		enum Type { NONE, BOX, POLYGON };
+		Type type = NONE;
+
+		//! Box min corner
+		CCVector3d boxMin;
+		//! Box max corner
+		CCVector3d boxMax;
+		//! Polygon vertices (XY)
+		std::vector<CCVector2d> polygon;
+
+		//! Returns whether the region is defined
+		inline bool isValid() const { return type != NONE; }
+
+		//! Returns whether a point (in global coordinates) is inside the region, possibly enlarged by a margin
+		bool contains(const CCVector3d& P, double margin = 0.0) const;
+
+		//! Parses a region description
+		/** Expected syntax: 'BOX:xmin,ymin,zmin,xmax,ymax,zmax' or 'POLY:x1,y1,x2,y2,x3,y3[,...]'
+		**/
+		static bool FromString(const QString& description, RegionOfInterest& roi, QString& error);
+
+		//! Returns the region description
+		QString toString() const;
+	};
+
+}; //namespace masc
@@ -0,0 +1,334 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ResultSidecar.h"
+
+//Local
+#include "q3DMASCTools.h"
+
+//qCC_db
+#include <ccPointCloud.h>
+#include <ccScalarField.h>
+#include <ccLog.h>
+
+//qPDALIO
+#include "../../../core/IO/qPDALIO/include/LASFields.h"
+
+//Qt
+#include <QDataStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QtEndian>
+
+//system
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <limits>
+
+using namespace masc;
+
+static const quint32 s_magic = 0x3D4D4352; //'3DMCR'
+static const quint16 s_version = 1;
+//! Header size (the arrays start right after)
+static const qint64 s_headerSize = 64;
+//! Flags
+static const quint16 s_withMargin = 1;
+static const quint16 s_wideClasses = 2; //4 bytes per class (instead of 1)
+//! Quantized value for NaN
+static const uchar s_nanValue = 255;
+//! Stored class for NaN (1 byte)
+static const uchar s_nanClass = 255;
+//! Stored class for NaN (4 bytes)
+static const qint32 s_wideNanClass = std::numeric_limits<qint32>::min();
+//! Number of points processed at once
+static const unsigned s_chunkSize = (1 << 20);
+
+static uchar Quantize(ScalarType value)
+{
+	if (!CCCoreLib::ScalarField::ValidValue(value))
+	{
+		return s_nanValue;
+	}
+	return static_cast<uchar>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 254));
+}
+
+static ScalarType Dequantize(uchar value)
+{
+	return (value == s_nanValue ? CCCoreLib::NAN_VALUE : static_cast<ScalarType>(value / 254.0));
+}
+
+//! Unmaps a (possibly null) mapped address
+static void Unmap(QFile& file, const uchar* address)
+{
+	if (address)
+	{
+		file.unmap(const_cast<uchar*>(address));
+	}
+}
+
+//! Returns the global bounding-box of a cloud
+static void GetGlobalBoundingBox(const ccPointCloud* cloud, CCVector3d& bbMin, CCVector3d& bbMax)
+{
+	CCVector3 localMin, localMax;
+	const_cast<ccPointCloud*>(cloud)->getBoundingBox(localMin, localMax);
+	bbMin = cloud->toGlobal3d(localMin);
+	bbMax = cloud->toGlobal3d(localMax);
+}
+
+QString ResultSidecar::DefaultFilename(const QString& cloudFilename)
+{
+	QFileInfo fi(cloudFilename);
+	return fi.absolutePath() + "/" + fi.completeBaseName() + "." + Extension();
+}
+
+bool ResultSidecar::Save(const ccPointCloud* cloud, const QString& filename, bool withMargin, QString& error)
+{
+	if (!cloud)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	const CCCoreLib::ScalarField* classificationSF = Tools::GetClassificationSF(cloud);
+	if (!classificationSF)
+	{
+		error = "The cloud has no classification field";
+		return false;
+	}
+	const CCCoreLib::ScalarField* confidenceSF = Tools::RetrieveSF(cloud, "Classification_confidence");
+	const CCCoreLib::ScalarField* marginSF = withMargin ? Tools::RetrieveSF(cloud, "Classification_margin") : nullptr;
+	if (withMargin && !marginSF)
+	{
+		ccLog::Warning("[3DMASC] The cloud has no margin field: it won't be saved in the sidecar");
+	}
+
+	unsigned pointCount = cloud->size();
+
+	//can the classes be stored on 1 byte?
+	bool wideClasses = false;
+	for (unsigned i = 0; i < pointCount; ++i)
+	{
+		ScalarType value = classificationSF->getValue(i);
+		if (!CCCoreLib::ScalarField::ValidValue(value))
+		{
+			continue; //NaN is stored as a reserved value in both cases
+		}
+		if (value < 0 || value >= s_nanClass || value != std::floor(value))
+		{
+			wideClasses = true;
+			break;
+		}
+	}
+	qint64 classBytes = (wideClasses ? 4 : 1);
+	quint16 flags = (marginSF ? s_withMargin : 0) | (wideClasses ? s_wideClasses : 0);
+	qint64 dataSize = static_cast<qint64>(pointCount) * (classBytes + 1 + (marginSF ? 1 : 0));
+
+	QFile file(filename);
+	if (!file.open(QFile::ReadWrite | QFile::Truncate))
+	{
+		error = QString("Can't write file '%1'").arg(filename);
+		return false;
+	}
+
+	//header
+	{
+		CCVector3d bbMin, bbMax;
+		GetGlobalBoundingBox(cloud, bbMin, bbMax);
+
+		QDataStream stream(&file);
+		stream.setByteOrder(QDataStream::LittleEndian);
+		stream << s_magic << s_version << flags << static_cast<quint32>(pointCount);
+		stream << bbMin.x << bbMin.y << bbMin.z << bbMax.x << bbMax.y << bbMax.z;
+		if (stream.status() != QDataStream::Ok || !file.resize(s_headerSize + dataSize))
+		{
+			error = QString("Failed to write file '%1'").arg(filename);
+			file.close();
+			file.remove();
+			return false;
+		}
+	}
+
+	//the arrays are written chunk by chunk (only the current chunk of each array is mapped)
+	qint64 confidencesOffset = s_headerSize + static_cast<qint64>(pointCount) * classBytes;
+	qint64 marginsOffset = confidencesOffset + pointCount;
+	for (unsigned start = 0; start < pointCount; start += s_chunkSize)
+	{
+		unsigned count = std::min(pointCount - start, s_chunkSize);
+		uchar* classes = file.map(s_headerSize + start * classBytes, count * classBytes);
+		uchar* confidences = file.map(confidencesOffset + start, count);
+		uchar* margins = (marginSF ? file.map(marginsOffset + start, count) : nullptr);
+		if (!classes || !confidences || (marginSF && !margins))
+		{
+			error = QString("Failed to map file '%1'").arg(filename);
+			Unmap(file, classes);
+			Unmap(file, confidences);
+			Unmap(file, margins);
+			file.close();
+			file.remove();
+			return false;
+		}
+
+		for (unsigned j = 0; j < count; ++j)
+		{
+			unsigned i = start + j;
+			ScalarType label = classificationSF->getValue(i);
+			if (wideClasses)
+			{
+				qint32 value = CCCoreLib::ScalarField::ValidValue(label) ? static_cast<qint32>(label) : s_wideNanClass;
+				qToLittleEndian<qint32>(value, classes + 4 * static_cast<size_t>(j));
+			}
+			else
+			{
+				classes[j] = CCCoreLib::ScalarField::ValidValue(label) ? static_cast<uchar>(label) : s_nanClass;
+			}
+
+			confidences[j] = (confidenceSF ? Quantize(confidenceSF->getValue(i)) : s_nanValue);
+			if (marginSF)
+			{
+				margins[j] = Quantize(marginSF->getValue(i));
+			}
+		}
+
+		Unmap(file, classes);
+		Unmap(file, confidences);
+		Unmap(file, margins);
+	}
+
+	ccLog::Print(QString("[3DMASC] Classification results saved in '%1' (%2 points, %3 bytes)").arg(filename).arg(pointCount).arg(s_headerSize + dataSize));
+	return true;
+}
+
+bool ResultSidecar::Merge(ccPointCloud* cloud, const QString& filename, QString& error)
+{
+	if (!cloud)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	QFile file(filename);
+	if (!file.open(QFile::ReadOnly))
+	{
+		error = QString("Can't open file '%1'").arg(filename);
+		return false;
+	}
+
+	quint32 magic = 0, pointCount = 0;
+	quint16 version = 0, flags = 0;
+	CCVector3d fileMin, fileMax;
+	{
+		QDataStream stream(&file);
+		stream.setByteOrder(QDataStream::LittleEndian);
+		stream >> magic >> version >> flags >> pointCount;
+		stream >> fileMin.x >> fileMin.y >> fileMin.z >> fileMax.x >> fileMax.y >> fileMax.z;
+		if (stream.status() != QDataStream::Ok || magic != s_magic || version != s_version)
+		{
+			error = QString("File '%1' is not a (compatible) classification sidecar").arg(filename);
+			return false;
+		}
+	}
+
+	//check that the sidecar corresponds to the cloud
+	CCVector3d bbMin, bbMax;
+	GetGlobalBoundingBox(cloud, bbMin, bbMax);
+	double tolerance = 1.0e-4 * (fileMax - fileMin).norm() + 1.0e-3;
+	if (	pointCount != cloud->size()
+		||	(bbMin - fileMin).norm() > tolerance
+		||	(bbMax - fileMax).norm() > tolerance)
+	{
+		error = QString("File '%1' doesn't match the cloud %2 (%3 points vs %4)").arg(filename).arg(cloud->getName()).arg(pointCount).arg(cloud->size());
+		return false;
+	}
+
+	bool withMargin = (flags & s_withMargin);
+	qint64 classBytes = ((flags & s_wideClasses) ? 4 : 1);
+	qint64 dataSize = static_cast<qint64>(pointCount) * (classBytes + 1 + (withMargin ? 1 : 0));
+	if (file.size() < s_headerSize + dataSize)
+	{
+		error = QString("File '%1' is truncated").arg(filename);
+		return false;
+	}
+
+	//create (or replace) the fields
+	ccScalarField* fields[3] = { nullptr, nullptr, nullptr };
+	const char* fieldNames[3] = { LAS_FIELD_NAMES[LAS_CLASSIFICATION], "Classification_confidence", "Classification_margin" };
+	for (int f = 0; f < (withMargin ? 3 : 2); ++f)
+	{
+		int sfIdx = cloud->getScalarFieldIndexByName(fieldNames[f]);
+		if (sfIdx < 0)
+		{
+			sfIdx = cloud->addScalarField(fieldNames[f]);
+			if (sfIdx < 0)
+			{
+				error = "Not enough memory";
+				return false;
+			}
+		}
+		fields[f] = static_cast<ccScalarField*>(cloud->getScalarField(sfIdx));
+	}
+
+	//the arrays are read chunk by chunk (only the current chunk of each array is mapped)
+	qint64 confidencesOffset = s_headerSize + static_cast<qint64>(pointCount) * classBytes;
+	qint64 marginsOffset = confidencesOffset + pointCount;
+	for (unsigned start = 0; start < pointCount; start += s_chunkSize)
+	{
+		unsigned count = std::min(pointCount - start, s_chunkSize);
+		const uchar* classes = file.map(s_headerSize + start * classBytes, count * classBytes);
+		const uchar* confidences = file.map(confidencesOffset + start, count);
+		const uchar* margins = (withMargin ? file.map(marginsOffset + start, count) : nullptr);
+		if (!classes || !confidences || (withMargin && !margins))
+		{
+			error = QString("Failed to map file '%1'").arg(filename);
+			Unmap(file, classes);
+			Unmap(file, confidences);
+			Unmap(file, margins);
+			return false;
+		}
+
+		for (unsigned j = 0; j < count; ++j)
+		{
+			unsigned i = start + j;
+			qint32 label = (classBytes == 4 ? qFromLittleEndian<qint32>(classes + 4 * static_cast<size_t>(j)) : classes[j]);
+			bool isNaN = (classBytes == 4 ? label == s_wideNanClass : label == s_nanClass);
+			fields[0]->setValue(i, isNaN ? CCCoreLib::NAN_VALUE : static_cast<ScalarType>(label));
+			fields[1]->setValue(i, Dequantize(confidences[j]));
+			if (withMargin)
+			{
+				fields[2]->setValue(i, Dequantize(margins[j]));
+			}
+		}
+
+		Unmap(file, classes);
+		Unmap(file, confidences);
+		Unmap(file, margins);
+	}
+
+	for (ccScalarField* sf : fields)
+	{
+		if (sf)
+		{
+			sf->computeMinAndMax();
+		}
+	}
+	cloud->setCurrentDisplayedScalarField(cloud->getScalarFieldIndexByName(LAS_FIELD_NAMES[LAS_CLASSIFICATION]));
+
+	ccLog::Print(QString("[3DMASC] Classification results of '%1' merged into cloud %2").arg(filename).arg(cloud->getName()));
+	return true;
+}
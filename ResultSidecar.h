@@ -0,0 +1,61 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Qt
+#include <QString>
+
+class ccPointCloud;
+
+namespace masc
+{
+	//! Compact classification results (sidecar file)
+	/** Instead of exporting the whole classified cloud, only the classification results are
+		written (in the point order of the cloud): the class (1 or 4 bytes, with a reserved
+		value for NaN), the confidence (1 byte) and optionally the margin between the two best
+		classes (1 byte).
+		The sidecar can be merged back into the source cloud later.
+	**/
+	class ResultSidecar
+	{
+	public:
+
+		//! Sidecar file extension
+		static QString Extension() { return "3dmasc_cls"; }
+
+		//! Returns the default sidecar filename of a cloud file
+		static QString DefaultFilename(const QString& cloudFilename);
+
+		//! Writes the classification results of a cloud
+		/** \param cloud classified cloud (with a 'Classification' field)
+			\param filename sidecar filename
+			\param withMargin whether to save the 'Classification_margin' field as well
+			\param error error message (if any)
+			\return success
+		**/
+		static bool Save(const ccPointCloud* cloud, const QString& filename, bool withMargin, QString& error);
+
+		//! Merges classification results into a cloud
+		/** The cloud must be the one that was classified (same points, same order).
+			The 'Classification', 'Classification_confidence' and 'Classification_margin' (if saved)
+			fields are created or replaced.
+			\return success
+		**/
+		static bool Merge(ccPointCloud* cloud, const QString& filename, QString& error);
+	};
+}
@@ -47,6 +47,9 @@ public:
 	virtual inline QString getName() const { return m_sf->getName(); }
 	virtual size_t size() const override { return m_sf->size(); }
 
+	//! Returns the wrapped scalar field
+	inline CCCoreLib::ScalarField* sf() const { return m_sf; }
+
 protected:
 	CCCoreLib::ScalarField* m_sf;
 };
@@ -71,6 +74,11 @@ public:
 	virtual inline QString getName() const { return m_name; }
 	virtual inline size_t size() const override { return std::min(m_sfp->size(), m_sfq->size()); }
 
+	//! Returns the numerator scalar field
+	inline CCCoreLib::ScalarField* sfp() const { return m_sfp; }
+	//! Returns the denominator scalar field
+	inline CCCoreLib::ScalarField* sfq() const { return m_sfq; }
+
 protected:
 	CCCoreLib::ScalarField *m_sfp, *m_sfq;
 	QString m_name;
@@ -97,6 +105,9 @@ public:
 	virtual inline QString getName() const { static const char s_names[][14] = { "Norm dip", "Norm dip dir." }; return s_names[m_mode]; }
 	virtual inline size_t size() const override { return m_cloud->size(); }
 
+	inline const ccPointCloud* cloud() const { return m_cloud; }
+	inline Mode mode() const { return m_mode; }
+
 protected:
 	const ccPointCloud* m_cloud;
 	Mode m_mode;
@@ -117,11 +128,34 @@ public:
 	virtual inline QString getName() const { static const char s_names[][5] = { "DimX", "DimY", "DimZ" }; return s_names[m_dim]; }
 	virtual inline size_t size() const override { return m_cloud->size(); }
 
+	inline const ccPointCloud* cloud() const { return m_cloud; }
+	inline Dim dim() const { return m_dim; }
+
 protected:
 	const ccPointCloud* m_cloud;
 	Dim m_dim;
 };
 
+class ConstantScalarFieldWrapper : public IScalarFieldWrapper
+{
+public:
+	ConstantScalarFieldWrapper(size_t count, double value, QString name)
+		: m_count(count)
+		, m_value(value)
+		, m_name(name)
+	{}
+
+	virtual inline double pointValue(unsigned index) const override { return m_value; }
+	virtual inline bool isValid() const { return true; }
+	virtual inline QString getName() const { return m_name; }
+	virtual inline size_t size() const override { return m_count; }
+
+protected:
+	size_t m_count;
+	double m_value;
+	QString m_name;
+};
+
 class ColorScalarFieldWrapper : public IScalarFieldWrapper
 {
 public:
@@ -137,6 +171,9 @@ public:
 	virtual inline QString getName() const { static const char s_names[][6] = { "Red", "Green", "Blue" }; return s_names[m_band]; }
 	virtual inline size_t size() const override { return m_cloud->size(); }
 
+	inline const ccPointCloud* cloud() const { return m_cloud; }
+	inline Band band() const { return m_band; }
+
 protected:
 	const ccPointCloud* m_cloud;
 	Band m_band;
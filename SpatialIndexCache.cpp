@@ -0,0 +1,485 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "SpatialIndexCache.h"
+
+//qCC_db
+#include <ccPointCloud.h>
+#include <ccLog.h>
+
+//Qt
+#include <QCryptographicHash>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+
+//system
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace masc;
+
+static const char* s_sourceMetaDataKey = "3DMASC.SpatialIndexSource";
+//! Number of points of the cloud when its source was set (the clones inherit the meta-data)
+static const char* s_sourcePointCountMetaDataKey = "3DMASC.SpatialIndexSourcePointCount";
+static const char* s_shareClassIndexesMetaDataKey = "3DMASC.ShareClassIndexes";
+
+//! Shared class indexes (per cloud unique ID and class)
+static QMap< QPair<unsigned, int>, QSharedPointer<SpatialIndexCache::ClassIndex> > s_classIndexes;
+static QMutex s_classIndexesMutex;
+static const quint32 s_magic = 0x3D4D4958; //'3DMIX'
+static const quint16 s_version = 1;
+//! Maximum number of bytes hashed, written or read at once (Qt uses 'int' sizes)
+static const qint64 s_maxChunkSize = (1 << 30);
+
+//! Writes a raw buffer by chunks
+static bool WriteRawData(QDataStream& stream, const char* data, qint64 byteCount)
+{
+	while (byteCount > 0)
+	{
+		int chunkSize = static_cast<int>(std::min(byteCount, s_maxChunkSize));
+		if (stream.writeRawData(data, chunkSize) != chunkSize)
+		{
+			return false;
+		}
+		data += chunkSize;
+		byteCount -= chunkSize;
+	}
+	return true;
+}
+
+//! Reads a raw buffer by chunks
+static bool ReadRawData(QDataStream& stream, char* data, qint64 byteCount)
+{
+	while (byteCount > 0)
+	{
+		int chunkSize = static_cast<int>(std::min(byteCount, s_maxChunkSize));
+		if (stream.readRawData(data, chunkSize) != chunkSize)
+		{
+			return false;
+		}
+		data += chunkSize;
+		byteCount -= chunkSize;
+	}
+	return true;
+}
+
+//! Octree restored from a sidecar file
+class RestoredOctree : public ccOctree
+{
+public:
+	explicit RestoredOctree(ccPointCloud* cloud)
+		: ccOctree(cloud)
+	{}
+
+	//! Restores the octree tables (instead of building them)
+	bool restore(	const CCVector3& pointsMin,
+					const CCVector3& pointsMax,
+					const CCVector3& dimMin,
+					const CCVector3& dimMax,
+					cellsContainer& pointsAndCodes)
+	{
+		clear();
+
+		m_pointsMin = pointsMin;
+		m_pointsMax = pointsMax;
+		m_dimMin = dimMin;
+		m_dimMax = dimMax;
+		m_nearestPow2 = (1 << static_cast<int>(log(m_dimMax.x - m_dimMin.x) / log(2.0)));
+
+		m_thePointsAndTheirCellCodes.swap(pointsAndCodes);
+		m_numberOfProjectedPoints = static_cast<unsigned>(m_thePointsAndTheirCellCodes.size());
+
+		//same as at the end of the standard build
+		updateMinAndMaxTables();
+		updateCellSizeTable();
+		updateCellCountTable();
+
+		return m_numberOfProjectedPoints != 0;
+	}
+};
+
+static void WriteVector(QDataStream& stream, const CCVector3& P)
+{
+	stream << static_cast<double>(P.x) << static_cast<double>(P.y) << static_cast<double>(P.z);
+}
+
+static CCVector3 ReadVector(QDataStream& stream)
+{
+	double x = 0, y = 0, z = 0;
+	stream >> x >> y >> z;
+	return CCVector3(	static_cast<PointCoordinateType>(x),
+						static_cast<PointCoordinateType>(y),
+						static_cast<PointCoordinateType>(z));
+}
+
+static bool SameVector(const CCVector3& A, const CCVector3& B)
+{
+	return A.x == B.x && A.y == B.y && A.z == B.z;
+}
+
+void SpatialIndexCache::SetSource(ccPointCloud* cloud, const QString& baseFilename)
+{
+	if (cloud && !baseFilename.isEmpty())
+	{
+		cloud->setMetaData(s_sourceMetaDataKey, baseFilename);
+		cloud->setMetaData(s_sourcePointCountMetaDataKey, cloud->size());
+	}
+}
+
+QString SpatialIndexCache::GetSource(const ccPointCloud* cloud)
+{
+	if (!cloud || !cloud->hasMetaData(s_sourceMetaDataKey))
+	{
+		return QString();
+	}
+
+	//a partial clone (cropped cloud, subset, etc.) inherits the meta-data of its source cloud
+	bool ok = false;
+	unsigned sourcePointCount = cloud->getMetaData(s_sourcePointCountMetaDataKey).toUInt(&ok);
+	if (!ok || sourcePointCount != cloud->size())
+	{
+		return QString();
+	}
+
+	return cloud->getMetaData(s_sourceMetaDataKey).toString();
+}
+
+QString SpatialIndexCache::GetSidecarFilename(const ccPointCloud* cloud)
+{
+	QString baseFilename = GetSource(cloud);
+	if (baseFilename.isEmpty())
+	{
+		return QString();
+	}
+
+	return baseFilename + "." + Extension();
+}
+
+QByteArray SpatialIndexCache::ComputeHash(const ccPointCloud* cloud)
+{
+	QCryptographicHash hash(QCryptographicHash::Md5);
+	if (cloud && cloud->size() != 0)
+	{
+		//the points are stored contiguously
+		const char* data = reinterpret_cast<const char*>(cloud->getPoint(0));
+		qint64 byteCount = static_cast<qint64>(cloud->size()) * static_cast<qint64>(sizeof(CCVector3));
+		while (byteCount > 0)
+		{
+			int chunkSize = static_cast<int>(std::min(byteCount, s_maxChunkSize));
+			hash.addData(data, chunkSize);
+			data += chunkSize;
+			byteCount -= chunkSize;
+		}
+	}
+	return hash.result();
+}
+
+bool SpatialIndexCache::Save(const ccPointCloud* cloud, const ccOctree& octree, const QByteArray& hash, const QString& filename)
+{
+	if (!cloud || filename.isEmpty())
+	{
+		assert(false);
+		return false;
+	}
+
+	const CCCoreLib::DgmOctree::cellsContainer& pointsAndCodes = octree.pointsAndTheirCellCodes();
+	if (pointsAndCodes.empty())
+	{
+		return false;
+	}
+
+	QFile file(filename);
+	if (!file.open(QFile::WriteOnly))
+	{
+		ccLog::Warning(QString("[3DMASC] Can't write spatial index file '%1'").arg(filename));
+		return false;
+	}
+
+	CCVector3 pointsMin, pointsMax;
+	const_cast<ccPointCloud*>(cloud)->getBoundingBox(pointsMin, pointsMax);
+	CCVector3 dimMin, dimMax;
+	octree.getBoundingBox(dimMin, dimMax);
+
+	QDataStream stream(&file);
+	stream << s_magic << s_version;
+	stream << static_cast<quint32>(sizeof(CCCoreLib::DgmOctree::IndexAndCode));
+	stream << hash;
+	stream << static_cast<quint32>(cloud->size());
+	WriteVector(stream, pointsMin);
+	WriteVector(stream, pointsMax);
+	WriteVector(stream, dimMin);
+	WriteVector(stream, dimMax);
+	stream << static_cast<quint32>(pointsAndCodes.size());
+
+	//the codes are written 'as is'
+	qint64 byteCount = static_cast<qint64>(pointsAndCodes.size()) * static_cast<qint64>(sizeof(CCCoreLib::DgmOctree::IndexAndCode));
+	if (!WriteRawData(stream, reinterpret_cast<const char*>(pointsAndCodes.data()), byteCount)
+		|| stream.status() != QDataStream::Ok)
+	{
+		ccLog::Warning(QString("[3DMASC] Failed to write spatial index file '%1'").arg(filename));
+		file.close();
+		file.remove();
+		return false;
+	}
+
+	return true;
+}
+
+ccOctree::Shared SpatialIndexCache::Load(ccPointCloud* cloud, const QByteArray& hash, const QString& filename)
+{
+	if (!cloud || filename.isEmpty() || !QFileInfo::exists(filename))
+	{
+		return ccOctree::Shared();
+	}
+
+	QFile file(filename);
+	if (!file.open(QFile::ReadOnly))
+	{
+		return ccOctree::Shared();
+	}
+
+	QDataStream stream(&file);
+	quint32 magic = 0;
+	quint16 version = 0;
+	quint32 codeSize = 0;
+	stream >> magic >> version >> codeSize;
+	if (magic != s_magic || version != s_version || codeSize != sizeof(CCCoreLib::DgmOctree::IndexAndCode))
+	{
+		ccLog::Warning(QString("[3DMASC] Spatial index file '%1' is not compatible (it will be replaced)").arg(filename));
+		return ccOctree::Shared();
+	}
+
+	QByteArray fileHash;
+	quint32 pointCount = 0;
+	stream >> fileHash >> pointCount;
+	CCVector3 pointsMin = ReadVector(stream);
+	CCVector3 pointsMax = ReadVector(stream);
+	CCVector3 dimMin = ReadVector(stream);
+	CCVector3 dimMax = ReadVector(stream);
+	quint32 codeCount = 0;
+	stream >> codeCount;
+
+	//check that the sidecar corresponds to the cloud
+	CCVector3 bbMin, bbMax;
+	cloud->getBoundingBox(bbMin, bbMax);
+	if (	stream.status() != QDataStream::Ok
+		||	pointCount != cloud->size()
+		||	codeCount == 0
+		||	codeCount > pointCount
+		||	fileHash != hash
+		||	!SameVector(bbMin, pointsMin)
+		||	!SameVector(bbMax, pointsMax))
+	{
+		ccLog::Warning(QString("[3DMASC] Spatial index file '%1' doesn't match the cloud (it will be replaced)").arg(filename));
+		return ccOctree::Shared();
+	}
+
+	CCCoreLib::DgmOctree::cellsContainer pointsAndCodes;
+	try
+	{
+		pointsAndCodes.resize(codeCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		ccLog::Warning("[3DMASC] Not enough memory to load the spatial index");
+		return ccOctree::Shared();
+	}
+
+	qint64 byteCount = static_cast<qint64>(pointsAndCodes.size()) * static_cast<qint64>(sizeof(CCCoreLib::DgmOctree::IndexAndCode));
+	if (!ReadRawData(stream, reinterpret_cast<char*>(pointsAndCodes.data()), byteCount))
+	{
+		ccLog::Warning(QString("[3DMASC] Spatial index file '%1' is truncated (it will be replaced)").arg(filename));
+		return ccOctree::Shared();
+	}
+
+	QSharedPointer<RestoredOctree> octree(new RestoredOctree(cloud));
+	if (!octree->restore(pointsMin, pointsMax, dimMin, dimMax, pointsAndCodes))
+	{
+		return ccOctree::Shared();
+	}
+
+	cloud->setOctree(octree);
+	return octree;
+}
+
+ccOctree::Shared SpatialIndexCache::GetOctree(ccPointCloud* cloud, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return ccOctree::Shared();
+	}
+
+	ccOctree::Shared octree = cloud->getOctree();
+	if (octree)
+	{
+		//nothing to do
+		return octree;
+	}
+
+	QString sidecarFilename = GetSidecarFilename(cloud);
+	QByteArray hash;
+	if (!sidecarFilename.isEmpty())
+	{
+		QElapsedTimer timer;
+		timer.start();
+		hash = ComputeHash(cloud);
+
+		octree = Load(cloud, hash, sidecarFilename);
+		if (octree)
+		{
+			ccLog::Print(QString("[3DMASC] Octree of cloud %1 loaded from '%2' (%3 s.)").arg(cloud->getName()).arg(sidecarFilename).arg(timer.elapsed() / 1000.0, 0, 'f', 1));
+			return octree;
+		}
+	}
+
+	octree = cloud->computeOctree(progressCb);
+	if (!octree)
+	{
+		return octree;
+	}
+
+	if (!sidecarFilename.isEmpty())
+	{
+		if (Save(cloud, *octree, hash, sidecarFilename))
+		{
+			ccLog::Print(QString("[3DMASC] Octree of cloud %1 saved in '%2'").arg(cloud->getName()).arg(sidecarFilename));
+		}
+	}
+
+	return octree;
+}
+
+static QSharedPointer<SpatialIndexCache::ClassIndex> BuildClassIndex(ccPointCloud* cloud, const CCCoreLib::ScalarField* classificationSF, int classLabel, CCCoreLib::GenericProgressCallback* progressCb)
+{
+	QSharedPointer<SpatialIndexCache::ClassIndex> classIndex(new SpatialIndexCache::ClassIndex);
+	classIndex->sourceSize = cloud->size();
+	classIndex->sourceSF = classificationSF;
+
+	const ScalarType fClass = static_cast<ScalarType>(classLabel);
+	unsigned classCount = 0;
+	for (unsigned i = 0; i < classificationSF->size(); ++i)
+	{
+		if (classificationSF->getValue(i) == fClass)
+			++classCount;
+	}
+	if (classCount == 0)
+	{
+		//nothing to index
+		return classIndex;
+	}
+
+	if (!classIndex->cloud.reserve(classCount))
+	{
+		return {};
+	}
+	for (unsigned i = 0; i < classificationSF->size(); ++i)
+	{
+		if (classificationSF->getValue(i) == fClass)
+		{
+			classIndex->cloud.addPoint(*cloud->getPoint(i));
+		}
+	}
+
+	//compute the octree (or load it from the cloud sidecar)
+	QString source = SpatialIndexCache::GetSource(cloud);
+	if (!source.isEmpty())
+	{
+		SpatialIndexCache::SetSource(&classIndex->cloud, source + QString("_class%1").arg(classLabel));
+	}
+	ccLog::Print(QString("Computing octree of class %1 points (%2 points)").arg(classLabel).arg(classCount));
+	classIndex->octree = SpatialIndexCache::GetOctree(&classIndex->cloud, progressCb);
+	if (!classIndex->octree)
+	{
+		return {};
+	}
+
+	return classIndex;
+}
+
+QSharedPointer<SpatialIndexCache::ClassIndex> SpatialIndexCache::GetClassIndex(ccPointCloud* cloud, const CCCoreLib::ScalarField* classificationSF, int classLabel, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (!cloud || !classificationSF || classificationSF->size() < cloud->size())
+	{
+		assert(false);
+		return {};
+	}
+
+	if (!cloud->hasMetaData(s_shareClassIndexesMetaDataKey))
+	{
+		return BuildClassIndex(cloud, classificationSF, classLabel, progressCb);
+	}
+
+	//(the lock is kept while the index is built, so that it is only built once)
+	QMutexLocker locker(&s_classIndexesMutex);
+	QPair<unsigned, int> key(cloud->getUniqueID(), classLabel);
+	QSharedPointer<ClassIndex> classIndex = s_classIndexes.value(key);
+	if (classIndex && classIndex->sourceSize == cloud->size() && classIndex->sourceSF == classificationSF)
+	{
+		return classIndex;
+	}
+
+	classIndex = BuildClassIndex(cloud, classificationSF, classLabel, progressCb);
+	if (classIndex)
+	{
+		s_classIndexes.insert(key, classIndex);
+	}
+	return classIndex;
+}
+
+void SpatialIndexCache::ShareClassIndexes(ccPointCloud* cloud, bool state)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return;
+	}
+
+	if (state)
+	{
+		cloud->setMetaData(s_shareClassIndexesMetaDataKey, true);
+	}
+	else
+	{
+		cloud->removeMetaData(s_shareClassIndexesMetaDataKey);
+		ReleaseClassIndexes(cloud);
+	}
+}
+
+void SpatialIndexCache::ReleaseClassIndexes(const ccPointCloud* cloud)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return;
+	}
+
+	QMutexLocker locker(&s_classIndexesMutex);
+	for (auto it = s_classIndexes.begin(); it != s_classIndexes.end(); )
+	{
+		if (it.key().first == cloud->getUniqueID())
+			it = s_classIndexes.erase(it);
+		else
+			++it;
+	}
+}
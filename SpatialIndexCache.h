@@ -0,0 +1,103 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//qCC_db
+#include <ccOctree.h>
+#include <ccPointCloud.h>
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+
+namespace masc
+{
+	//! Spatial index (octree) sidecar files
+	/** The octree of a cloud is saved next to its source file (<source>.3dmasc_idx)
+		so that it can be re-used by the next runs. The sidecar is validated with
+		the number of points, the bounding-box and a hash of the point coordinates.
+	**/
+	class SpatialIndexCache
+	{
+	public:
+
+		//! Sidecar file extension
+		static QString Extension() { return "3dmasc_idx"; }
+
+		//! Associates a sidecar base filename to a cloud (typically its source file)
+		/** The association is ignored if the number of points of the cloud changes
+			(e.g. for the partial clones, that inherit the meta-data).
+		**/
+		static void SetSource(ccPointCloud* cloud, const QString& baseFilename);
+
+		//! Returns the sidecar base filename associated to a cloud (if any)
+		static QString GetSource(const ccPointCloud* cloud);
+
+		//! Returns the sidecar filename associated to a cloud (if any)
+		static QString GetSidecarFilename(const ccPointCloud* cloud);
+
+		//! Returns the octree of a cloud
+		/** If the cloud has no octree yet, it is loaded from the sidecar file
+			(if valid), or computed and then saved in the sidecar file.
+		**/
+		static ccOctree::Shared GetOctree(ccPointCloud* cloud, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Saves the octree of a cloud
+		static bool Save(const ccPointCloud* cloud, const ccOctree& octree, const QByteArray& hash, const QString& filename);
+
+		//! Loads the octree of a cloud (returns a null pointer if the file is missing or doesn't match the cloud)
+		static ccOctree::Shared Load(ccPointCloud* cloud, const QByteArray& hash, const QString& filename);
+
+		//! Computes the hash of the cloud points
+		static QByteArray ComputeHash(const ccPointCloud* cloud);
+
+		//! Points of a given class of a (context) cloud, with their octree
+		/** Shared indexes are used by several threads: they must be considered as read-only.
+		**/
+		struct ClassIndex
+		{
+			ClassIndex() : cloud("class index") {}
+
+			//! Points of the class
+			ccPointCloud cloud;
+			//! Octree of the class points (null if there's no such point)
+			ccOctree::Shared octree;
+			//! Size of the source cloud (to detect changes)
+			unsigned sourceSize = 0;
+			//! Classification field of the source cloud (to detect changes)
+			const CCCoreLib::ScalarField* sourceSF = nullptr;
+		};
+
+		//! Returns the index of the points of a given class
+		/** If the class indexes of the cloud are shared (see ShareClassIndexes), the index is
+			only built once and then re-used. Otherwise a new index is built at each call.
+			\return the index (or a null pointer if not enough memory)
+		**/
+		static QSharedPointer<ClassIndex> GetClassIndex(ccPointCloud* cloud, const CCCoreLib::ScalarField* classificationSF, int classLabel, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Sets whether the class indexes of a cloud are kept and shared (e.g. a context cloud re-used for many tiles)
+		static void ShareClassIndexes(ccPointCloud* cloud, bool state);
+
+		//! Releases the shared class indexes of a cloud
+		static void ReleaseClassIndexes(const ccPointCloud* cloud);
+	};
+}
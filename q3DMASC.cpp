@@ -24,9 +24,11 @@
 #include "qClassify3DMASCDialog.h"
 #include "qTrain3DMASCDialog.h"
 #include "q3DMASCCommands.h"
+#include "SpatialIndexCache.h"
 
 //qCC_db
 #include <ccPointCloud.h>
+#include <ccPolyline.h>
 #include <ccProgressDialog.h>
 
 //Qt
@@ -35,7 +37,15 @@
 #include <QApplication>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QSettings>
+#include <QtConcurrent>
+
+//system
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
 
 q3DMASCPlugin::q3DMASCPlugin(QObject* parent/*=0*/)
 	: QObject(parent)
@@ -88,6 +98,168 @@ QList<QAction*> q3DMASCPlugin::getActions()
 	return group;
 }
 
+//! Classifies a cloud by growing random batches, updating the classification fields after each batch
+/** The first batch gives a quick preview of the result. The user can stop the process at any time
+	(the points that are not classified yet keep a NaN class).
+**/
+static bool ClassifyProgressively(	ccMainAppInterface* app,
+									const QString& classifierFilename,
+									masc::Tools::NamedClouds& clouds,
+									const masc::CorePoints& corePoints,
+									masc::Classifier& classifier,
+									double firstBatchRatio,
+									QString& error)
+{
+	ccPointCloud* cloud = corePoints.origin;
+	if (!app || !cloud || firstBatchRatio <= 0.0)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+	unsigned pointCount = cloud->size();
+
+	//random order of the points
+	std::vector<unsigned> order;
+	try
+	{
+		order.resize(pointCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	std::iota(order.begin(), order.end(), 0u);
+	std::shuffle(order.begin(), order.end(), std::mt19937(0));
+
+	CCCoreLib::ScalarField* classificationSF = nullptr;
+	CCCoreLib::ScalarField* confidenceSF = nullptr;
+	if (!masc::Tools::CreateClassificationSFs(cloud, classificationSF, confidenceSF))
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	cloud->setCurrentDisplayedScalarField(cloud->getScalarFieldIndexByName(classificationSF->getName()));
+	cloud->showSF(true);
+
+	//the clouds used by the features (they will be read by the background thread)
+	std::vector<ccPointCloud*> usedClouds(1, cloud);
+	for (ccPointCloud* pc : clouds)
+	{
+		if (pc && std::find(usedClouds.begin(), usedClouds.end(), pc) == usedClouds.end())
+		{
+			usedClouds.push_back(pc);
+		}
+	}
+
+	//the octrees are computed (or loaded) beforehand, in the main thread
+	{
+		ccProgressDialog pDlg(true, app->getMainWindow());
+		for (ccPointCloud* pc : usedClouds)
+		{
+			if (!masc::SpatialIndexCache::GetOctree(pc, &pDlg))
+			{
+				error = QString("Failed to compute the octree of cloud %1").arg(pc->getName());
+				return false;
+			}
+		}
+	}
+
+	//the dialog is not modal so that the user can look at the preview
+	QProgressDialog progressDlg("Progressive classification", "Stop", 0, 100, app->getMainWindow());
+	progressDlg.setWindowTitle("3DMASC");
+	progressDlg.setWindowModality(Qt::NonModal);
+	progressDlg.setAutoReset(false);
+	progressDlg.setAutoClose(false);
+	progressDlg.show();
+
+	//the clouds shouldn't be deleted or modified in the meantime
+	std::vector<bool> wasLocked(usedClouds.size());
+	for (size_t i = 0; i < usedClouds.size(); ++i)
+	{
+		wasLocked[i] = usedClouds[i]->isLocked();
+		usedClouds[i]->setLocked(true);
+	}
+
+	bool success = true;
+	bool stopped = false;
+	size_t classifiedCount = 0;
+	double ratio = firstBatchRatio;
+	while (classifiedCount < pointCount && !stopped)
+	{
+		size_t targetCount = (ratio >= 1.0 ? pointCount : std::max(classifiedCount + 1, static_cast<size_t>(std::ceil(ratio * pointCount))));
+		std::vector<unsigned> batch(order.begin() + classifiedCount, order.begin() + targetCount);
+		std::sort(batch.begin(), batch.end());
+
+		//each batch needs its own features (a feature can only be prepared once)
+		masc::Feature::Set batchFeatures;
+		if (!masc::Tools::LoadFile(classifierFilename, &clouds, true, &batchFeatures))
+		{
+			error = "Failed to load the features";
+			success = false;
+			break;
+		}
+		masc::Tools::FlagUnusedFeatures(batchFeatures, classifier);
+
+		progressDlg.setLabelText(QString("Classifying %1 more points (%2% of the cloud)...\nStop whenever the preview is good enough").arg(batch.size()).arg((100.0 * targetCount) / pointCount, 0, 'f', 1));
+
+		//the batch is processed in a background thread
+		std::vector<ScalarType> labels, confidences;
+		QString batchError;
+		QFuture<bool> future = QtConcurrent::run([&]()
+		{
+			return masc::Tools::ClassifySelection(cloud, corePoints.role, batch, batchFeatures, classifier, labels, confidences, batchError);
+		});
+		while (!future.isFinished())
+		{
+			QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+			if (progressDlg.wasCanceled())
+			{
+				//the current batch can't be interrupted
+				stopped = true;
+			}
+			QThread::msleep(20);
+		}
+		if (!future.result())
+		{
+			error = batchError;
+			success = false;
+			break;
+		}
+
+		//update the fields in place
+		for (size_t j = 0; j < batch.size(); ++j)
+		{
+			classificationSF->setValue(batch[j], labels[j]);
+			confidenceSF->setValue(batch[j], confidences[j]);
+		}
+		classificationSF->computeMinAndMax();
+		confidenceSF->computeMinAndMax();
+		cloud->redrawDisplay();
+		app->redrawAll();
+
+		classifiedCount = targetCount;
+		progressDlg.setValue(static_cast<int>((100.0 * classifiedCount) / pointCount));
+		app->dispToConsole(QString("[3DMASC] Progressive classification: %1 / %2 points classified").arg(classifiedCount).arg(pointCount), ccMainAppInterface::STD_CONSOLE_MESSAGE);
+
+		ratio *= 4.0;
+	}
+
+	for (size_t i = 0; i < usedClouds.size(); ++i)
+	{
+		usedClouds[i]->setLocked(wasLocked[i]);
+	}
+	progressDlg.close();
+
+	if (success && classifiedCount < pointCount)
+	{
+		app->dispToConsole(QString("[3DMASC] Progressive classification stopped: %1 points are not classified (NaN)").arg(pointCount - classifiedCount), ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+	}
+
+	return success;
+}
+
 void q3DMASCPlugin::doClassifyAction()
 {
 	if (!m_app)
@@ -143,6 +315,26 @@ void q3DMASCPlugin::doClassifyAction()
 	classifDlg.classifierFileLineEdit->setText(inputFilename);
 	classifDlg.testCloudComboBox->hide();
 	classifDlg.testLabel->hide();
+	for (ccHObject* entity : m_selectedEntities)
+	{
+		//a selected polyline can be used as region of interest
+		if (entity->isA(CC_TYPES::POLY_LINE))
+		{
+			ccPolyline* poly = static_cast<ccPolyline*>(entity);
+			masc::RegionOfInterest roi;
+			roi.type = masc::RegionOfInterest::POLYGON;
+			for (unsigned i = 0; i < poly->size(); ++i)
+			{
+				CCVector3d P = poly->toGlobal3d(*poly->getPoint(i));
+				roi.polygon.push_back(CCVector2d(P.x, P.y));
+			}
+			if (roi.polygon.size() >= 3)
+			{
+				classifDlg.roiLineEdit->setText(roi.toString());
+			}
+			break;
+		}
+	}
 	if (!classifDlg.exec())
 	{
 		//process cancelled by the user
@@ -177,34 +369,125 @@ void q3DMASCPlugin::doClassifyAction()
 	corePoints.origin = corePoints.cloud = clouds[mainCloudLabel];
 	corePoints.role = mainCloudLabel;
 
+	//region of interest
+	if (classifDlg.roiCheckBox->isChecked())
+	{
+		masc::RegionOfInterest roi;
+		QString errorMessage;
+		if (!masc::RegionOfInterest::FromString(classifDlg.roiLineEdit->text(), roi, errorMessage))
+		{
+			m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+			return;
+		}
+
+		ccProgressDialog progressDlg(true, m_app->getMainWindow());
+		progressDlg.setAutoClose(false);
+		bool success = masc::Tools::ClassifyRegionOfInterest(inputFilename, roi, clouds, mainCloudLabel, classifier, errorMessage, &progressDlg, m_app->getMainWindow());
+		progressDlg.close();
+		if (!success)
+		{
+			m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+		}
+		corePoints.origin->redrawDisplay();
+		m_app->redrawAll();
+		return;
+	}
+
+	//progressive preview
+	if (classifDlg.progressiveCheckBox->isChecked())
+	{
+		if (classifDlg.propagateCheckBox->isChecked() || classifier.hasCascade())
+		{
+			m_app->dispToConsole("[3DMASC] Progressive preview: all the points are classified by the full classifier (core points/cascade are ignored)", ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+		}
+		QString errorMessage;
+		if (!ClassifyProgressively(m_app, inputFilename, clouds, corePoints, classifier, classifDlg.progressiveRatioSpinBox->value() / 100.0, errorMessage))
+		{
+			m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+		}
+		m_app->redrawAll();
+		return;
+	}
+
 	//prepare the main cloud
 	ccProgressDialog progressDlg(true, m_app->getMainWindow());
 	progressDlg.show();
 	progressDlg.setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
 	QString error;
 	SFCollector generatedScalarFields;
-    if (!masc::Tools::PrepareFeatures(corePoints, features, error, &progressDlg, &generatedScalarFields))
+
+	//classify the core points only? (their classes are then propagated to the whole cloud)
+	masc::PropagationParameters propagationParams;
+	masc::Feature::Set refinementFeatures;
+	if (classifDlg.propagateCheckBox->isChecked())
 	{
-		m_app->dispToConsole(error, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-		generatedScalarFields.releaseSFs(false);
-		return;
+		if (!masc::Tools::LoadCorePointsSelection(inputFilename, clouds, corePoints, &progressDlg))
+		{
+			m_app->dispToConsole("Failed to compute/prepare the core points!", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+			return;
+		}
+		if (corePoints.cloud == corePoints.origin)
+		{
+			m_app->dispToConsole("[3DMASC] The propagation requires a subsampled core points definition in the classifier file (e.g. 'core_points: PC1_SS_S0.5'): all the points will be classified", ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+		}
+
+		propagationParams.k = classifDlg.propagationKSpinBox->value();
+		propagationParams.refineBoundaries = classifDlg.refineBoundariesCheckBox->isChecked();
+		if (corePoints.cloud != corePoints.origin && propagationParams.refineBoundaries)
+		{
+			//the boundary points need their own features (a feature can only be prepared once)
+			if (!masc::Tools::LoadFile(inputFilename, &clouds, true, &refinementFeatures, nullptr, nullptr, nullptr, nullptr, m_app->getMainWindow()))
+			{
+				delete corePoints.cloud;
+				return;
+			}
+			masc::Tools::FlagUnusedFeatures(refinementFeatures, classifier);
+		}
 	}
-	progressDlg.close();
-	QCoreApplication::processEvents();
 
-	//apply classifier
+	bool success = false;
+	if (classifier.hasCascade())
 	{
-		QString errorMessage;
+		//the features are computed on the fly (only for the uncertain points for the expensive ones)
+		success = masc::Tools::ClassifyCascade(corePoints, features, classifier, error, &progressDlg, &generatedScalarFields, m_app->getMainWindow());
+	}
+	else if (masc::Tools::PrepareFeatures(corePoints, features, error, &progressDlg, &generatedScalarFields))
+	{
+		//apply classifier
 		masc::Feature::Source::Set featureSources;
 		masc::Feature::ExtractSources(features, featureSources);
-		if (!classifier.classify(featureSources, corePoints.cloud, errorMessage, m_app->getMainWindow()))
+		success = classifier.classify(featureSources, corePoints.cloud, error, m_app->getMainWindow());
+	}
+
+	if (success && corePoints.cloud != corePoints.origin)
+	{
+		success = masc::Tools::PropagateClassification(corePoints, propagationParams, error, &refinementFeatures, &classifier, &progressDlg, m_app->getMainWindow());
+	}
+	progressDlg.close();
+	QCoreApplication::processEvents();
+
+	if (!success)
+	{
+		m_app->dispToConsole(error, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+	}
+	generatedScalarFields.releaseSFs(success && s_keepAttributes);
+
+	if (corePoints.cloud != corePoints.origin)
+	{
+		if (success)
 		{
-			m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
-			generatedScalarFields.releaseSFs(false);
-			return;
+			//keep the classified core points (hidden) for inspection
+			corePoints.cloud->setName(QString("Core points (%1)").arg(corePoints.origin->getName()));
+			corePoints.cloud->setEnabled(false);
+			corePoints.origin->addChild(corePoints.cloud);
+			m_app->addToDB(corePoints.cloud, false, true, false, false);
+			corePoints.origin->redrawDisplay();
 		}
-
-		generatedScalarFields.releaseSFs(s_keepAttributes);
+		else
+		{
+			delete corePoints.cloud;
+		}
+		corePoints.cloud = nullptr;
 	}
 }
 
@@ -224,6 +507,16 @@ void q3DMASCPlugin::saveTrainParameters(const masc::TrainParameters& params)
 	settings.setValue("TrainParameters/minSampleCount", params.rt.minSampleCount);
 	settings.setValue("TrainParameters/activeVarCount", params.rt.activeVarCount);
 	settings.setValue("TrainParameters/maxTreeCount", params.rt.maxTreeCount);
+	settings.setValue("TrainParameters/nativeTrainer", params.rt.nativeTrainer);
+	settings.setValue("TrainParameters/histogramBinning", params.rt.histogramBinning);
+	settings.setValue("TrainParameters/maxSamplesPerClass", params.maxSamplesPerClass);
+	settings.setValue("TrainParameters/seed", params.seed);
+	settings.setValue("TrainParameters/outOfBag", params.outOfBag);
+	settings.setValue("TrainParameters/compressForest", params.compressForest);
+	settings.setValue("TrainParameters/compressionTolerance", params.compressionTolerance);
+	settings.setValue("TrainParameters/cascade", params.cascade);
+	settings.setValue("TrainParameters/cascadeMaxScale", params.cascadeMaxScale);
+	settings.setValue("TrainParameters/cascadeThreshold", params.cascadeThreshold);
 }
 
 void q3DMASCPlugin::loadTrainParameters(masc::TrainParameters& params)
@@ -233,6 +526,16 @@ void q3DMASCPlugin::loadTrainParameters(masc::TrainParameters& params)
 	params.rt.minSampleCount = settings.value("TrainParameters/minSampleCount", 10).toInt();
 	params.rt.activeVarCount = settings.value("TrainParameters/activeVarCount", 0).toInt();
 	params.rt.maxTreeCount = settings.value("TrainParameters/maxTreeCount", 100).toInt();
+	params.rt.nativeTrainer = settings.value("TrainParameters/nativeTrainer", false).toBool();
+	params.rt.histogramBinning = settings.value("TrainParameters/histogramBinning", false).toBool();
+	params.maxSamplesPerClass = settings.value("TrainParameters/maxSamplesPerClass", 0).toInt();
+	params.seed = settings.value("TrainParameters/seed", 0).toUInt();
+	params.outOfBag = settings.value("TrainParameters/outOfBag", false).toBool();
+	params.compressForest = settings.value("TrainParameters/compressForest", false).toBool();
+	params.compressionTolerance = settings.value("TrainParameters/compressionTolerance", 0.005).toDouble();
+	params.cascade = settings.value("TrainParameters/cascade", false).toBool();
+	params.cascadeMaxScale = settings.value("TrainParameters/cascadeMaxScale", 1.0).toDouble();
+	params.cascadeThreshold = settings.value("TrainParameters/cascadeThreshold", 0.8).toFloat();
 }
 
 void q3DMASCPlugin::doTrainAction()
@@ -385,8 +688,17 @@ void q3DMASCPlugin::doTrainAction()
 	trainDlg.maxTreeCountSpinBox->setValue(s_params.rt.maxTreeCount);
 	trainDlg.activeVarCountSpinBox->setValue(s_params.rt.activeVarCount);
 	trainDlg.minSampleCountSpinBox->setValue(s_params.rt.minSampleCount);
+	trainDlg.nativeTrainerCheckBox->setChecked(s_params.rt.nativeTrainer);
+	trainDlg.histogramBinningCheckBox->setChecked(s_params.rt.histogramBinning);
 	trainDlg.testDataRatioSpinBox->setValue(static_cast<int>(s_params.testDataRatio * 100));
 	trainDlg.testDataRatioSpinBox->setEnabled(testCloud == nullptr);
+	trainDlg.maxSamplesPerClassSpinBox->setValue(s_params.maxSamplesPerClass);
+	trainDlg.outOfBagCheckBox->setChecked(s_params.outOfBag);
+	trainDlg.compressCheckBox->setChecked(s_params.compressForest);
+	trainDlg.compressionToleranceSpinBox->setValue(s_params.compressionTolerance * 100);
+	trainDlg.cascadeCheckBox->setChecked(s_params.cascade);
+	trainDlg.cascadeMaxScaleSpinBox->setValue(s_params.cascadeMaxScale);
+	trainDlg.cascadeThresholdSpinBox->setValue(s_params.cascadeThreshold);
 	trainDlg.setInputFilePath(inputFilename);
 
 	//display the loaded features and let the user select the ones to use
@@ -470,6 +782,7 @@ void q3DMASCPlugin::doTrainAction()
 	//train / test subsets
 	QSharedPointer<CCCoreLib::ReferenceCloud> trainSubset, testSubset;
 	float previousTestSubsetRatio = -1.0f;
+	int previousMaxSamplesPerClass = -1;
 	SFCollector generatedScalarFields, generatedScalarFieldsTest;
 
 	//we will train + evaluate the classifier, then display the results
@@ -531,12 +844,29 @@ void q3DMASCPlugin::doTrainAction()
 			s_params.rt.maxTreeCount = trainDlg.maxTreeCountSpinBox->value();
 			s_params.rt.activeVarCount = trainDlg.activeVarCountSpinBox->value();
 			s_params.rt.minSampleCount = trainDlg.minSampleCountSpinBox->value();
+			s_params.rt.nativeTrainer = trainDlg.nativeTrainerCheckBox->isChecked();
+			s_params.rt.histogramBinning = trainDlg.histogramBinningCheckBox->isChecked();
+			s_params.rt.seed = s_params.seed;
+			s_params.compressForest = trainDlg.compressCheckBox->isChecked();
+			s_params.compressionTolerance = trainDlg.compressionToleranceSpinBox->value() / 100.0;
+			s_params.cascade = trainDlg.cascadeCheckBox->isChecked();
+			s_params.cascadeMaxScale = trainDlg.cascadeMaxScaleSpinBox->value();
+			s_params.cascadeThreshold = static_cast<float>(trainDlg.cascadeThresholdSpinBox->value());
 			float testDataRatio = 0.0f;
+			int maxSamplesPerClass = s_params.maxSamplesPerClass = trainDlg.maxSamplesPerClassSpinBox->value();
+			s_params.outOfBag = trainDlg.outOfBagCheckBox->isChecked();
+			//with the out-of-bag evaluation, all the core points are used for training (if there's no test cloud),
+			//unless the forest is compressed (the compression needs its own held-out points)
+			bool outOfBagEvaluation = (s_params.outOfBag && !testCloud);
 
 			if (!testCloud)
 			{
 				//we need to generate test subsets
 				testDataRatio = s_params.testDataRatio = trainDlg.testDataRatioSpinBox->value() / 100.0f;
+				if (outOfBagEvaluation && !s_params.compressForest)
+				{
+					testDataRatio = 0.0f;
+				}
 				if (testDataRatio < 0.0f || testDataRatio > 0.99f)
 				{
 					assert(false);
@@ -544,7 +874,7 @@ void q3DMASCPlugin::doTrainAction()
 					trainSubset.clear();
 					testSubset.clear();
 				}
-				else if (previousTestSubsetRatio != testDataRatio)
+				else if (previousTestSubsetRatio != testDataRatio || previousMaxSamplesPerClass != maxSamplesPerClass)
 				{
 					if (!trainSubset)
 						trainSubset.reset(new CCCoreLib::ReferenceCloud(corePoints.cloud));
@@ -554,8 +884,8 @@ void q3DMASCPlugin::doTrainAction()
 						testSubset.reset(new CCCoreLib::ReferenceCloud(corePoints.cloud));
 					testSubset->clear();
 
-					//randomly select the training points
-					if (!masc::Tools::RandomSubset(corePoints.cloud, testDataRatio, testSubset.data(), trainSubset.data()))
+					//randomly select the training points (class by class)
+					if (!masc::Tools::StratifiedSubsets(corePoints.cloud, testDataRatio, maxSamplesPerClass, s_params.seed, testSubset.data(), trainSubset.data()))
 					{
 						m_app->dispToConsole("Not enough memory to generate the test subsets", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 						generatedScalarFields.releaseSFs(false);
@@ -563,7 +893,26 @@ void q3DMASCPlugin::doTrainAction()
 						return;
 					}
 					previousTestSubsetRatio = testDataRatio;
+					previousMaxSamplesPerClass = maxSamplesPerClass;
+				}
+			}
+			else if (previousMaxSamplesPerClass != maxSamplesPerClass)
+			{
+				//no test subset, but the number of training samples per class may be limited
+				testSubset.clear();
+				trainSubset.clear();
+				if (maxSamplesPerClass > 0)
+				{
+					trainSubset.reset(new CCCoreLib::ReferenceCloud(corePoints.cloud));
+					if (!masc::Tools::StratifiedSubsets(corePoints.cloud, 0.0f, maxSamplesPerClass, s_params.seed, nullptr, trainSubset.data()))
+					{
+						m_app->dispToConsole("Not enough memory to generate the training subset", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+						generatedScalarFields.releaseSFs(false);
+						generatedScalarFieldsTest.releaseSFs(false);
+						return;
+					}
 				}
+				previousMaxSamplesPerClass = maxSamplesPerClass;
 			}
 
 			//extract the sources (after having prepared the features!)
@@ -571,6 +920,7 @@ void q3DMASCPlugin::doTrainAction()
 			masc::Feature::ExtractSources(features, featureSources);
 
 			//train the classifier
+			masc::RandomForestTrainer::OutOfBagMetrics outOfBagMetrics;
 			{
 				QString errorMessage;
 				if (!classifier.train(	corePoints.cloud,
@@ -579,7 +929,8 @@ void q3DMASCPlugin::doTrainAction()
 										errorMessage,
 										trainSubset.data(),
 										m_app,
-										m_app->getMainWindow()
+										m_app->getMainWindow(),
+										s_params.outOfBag ? &outOfBagMetrics : nullptr
 									))
 				{
 					m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
@@ -591,6 +942,43 @@ void q3DMASCPlugin::doTrainAction()
 //				trainDlg.shouldSaveClassifier(); // useless?
 			}
 
+			//train the first stage classifier (cascade)
+			if (s_params.cascade)
+			{
+				std::vector<int> cheapIndexes = masc::Tools::CascadeFeatures(features, s_params.cascadeMaxScale);
+				if (cheapIndexes.empty() || cheapIndexes.size() == features.size())
+				{
+					m_app->dispToConsole(QString("Cascade classification ignored: %1 of the selected features are below the max scale").arg(cheapIndexes.empty() ? "none" : "all"), ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+				}
+				else
+				{
+					masc::Feature::Source::Set cheapSources;
+					for (int index : cheapIndexes)
+					{
+						cheapSources.push_back(featureSources[index]);
+					}
+
+					QSharedPointer<masc::Classifier> stage(new masc::Classifier);
+					QString errorMessage;
+					if (stage->train(	corePoints.cloud,
+										s_params.rt,
+										cheapSources,
+										errorMessage,
+										trainSubset.data(),
+										m_app,
+										m_app->getMainWindow()
+									))
+					{
+						classifier.setCascade(stage, cheapIndexes, s_params.cascadeThreshold);
+						m_app->dispToConsole(QString("[3DMASC] First stage classifier trained on %1 / %2 features").arg(cheapIndexes.size()).arg(features.size()), ccMainAppInterface::STD_CONSOLE_MESSAGE);
+					}
+					else
+					{
+						m_app->dispToConsole("Failed to train the first stage classifier: " + errorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+					}
+				}
+			}
+
 			//test the trained classifier
 			{
 				if (testCloud)
@@ -644,16 +1032,63 @@ void q3DMASCPlugin::doTrainAction()
 					}
 				}
 
+				//the compressed forest is chosen on one half of the held-out points and evaluated on the other half
+				//(so that its reported accuracy is not biased by this choice)
+				ccPointCloud* heldOutCloud = (testCloud ? testCloud : corePoints.cloud);
+				CCCoreLib::ReferenceCloud validationSubset(heldOutCloud), evaluationSubset(heldOutCloud);
+				bool compressForest = s_params.compressForest;
+				if (compressForest)
+				{
+					unsigned heldOutCount = (testCloud ? testCloud->size() : (testSubset ? testSubset->size() : 0));
+					if (heldOutCount < 2)
+					{
+						m_app->dispToConsole("The forest can't be compressed without test data (set a test data ratio)", ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+						compressForest = false;
+					}
+					else if (!masc::Tools::StratifiedSubsets(heldOutCloud, 0.5f, 0, s_params.seed, &evaluationSubset, &validationSubset, testCloud ? nullptr : testSubset.data()))
+					{
+						m_app->dispToConsole("Failed to split the test data: the forest won't be compressed", ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+						compressForest = false;
+					}
+				}
+
 				masc::Classifier::AccuracyMetrics metrics;
 				QString errorMessage;
-				if (!classifier.evaluate(	featureSources,
-											testCloud ? testCloud : corePoints.cloud,
-											metrics,
-											errorMessage,
-											trainDlg,
-											testCloud ? nullptr : testSubset.data(),
-											testCloud ? "Classification_prediction" : "", // outputSFName, empty is the test cloud is not a separate cloud
-											m_app->getMainWindow()))
+				//the out-of-bag metrics may be unavailable (too many trees, or no out-of-bag sample)
+				bool useOutOfBagMetrics = (outOfBagEvaluation && outOfBagMetrics.sampleCount != 0);
+				//without them, the classifier is evaluated on the held-out points if any (or on the training points)
+				CCCoreLib::ReferenceCloud* evaluatedSubset = nullptr;
+				if (!testCloud)
+				{
+					if (!outOfBagEvaluation)
+						evaluatedSubset = testSubset.data();
+					else if (compressForest)
+						evaluatedSubset = &evaluationSubset;
+					else
+						evaluatedSubset = trainSubset.data();
+				}
+				if (outOfBagEvaluation && !useOutOfBagMetrics && !compressForest)
+				{
+					m_app->dispToConsole("No out-of-bag metrics: the classifier is evaluated on the training points instead (the accuracy is optimistic)", ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+				}
+				if (useOutOfBagMetrics)
+				{
+					//no need for a separate evaluation pass
+					metrics.sampleCount = outOfBagMetrics.sampleCount;
+					metrics.goodGuess = outOfBagMetrics.goodGuess;
+					metrics.ratio = outOfBagMetrics.ratio;
+					std::vector<ScalarType> actualClass(outOfBagMetrics.actual.begin(), outOfBagMetrics.actual.end());
+					std::vector<ScalarType> predictedClass(outOfBagMetrics.predicted.begin(), outOfBagMetrics.predicted.end());
+					trainDlg.addConfusionMatrixAndSaveTraces(new ConfusionMatrix(actualClass, predictedClass));
+				}
+				else if (!classifier.evaluate(	featureSources,
+												testCloud ? testCloud : corePoints.cloud,
+												metrics,
+												errorMessage,
+												&trainDlg,
+												evaluatedSubset,
+												testCloud ? "Classification_prediction" : "", // outputSFName, empty is the test cloud is not a separate cloud
+												m_app->getMainWindow()))
 				{
 					m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 					generatedScalarFields.releaseSFs(false);
@@ -661,8 +1096,55 @@ void q3DMASCPlugin::doTrainAction()
 					return;
 				}
 
-				QString resultText = QString("Correct guess = %1 / %2 --> accuracy = %3").arg(metrics.goodGuess).arg(metrics.sampleCount).arg(metrics.ratio);
+				QString resultText = QString("%1Correct guess = %2 / %3 --> accuracy = %4").arg(useOutOfBagMetrics ? "Out-of-bag: " : "").arg(metrics.goodGuess).arg(metrics.sampleCount).arg(metrics.ratio);
 				m_app->dispToConsole(resultText, ccMainAppInterface::STD_CONSOLE_MESSAGE);
+
+				//compress the forest (on the validation half of the held-out points)
+				if (compressForest)
+				{
+					masc::ForestCompression::Parameters compressionParams;
+					compressionParams.tolerance = s_params.compressionTolerance;
+					masc::ForestCompression::Report report;
+					if (!classifier.compress(	featureSources,
+												heldOutCloud,
+												compressionParams,
+												report,
+												errorMessage,
+												&validationSubset,
+												m_app->getMainWindow()))
+					{
+						m_app->dispToConsole("Failed to compress the classifier: " + errorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+					}
+					else
+					{
+						resultText += QString("\nCompressed forest: %1 trees, depth %2, %3 KB (instead of %4 KB), speedup = x%5")
+										.arg(report.treeCount)
+										.arg(report.depth)
+										.arg(report.size / 1024)
+										.arg(report.originalSize / 1024)
+										.arg(report.speedup, 0, 'f', 2);
+
+						//the compressed forest is the one that is saved: it must be evaluated as well
+						masc::Classifier::AccuracyMetrics compressedMetrics;
+						if (classifier.evaluate(featureSources,
+												heldOutCloud,
+												compressedMetrics,
+												errorMessage,
+												&trainDlg,
+												&evaluationSubset,
+												QString(),
+												m_app->getMainWindow()))
+						{
+							QString compressedText = QString("Compressed forest: correct guess = %1 / %2 --> accuracy = %3 (on the test points not used for the compression)").arg(compressedMetrics.goodGuess).arg(compressedMetrics.sampleCount).arg(compressedMetrics.ratio);
+							m_app->dispToConsole(compressedText, ccMainAppInterface::STD_CONSOLE_MESSAGE);
+							resultText += "\n" + compressedText;
+						}
+						else
+						{
+							m_app->dispToConsole("Failed to evaluate the compressed classifier: " + errorMessage, ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+						}
+					}
+				}
 				trainDlg.setResultText(resultText);
 
 				cv::Mat importanceMat = classifier.getVarImportance();
@@ -775,4 +1257,7 @@ void q3DMASCPlugin::registerCommands(ccCommandLineInterface* cmd)
 	}
 	
 	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCClassif));
+	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCServe));
+	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCMergeResults));
+	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCCompress));
 }
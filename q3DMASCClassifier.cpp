@@ -38,10 +38,15 @@
 #include <QProgressDialog>
 #include <QtConcurrent>
 #include <QMessageBox>
+#include <QMutex>
 
 #include "qTrain3DMASCDialog.h"
 #include "confusionmatrix.h"
 
+//system
+#include <atomic>
+#include <cmath>
+
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
@@ -49,7 +54,36 @@
 using namespace masc;
 
 Classifier::Classifier()
+	: m_allowCompiledForest(false)
+	, m_cascadeThreshold(0.0f)
+{
+}
+
+void Classifier::setCascade(QSharedPointer<Classifier> stage, const std::vector<int>& stageFeatures, float threshold)
 {
+	m_cascadeStage = stage;
+	m_cascadeFeatures = stageFeatures;
+	m_cascadeThreshold = threshold;
+}
+
+std::vector<bool> Classifier::usedFeatures() const
+{
+	std::vector<bool> used;
+	if (!isValid())
+	{
+		return used;
+	}
+
+	used.resize(m_rtrees->getVarCount(), false);
+	for (const cv::ml::DTrees::Split& split : m_rtrees->getSplits())
+	{
+		if (split.varIdx >= 0 && split.varIdx < static_cast<int>(used.size()))
+		{
+			used[split.varIdx] = true;
+		}
+	}
+
+	return used;
 }
 
 bool Classifier::isValid() const
@@ -98,11 +132,252 @@ static IScalarFieldWrapper::Shared GetSource(const Feature::Source& fs, const cc
 	case Feature::Source::Blue:
 		source.reset(new ColorScalarFieldWrapper(cloud, ColorScalarFieldWrapper::Blue));
 		break;
+	case Feature::Source::Placeholder:
+		//the values of unused features have no influence on the predictions
+		source.reset(new ConstantScalarFieldWrapper(cloud->size(), 0.0, fs.name));
+		break;
 	}
 
 	return source;
 }
 
+//! Number of samples classified at once
+static const int s_predictionBlockSize = 1024;
+
+//! Prediction of a single sample
+struct Prediction
+{
+	//! Predicted class (max vote)
+	int label = 0;
+	//! Ratio of the trees that voted for the predicted class
+	ScalarType confidence = CCCoreLib::NAN_VALUE;
+	//! Difference between the ratios of votes of the two best classes
+	ScalarType margin = CCCoreLib::NAN_VALUE;
+	//! Number of evaluated trees
+	int treeCount = 0;
+};
+
+//! Inference buffers (re-used from one block to the other)
+struct InferenceBuffers
+{
+	//! OpenCV votes
+	cv::Mat votes;
+	//! Inference engine votes
+	std::vector<int> engineVotes;
+	//! Inference engine working buffer
+	std::vector<uint8_t> engineBuffer;
+	//! Number of evaluated trees per sample (early exit mode)
+	std::vector<int> engineTreeCounts;
+};
+
+//! Deduces the prediction of a sample from the votes of the trees
+static void VotesToPrediction(const int* labels, const int* sampleVotes, int classCount, Prediction& prediction)
+{
+	//same tie-breaking rule as cv::ml::RTrees::predict (first class with the max. number of votes)
+	int bestIndex = 0;
+	int voteCount = sampleVotes[0];
+	int secondBestVoteCount = 0;
+	for (int col = 1; col < classCount; ++col)
+	{
+		voteCount += sampleVotes[col];
+		if (sampleVotes[col] > sampleVotes[bestIndex])
+		{
+			secondBestVoteCount = sampleVotes[bestIndex];
+			bestIndex = col;
+		}
+		else if (sampleVotes[col] > secondBestVoteCount)
+		{
+			secondBestVoteCount = sampleVotes[col];
+		}
+	}
+
+	prediction.label = labels[bestIndex];
+	//the confidence and the margin are relative to the evaluated trees
+	prediction.treeCount = voteCount;
+	if (voteCount > 0)
+	{
+		prediction.confidence = static_cast<ScalarType>(sampleVotes[bestIndex]) / voteCount;
+		prediction.margin = static_cast<ScalarType>(sampleVotes[bestIndex] - secondBestVoteCount) / voteCount;
+	}
+	else
+	{
+		prediction.confidence = prediction.margin = CCCoreLib::NAN_VALUE;
+	}
+}
+
+//! Predicts the class of a block of samples from the votes of the trees
+/** Each sample goes through each tree only once (the predicted class, the
+	confidence and the margin are all deduced from the votes).
+	\param rtrees random trees
+	\param engine inference engine to use instead of the random trees (optional)
+	\param samples block of samples (one per row)
+	\param buffers inference buffers (re-used from one call to the other)
+	\param predictions output predictions (at least as many as samples)
+	\param error error message (if any)
+	\param earlyExit early exit options (only used with an inference engine)
+	\return success
+**/
+static bool PredictBlock(	const cv::ml::RTrees& rtrees,
+							const ForestEngine* engine,
+							const cv::Mat& samples,
+							InferenceBuffers& buffers,
+							Prediction* predictions,
+							QString& error,
+							const EarlyExitOptions& earlyExit = EarlyExitOptions())
+{
+	if (engine)
+	{
+		if (earlyExit.enabled)
+		{
+			engine->getVotes(samples, buffers.engineVotes, buffers.engineBuffer, earlyExit, buffers.engineTreeCounts);
+		}
+		else
+		{
+			engine->getVotes(samples, buffers.engineVotes, buffers.engineBuffer);
+		}
+
+		int classCount = engine->classCount();
+		const int* labels = engine->classLabels().data();
+		for (int i = 0; i < samples.rows; ++i)
+		{
+			VotesToPrediction(labels, buffers.engineVotes.data() + static_cast<size_t>(i) * classCount, classCount, predictions[i]);
+		}
+
+		return true;
+	}
+
+	try
+	{
+		//first row: class labels (sorted), then one row of votes per sample
+		rtrees.getVotes(samples, buffers.votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return false;
+	}
+
+	const cv::Mat& votes = buffers.votes;
+	if (votes.rows != samples.rows + 1 || votes.cols == 0)
+	{
+		assert(false);
+		error = QObject::tr("Invalid votes");
+		return false;
+	}
+
+	const int* labels = votes.ptr<int>(0);
+	for (int i = 0; i < samples.rows; ++i)
+	{
+		VotesToPrediction(labels, votes.ptr<int>(i + 1), votes.cols, predictions[i]);
+	}
+
+	return true;
+}
+
+//! Fills a block of samples with the features of consecutive points
+static void FillBlock(const std::vector< IScalarFieldWrapper::Shared >& wrappers, int firstIndex, cv::Mat& samples)
+{
+	//feature by feature
+	for (int fIndex = 0; fIndex < static_cast<int>(wrappers.size()); ++fIndex)
+	{
+		const IScalarFieldWrapper& wrapper = *wrappers[fIndex];
+		for (int i = 0; i < samples.rows; ++i)
+		{
+			samples.at<float>(i, fIndex) = static_cast<float>(wrapper.pointValue(firstIndex + i));
+		}
+	}
+}
+
+static bool SamePrediction(const Prediction& a, const Prediction& b)
+{
+	return a.label == b.label
+		&& (a.confidence == b.confidence || (std::isnan(a.confidence) && std::isnan(b.confidence)))
+		&& (a.margin == b.margin || (std::isnan(a.margin) && std::isnan(b.margin)));
+}
+
+//! Checks that an inference engine gives strictly the same predictions as OpenCV
+static bool CheckEngine(const cv::ml::RTrees& rtrees, const ForestEngine& engine, const cv::Mat& probeSamples)
+{
+	std::vector<Prediction> cvPredictions, enginePredictions;
+	try
+	{
+		cvPredictions.resize(probeSamples.rows);
+		enginePredictions.resize(probeSamples.rows);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	InferenceBuffers buffers;
+	QString error;
+	if (	!PredictBlock(rtrees, nullptr, probeSamples, buffers, cvPredictions.data(), error)
+		||	!PredictBlock(rtrees, &engine, probeSamples, buffers, enginePredictions.data(), error))
+	{
+		return false;
+	}
+
+	for (int i = 0; i < probeSamples.rows; ++i)
+	{
+		if (!SamePrediction(cvPredictions[i], enginePredictions[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+const ForestEngine* Classifier::prepareInferenceEngine(const cv::Mat& probeSamples)
+{
+	if (!isValid())
+	{
+		return nullptr;
+	}
+
+	if (!m_flatForest.isValid() || m_flatForest.featureCount() != probeSamples.cols)
+	{
+		QString error;
+		if (!m_flatForest.build(*m_rtrees, probeSamples.cols, error))
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] Fast inference can't be used (%1), OpenCV will be used instead").arg(error));
+			m_compiledForest.unload();
+			return nullptr;
+		}
+		m_flatForest.setQuantization(m_flatForest.bestQuantization());
+		
+		ccLog::Print(QObject::tr("[3DMASC] Flattened forest: %1 trees, %2 nodes, %3 classes (%4 bits features)")
+						.arg(m_flatForest.treeCount())
+						.arg(m_flatForest.nodeCount())
+						.arg(m_flatForest.classCount())
+						.arg(m_flatForest.quantization() == FlatForest::Bins8 ? 8 : m_flatForest.quantization() == FlatForest::Bins16 ? 16 : 32));
+	}
+
+	//the compiled forest (if any) must have been generated from the same forest
+	if (m_compiledForest.isValid())
+	{
+		if (	m_compiledForest.signature() == m_flatForest.signature()
+			&&	m_compiledForest.featureCount() == probeSamples.cols
+			&&	CheckEngine(*m_rtrees, m_compiledForest, probeSamples))
+		{
+			return &m_compiledForest;
+		}
+
+		ccLog::Warning(QObject::tr("[3DMASC] Compiled forest '%1' doesn't match the classifier, it will be ignored").arg(m_compiledForest.filename()));
+		m_compiledForest.unload();
+	}
+
+	//check that the predictions are strictly identical to OpenCV's ones
+	if (!CheckEngine(*m_rtrees, m_flatForest, probeSamples))
+	{
+		ccLog::Warning(QObject::tr("[3DMASC] Fast inference doesn't match OpenCV, OpenCV will be used instead"));
+		m_flatForest.clear();
+		return nullptr;
+	}
+
+	return &m_flatForest;
+}
+
 bool Classifier::classify(	const Feature::Source::Set& featureSources,
 							ccPointCloud* cloud,
 							QString& errorMessage,
@@ -135,6 +410,24 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 	cvConfidenceIdx = cloud->addScalarField("Classification_confidence");
 	ccScalarField* cvConfidenceSF = static_cast<ccScalarField*>(cloud->getScalarField(cvConfidenceIdx));
 
+	// add a Classification_margin value (difference between the two best classes)
+	int cvMarginIdx = cloud->getScalarFieldIndexByName("Classification_margin");
+	if (cvMarginIdx >= 0) // if the scalar field exists, delete it
+		cloud->deleteScalarField(cvMarginIdx);
+	cvMarginIdx = cloud->addScalarField("Classification_margin");
+	ccScalarField* cvMarginSF = static_cast<ccScalarField*>(cloud->getScalarField(cvMarginIdx));
+
+	// add a Classification_tree_count value (number of evaluated trees) in early exit mode
+	int treeCountIdx = cloud->getScalarFieldIndexByName("Classification_tree_count");
+	if (treeCountIdx >= 0) // if the scalar field exists, delete it
+		cloud->deleteScalarField(treeCountIdx);
+	ccScalarField* treeCountSF = nullptr;
+	if (m_earlyExit.enabled)
+	{
+		treeCountIdx = cloud->addScalarField("Classification_tree_count");
+		treeCountSF = static_cast<ccScalarField*>(cloud->getScalarField(treeCountIdx));
+	}
+
 	//look for the classification field
 	CCCoreLib::ScalarField* classificationSF = Tools::GetClassificationSF(cloud);
 	ccScalarField* classifSFBackup = nullptr;
@@ -200,65 +493,145 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 	}
 	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), cloud->size());
 
-	bool success = true;
-	int numberOfTrees = static_cast<int>(m_rtrees->getRoots().size());
+	//prepare the fast inference engine (checked on the first points)
+	const ForestEngine* engine = nullptr;
+	{
+		cv::Mat probe;
+		try
+		{
+			probe.create(std::min(s_predictionBlockSize, sampleCount), attributesPerSample, CV_32FC1);
+		}
+		catch (const cv::Exception& cvex)
+		{
+			errorMessage = cvex.msg.c_str();
+			return false;
+		}
+		FillBlock(wrappers, 0, probe);
+
+		engine = prepareInferenceEngine(probe);
+	}
+
+	if (m_earlyExit.enabled)
+	{
+		if (engine)
+		{
+			ccLog::Print(QObject::tr("[3DMASC] Early exit enabled (confidence threshold: %1, after at least %2 trees)").arg(m_earlyExit.confidence).arg(m_earlyExit.minTreeCount));
+		}
+		else
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] Early exit is not supported by OpenCV, all the trees will be evaluated"));
+		}
+	}
+	double evaluatedTreeCount = 0.0;
+
+	std::atomic<bool> success(true);
+	QMutex mutex;
+	int blockCount = (sampleCount + s_predictionBlockSize - 1) / s_predictionBlockSize;
+	const cv::ml::RTrees& rtrees = *m_rtrees;
 #ifndef _DEBUG
 #if defined(_OPENMP)
-	omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
+#pragma omp parallel num_threads(Tools::MaxThreadCount())
 #endif
 #endif
-	for (int i = 0; i < static_cast<int>(cloud->size()); ++i)
 	{
-		//allocate the data matrix
-		cv::Mat test_data;
+		//per-thread buffers (re-used from one block to the other)
+		cv::Mat blockData;
+		InferenceBuffers buffers;
+		std::vector<Prediction> predictions;
 		try
 		{
-			test_data.create(1, attributesPerSample, CV_32FC1);
+			blockData.create(s_predictionBlockSize, attributesPerSample, CV_32FC1);
+			predictions.resize(s_predictionBlockSize);
 		}
 		catch (const cv::Exception& cvex)
 		{
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
 			errorMessage = cvex.msg.c_str();
 			success = false;
-			break;
 		}
-
-		for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+		catch (const std::bad_alloc&)
 		{
-			double value = wrappers[fIndex]->pointValue(i);
-			test_data.at<float>(0, fIndex) = static_cast<float>(value);
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+			errorMessage = QObject::tr("Not enough memory");
+			success = false;
 		}
 
-		float predictedClass = m_rtrees->predict(test_data.row(0), cv::noArray(), cv::ml::DTrees::PREDICT_MAX_VOTE);
-		classificationSF->setValue(i, static_cast<int>(predictedClass));
-		// compute the confidence
-		cv::Mat result;
-		m_rtrees->getVotes(test_data, result, cv::ml::DTrees::PREDICT_MAX_VOTE);
-		int classIndex = -1;
-		for (int col = 0; col < result.cols; col++) // look for the index of the predicted class
-			if (predictedClass == result.at<int>(0, col))
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic)
+#endif
+#endif
+		for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex)
+		{
+			if (!success)
 			{
-				classIndex = col;
-				break;
+				continue;
 			}
-		if (classIndex != -1)
-		{
-			float nbVotes = result.at<int>(1, classIndex); // get the number of votes
-			cvConfidenceSF->setValue(i, static_cast<ScalarType>(nbVotes / numberOfTrees)); // compute the confidence
-		}
-		else
-			cvConfidenceSF->setValue(i, CCCoreLib::NAN_VALUE);
 
-		if (pDlg && !nProgress.oneStep())
-		{
-			//process cancelled by the user
-			success = false;
-			break;
+			int firstIndex = blockIndex * s_predictionBlockSize;
+			int count = std::min(s_predictionBlockSize, sampleCount - firstIndex);
+			cv::Mat samples = blockData.rowRange(0, count);
+			FillBlock(wrappers, firstIndex, samples);
+
+			QString blockError;
+			if (!PredictBlock(rtrees, engine, samples, buffers, predictions.data(), blockError, m_earlyExit))
+			{
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+				errorMessage = blockError;
+				success = false;
+				continue;
+			}
+
+			int blockTreeCount = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				const Prediction& prediction = predictions[i];
+				classificationSF->setValue(firstIndex + i, static_cast<ScalarType>(prediction.label));
+				cvConfidenceSF->setValue(firstIndex + i, prediction.confidence);
+				cvMarginSF->setValue(firstIndex + i, prediction.margin);
+				if (treeCountSF)
+				{
+					treeCountSF->setValue(firstIndex + i, static_cast<ScalarType>(prediction.treeCount));
+				}
+				blockTreeCount += prediction.treeCount;
+			}
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+			evaluatedTreeCount += blockTreeCount;
+
+			if (pDlg)
+			{
+				mutex.lock();
+				bool cancelled = !nProgress.steps(count);
+				mutex.unlock();
+				if (cancelled)
+				{
+					//process cancelled by the user
+					success = false;
+				}
+			}
 		}
 	}
 
 	classificationSF->computeMinAndMax();
 	cvConfidenceSF->computeMinAndMax();
+	cvMarginSF->computeMinAndMax();
+	if (treeCountSF)
+	{
+		treeCountSF->computeMinAndMax();
+	}
+
+	if (success && sampleCount != 0)
+	{
+		ccLog::Print(QObject::tr("[3DMASC] Average number of evaluated trees per point: %1 / %2").arg(evaluatedTreeCount / sampleCount, 0, 'f', 1).arg(m_rtrees->getRoots().size()));
+	}
 
 	//show the classification field by default
 	{
@@ -283,7 +656,7 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 							ccPointCloud* testCloud,
 							AccuracyMetrics& metrics,
 							QString& errorMessage,
-							Train3DMASCDialog& train3DMASCDialog,
+							Train3DMASCDialog* train3DMASCDialog,
 							CCCoreLib::ReferenceCloud* testSubset/*=nullptr=*/,
 							QString outputSFName/*=QString()*/,
 							QWidget* parentWidget/*=nullptr*/)
@@ -396,8 +769,6 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 		}
 	}
 
-	int numberOfTrees = static_cast<int>(m_rtrees->getRoots().size());
-
 	//estimate the efficiency of the classifier
 	std::vector<ScalarType> actualClass(testSampleCount);
 	std::vector<ScalarType> predictectedClass(testSampleCount);
@@ -405,6 +776,80 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 		metrics.sampleCount = testSampleCount;
 		metrics.goodGuess = 0;
 
+		std::vector<Prediction> predictions;
+		try
+		{
+			predictions.resize(testSampleCount);
+		}
+		catch (const std::bad_alloc&)
+		{
+			errorMessage = QObject::tr("Not enough memory");
+			return false;
+		}
+
+		//prepare the fast inference engine (checked on the first samples)
+		int sampleCount = static_cast<int>(testSampleCount);
+		const ForestEngine* engine = prepareInferenceEngine(test_data.rowRange(0, std::min(s_predictionBlockSize, sampleCount)));
+
+		//predict the class of all samples
+		std::atomic<bool> success(true);
+		QMutex mutex;
+		int blockCount = (sampleCount + s_predictionBlockSize - 1) / s_predictionBlockSize;
+		const cv::ml::RTrees& rtrees = *m_rtrees;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(Tools::MaxThreadCount())
+#endif
+#endif
+		{
+			//per-thread buffers (re-used from one block to the other)
+			InferenceBuffers buffers;
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp for schedule(dynamic)
+#endif
+#endif
+			for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex)
+			{
+				if (!success)
+				{
+					continue;
+				}
+
+				int firstIndex = blockIndex * s_predictionBlockSize;
+				int count = std::min(s_predictionBlockSize, sampleCount - firstIndex);
+
+				QString blockError;
+				if (!PredictBlock(rtrees, engine, test_data.rowRange(firstIndex, firstIndex + count), buffers, predictions.data() + firstIndex, blockError))
+				{
+#if defined(_OPENMP)
+#pragma omp critical
+#endif
+					errorMessage = blockError;
+					success = false;
+					continue;
+				}
+
+				if (pDlg)
+				{
+					mutex.lock();
+					bool cancelled = !nProgress.steps(count);
+					mutex.unlock();
+					if (cancelled)
+					{
+						//process cancelled by the user
+						success = false;
+					}
+				}
+			}
+		}
+
+		if (!success)
+		{
+			return false;
+		}
+
 		for (unsigned i = 0; i < testSampleCount; ++i)
 		{
 			unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(i) : i);
@@ -416,8 +861,8 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 			//	return false;
 			//}
 
-			float fPredictedClass = m_rtrees->predict(test_data.row(i), cv::noArray(), cv::ml::DTrees::PREDICT_MAX_VOTE);
-			int iPredictedClass = static_cast<int>(fPredictedClass);
+			const Prediction& prediction = predictions[i];
+			int iPredictedClass = prediction.label;
 			actualClass.at(i) = iClass;
 			predictectedClass.at(i) = iPredictedClass;
 			if (iPredictedClass == iClass)
@@ -429,31 +874,9 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 				outSF->setValue(pointIndex, static_cast<ScalarType>(iPredictedClass));
 				if (cvConfidenceSF)
 				{
-					// compute the confidence
-					cv::Mat result;
-					m_rtrees->getVotes(test_data.row(i), result, cv::ml::DTrees::PREDICT_MAX_VOTE);
-					int classIndex = -1;
-					for (int col = 0; col < result.cols; col++) // look for the index of the predicted class
-						if (iPredictedClass == result.at<int>(0, col))
-						{
-							classIndex = col;
-							break;
-						}
-					if (classIndex != -1)
-					{
-						float nbVotes = result.at<int>(1, classIndex); // get the number of votes
-						cvConfidenceSF->setValue(i, static_cast<ScalarType>(nbVotes / numberOfTrees)); // compute the confidence
-					}
-					else
-						cvConfidenceSF->setValue(i, CCCoreLib::NAN_VALUE);
+					cvConfidenceSF->setValue(pointIndex, prediction.confidence);
 				}
 			}
-
-			if (pDlg && !nProgress.oneStep())
-			{
-				//process cancelled by the user
-				return false;
-			}
 		}
 
 		if (outSF)
@@ -464,7 +887,10 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 		metrics.ratio = static_cast<float>(metrics.goodGuess) / metrics.sampleCount;
 	}
 
-	train3DMASCDialog.addConfusionMatrixAndSaveTraces(new ConfusionMatrix(actualClass, predictectedClass));
+	if (train3DMASCDialog)
+	{
+		train3DMASCDialog->addConfusionMatrixAndSaveTraces(new ConfusionMatrix(actualClass, predictectedClass));
+	}
 
 	//show the Classification_prediction field by default
 	if (outSF)
@@ -483,13 +909,123 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 	return true;
 }
 
+bool Classifier::compress(	const Feature::Source::Set& featureSources,
+							ccPointCloud* validationCloud,
+							const ForestCompression::Parameters& params,
+							ForestCompression::Report& report,
+							QString& errorMessage,
+							CCCoreLib::ReferenceCloud* validationSubset/*=nullptr*/,
+							QWidget* parentWidget/*=nullptr*/)
+{
+	if (!isValid())
+	{
+		errorMessage = QObject::tr("Invalid classifier");
+		return false;
+	}
+	if (!validationCloud || featureSources.empty())
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid input");
+		return false;
+	}
+	if (validationSubset && validationSubset->getAssociatedCloud() != validationCloud)
+	{
+		errorMessage = QObject::tr("Invalid validation subset (associated point cloud is different)");
+		return false;
+	}
+
+	//look for the classification field
+	CCCoreLib::ScalarField* classifSF = Tools::GetClassificationSF(validationCloud);
+	if (!classifSF || classifSF->size() < validationCloud->size())
+	{
+		errorMessage = QObject::tr("Missing/invalid 'Classification' field on the validation cloud");
+		return false;
+	}
+
+	int sampleCount = static_cast<int>(validationSubset ? validationSubset->size() : validationCloud->size());
+	int attributesPerSample = static_cast<int>(featureSources.size());
+	if (sampleCount == 0)
+	{
+		errorMessage = QObject::tr("No validation data (a test cloud or a test data ratio is required)");
+		return false;
+	}
+
+	//fill the validation data
+	cv::Mat validationData;
+	std::vector<int> validationLabels;
+	try
+	{
+		validationData.create(sampleCount, attributesPerSample, CV_32FC1);
+		validationLabels.resize(sampleCount);
+	}
+	catch (const cv::Exception& cvex)
+	{
+		errorMessage = cvex.msg.c_str();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	for (int i = 0; i < sampleCount; ++i)
+	{
+		unsigned pointIndex = (validationSubset ? validationSubset->getPointGlobalIndex(i) : static_cast<unsigned>(i));
+		validationLabels[i] = static_cast<int>(classifSF->getValue(pointIndex));
+	}
+
+	for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+	{
+		const Feature::Source& fs = featureSources[fIndex];
+		IScalarFieldWrapper::Shared source = GetSource(fs, validationCloud);
+		if (!source || !source->isValid())
+		{
+			assert(false);
+			errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
+			return false;
+		}
+
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			unsigned pointIndex = (validationSubset ? validationSubset->getPointGlobalIndex(i) : static_cast<unsigned>(i));
+			validationData.at<float>(i, fIndex) = static_cast<float>(source->pointValue(pointIndex));
+		}
+	}
+
+	QScopedPointer<QProgressDialog> pDlg;
+	if (parentWidget)
+	{
+		pDlg.reset(new QProgressDialog(parentWidget));
+		pDlg->setRange(0, 0); //infinite loop
+		pDlg->setLabelText(QObject::tr("Compressing classifier"));
+		pDlg->show();
+		QCoreApplication::processEvents();
+	}
+
+	cv::Ptr<cv::ml::RTrees> compressed;
+	if (!ForestCompression::Compress(*m_rtrees, validationData, validationLabels, params, compressed, report, errorMessage))
+	{
+		return false;
+	}
+
+	//the fast inference engines will be re-generated if necessary
+	m_flatForest.clear();
+	m_compiledForest.unload();
+	m_rtrees = compressed;
+
+	ccLog::Print("[3DMASC] Compressed classifier: " + report.toString());
+	return true;
+}
+
 bool Classifier::train(	const ccPointCloud* cloud,
 						const RandomTreesParams& params,
 						const Feature::Source::Set& featureSources,
 						QString& errorMessage,
 						CCCoreLib::ReferenceCloud* trainSubset/*=nullptr*/,
 						ccMainAppInterface* app/*=nullptr*/,
-						QWidget* parentWidget/*=nullptr*/)
+						QWidget* parentWidget/*=nullptr*/,
+						RandomForestTrainer::OutOfBagMetrics* outOfBag/*=nullptr*/)
 {
 	if (featureSources.empty())
 	{
@@ -525,10 +1061,22 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		app->dispToConsole(QString("[3DMASC] Training data: %1 samples with %2 feature(s)").arg(sampleCount).arg(attributesPerSample));
 	}
 
+	//with histogram binning, the features are binned column by column (the full matrix is never created)
+	bool binning = params.histogramBinning;
+	RandomForestTrainer::BinnedSamples binnedSamples;
+	std::vector<float> column;
+
 	cv::Mat training_data, train_labels;
 	try
 	{
-		training_data.create(sampleCount, attributesPerSample, CV_32FC1);
+		if (binning)
+		{
+			column.resize(sampleCount);
+		}
+		else
+		{
+			training_data.create(sampleCount, attributesPerSample, CV_32FC1);
+		}
 		train_labels.create(sampleCount, 1, CV_32FC1);
 	}
 	catch (const cv::Exception& cvex)
@@ -571,9 +1119,24 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		{
 			int pointIndex = (trainSubset ? static_cast<int>(trainSubset->getPointGlobalIndex(i)) : i);
 			double value = source->pointValue(pointIndex);
-			training_data.at<float>(i, fIndex) = static_cast<float>(value);
+			if (binning)
+			{
+				column[i] = static_cast<float>(value);
+			}
+			else
+			{
+				training_data.at<float>(i, fIndex) = static_cast<float>(value);
+			}
+		}
+
+		if (binning && !binnedSamples.addFeature(column))
+		{
+			errorMessage = QObject::tr("Not enough memory");
+			return false;
 		}
 	}
+	column.clear();
+	column.shrink_to_fit();
 
 	QScopedPointer<QProgressDialog> pDlg;
 	if (parentWidget)
@@ -585,6 +1148,9 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		QCoreApplication::processEvents();
 	}
 
+	m_flatForest.clear();
+	m_compiledForest.unload();
+	setCascade(QSharedPointer<Classifier>(), {}, 0.0f);
 	m_rtrees = cv::ml::RTrees::create();
 	m_rtrees->setMaxDepth(params.maxDepth);
 	m_rtrees->setMinSampleCount(params.minSampleCount);
@@ -601,6 +1167,17 @@ bool Classifier::train(	const ccPointCloud* cloud,
 	QFuture<bool> future = QtConcurrent::run([&]()
 	{
 		// Code in this block will run in another thread
+		if (binning)
+		{
+			m_rtrees = RandomForestTrainer::Train(binnedSamples, train_labels, params, errorMessage, outOfBag);
+			return !m_rtrees.empty();
+		}
+		else if (params.nativeTrainer || outOfBag)
+		{
+			m_rtrees = RandomForestTrainer::Train(training_data, train_labels, params, errorMessage, outOfBag);
+			return !m_rtrees.empty();
+		}
+
 		try
 		{
 			cv::Mat sampleIndexes = cv::Mat::zeros(1, training_data.rows, CV_8U);
@@ -672,9 +1249,12 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		QCoreApplication::processEvents();
 	}
 
-	if (future.isCanceled() || !future.result() || !m_rtrees->isTrained())
+	if (future.isCanceled() || !future.result() || m_rtrees.empty() || !m_rtrees->isTrained())
 	{
-		errorMessage = QObject::tr("Training failed for an unknown reason...");
+		if (errorMessage.isEmpty())
+		{
+			errorMessage = QObject::tr("Training failed for an unknown reason...");
+		}
 		m_rtrees.release();
 		return false;
 	}
@@ -720,6 +1300,8 @@ bool Classifier::fromFile(QString filename, QWidget* parentWidget/*=nullptr*/)
 		QCoreApplication::processEvents();
 	}
 	
+	m_flatForest.clear();
+	m_compiledForest.unload();
 	try
 	{
 		m_rtrees = cv::ml::RTrees::load(filename.toStdString());
@@ -747,5 +1329,21 @@ bool Classifier::fromFile(QString filename, QWidget* parentWidget/*=nullptr*/)
 		ccLog::Warning(QObject::tr("Loaded classifier doesn't seem to be trained"));
 	}
 
+	//look for a compiled version of the forest (see CompiledForest), only if explicitly allowed
+	if (m_allowCompiledForest)
+	{
+		QString moduleBaseName = CompiledForest::ModuleBaseName(filename);
+		ccLog::Print(QObject::tr("[3DMASC] Looking for a compiled forest module: %1").arg(moduleBaseName));
+		QString moduleError;
+		if (m_compiledForest.load(moduleBaseName, moduleError))
+		{
+			ccLog::Print(QObject::tr("[3DMASC] Compiled forest loaded: %1").arg(m_compiledForest.filename()));
+		}
+		else if (!moduleError.isEmpty())
+		{
+			ccLog::Warning("[3DMASC] " + moduleError);
+		}
+	}
+
 	return true;
 }
@@ -20,8 +20,13 @@
 //Local
 #include "Parameters.h"
 #include "FeaturesInterface.h"
+#include "FlatForest.h"
+#include "CompiledForest.h"
+#include "ForestCompression.h"
+#include "RandomForestTrainer.h"
 
 //Qt
+#include <QSharedPointer>
 #include <QString>
 
 //CCLib
@@ -46,13 +51,17 @@ namespace masc
 		Classifier();
 
 		//! Train the classifier
+		/** \param outOfBag if not null, the out-of-bag metrics are computed during the training
+				(with the native trainer), so that no test data is needed
+		**/
 		bool train(	const ccPointCloud* cloud,
 					const RandomTreesParams& params,
 					const Feature::Source::Set& featureSources,
 					QString& errorMessage,
 					CCCoreLib::ReferenceCloud* trainSubset = nullptr,
 					ccMainAppInterface* app = nullptr,
-					QWidget* parentWidget = nullptr);
+					QWidget* parentWidget = nullptr,
+					RandomForestTrainer::OutOfBagMetrics* outOfBag = nullptr);
 
 		//! Classifier accuracy metrics
 		struct AccuracyMetrics
@@ -63,15 +72,29 @@ namespace masc
 		};
 
 		//! Evaluates the classifier
+		/** The confusion matrix is added to the training dialog (if any).
+		**/
 		bool evaluate(	const Feature::Source::Set& featureSources,
 						ccPointCloud* testCloud,
 						AccuracyMetrics& metrics,
 						QString& errorMessage,
-						Train3DMASCDialog& train3DMASCDialog,
+						Train3DMASCDialog* train3DMASCDialog,
 						CCCoreLib::ReferenceCloud* testSubset = nullptr,
 						QString outputSFName = QString(),
 						QWidget* parentWidget = nullptr);
 
+		//! Compresses the classifier (tree subset and/or depth limit)
+		/** The accuracy of the compressed classifier on the validation data stays within the tolerance.
+			The compressed classifier replaces the current one (see ForestCompression).
+		**/
+		bool compress(	const Feature::Source::Set& featureSources,
+						ccPointCloud* validationCloud,
+						const ForestCompression::Parameters& params,
+						ForestCompression::Report& report,
+						QString& errorMessage,
+						CCCoreLib::ReferenceCloud* validationSubset = nullptr,
+						QWidget* parentWidget = nullptr);
+
 		//! Applies the classifier
 		bool classify(	const Feature::Source::Set& featureSources,
 						ccPointCloud* cloud,
@@ -81,17 +104,83 @@ namespace masc
 		//! Returns whether the classifier is valid or not
 		bool isValid() const;
 
+		//! Returns whether each feature (column) is used by at least one split of the forest
+		std::vector<bool> usedFeatures() const;
+
+		//! Sets the first stage of a cascade classification
+		/** The first stage classifier (trained on cheap features) classifies all the points.
+			Only the points for which its confidence is below the threshold are then classified
+			by this classifier (see Tools::ClassifyCascade).
+			\param stage first stage classifier (or null to disable the cascade)
+			\param stageFeatures indexes of the first stage features (among the features of this classifier)
+			\param threshold confidence threshold
+		**/
+		void setCascade(QSharedPointer<Classifier> stage, const std::vector<int>& stageFeatures, float threshold);
+		//! Returns whether this classifier has a first stage (cascade classification)
+		inline bool hasCascade() const { return m_cascadeStage && m_cascadeStage->isValid(); }
+		//! Returns the first stage classifier (if any)
+		inline QSharedPointer<Classifier> cascadeStage() const { return m_cascadeStage; }
+		//! Returns the indexes of the first stage features
+		inline const std::vector<int>& cascadeFeatures() const { return m_cascadeFeatures; }
+		//! Returns the confidence threshold below which the points are escalated to this classifier
+		inline float cascadeThreshold() const { return m_cascadeThreshold; }
+
 		//! Saves the classifier to file
 		bool toFile(QString filename, QWidget* parentWidget = nullptr) const;
 		//! Loads the classifier from file
+		/** The compiled version of the forest (if any, see CompiledForest) is only loaded
+			if it has been explicitly allowed (see allowCompiledForest).
+		**/
 		bool fromFile(QString filename, QWidget* parentWidget = nullptr);
 
+		//! Sets whether the compiled forest module next to the classifier file can be loaded
+		/** Loading the module executes its native code: this is disabled by default.
+		**/
+		inline void allowCompiledForest(bool state) { m_allowCompiledForest = state; }
+		//! Returns whether the compiled forest module can be loaded
+		inline bool compiledForestAllowed() const { return m_allowCompiledForest; }
+
 		inline cv::Mat getVarImportance() const { return m_rtrees->getVarImportance(); }
 
+		//! Sets the early exit options (adaptive evaluation of the trees during classification)
+		/** The confidence (and the margin) is then computed from the evaluated trees only.
+			Only used with the fast inference engines (not with OpenCV).
+		**/
+		inline void setEarlyExit(const EarlyExitOptions& options) { m_earlyExit = options; }
+		//! Returns the early exit options
+		inline const EarlyExitOptions& earlyExit() const { return m_earlyExit; }
+
+	protected:
+
+		//! Prepares the fastest inference engine giving the same predictions as OpenCV
+		/** The compiled forest (if any) is preferred to the flattened forest.
+			\param probeSamples samples used to check the predictions
+			\return the engine to use (or nullptr if OpenCV should be used)
+		**/
+		const ForestEngine* prepareInferenceEngine(const cv::Mat& probeSamples);
+
 	protected:
 
 		//! Random trees (OpenCV)
 		cv::Ptr<cv::ml::RTrees> m_rtrees;
+
+		//! Flattened random trees (for fast inference)
+		FlatForest m_flatForest;
+
+		//! Compiled random trees (optional)
+		CompiledForest m_compiledForest;
+		//! Whether the compiled forest can be loaded
+		bool m_allowCompiledForest;
+
+		//! Early exit options
+		EarlyExitOptions m_earlyExit;
+
+		//! First stage classifier (cascade)
+		QSharedPointer<Classifier> m_cascadeStage;
+		//! Indexes of the first stage features
+		std::vector<int> m_cascadeFeatures;
+		//! Confidence threshold of the cascade
+		float m_cascadeThreshold;
 	};
 
 }; //namespace masc
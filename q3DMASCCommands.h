@@ -21,19 +21,44 @@
 #include <ccCommandLineInterface.h>
 
 //Local
+#include "ClassificationDaemon.h"
 #include "q3DMASCTools.h"
+#include "ResultSidecar.h"
+#include "SpatialIndexCache.h"
 
 //qCC_db
 #include <ccProgressDialog.h>
 
+//qCC_io
+#include <FileIOFilter.h>
+
 //Qt
 #include <QDialog>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QTextStream>
+#include <QtConcurrent>
 
 static const char COMMAND_3DMASC_CLASSIFY[] = "3DMASC_CLASSIFY";
 static const char COMMAND_3DMASC_KEEP_ATTRIBS[] = "KEEP_ATTRIBUTES";
 static const char COMMAND_3DMASC_ONLY_FEATURES[] = "ONLY_FEATURES";
 static const char COMMAND_3DMASC_SKIP_FEATURES[] = "SKIP_FEATURES";
+static const char COMMAND_3DMASC_EARLY_EXIT[] = "EARLY_EXIT";
+static const char COMMAND_3DMASC_PROPAGATE[] = "PROPAGATE";
+static const char COMMAND_3DMASC_REFINE_BOUNDARIES[] = "REFINE_BOUNDARIES";
+static const char COMMAND_3DMASC_ROI[] = "ROI";
+static const char COMMAND_3DMASC_INCREMENTAL[] = "INCREMENTAL";
+static const char COMMAND_3DMASC_CHANGE_SF[] = "CHANGE_SF";
+static const char COMMAND_3DMASC_BATCH[] = "BATCH";
+static const char COMMAND_3DMASC_SIDECAR[] = "SIDECAR";
+static const char COMMAND_3DMASC_SIDECAR_MARGIN[] = "SIDECAR_MARGIN";
+static const char COMMAND_3DMASC_MERGE_RESULTS[] = "3DMASC_MERGE_RESULTS";
+static const char COMMAND_3DMASC_SERVE[] = "3DMASC_SERVE";
+static const char COMMAND_3DMASC_MAX_JOBS[] = "MAX_JOBS";
+static const char COMMAND_3DMASC_COMPILED_FOREST[] = "COMPILED_FOREST";
+static const char COMMAND_3DMASC_COMPRESS[] = "3DMASC_COMPRESS";
+static const char COMMAND_3DMASC_TOLERANCE[] = "TOLERANCE";
 
 struct Command3DMASCClassif : public ccCommandLineInterface::Command
 {
@@ -43,20 +68,25 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 	{
 		cmd.print("[3DMASC]");
 
-		if (cmd.clouds().empty())
-		{
-			return cmd.error("No cloud loaded");
-		}
-
 		int minArgumentCount = 2;
 		if (cmd.arguments().size() < minArgumentCount)
 		{
-			return cmd.error(QString("Missing parameter(s): options, classifier filename (.txt) and cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
+			return cmd.error(QString("Missing parameter(s): options, classifier filename(s) (.txt, comma separated) and cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
 		}
 
 		bool keepAttributes = false;
 		bool onlyFeatures = false;
 		bool skipFeatures = false;
+		masc::EarlyExitOptions earlyExit;
+		bool propagate = false;
+		masc::PropagationParameters propagationParams;
+		masc::RegionOfInterest roi;
+		ccPointCloud* previousCloud = nullptr;
+		masc::Tools::ChangeParameters change;
+		QString batchTiles, batchOutputDir;
+		bool sidecar = false;
+		bool sidecarMargin = false;
+		bool compiledForest = false;
 		QString featureSourceFilename;
 		while (true)
 		{
@@ -95,6 +125,145 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 				//we only expect the classifier filename now
 				--minArgumentCount;
 			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_EARLY_EXIT))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().empty())
+				{
+					return cmd.error(QString("Missing parameter: confidence threshold after \"-%1\"").arg(COMMAND_3DMASC_EARLY_EXIT));
+				}
+				bool ok = false;
+				float confidence = cmd.arguments().front().toFloat(&ok);
+				if (!ok || confidence < 0.0f || confidence > 1.0f)
+				{
+					return cmd.error(QString("Invalid confidence threshold after \"-%1\" (should be in [0 ; 1], 0 = only stop when the predicted class can't change anymore)").arg(COMMAND_3DMASC_EARLY_EXIT));
+				}
+				cmd.arguments().pop_front();
+
+				earlyExit.enabled = true;
+				earlyExit.confidence = confidence;
+				cmd.print(QString("Early exit enabled (confidence threshold: %1)").arg(confidence));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_PROPAGATE))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().empty())
+				{
+					return cmd.error(QString("Missing parameter: number of voting core points after \"-%1\"").arg(COMMAND_3DMASC_PROPAGATE));
+				}
+				bool ok = false;
+				int k = cmd.arguments().front().toInt(&ok);
+				if (!ok || k < 1)
+				{
+					return cmd.error(QString("Invalid number of voting core points after \"-%1\" (should be >= 1)").arg(COMMAND_3DMASC_PROPAGATE));
+				}
+				cmd.arguments().pop_front();
+
+				propagate = true;
+				propagationParams.k = k;
+				cmd.print(QString("Will only classify the core points and propagate their classes (k = %1)").arg(k));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_ROI))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().empty())
+				{
+					return cmd.error(QString("Missing parameter: region of interest after \"-%1\" (BOX:xmin,ymin,zmin,xmax,ymax,zmax or POLY:x1,y1,x2,y2,x3,y3,...)").arg(COMMAND_3DMASC_ROI));
+				}
+				QString roiError;
+				if (!masc::RegionOfInterest::FromString(cmd.arguments().front(), roi, roiError))
+				{
+					return cmd.error(roiError);
+				}
+				cmd.arguments().pop_front();
+				cmd.print("Region of interest: " + roi.toString());
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_INCREMENTAL))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().size() < 2)
+				{
+					return cmd.error(QString("Missing parameter(s): index of the previous epoch cloud and change threshold after \"-%1\"").arg(COMMAND_3DMASC_INCREMENTAL));
+				}
+				bool ok = false;
+				unsigned cloudIndex = cmd.arguments().front().toUInt(&ok);
+				if (!ok || cloudIndex == 0 || cloudIndex > cmd.clouds().size())
+				{
+					return cmd.error(QString("Invalid index of the previous epoch cloud after \"-%1\" (should be between 1 and %2)").arg(COMMAND_3DMASC_INCREMENTAL).arg(cmd.clouds().size()));
+				}
+				cmd.arguments().pop_front();
+				previousCloud = cmd.clouds()[cloudIndex - 1].pc;
+
+				change.threshold = cmd.arguments().front().toDouble(&ok);
+				if (!ok || change.threshold < 0.0)
+				{
+					return cmd.error(QString("Invalid change threshold after \"-%1\" (should be >= 0)").arg(COMMAND_3DMASC_INCREMENTAL));
+				}
+				cmd.arguments().pop_front();
+				cmd.print(QString("Incremental classification: previous epoch = cloud #%1, change threshold = %2").arg(cloudIndex).arg(change.threshold));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_CHANGE_SF))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().empty())
+				{
+					return cmd.error(QString("Missing parameter: change scalar field name after \"-%1\"").arg(COMMAND_3DMASC_CHANGE_SF));
+				}
+				change.sfName = cmd.arguments().front();
+				cmd.arguments().pop_front();
+				cmd.print("Change scalar field: " + change.sfName);
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_SIDECAR))
+			{
+				sidecar = true;
+				cmd.print("Will only save the classification results (sidecar file)");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_SIDECAR_MARGIN))
+			{
+				sidecar = sidecarMargin = true;
+				cmd.print("Will only save the classification results and margins (sidecar file)");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_BATCH))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().size() < 2)
+				{
+					return cmd.error(QString("Missing parameter(s): tiles (directory or file list) and output directory after \"-%1\"").arg(COMMAND_3DMASC_BATCH));
+				}
+				batchTiles = cmd.arguments().takeFirst();
+				batchOutputDir = cmd.arguments().takeFirst();
+				cmd.print(QString("Batch mode: tiles = %1, output directory = %2").arg(batchTiles).arg(batchOutputDir));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_REFINE_BOUNDARIES))
+			{
+				propagationParams.refineBoundaries = true;
+				cmd.print("Will refine the class boundaries");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_COMPILED_FOREST))
+			{
+				compiledForest = true;
+				cmd.print("Will load the compiled forests next to the classifier files (if any)");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
 			else
 			{
 				//urecognized option
@@ -102,24 +271,95 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			}
 		}
 
+		if (cmd.clouds().empty() && batchTiles.isEmpty())
+		{
+			return cmd.error("No cloud loaded");
+		}
+
+		if (!batchTiles.isEmpty() && (onlyFeatures || skipFeatures || propagate || roi.isValid() || previousCloud))
+		{
+			return cmd.error(QString("\"-%1\" can't be combined with \"-%2\", \"-%3\", \"-%4\", \"-%5\" or \"-%6\"").arg(COMMAND_3DMASC_BATCH).arg(COMMAND_3DMASC_ONLY_FEATURES).arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_PROPAGATE).arg(COMMAND_3DMASC_ROI).arg(COMMAND_3DMASC_INCREMENTAL));
+		}
+
+		if (sidecar && onlyFeatures)
+		{
+			return cmd.error(QString("\"-%1\" can't be combined with \"-%2\"").arg(COMMAND_3DMASC_SIDECAR).arg(COMMAND_3DMASC_ONLY_FEATURES));
+		}
+
 		if (onlyFeatures && skipFeatures)
 		{
 			return cmd.error("Can't compute only the features and skip them at the same time :p");
 		}
 
+		if (propagate && (onlyFeatures || skipFeatures))
+		{
+			return cmd.error(QString("\"-%1\" requires the features to be computed and the classifier to be applied").arg(COMMAND_3DMASC_PROPAGATE));
+		}
+		if (roi.isValid() && (onlyFeatures || skipFeatures || propagate))
+		{
+			return cmd.error(QString("\"-%1\" can't be combined with \"-%2\", \"-%3\" or \"-%4\"").arg(COMMAND_3DMASC_ROI).arg(COMMAND_3DMASC_ONLY_FEATURES).arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_PROPAGATE));
+		}
+		if (previousCloud && (onlyFeatures || skipFeatures || propagate || roi.isValid()))
+		{
+			return cmd.error(QString("\"-%1\" can't be combined with \"-%2\", \"-%3\", \"-%4\" or \"-%5\"").arg(COMMAND_3DMASC_INCREMENTAL).arg(COMMAND_3DMASC_ONLY_FEATURES).arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_PROPAGATE).arg(COMMAND_3DMASC_ROI));
+		}
+		if (!change.sfName.isEmpty() && !previousCloud)
+		{
+			cmd.warning(QString("\"-%1\" is ignored without \"-%2\"").arg(COMMAND_3DMASC_CHANGE_SF).arg(COMMAND_3DMASC_INCREMENTAL));
+		}
+		if (propagationParams.refineBoundaries && !propagate)
+		{
+			cmd.warning(QString("\"-%1\" is ignored without \"-%2\"").arg(COMMAND_3DMASC_REFINE_BOUNDARIES).arg(COMMAND_3DMASC_PROPAGATE));
+		}
+
 		if (cmd.arguments().size() < minArgumentCount)
 		{
 			return cmd.error(QString("Missing parameter(s): classifier filename (.txt) and/or cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
 		}
 
-		QString classifierFilename = cmd.arguments().front();
+		//several classifiers can be applied at once (comma separated filenames)
+		QStringList classifierFilenames = cmd.arguments().front().split(',', QString::SkipEmptyParts);
+		cmd.arguments().pop_front();
+		if (classifierFilenames.empty())
+		{
+			return cmd.error(QString("Missing parameter: classifier filename (.txt) after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
+		}
+		QString classifierFilename = classifierFilenames.front();
 		cmd.print("Classifier filename: " + classifierFilename);
+		for (int i = 1; i < classifierFilenames.size(); ++i)
+		{
+			cmd.print("Additional classifier filename: " + classifierFilenames[i]);
+		}
 		QCoreApplication::processEvents();
-		cmd.arguments().pop_front();
+		bool multipleClassifiers = (classifierFilenames.size() > 1);
+
+		if (!batchTiles.isEmpty())
+		{
+			if (multipleClassifiers)
+			{
+				return cmd.error(QString("Several classifiers can't be applied with \"-%1\"").arg(COMMAND_3DMASC_BATCH));
+			}
+			QString cloudRolesStr = cmd.arguments().takeFirst();
+			cmd.print("Cloud roles: " + cloudRolesStr);
+			return processBatch(cmd, batchTiles, batchOutputDir, classifierFilename, cloudRolesStr, keepAttributes, earlyExit, sidecar, sidecarMargin, compiledForest);
+		}
+
+		if (multipleClassifiers && (skipFeatures || propagate || roi.isValid() || previousCloud))
+		{
+			return cmd.error(QString("Several classifiers can't be applied with \"-%1\", \"-%2\", \"-%3\" or \"-%4\"").arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_PROPAGATE).arg(COMMAND_3DMASC_ROI).arg(COMMAND_3DMASC_INCREMENTAL));
+		}
 
 		ccPointCloud* classifiedCloud = nullptr;
 		SFCollector generatedScalarFields;
 		masc::Feature::Source::Set featureSources;
+		masc::Classifier classifier;
+		classifier.allowCompiledForest(compiledForest);
+		bool classificationDone = false;
+
+		//additional classifiers (sharing the features of the first one)
+		std::vector< QSharedPointer<masc::Classifier> > extraClassifiers;
+		std::vector<masc::Feature::Set> extraFeatures;
+		size_t classifierFeatureCount = 0;
 
 		if (!skipFeatures)
 		{
@@ -153,7 +393,13 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 				{
 					return cmd.error(QString("Cloud index %1 exceeds the number of loaded clouds (=%2)").arg(cloudIndex).arg(cmd.clouds().size()));
 				}
-				cloudPerRole.insert(role, cmd.clouds()[cloudIndex - 1].pc);
+				CLCloudDesc& desc = cmd.clouds()[cloudIndex - 1];
+				if (masc::SpatialIndexCache::GetSource(desc.pc).isEmpty())
+				{
+					//the octree will be saved next to the file
+					masc::SpatialIndexCache::SetSource(desc.pc, desc.path + "/" + desc.basename);
+				}
+				cloudPerRole.insert(role, desc.pc);
 
 				if (mainCloudRole.isEmpty())
 				{
@@ -169,6 +415,24 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			{
 				return cmd.error("Failed to read classifier file");
 			}
+			for (int i = 1; i < classifierFilenames.size(); ++i)
+			{
+				QList<QString> otherCloudLabels;
+				QString otherCorePointsLabel;
+				if (!masc::Tools::LoadClassifierCloudLabels(classifierFilenames[i], otherCloudLabels, otherCorePointsLabel, filenamesSpecified))
+				{
+					return cmd.error("Failed to read classifier file " + classifierFilenames[i]);
+				}
+				if (otherCorePointsLabel.toUpper() != corePointsLabel.toUpper())
+				{
+					cmd.warning(QString("Classifier %1 uses other core points (%2): the ones of the first classifier will be used").arg(classifierFilenames[i]).arg(otherCorePointsLabel));
+				}
+				for (const QString& label : otherCloudLabels)
+				{
+					if (!cloudLabels.contains(label))
+						cloudLabels.push_back(label);
+				}
+			}
 
 			if (!corePointsLabel.isEmpty())
 			{
@@ -194,10 +458,37 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			//load features
 			masc::Feature::Set features;
 			std::vector<double> scales;
-			if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, nullptr, nullptr, cmd.widgetParent()))
+			//(the classifier is loaded at the same time so that the features it doesn't use are not computed)
+			if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, onlyFeatures ? nullptr : &classifier, nullptr, cmd.widgetParent()))
 			{
 				return cmd.error("Failed to load the classifier");
 			}
+			classifierFeatureCount = features.size();
+
+			//load the features of the other classifiers (each distinct feature will only be computed once)
+			for (int i = 1; i < classifierFilenames.size(); ++i)
+			{
+				QSharedPointer<masc::Classifier> otherClassifier(new masc::Classifier);
+				otherClassifier->allowCompiledForest(compiledForest);
+				masc::Feature::Set otherFeatures;
+				if (!masc::Tools::LoadFile(classifierFilenames[i], &cloudPerRole, true, &otherFeatures, nullptr, nullptr, onlyFeatures ? nullptr : otherClassifier.data(), nullptr, cmd.widgetParent()))
+				{
+					return cmd.error("Failed to load the classifier " + classifierFilenames[i]);
+				}
+				size_t sharedCount = masc::Tools::MergeFeatures(features, otherFeatures);
+				cmd.print(QString("Classifier %1: %2 feature(s), %3 shared with the previous classifier(s)").arg(classifierFilenames[i]).arg(otherFeatures.size()).arg(sharedCount));
+
+				extraClassifiers.push_back(otherClassifier);
+				extraFeatures.push_back(otherFeatures);
+			}
+			if (multipleClassifiers)
+			{
+				cmd.print(QString("%1 distinct feature(s) will be computed").arg(features.size()));
+				if (classifier.hasCascade())
+				{
+					cmd.warning("Cascade classification is ignored when several classifiers are applied");
+				}
+			}
 
 			//internal consistency check
 			if (!cloudPerRole.contains(mainCloudRole))
@@ -226,7 +517,96 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			}
 
 			QString errorMessage;
-			if (!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields))
+
+			if (roi.isValid())
+			{
+				//only the points inside the region of interest are classified (and written in the full cloud)
+				classifier.setEarlyExit(earlyExit);
+				if (!masc::Tools::ClassifyRegionOfInterest(classifierFilename, roi, cloudPerRole, mainCloudRole, classifier, errorMessage, pDlg.data(), cmd.widgetParent()))
+				{
+					return cmd.error(errorMessage);
+				}
+				classificationDone = true;
+			}
+			else if (previousCloud)
+			{
+				//only the points close to a change are classified (the others get the class of the previous epoch)
+				if (previousCloud == classifiedCloud)
+				{
+					return cmd.error("The previous epoch cloud can't be the classified cloud");
+				}
+				classifier.setEarlyExit(earlyExit);
+				if (!masc::Tools::ClassifyIncremental(classifierFilename, cloudPerRole, mainCloudRole, previousCloud, change, classifier, errorMessage, pDlg.data(), cmd.widgetParent()))
+				{
+					return cmd.error(errorMessage);
+				}
+				classificationDone = true;
+			}
+
+			//classify the core points only? (their classes are then propagated to the whole cloud)
+			masc::Feature::Set refinementFeatures;
+			if (propagate)
+			{
+				if (!masc::Tools::LoadCorePointsSelection(classifierFilename, cloudPerRole, corePoints, pDlg.data()))
+				{
+					return cmd.error("Failed to compute/prepare the core points");
+				}
+				if (corePoints.cloud == corePoints.origin)
+				{
+					cmd.warning(QString("\"-%1\" requires a subsampled core points definition in the classifier file (e.g. 'core_points: PC1_SS_S0.5'): all the points will be classified").arg(COMMAND_3DMASC_PROPAGATE));
+				}
+				if (corePoints.cloud != corePoints.origin && propagationParams.refineBoundaries)
+				{
+					//the boundary points need their own features (a feature can only be prepared once)
+					if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &refinementFeatures, nullptr, nullptr, nullptr, nullptr, cmd.widgetParent()))
+					{
+						delete corePoints.cloud;
+						return cmd.error("Failed to load the classifier");
+					}
+					masc::Tools::FlagUnusedFeatures(refinementFeatures, classifier);
+				}
+			}
+
+			if (classificationDone)
+			{
+				//nothing to do
+			}
+			else if (!onlyFeatures && !multipleClassifiers && (classifier.hasCascade() || corePoints.cloud != corePoints.origin))
+			{
+				//the classification is done right away
+				classifier.setEarlyExit(earlyExit);
+				bool success = false;
+				if (classifier.hasCascade())
+				{
+					//the features are computed on the fly (only for the uncertain points for the expensive ones)
+					success = masc::Tools::ClassifyCascade(corePoints, features, classifier, errorMessage, pDlg.data(), &generatedScalarFields, cmd.widgetParent());
+				}
+				else if (masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields))
+				{
+					masc::Feature::Source::Set coreSources;
+					masc::Feature::ExtractSources(features, coreSources);
+					success = classifier.classify(coreSources, corePoints.cloud, errorMessage, cmd.widgetParent());
+				}
+
+				if (success && corePoints.cloud != corePoints.origin)
+				{
+					success = masc::Tools::PropagateClassification(corePoints, propagationParams, errorMessage, &refinementFeatures, &classifier, pDlg.data(), cmd.widgetParent());
+				}
+
+				generatedScalarFields.releaseSFs(success && keepAttributes);
+				if (corePoints.cloud != corePoints.origin)
+				{
+					//the core points are not needed anymore
+					delete corePoints.cloud;
+					corePoints.cloud = nullptr;
+				}
+				if (!success)
+				{
+					return cmd.error(errorMessage);
+				}
+				classificationDone = true;
+			}
+			else if (!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields))
 			{
 				generatedScalarFields.releaseSFs(false);
 				return cmd.error(errorMessage);
@@ -270,25 +650,70 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		}
 
 		//apply classifier
-		if (!onlyFeatures)
+		if (!onlyFeatures && !classificationDone)
 		{
-			masc::Classifier classifier;
-			if (!masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()))
+			if (!classifier.isValid() && !masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()))
 			{
 				return cmd.error("Failed to load the classifier");
 			}
+			classifier.setEarlyExit(earlyExit);
+
+			//the features of the first classifier come first (the others may follow)
+			masc::Feature::Source::Set classifierSources = featureSources;
+			if (classifierFeatureCount != 0 && classifierFeatureCount < classifierSources.size())
+			{
+				classifierSources.resize(classifierFeatureCount);
+			}
 
 			QString errorMessage;
-			if (!classifier.classify(featureSources, classifiedCloud, errorMessage, cmd.widgetParent()))
+			if (!classifier.classify(classifierSources, classifiedCloud, errorMessage, cmd.widgetParent()))
 			{
 				generatedScalarFields.releaseSFs(false);
 				return cmd.error(errorMessage);
 			}
 
+			if (multipleClassifiers)
+			{
+				//one set of classification fields per classifier
+				masc::Tools::RenameClassificationSFs(classifiedCloud, QFileInfo(classifierFilenames[0]).completeBaseName());
+
+				for (size_t i = 0; i < extraClassifiers.size(); ++i)
+				{
+					extraClassifiers[i]->setEarlyExit(earlyExit);
+
+					masc::Feature::Source::Set otherSources;
+					masc::Feature::ExtractSources(extraFeatures[i], otherSources);
+					if (!extraClassifiers[i]->classify(otherSources, classifiedCloud, errorMessage, cmd.widgetParent()))
+					{
+						generatedScalarFields.releaseSFs(false);
+						return cmd.error(errorMessage);
+					}
+					masc::Tools::RenameClassificationSFs(classifiedCloud, QFileInfo(classifierFilenames[static_cast<int>(i) + 1]).completeBaseName());
+				}
+			}
+
 			generatedScalarFields.releaseSFs(keepAttributes);
 		}
 
-		if (cmd.autoSaveMode() || onlyFeatures)
+		if (sidecar)
+		{
+			//only the classification results are saved (next to the source file)
+			for (CLCloudDesc& desc : cmd.clouds())
+			{
+				if (desc.pc == classifiedCloud)
+				{
+					QString sidecarFilename = desc.path + "/" + desc.basename + "." + masc::ResultSidecar::Extension();
+					QString errorStr;
+					if (!masc::ResultSidecar::Save(classifiedCloud, sidecarFilename, sidecarMargin, errorStr))
+					{
+						return cmd.error(errorStr);
+					}
+					cmd.print("Classification results saved: " + sidecarFilename);
+					break;
+				}
+			}
+		}
+		else if (cmd.autoSaveMode() || onlyFeatures)
 		{
 			for (CLCloudDesc& desc : cmd.clouds())
 			{
@@ -306,4 +731,467 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 
 		return true;
 	}
+
+	//! Classifies a set of tiles (the next tile is loaded and the previous one saved while a tile is classified)
+	static bool processBatch(	ccCommandLineInterface& cmd,
+								const QString& tilesPath,
+								const QString& outputDir,
+								const QString& classifierFilename,
+								const QString& cloudRolesStr,
+								bool keepAttributes,
+								const masc::EarlyExitOptions& earlyExit,
+								bool sidecar,
+								bool sidecarMargin,
+								bool compiledForest)
+	{
+		//list the tiles
+		QStringList tiles;
+		QFileInfo tilesInfo(tilesPath);
+		if (tilesInfo.isDir())
+		{
+			QDir tilesDir(tilesPath);
+			for (const QFileInfo& fi : tilesDir.entryInfoList(QDir::Files | QDir::Readable, QDir::Name))
+			{
+				if (FileIOFilter::FindBestFilterForExtension(fi.suffix()))
+				{
+					tiles.push_back(fi.absoluteFilePath());
+				}
+			}
+		}
+		else
+		{
+			//one file per line
+			QFile listFile(tilesPath);
+			if (!listFile.open(QFile::Text | QFile::ReadOnly))
+			{
+				return cmd.error("Failed to open the tile list " + tilesPath);
+			}
+			QTextStream stream(&listFile);
+			while (!stream.atEnd())
+			{
+				QString line = stream.readLine().trimmed();
+				if (!line.isEmpty() && !line.startsWith('#'))
+				{
+					tiles.push_back(tilesInfo.absoluteDir().absoluteFilePath(line));
+				}
+			}
+		}
+		if (tiles.empty())
+		{
+			return cmd.error("No tile to classify in " + tilesPath);
+		}
+		cmd.print(QString("%1 tile(s) to classify").arg(tiles.size()));
+
+		if (!QDir().mkpath(outputDir))
+		{
+			return cmd.error("Failed to create the output directory " + outputDir);
+		}
+
+		//roles: 'TILE' or the index of an already loaded cloud (context)
+		QMap<QString, ccPointCloud*> contextClouds;
+		QStringList tileRoles;
+		for (const QString& token : cloudRolesStr.simplified().split(QChar(' '), QString::SkipEmptyParts))
+		{
+			QStringList subTokens = token.split("=");
+			if (subTokens.size() != 2)
+			{
+				return cmd.error("Malformed cloud roles description (expecting: \"PC1=TILE CTX=1\" for instance)");
+			}
+			QString role = subTokens[0].toUpper();
+			if (subTokens[1].toUpper() == "TILE")
+			{
+				tileRoles.push_back(role);
+				continue;
+			}
+			bool ok = false;
+			unsigned cloudIndex = subTokens[1].toUInt(&ok);
+			if (!ok || cloudIndex == 0 || cloudIndex > cmd.clouds().size())
+			{
+				return cmd.error(QString("Malformed cloud roles description (expecting 'TILE' or the index of a loaded cloud for role %1)").arg(role));
+			}
+			contextClouds.insert(role, cmd.clouds()[cloudIndex - 1].pc);
+		}
+		if (tileRoles.empty())
+		{
+			return cmd.error("At least one role must be played by the tiles (e.g. \"PC1=TILE\")");
+		}
+
+		QList<QString> cloudLabels;
+		QString corePointsLabel;
+		bool filenamesSpecified = false;
+		if (!masc::Tools::LoadClassifierCloudLabels(classifierFilename, cloudLabels, corePointsLabel, filenamesSpecified))
+		{
+			return cmd.error("Failed to read classifier file");
+		}
+		QString mainRole = corePointsLabel.isEmpty() ? tileRoles.front() : corePointsLabel.toUpper();
+		if (!tileRoles.contains(mainRole))
+		{
+			return cmd.error(QString("The classified role (%1) must be played by the tiles").arg(mainRole));
+		}
+		for (const QString& label : cloudLabels)
+		{
+			if (!tileRoles.contains(label.toUpper()) && !contextClouds.contains(label.toUpper()))
+			{
+				return cmd.error(QString("Role %1 has not been defined").arg(label));
+			}
+		}
+
+		//the classifier is only loaded once
+		masc::Classifier classifier;
+		classifier.allowCompiledForest(compiledForest);
+		if (!masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()) || !classifier.isValid())
+		{
+			return cmd.error("Failed to load the classifier");
+		}
+		classifier.setEarlyExit(earlyExit);
+
+		//the tiles must share the global shift of the context clouds (if any)
+		bool useContextShift = !contextClouds.empty();
+		CCVector3d contextShift = useContextShift ? contextClouds.first()->getGlobalShift() : CCVector3d(0, 0, 0);
+		auto loadTile = [useContextShift, contextShift](const QString& filename, QString& error) -> ccPointCloud*
+		{
+			CCVector3d coordinatesShift = contextShift;
+			bool coordinatesShiftEnabled = useContextShift;
+			return masc::Tools::LoadCloud(filename, error, &coordinatesShift, &coordinatesShiftEnabled);
+		};
+
+		QScopedPointer<ccProgressDialog> pDlg;
+		if (!cmd.silentMode())
+		{
+			pDlg.reset(new ccProgressDialog(true, cmd.widgetParent()));
+			pDlg->setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
+		}
+
+		//the class indexes of the context clouds are only built once for all the tiles
+		for (ccPointCloud* contextCloud : contextClouds)
+		{
+			masc::SpatialIndexCache::ShareClassIndexes(contextCloud, true);
+		}
+
+		QElapsedTimer totalTimer;
+		totalTimer.start();
+
+		//prefetch the first tile
+		QString loadError;
+		QFuture<ccPointCloud*> loadFuture = QtConcurrent::run([&, filename = tiles.front()]() { return loadTile(filename, loadError); });
+		QFuture<QString> saveFuture;
+		auto waitForSave = [&]() -> bool
+		{
+			if (saveFuture.isStarted())
+			{
+				QString saveError = saveFuture.result();
+				if (!saveError.isEmpty())
+				{
+					cmd.warning(saveError);
+					return false;
+				}
+			}
+			return true;
+		};
+
+		int failedCount = 0;
+		size_t classifiedPointCount = 0;
+		for (int i = 0; i < tiles.size(); ++i)
+		{
+			QElapsedTimer timer;
+			timer.start();
+			ccPointCloud* tile = loadFuture.result();
+			QString tileError = loadError;
+			double loadWait = timer.elapsed() / 1000.0;
+
+			//prefetch the next tile while this one is classified
+			if (i + 1 < tiles.size())
+			{
+				loadFuture = QtConcurrent::run([&, filename = tiles[i + 1]]() { return loadTile(filename, loadError); });
+			}
+
+			if (!tile)
+			{
+				cmd.warning(QString("[%1/%2] %3").arg(i + 1).arg(tiles.size()).arg(tileError));
+				++failedCount;
+				continue;
+			}
+
+			masc::Tools::NamedClouds clouds = contextClouds;
+			for (const QString& role : tileRoles)
+			{
+				clouds.insert(role, tile);
+			}
+			timer.restart();
+			QString errorMessage;
+			bool success = masc::Tools::ClassifyCloud(classifierFilename, clouds, mainRole, classifier, errorMessage, keepAttributes, pDlg.data(), cmd.widgetParent());
+			double computeTime = timer.elapsed() / 1000.0;
+
+			if (!success)
+			{
+				cmd.warning(QString("[%1/%2] %3: %4").arg(i + 1).arg(tiles.size()).arg(tiles[i]).arg(errorMessage));
+				delete tile;
+				++failedCount;
+				continue;
+			}
+
+			unsigned pointCount = tile->size();
+			classifiedPointCount += pointCount;
+			cmd.print(QString("[%1/%2] %3: %4 points, waited %5 s for loading, classified in %6 s (%7 points/s)")
+						.arg(i + 1)
+						.arg(tiles.size())
+						.arg(QFileInfo(tiles[i]).fileName())
+						.arg(pointCount)
+						.arg(loadWait, 0, 'f', 1)
+						.arg(computeTime, 0, 'f', 1)
+						.arg(computeTime > 0 ? pointCount / computeTime : 0.0, 0, 'f', 0));
+
+			//save the tile while the next one is classified
+			if (!waitForSave())
+			{
+				++failedCount;
+			}
+			QFileInfo fi(tiles[i]);
+			QString outputFilename = QDir(outputDir).absoluteFilePath(sidecar ? fi.completeBaseName() + "." + masc::ResultSidecar::Extension() : fi.completeBaseName() + "_CLASSIFIED." + fi.suffix());
+			tile->setCurrentDisplayedScalarField(-1);
+			saveFuture = QtConcurrent::run([tile, outputFilename, sidecar, sidecarMargin]()
+			{
+				QString saveError;
+				if (sidecar)
+					masc::ResultSidecar::Save(tile, outputFilename, sidecarMargin, saveError);
+				else
+					masc::Tools::SaveCloud(tile, outputFilename, saveError);
+				delete tile;
+				return saveError;
+			});
+		}
+		if (!waitForSave())
+		{
+			++failedCount;
+		}
+
+		for (ccPointCloud* contextCloud : contextClouds)
+		{
+			masc::SpatialIndexCache::ShareClassIndexes(contextCloud, false);
+		}
+
+		if (pDlg)
+		{
+			pDlg->setAutoClose(true); //restore the default behavior of the progress dialog
+			pDlg->close();
+			QCoreApplication::processEvents();
+		}
+
+		double totalTime = totalTimer.elapsed() / 1000.0;
+		cmd.print(QString("Batch done: %1 tile(s) classified, %2 failed, %3 points in %4 s (%5 points/s)")
+					.arg(tiles.size() - failedCount)
+					.arg(failedCount)
+					.arg(classifiedPointCount)
+					.arg(totalTime, 0, 'f', 1)
+					.arg(totalTime > 0 ? classifiedPointCount / totalTime : 0.0, 0, 'f', 0));
+
+		if (failedCount != 0)
+		{
+			return cmd.error(QString("%1 tile(s) failed").arg(failedCount));
+		}
+		return true;
+	}
+};
+
+struct Command3DMASCServe : public ccCommandLineInterface::Command
+{
+	Command3DMASCServe() : ccCommandLineInterface::Command("3DMASC Serve", COMMAND_3DMASC_SERVE) {}
+
+	virtual bool process(ccCommandLineInterface& cmd) override
+	{
+		cmd.print("[3DMASC]");
+
+		int maxConcurrentJobs = 1;
+		bool compiledForest = false;
+		while (!cmd.arguments().empty())
+		{
+			if (ccCommandLineInterface::IsCommand(cmd.arguments().front(), COMMAND_3DMASC_MAX_JOBS))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				bool ok = false;
+				maxConcurrentJobs = cmd.arguments().empty() ? 0 : cmd.arguments().front().toInt(&ok);
+				if (!ok || maxConcurrentJobs < 1)
+				{
+					return cmd.error(QString("Invalid number of concurrent jobs after \"-%1\" (should be >= 1)").arg(COMMAND_3DMASC_MAX_JOBS));
+				}
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(cmd.arguments().front(), COMMAND_3DMASC_COMPILED_FOREST))
+			{
+				compiledForest = true;
+				cmd.print("Will load the compiled forests next to the classifier files (if any)");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		if (cmd.arguments().empty())
+		{
+			return cmd.error(QString("Missing parameter: server (socket) name after \"-%1\"").arg(COMMAND_3DMASC_SERVE));
+		}
+		QString serverName = cmd.arguments().front();
+		cmd.arguments().pop_front();
+
+		masc::ClassificationDaemon daemon(maxConcurrentJobs);
+		daemon.allowCompiledForests(compiledForest);
+		QString errorMessage;
+		if (!daemon.listen(serverName, errorMessage))
+		{
+			return cmd.error("Failed to start the daemon: " + errorMessage);
+		}
+		cmd.print(QString("Daemon started on '%1' (send {\"command\": \"shutdown\"} to stop it)").arg(serverName));
+
+		//wait for the 'shutdown' request
+		daemon.exec();
+
+		return true;
+	}
+};
+
+struct Command3DMASCMergeResults : public ccCommandLineInterface::Command
+{
+	Command3DMASCMergeResults() : ccCommandLineInterface::Command("3DMASC Merge results", COMMAND_3DMASC_MERGE_RESULTS) {}
+
+	virtual bool process(ccCommandLineInterface& cmd) override
+	{
+		cmd.print("[3DMASC]");
+
+		if (cmd.clouds().empty())
+		{
+			return cmd.error("No cloud loaded");
+		}
+
+		//the sidecar of each loaded cloud is expected next to its source file
+		for (CLCloudDesc& desc : cmd.clouds())
+		{
+			QString sidecarFilename = desc.path + "/" + desc.basename + "." + masc::ResultSidecar::Extension();
+			QString errorMessage;
+			if (!masc::ResultSidecar::Merge(desc.pc, sidecarFilename, errorMessage))
+			{
+				return cmd.error(errorMessage);
+			}
+			cmd.print("Classification results merged from " + sidecarFilename);
+
+			if (cmd.autoSaveMode())
+			{
+				QString errorStr = cmd.exportEntity(desc, "CLASSIFIED");
+				if (!errorStr.isEmpty())
+				{
+					return cmd.error(errorStr);
+				}
+			}
+		}
+
+		return true;
+	}
+};
+
+struct Command3DMASCCompress : public ccCommandLineInterface::Command
+{
+	Command3DMASCCompress() : ccCommandLineInterface::Command("3DMASC Compress", COMMAND_3DMASC_COMPRESS) {}
+
+	virtual bool process(ccCommandLineInterface& cmd) override
+	{
+		cmd.print("[3DMASC]");
+
+		masc::ForestCompression::Parameters params;
+		while (!cmd.arguments().empty() && ccCommandLineInterface::IsCommand(cmd.arguments().front(), COMMAND_3DMASC_TOLERANCE))
+		{
+			//local option confirmed, we can move on
+			cmd.arguments().pop_front();
+
+			bool ok = false;
+			params.tolerance = cmd.arguments().empty() ? -1.0 : cmd.arguments().front().toDouble(&ok);
+			if (!ok || params.tolerance < 0.0 || params.tolerance > 1.0)
+			{
+				return cmd.error(QString("Invalid tolerance after \"-%1\" (maximum accuracy loss, should be in [0 ; 1])").arg(COMMAND_3DMASC_TOLERANCE));
+			}
+			cmd.arguments().pop_front();
+		}
+
+		if (cmd.arguments().size() < 3)
+		{
+			return cmd.error(QString("Missing parameter(s): classifier filename (.txt), cloud roles and output filename (.txt) after \"-%1\"").arg(COMMAND_3DMASC_COMPRESS));
+		}
+		QString classifierFilename = cmd.arguments().takeFirst();
+		QString cloudRolesStr = cmd.arguments().takeFirst();
+		QString outputFilename = cmd.arguments().takeFirst();
+		cmd.print("Classifier: " + classifierFilename);
+		cmd.print("Cloud roles: " + cloudRolesStr);
+
+		//the roles are played by the already loaded clouds (the labelled cloud being the core points one)
+		masc::Tools::NamedClouds cloudPerRole;
+		for (const QString& token : cloudRolesStr.simplified().split(QChar(' '), QString::SkipEmptyParts))
+		{
+			QStringList subTokens = token.split("=");
+			if (subTokens.size() != 2)
+			{
+				return cmd.error("Malformed cloud roles description (expecting: \"PC1=1 PC2=3 CTX=2\" for instance)");
+			}
+			QString role = subTokens[0].toUpper();
+			bool ok = false;
+			unsigned cloudIndex = subTokens[1].toUInt(&ok);
+			if (!ok || cloudIndex == 0 || cloudIndex > cmd.clouds().size())
+			{
+				return cmd.error(QString("Malformed cloud roles description (expecting the index of a loaded cloud for role %1)").arg(role));
+			}
+			cloudPerRole.insert(role, cmd.clouds()[cloudIndex - 1].pc);
+		}
+
+		QList<QString> cloudLabels;
+		QString corePointsLabel;
+		bool filenamesSpecified = false;
+		if (!masc::Tools::LoadClassifierCloudLabels(classifierFilename, cloudLabels, corePointsLabel, filenamesSpecified))
+		{
+			return cmd.error("Failed to read classifier file");
+		}
+		for (const QString& label : cloudLabels)
+		{
+			if (!cloudPerRole.contains(label.toUpper()))
+			{
+				return cmd.error(QString("Role %1 has not been defined").arg(label));
+			}
+		}
+		QString mainRole = corePointsLabel.isEmpty() ? cloudPerRole.firstKey() : corePointsLabel.toUpper();
+		if (!cloudPerRole.contains(mainRole))
+		{
+			return cmd.error(QString("Role %1 has not been defined").arg(mainRole));
+		}
+		cmd.print("Labelled cloud role: " + mainRole);
+
+		QScopedPointer<ccProgressDialog> pDlg;
+		if (!cmd.silentMode())
+		{
+			pDlg.reset(new ccProgressDialog(true, cmd.widgetParent()));
+			pDlg->setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
+		}
+
+		masc::ForestCompression::Report report;
+		masc::Classifier::AccuracyMetrics metrics;
+		QString errorMessage;
+		bool success = masc::Tools::CompressClassifier(classifierFilename, cloudPerRole, mainRole, params, outputFilename, report, metrics, errorMessage, 0, pDlg.data(), cmd.widgetParent());
+
+		if (pDlg)
+		{
+			pDlg->setAutoClose(true); //restore the default behavior of the progress dialog
+			pDlg->close();
+			QCoreApplication::processEvents();
+		}
+
+		if (!success)
+		{
+			return cmd.error(errorMessage);
+		}
+		cmd.print("Compressed classifier: " + report.toString());
+		cmd.print(QString("Correct guess = %1 / %2 --> accuracy = %3 (on the points not used for the compression)").arg(metrics.goodGuess).arg(metrics.sampleCount).arg(metrics.ratio));
+		cmd.print("Compressed classifier saved: " + outputFilename);
+
+		return true;
+	}
 };
@@ -22,11 +22,14 @@
 #include "NeighborhoodFeature.h"
 #include "DualCloudFeature.h"
 #include "ContextBasedFeature.h"
+#include "FeaturePlan.h"
+#include "SpatialIndexCache.h"
 #include "ccMainAppInterface.h"
 
 //qCC_io
 #include <FileIOFilter.h>
 //qCC_db
+#include <ccOctree.h>
 #include <ccScalarField.h>
 #include <ccPointCloud.h>
 
@@ -39,11 +42,17 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QMutex>
+#include <QSet>
 #include <QCoreApplication>
 
 //system
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <random>
 
 #if defined(_OPENMP)
 #include <omp.h>
@@ -87,9 +96,11 @@ bool Tools::SaveClassifier(	QString filename,
 		if (f->cloud2 && !cloudLabels.contains(f->cloud2Label))
 			cloudLabels.push_back(f->cloud2Label);
 	}
-	if (!corePointsRole.isEmpty() && !cloudLabels.contains(corePointsRole))
+	//the core points role may be followed by the subsampling definition (e.g. 'PC1_SS_R0.1')
+	QString corePointsCloud = corePointsRole.section('_', 0, 0).trimmed();
+	if (!corePointsCloud.isEmpty() && !cloudLabels.contains(corePointsCloud))
 	{
-		cloudLabels.push_back(corePointsRole);
+		cloudLabels.push_back(corePointsCloud);
 	}
 
 	stream << "# Clouds (roles)" << endl;
@@ -110,14 +121,38 @@ bool Tools::SaveClassifier(	QString filename,
 		stream << "feature: " << f->toString() << endl;
 	}
 
+	if (classifier.hasCascade())
+	{
+		//save the first stage classifier data
+		QString cascadeYamlFilename = fi.baseName() + "_cascade.yaml";
+		if (!classifier.cascadeStage()->toFile(fi.absoluteDir().absoluteFilePath(cascadeYamlFilename), parent))
+		{
+			ccLog::Error("Failed to save the first stage classifier data");
+			return false;
+		}
+
+		QStringList featureIndexes;
+		for (int index : classifier.cascadeFeatures())
+		{
+			featureIndexes << QString::number(index);
+		}
+
+		stream << "# Cascade (first stage classifier, on a subset of the features)" << endl;
+		stream << "cascade: " << cascadeYamlFilename << endl;
+		stream << "cascade_features: " << featureIndexes.join(',') << endl;
+		stream << "cascade_threshold: " << classifier.cascadeThreshold() << endl;
+	}
+
 	return true;
 }
 
-bool Tools::LoadClassifierCloudLabels(QString filename, QList<QString>& labels, QString& corePointsLabel, bool& filenamesSpecified)
+bool Tools::LoadClassifierCloudLabels(QString filename, QList<QString>& labels, QString& corePointsLabel, bool& filenamesSpecified, QString* corePointsDefinition/*=nullptr*/)
 {
 	//just in case
 	corePointsLabel.clear();
 	labels.clear();
+	if (corePointsDefinition)
+		corePointsDefinition->clear();
 
 	QFile file(filename);
 	if (!file.open(QFile::Text | QFile::ReadOnly))
@@ -175,6 +210,8 @@ bool Tools::LoadClassifierCloudLabels(QString filename, QList<QString>& labels,
 				return false;
 			}
 			corePointsLabel = tokens[0].trimmed();
+			if (corePointsDefinition)
+				*corePointsDefinition = command.trimmed();
 		}
 	}
 
@@ -731,6 +768,7 @@ static bool ReadCloud(const QString& command, Tools::NamedClouds& clouds, const
 		if (pc->getParent())
 			pc->getParent()->detachChild(pc);
 		pc->setName(pcName); //DGM: warning, may not be acceptable in the GUI version?
+		SpatialIndexCache::SetSource(pc, pcFilename); //the octree will be saved next to the file
 		clouds.insert(pcName, pc);
 	}
 
@@ -761,6 +799,11 @@ bool Tools::LoadFile(	const QString& filename,
 		return false;
 	}
 
+	//cascade (first stage classifier)
+	QSharedPointer<Classifier> cascadeStage;
+	std::vector<int> cascadeFeatures;
+	float cascadeThreshold = -1.0f;
+
 	//to use the same 'global shift' for multiple files
 	CCVector3d loadCoordinatesShift(0, 0, 0);
 	bool loadCoordinatesTransEnabled = false;
@@ -825,6 +868,48 @@ bool Tools::LoadFile(	const QString& filename,
 				}
 				ccLog::Print("[3DMASC] Classifier data loaded from " + yamlAbsoluteFilename);
 			}
+			else if (upperLine.startsWith("CASCADE:")) //first stage classifier
+			{
+				if (!classifier)
+				{
+					//no need to load the classifier
+					continue;
+				}
+				QString yamlAbsoluteFilename = fi.absoluteDir().absoluteFilePath(line.mid(8).trimmed());
+				cascadeStage.reset(new Classifier);
+				cascadeStage->allowCompiledForest(classifier->compiledForestAllowed());
+				if (!cascadeStage->fromFile(yamlAbsoluteFilename, parent))
+				{
+					ccLog::Warning("Failed to load the first stage classifier file from " + yamlAbsoluteFilename);
+					return false;
+				}
+			}
+			else if (upperLine.startsWith("CASCADE_FEATURES:")) //first stage features
+			{
+				QStringList tokens = line.mid(17).split(',', QString::SkipEmptyParts);
+				cascadeFeatures.clear();
+				for (const QString& token : tokens)
+				{
+					bool ok = false;
+					int index = token.trimmed().toInt(&ok);
+					if (!ok || index < 0)
+					{
+						ccLog::Warning(QString("Line #%1: invalid feature index").arg(lineNumber));
+						return false;
+					}
+					cascadeFeatures.push_back(index);
+				}
+			}
+			else if (upperLine.startsWith("CASCADE_THRESHOLD:")) //first stage confidence threshold
+			{
+				bool ok = false;
+				cascadeThreshold = line.mid(18).trimmed().toFloat(&ok);
+				if (!ok || cascadeThreshold < 0.0f || cascadeThreshold > 1.0f)
+				{
+					ccLog::Warning(QString("Line #%1: invalid cascade threshold").arg(lineNumber));
+					return false;
+				}
+			}
 			else if (upperLine.startsWith("CLOUD:")) //clouds
 			{
 				if (!clouds || cloudsAreProvided)
@@ -932,10 +1017,30 @@ bool Tools::LoadFile(	const QString& filename,
 					{
 						parameters->rt.minSampleCount = tokens[1].toInt(&ok);
 					}
+					else if (tokens[0] == "PARAM_NATIVE_TRAINER")
+					{
+						parameters->rt.nativeTrainer = (tokens[1].toInt(&ok) != 0);
+					}
+					else if (tokens[0] == "PARAM_HISTOGRAM_BINNING")
+					{
+						parameters->rt.histogramBinning = (tokens[1].toInt(&ok) != 0);
+					}
 					else if (tokens[0] == "PARAM_TEST_DATA_RATIO")
 					{
 						parameters->testDataRatio = tokens[1].toFloat(&ok);
 					}
+					else if (tokens[0] == "PARAM_MAX_SAMPLES_PER_CLASS")
+					{
+						parameters->maxSamplesPerClass = tokens[1].toInt(&ok);
+					}
+					else if (tokens[0] == "PARAM_SEED")
+					{
+						parameters->seed = tokens[1].toUInt(&ok);
+					}
+					else if (tokens[0] == "PARAM_OUT_OF_BAG")
+					{
+						parameters->outOfBag = (tokens[1].toInt(&ok) != 0);
+					}
 					else
 					{
 						ccLog::Warning(QString("Line #%1: unrecognized parameter: ").arg(lineNumber) + tokens[0]);
@@ -964,451 +1069,1564 @@ bool Tools::LoadFile(	const QString& filename,
 		return false;
 	}
 
+	if (classifier && cascadeStage)
+	{
+		if (	cascadeThreshold < 0.0f
+			||	cascadeFeatures.empty()
+			||	cascadeFeatures.size() != cascadeStage->usedFeatures().size()
+			||	(rawFeatures && *std::max_element(cascadeFeatures.begin(), cascadeFeatures.end()) >= static_cast<int>(rawFeatures->size())))
+		{
+			ccLog::Warning("Malformed file: invalid cascade definition");
+			return false;
+		}
+		classifier->setCascade(cascadeStage, cascadeFeatures, cascadeThreshold);
+		ccLog::Print(QString("[3DMASC] Cascade classification: %1 first stage feature(s), confidence threshold = %2").arg(cascadeFeatures.size()).arg(cascadeThreshold));
+	}
+
 	if (rawFeatures)
+	{
 		rawFeatures->shrink_to_fit();
 
+		if (classifier && classifier->isValid())
+		{
+			FlagUnusedFeatures(*rawFeatures, *classifier);
+		}
+	}
+
 	return true;
 }
 
-bool Tools::LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, QWidget* parent/*=nullptr*/)
+size_t Tools::FlagUnusedFeatures(Feature::Set& features, const masc::Classifier& classifier)
 {
-	return LoadFile(filename, &clouds, true, &rawFeatures, nullptr, nullptr, &classifier, nullptr, parent);
+	std::vector<bool> used = classifier.usedFeatures();
+	if (used.size() != features.size())
+	{
+		ccLog::Warning(QString("[3DMASC] The classifier expects %1 features but %2 are defined").arg(used.size()).arg(features.size()));
+		return 0;
+	}
+
+	if (classifier.hasCascade())
+	{
+		//the features used by the first stage must be computed as well
+		std::vector<bool> stageUsed = classifier.cascadeStage()->usedFeatures();
+		const std::vector<int>& stageFeatures = classifier.cascadeFeatures();
+		for (size_t i = 0; i < stageFeatures.size() && i < stageUsed.size(); ++i)
+		{
+			if (stageUsed[i] && stageFeatures[i] < static_cast<int>(used.size()))
+			{
+				used[stageFeatures[i]] = true;
+			}
+		}
+	}
+
+	size_t unusedCount = 0;
+	for (size_t i = 0; i < features.size(); ++i)
+	{
+		features[i]->unused = !used[i];
+		if (features[i]->unused)
+		{
+			++unusedCount;
+		}
+	}
+
+	if (unusedCount != 0)
+	{
+		ccLog::Print(QString("[3DMASC] %1 feature(s) not used by the classifier will be skipped").arg(unusedCount));
+	}
+
+	return unusedCount;
 }
 
-bool Tools::LoadTrainingFile(	QString filename,
-								Feature::Set& rawFeatures,
-								std::vector<double>& rawScales,
-								NamedClouds& loadedClouds,
-								TrainParameters& parameters,
-								CorePoints* corePoints/*=nullptr*/,
-								QWidget* parentWidget/*=nullptr*/)
+//! Returns the largest scale of the features used by a classifier
+/** \param unboundedClouds if not null, the clouds in which the scale-less features look for
+		neighbors (kNN context features, nearest neighbor of SC0 point features) are returned.
+		Those neighbors can be farther than the largest scale.
+**/
+static bool LargestFeatureScale(const QString& classifierFilename,
+								const Tools::NamedClouds& clouds,
+								const masc::Classifier& classifier,
+								double& largestScale,
+								QSet<ccPointCloud*>* unboundedClouds = nullptr)
 {
-	bool cloudsWereProvided = !loadedClouds.empty();
-	if (LoadFile(filename, &loadedClouds, cloudsWereProvided, &rawFeatures, &rawScales, corePoints, nullptr, &parameters, parentWidget))
+	Feature::Set features;
+	Tools::NamedClouds fullClouds = clouds;
+	if (!Tools::LoadFile(classifierFilename, &fullClouds, true, &features))
 	{
-		return true;
+		return false;
 	}
-	else
+	Tools::FlagUnusedFeatures(features, classifier);
+
+	largestScale = 0.0;
+	for (const Feature::Shared& feature : features)
 	{
-		if (!cloudsWereProvided)
+		if (feature->unused)
 		{
-			//delete the already loaded clouds (if any)
-			for (NamedClouds::iterator it = loadedClouds.begin(); it != loadedClouds.end(); ++it)
-				delete it.value();
+			continue;
+		}
+		if (feature->scaled())
+		{
+			largestScale = std::max(largestScale, feature->scale);
+		}
+		else if (unboundedClouds)
+		{
+			if (feature->getType() == Feature::Type::ContextBasedFeature && feature->cloud1)
+			{
+				unboundedClouds->insert(feature->cloud1); //kNN neighbors in the context cloud
+			}
+			if (feature->cloud2)
+			{
+				unboundedClouds->insert(feature->cloud2); //nearest neighbor in the second cloud
+			}
 		}
-		return false;
 	}
+
+	return true;
 }
 
-CCCoreLib::ScalarField* Tools::RetrieveSF(const ccPointCloud* cloud, const QString& sfName, bool caseSensitive/*=true*/)
+bool Tools::ClassifyIncremental(const QString& classifierFilename,
+								const NamedClouds& clouds,
+								const QString& mainRole,
+								ccPointCloud* previousCloud,
+								const ChangeParameters& change,
+								masc::Classifier& classifier,
+								QString& error,
+								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+								QWidget* parent/*=nullptr*/)
 {
-	if (!cloud)
+	ccPointCloud* cloud = clouds.value(mainRole, nullptr);
+	if (!cloud || !previousCloud || !classifier.isValid() || change.threshold < 0.0)
 	{
 		assert(false);
-		return nullptr;
+		error = "Invalid input";
+		return false;
 	}
-	int sfIdx = -1;
-	if (caseSensitive)
+	unsigned pointCount = cloud->size();
+
+	CCCoreLib::ScalarField* previousClassificationSF = GetClassificationSF(previousCloud);
+	if (!previousClassificationSF)
 	{
-		sfIdx = cloud->getScalarFieldIndexByName(qPrintable(sfName));
+		error = "The previous epoch has no classification field";
+		return false;
 	}
-	else
+	CCCoreLib::ScalarField* previousConfidenceSF = RetrieveSF(previousCloud, "Classification_confidence");
+
+	CCCoreLib::ScalarField* changeSF = nullptr;
+	if (!change.sfName.isEmpty())
 	{
-		QString sfNameUpper = sfName.toUpper();
-		for (unsigned i = 0; i < cloud->getNumberOfScalarFields(); ++i)
+		changeSF = RetrieveSF(cloud, change.sfName, false);
+		if (!changeSF)
 		{
-			if (QString(cloud->getScalarField(i)->getName()).toUpper() == sfNameUpper)
-			{
-				sfIdx = static_cast<int>(i);
-				break;
-			}
+			error = QString("Change field '%1' not found").arg(change.sfName);
+			return false;
 		}
 	}
-	
-	if (sfIdx >= 0)
+
+	//the features of the points closer than the largest scale to a change must be recomputed
+	double radius = 0.0;
+	QSet<ccPointCloud*> unboundedClouds;
+	if (!LargestFeatureScale(classifierFilename, clouds, classifier, radius, &unboundedClouds))
 	{
-		return cloud->getScalarField(sfIdx);
+		error = "Failed to load the features";
+		return false;
 	}
-	else
+	if (!unboundedClouds.isEmpty())
 	{
-		return nullptr;
+		//the neighbors of the scale-less features are not bounded by the radius: a change can affect any point
+		QStringList cloudNames;
+		for (ccPointCloud* unboundedCloud : unboundedClouds)
+		{
+			cloudNames << unboundedCloud->getName();
+		}
+		ccLog::Warning(QString("[3DMASC] Cloud(s) %1 used by scale-less features (kNN or nearest neighbor): all the points are classified (no incremental classification)").arg(cloudNames.join(", ")));
+		return ClassifyCloud(classifierFilename, clouds, mainRole, classifier, error, false, progressCb, parent);
 	}
-}
 
-struct FeaturesAndScales
-{
-	std::vector<double> scales;
-	size_t featureCount = 0;
-	QMap<double, std::vector<PointFeature::Shared> > pointFeaturesPerScale;
-	QMap<double, std::vector<NeighborhoodFeature::Shared> > neighborhoodFeaturesPerScale;
-	QMap<double, std::vector<ContextBasedFeature::Shared> > contextBasedFeaturesPerScale;
-};
+	ccOctree::Shared previousOctree = SpatialIndexCache::GetOctree(previousCloud, progressCb);
+	ccOctree::Shared octree = SpatialIndexCache::GetOctree(cloud, progressCb);
+	if (!previousOctree || !octree)
+	{
+		error = "Failed to compute the octree";
+		return false;
+	}
 
-bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& errorStr,
-							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/)
-{
-	if (features.empty() || !corePoints.origin)
+	std::vector<char> changed, toClassify;
+	std::vector<unsigned> previousIndexes;
+	try
 	{
-		//invalid input parameters
-		assert(false);
+		changed.resize(pointCount, 0);
+		toClassify.resize(pointCount, 0);
+		previousIndexes.resize(pointCount, 0);
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
 		return false;
 	}
 
-	//gather all the scales that need to be extracted
-	QMap<ccPointCloud*, FeaturesAndScales> cloudsWithScaledFeatures;
-	//and prepare the features (scalar fields, etc.) at the same time
-	for (const Feature::Shared& feature : features)
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Incremental classification");
+		progressCb->setInfo("Detecting the changes");
+		progressCb->start();
+	}
+
+	//nearest point in the previous epoch (and change detection)
+	unsigned char previousLevel = previousOctree->findBestLevelForAGivenPopulationPerCell(3);
+	double sqThreshold = change.threshold * change.threshold;
+	size_t changedCount = 0;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for reduction(+:changedCount) num_threads(Tools::MaxThreadCount())
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
 	{
-		QString errorMessage("invalid pointer");
-		assert(!corePoints.role.isEmpty());
-		if (!feature || !feature->checkValidity(corePoints.role, errorMessage))
+		const CCVector3* P = cloud->getPoint(i);
+		//both epochs are compared in global coordinates
+		CCVector3 Pprevious = previousCloud->toLocal3pc<double>(cloud->toGlobal3d(*P));
+		CCCoreLib::ReferenceCloud Yk(previousCloud);
+		double maxSquareDist = 0;
+		bool found = (previousOctree->findPointNeighbourhood(&Pprevious, &Yk, 1, previousLevel, maxSquareDist) >= 1);
+		if (found)
 		{
-			errorStr = "Invalid rule/feature: " + errorMessage;
-			return false;
+			previousIndexes[i] = Yk.getPointGlobalIndex(0);
 		}
 
-		//prepare the feature
-		if (!feature->prepare(corePoints, errorStr, progressCb, generatedScalarFields))
+		bool isChanged = false;
+		if (changeSF)
 		{
-			//something failed (error should be up to date)
-			return false;
+			ScalarType value = changeSF->getValue(i);
+			isChanged = !(std::abs(value) <= change.threshold); //NaN = changed
+		}
+		else
+		{
+			isChanged = (!found || maxSquareDist > sqThreshold);
+		}
+		if (isChanged || !found)
+		{
+			changed[i] = 1;
+			++changedCount;
 		}
+	}
 
-		if (feature->scaled())
+	//flag the points close to a change
+	if (changedCount != 0)
+	{
+		if (progressCb)
 		{
-			try
+			progressCb->setInfo(qPrintable(QString("Flagging the points close to %1 changed points").arg(changedCount)));
+		}
+		unsigned char level = octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(static_cast<PointCoordinateType>(radius));
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(Tools::MaxThreadCount())
+#endif
+#endif
+		for (int i = 0; i < static_cast<int>(pointCount); ++i)
+		{
+			if (!changed[i])
 			{
-				switch (feature->getType())
-				{
-				//Point features
-				case Feature::Type::PointFeature:
-				{
-					//build the scaled feature list attached to the first cloud
-					if (feature->cloud1
-						&& !static_cast<PointFeature*>(feature.data())->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-					//build the scaled feature list attached to the second cloud (if any)
-					if (feature->cloud2
-						&& feature->cloud2 != feature->cloud1
-						&& feature->op != Feature::NO_OPERATION)
-					{
-						if(!static_cast<PointFeature*>(feature.data())->statSF1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-						{
-							if (!static_cast<PointFeature*>(feature.data())->statSF2WasAlreadyExisting)
-							{
-								FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud2];
-								++fas.featureCount;
-								fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
-								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-								{
-									fas.scales.push_back(feature->scale);
-								}
-							}
-						}
-					}
-				}
-				break;
-
-				//Neighborhood features
-				case Feature::Type::NeighborhoodFeature:
-				{
-					//build the scaled feature list attached to the first cloud
-					if (feature->cloud1
-						&& !static_cast<NeighborhoodFeature*>(feature.data())->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-
-					//build the scaled feature list attached to the second cloud (if any)
-					if (feature->cloud2
-						&& feature->cloud2 != feature->cloud1
-						&& feature->op != Feature::NO_OPERATION)
-					{
-						if (!static_cast<NeighborhoodFeature*>(feature.data())->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-						{
-							if (!static_cast<NeighborhoodFeature*>(feature.data())->sf2WasAlreadyExisting)
-							{
-								FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud2];
-								fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
-								++fas.featureCount;
-								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-								{
-									fas.scales.push_back(feature->scale);
-								}
-							}
-						}
-					}
-				}
-				break;
-
-				//Context-based features
-				case Feature::Type::ContextBasedFeature:
-				{
-					//build the scaled feature list attached to the context cloud
-					if (feature->cloud1
-						&& !static_cast<ContextBasedFeature*>(feature.data())->sfWasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.contextBasedFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<ContextBasedFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-				}
-				break;
-
-				default:
-					assert(false);
-					break;
-				}
+				continue;
 			}
-			catch (const std::bad_alloc&)
+			//the neighborhoods overlap: the flags are shared by all threads
+#if defined(_OPENMP)
+#pragma omp atomic write
+#endif
+			toClassify[i] = 1;
+			if (radius > 0.0)
 			{
-				errorStr = "Not enough memory";
-				return false;
+				CCCoreLib::DgmOctree::NeighboursSet neighbors;
+				octree->getPointsInSphericalNeighbourhood(*cloud->getPoint(i), static_cast<PointCoordinateType>(radius), neighbors, level);
+				for (const CCCoreLib::DgmOctree::PointDescriptor& neighbor : neighbors)
+				{
+#if defined(_OPENMP)
+#pragma omp atomic write
+#endif
+					toClassify[neighbor.pointIndex] = 1;
+				}
 			}
 		}
+	}
+	changed.clear();
+	changed.shrink_to_fit();
 
+	std::vector<unsigned> classifiedIndexes;
+	for (unsigned i = 0; i < pointCount; ++i)
+	{
+		if (toClassify[i])
+		{
+			classifiedIndexes.push_back(i);
+		}
+	}
+	toClassify.clear();
+	toClassify.shrink_to_fit();
+
+	size_t skippedCount = pointCount - classifiedIndexes.size();
+	ccLog::Print(QString("[3DMASC] Incremental classification: %1 changed points, %2 points to classify, %3 labels copied from the previous epoch (%4% of the work skipped)")
+					.arg(changedCount)
+					.arg(classifiedIndexes.size())
+					.arg(skippedCount)
+					.arg(pointCount != 0 ? (100.0 * skippedCount) / pointCount : 0.0, 0, 'f', 1));
+
+	//copy the previous labels
+	CCCoreLib::ScalarField* classificationSF = nullptr;
+	CCCoreLib::ScalarField* confidenceSF = nullptr;
+	if (!CreateClassificationSFs(cloud, classificationSF, confidenceSF))
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	for (unsigned i = 0; i < pointCount; ++i)
+	{
+		classificationSF->setValue(i, previousClassificationSF->getValue(previousIndexes[i]));
+		confidenceSF->setValue(i, previousConfidenceSF ? previousConfidenceSF->getValue(previousIndexes[i]) : CCCoreLib::NAN_VALUE);
 	}
+	previousIndexes.clear();
+	previousIndexes.shrink_to_fit();
 
+	//classify the other points
 	bool success = true;
-
-	//if we have scaled features
-	if (!cloudsWithScaledFeatures.empty())
+	if (!classifiedIndexes.empty())
 	{
-		//for each cloud
-		for (QMap<ccPointCloud*, FeaturesAndScales>::iterator it = cloudsWithScaledFeatures.begin(); success && it != cloudsWithScaledFeatures.end(); ++it)
+		Feature::Set features;
+		NamedClouds fullClouds = clouds;
+		if (!LoadFile(classifierFilename, &fullClouds, true, &features))
 		{
-			FeaturesAndScales& fas = it.value();
-			ccPointCloud* sourceCloud = it.key();
-
-			//sort the scales
-			std::sort(fas.scales.begin(), fas.scales.end());
+			error = "Failed to load the features";
+			return false;
+		}
+		FlagUnusedFeatures(features, classifier);
 
-			//get the octree
-			ccOctree::Shared octree = sourceCloud->getOctree();
-			if (!octree)
+		std::vector<ScalarType> labels, confidences;
+		success = ClassifySelection(cloud, mainRole, classifiedIndexes, features, classifier, labels, confidences, error, progressCb, parent);
+		if (success)
+		{
+			for (size_t j = 0; j < classifiedIndexes.size(); ++j)
 			{
-				ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(sourceCloud->getName()).arg(sourceCloud->size()));
-				if (progressCb)
-					progressCb->start();
-				QCoreApplication::processEvents();
-				octree = sourceCloud->computeOctree(progressCb);
-				if (!octree)
-				{
-					errorStr = "Failed to compute octree (not enough memory?)";
-					return false;
-				}
+				classificationSF->setValue(classifiedIndexes[j], labels[j]);
+				confidenceSF->setValue(classifiedIndexes[j], confidences[j]);
 			}
+		}
+	}
 
-			//now extract the neighborhoods from the biggest to the smallest scale
-			double largetScale = fas.scales.back();
-			PointCoordinateType largestRadius = static_cast<PointCoordinateType>(largetScale / 2); //scale is the diameter!
-			unsigned char octreeLevel = octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(largestRadius);
+	classificationSF->computeMinAndMax();
+	confidenceSF->computeMinAndMax();
+	cloud->setCurrentDisplayedScalarField(cloud->getScalarFieldIndexByName(LAS_FIELD_NAMES[LAS_CLASSIFICATION]));
 
-			unsigned pointCount = corePoints.size();
-			QString logMessage = QString("Computing %1 features on cloud %2\n(core points: %3)").arg(fas.featureCount).arg(sourceCloud->getName()).arg(pointCount);
-			if (progressCb)
-			{
-				progressCb->setMethodTitle("Compute features");
-				progressCb->setInfo(qPrintable(logMessage));
-			}
-			ccLog::Print(logMessage);
-			CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+	return success;
+}
 
-			QMutex mutex;
-#ifndef _DEBUG
-#if defined(_OPENMP)
-			omp_set_num_threads(std::max(1, omp_get_max_threads() - 2));
-#pragma omp parallel for
-#endif
-#endif
-			for (int i = 0; i < static_cast<int>(pointCount); ++i)
-			{
-				//spherical neighborhood extraction structure
-				CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
-				{
-					nNSS.level = octreeLevel;
-					nNSS.queryPoint = *corePoints.cloud->getPoint(i);
-					octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
-					octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
-				}
+bool Tools::ClassifyRegionOfInterest(	const QString& classifierFilename,
+										const RegionOfInterest& roi,
+										const NamedClouds& clouds,
+										const QString& mainRole,
+										masc::Classifier& classifier,
+										QString& error,
+										CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+										QWidget* parent/*=nullptr*/)
+{
+	ccPointCloud* mainCloud = clouds.value(mainRole, nullptr);
+	if (!roi.isValid() || !mainCloud || !classifier.isValid())
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	//the halo is given by the largest scale of the (used) features
+	double halo = 0.0;
+	QSet<ccPointCloud*> unboundedClouds;
+	if (!LargestFeatureScale(classifierFilename, clouds, classifier, halo, &unboundedClouds))
+	{
+		error = "Failed to load the features";
+		return false;
+	}
+	ccLog::Print(QString("[3DMASC] Region of interest: %1 (halo: %2)").arg(roi.toString()).arg(halo));
+
+	//restrict each (distinct) cloud to the region of interest + halo
+	QMap<ccPointCloud*, ccPointCloud*> croppedClouds;
+	QSharedPointer<CCCoreLib::ReferenceCloud> mainSelection;
+	NamedClouds roiClouds;
+	bool success = true;
+	for (NamedClouds::const_iterator it = clouds.begin(); it != clouds.end() && success; ++it)
+	{
+		ccPointCloud* cloud = it.value();
+		if (!croppedClouds.contains(cloud))
+		{
+			if (unboundedClouds.contains(cloud))
+			{
+				//the neighbors of the scale-less features are not bounded by the halo
+				ccLog::Warning(QString("[3DMASC] Cloud %1 is used by scale-less features (kNN or nearest neighbor): it is not restricted to the region of interest").arg(cloud->getName()));
+				croppedClouds.insert(cloud, cloud);
+				roiClouds.insert(it.key(), cloud);
+				continue;
+			}
+
+			QSharedPointer<CCCoreLib::ReferenceCloud> selection(new CCCoreLib::ReferenceCloud(cloud));
+			for (unsigned i = 0; i < cloud->size(); ++i)
+			{
+				if (roi.contains(cloud->toGlobal3d(*cloud->getPoint(i)), halo) && !selection->addPointIndex(i))
+				{
+					error = "Not enough memory";
+					success = false;
+					break;
+				}
+			}
+			if (!success)
+			{
+				break;
+			}
+
+			ccPointCloud* croppedCloud = cloud;
+			if (selection->size() == 0)
+			{
+				if (cloud == mainCloud)
+				{
+					error = "No point inside the region of interest";
+					success = false;
+					break;
+				}
+				//we keep the full cloud
+				ccLog::Warning(QString("[3DMASC] Cloud %1 has no point in the region of interest (the whole cloud is used)").arg(cloud->getName()));
+			}
+			else if (selection->size() < cloud->size())
+			{
+				croppedCloud = cloud->partialClone(selection.data());
+				if (!croppedCloud)
+				{
+					error = "Not enough memory";
+					success = false;
+					break;
+				}
+				croppedCloud->setName(cloud->getName() + " (ROI)");
+				ccLog::Print(QString("[3DMASC] Cloud %1 restricted to %2 / %3 points").arg(cloud->getName()).arg(croppedCloud->size()).arg(cloud->size()));
+			}
+			croppedClouds.insert(cloud, croppedCloud);
+			if (cloud == mainCloud)
+			{
+				mainSelection = selection;
+			}
+		}
+		roiClouds.insert(it.key(), croppedClouds.value(cloud));
+	}
+
+	CorePoints corePoints;
+	if (success)
+	{
+		//the core points are the points inside the region of interest (without the halo)
+		corePoints.origin = roiClouds.value(mainRole);
+		corePoints.role = mainRole;
+		corePoints.selection.reset(new CCCoreLib::ReferenceCloud(corePoints.origin));
+		for (unsigned i = 0; i < corePoints.origin->size(); ++i)
+		{
+			if (roi.contains(corePoints.origin->toGlobal3d(*corePoints.origin->getPoint(i))) && !corePoints.selection->addPointIndex(i))
+			{
+				error = "Not enough memory";
+				success = false;
+				break;
+			}
+		}
+
+		if (success && corePoints.selection->size() == corePoints.origin->size())
+		{
+			corePoints.selection.reset();
+			corePoints.cloud = corePoints.origin;
+		}
+		else if (success)
+		{
+			if (corePoints.selection->size() == 0)
+			{
+				error = "No point inside the region of interest";
+				success = false;
+			}
+			else
+			{
+				corePoints.cloud = corePoints.origin->partialClone(corePoints.selection.data());
+				if (!corePoints.cloud)
+				{
+					error = "Not enough memory";
+					success = false;
+				}
+			}
+		}
+	}
+
+	//the features are bound to the restricted clouds
+	Feature::Set features;
+	if (success)
+	{
+		if (LoadFile(classifierFilename, &roiClouds, true, &features))
+		{
+			FlagUnusedFeatures(features, classifier);
+		}
+		else
+		{
+			error = "Failed to load the features";
+			success = false;
+		}
+	}
+
+	if (success)
+	{
+		ccLog::Print(QString("[3DMASC] %1 points inside the region of interest").arg(corePoints.size()));
+		if (classifier.hasCascade())
+		{
+			success = ClassifyCascade(corePoints, features, classifier, error, progressCb, nullptr, parent);
+		}
+		else
+		{
+			success = PrepareFeatures(corePoints, features, error, progressCb);
+			if (success)
+			{
+				Feature::Source::Set sources;
+				Feature::ExtractSources(features, sources);
+				success = classifier.classify(sources, corePoints.cloud, error, parent);
+			}
+		}
+	}
+
+	//write the results back in the full cloud
+	if (success)
+	{
+		CCCoreLib::ScalarField* roiClassificationSF = GetClassificationSF(corePoints.cloud);
+		CCCoreLib::ScalarField* roiConfidenceSF = RetrieveSF(corePoints.cloud, "Classification_confidence");
+
+		CCCoreLib::ScalarField* classificationSF = GetClassificationSF(mainCloud);
+		if (!classificationSF)
+		{
+			ccScalarField* sf = new ccScalarField(LAS_FIELD_NAMES[LAS_CLASSIFICATION]);
+			if (sf->resizeSafe(mainCloud->size(), true, 0))
+			{
+				mainCloud->addScalarField(sf);
+				classificationSF = sf;
+			}
+			else
+			{
+				sf->release();
+			}
+		}
+		CCCoreLib::ScalarField* confidenceSF = RetrieveSF(mainCloud, "Classification_confidence");
+		if (!confidenceSF)
+		{
+			ccScalarField* sf = new ccScalarField("Classification_confidence");
+			if (sf->resizeSafe(mainCloud->size(), true, CCCoreLib::NAN_VALUE))
+			{
+				mainCloud->addScalarField(sf);
+				confidenceSF = sf;
+			}
+			else
+			{
+				sf->release();
+			}
+		}
+
+		if (!roiClassificationSF || !roiConfidenceSF)
+		{
+			assert(false);
+			error = "Missing classification";
+			success = false;
+		}
+		else if (!classificationSF || !confidenceSF)
+		{
+			error = "Not enough memory";
+			success = false;
+		}
+		else
+		{
+			for (unsigned i = 0; i < corePoints.size(); ++i)
+			{
+				unsigned croppedIndex = corePoints.originIndex(i);
+				unsigned pointIndex = (mainSelection && corePoints.origin != mainCloud ? mainSelection->getPointGlobalIndex(croppedIndex) : croppedIndex);
+				classificationSF->setValue(pointIndex, roiClassificationSF->getValue(i));
+				confidenceSF->setValue(pointIndex, roiConfidenceSF->getValue(i));
+			}
+			classificationSF->computeMinAndMax();
+			confidenceSF->computeMinAndMax();
+			mainCloud->setCurrentDisplayedScalarField(mainCloud->getScalarFieldIndexByName(LAS_FIELD_NAMES[LAS_CLASSIFICATION]));
+		}
+	}
+
+	//release the temporary clouds
+	if (corePoints.cloud && corePoints.cloud != corePoints.origin)
+	{
+		delete corePoints.cloud;
+	}
+	for (QMap<ccPointCloud*, ccPointCloud*>::const_iterator it = croppedClouds.begin(); it != croppedClouds.end(); ++it)
+	{
+		if (it.value() != it.key())
+		{
+			delete it.value();
+		}
+	}
+
+	return success;
+}
+
+size_t Tools::MergeFeatures(Feature::Set& features, Feature::Set& otherFeatures)
+{
+	QMap<QString, Feature::Shared> featuresByName;
+	for (const Feature::Shared& feature : features)
+	{
+		featuresByName.insert(feature->toString(), feature);
+	}
+
+	size_t sharedCount = 0;
+	for (Feature::Shared& otherFeature : otherFeatures)
+	{
+		QString name = otherFeature->toString();
+		QMap<QString, Feature::Shared>::iterator it = featuresByName.find(name);
+		if (it != featuresByName.end())
+		{
+			//the feature will be computed once
+			it.value()->unused = it.value()->unused && otherFeature->unused;
+			otherFeature = it.value();
+			++sharedCount;
+		}
+		else
+		{
+			features.push_back(otherFeature);
+			featuresByName.insert(name, otherFeature);
+		}
+	}
+
+	return sharedCount;
+}
+
+void Tools::RenameClassificationSFs(ccPointCloud* cloud, const QString& suffix)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return;
+	}
+
+	for (const char* sfName : { LAS_FIELD_NAMES[LAS_CLASSIFICATION], "Classification_confidence", "Classification_margin", "Classification_tree_count" })
+	{
+		int sfIdx = cloud->getScalarFieldIndexByName(sfName);
+		if (sfIdx < 0)
+		{
+			continue;
+		}
+
+		QString newName = QString(sfName) + "_" + suffix;
+		int existingIdx = cloud->getScalarFieldIndexByName(qPrintable(newName));
+		if (existingIdx >= 0)
+		{
+			cloud->deleteScalarField(existingIdx);
+			sfIdx = cloud->getScalarFieldIndexByName(sfName); //the indexes may have changed
+		}
+		cloud->getScalarField(sfIdx)->setName(qPrintable(newName));
+	}
+}
+
+bool Tools::LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, QWidget* parent/*=nullptr*/)
+{
+	return LoadFile(filename, &clouds, true, &rawFeatures, nullptr, nullptr, &classifier, nullptr, parent);
+}
+
+bool Tools::LoadCorePointsSelection(const QString& filename, NamedClouds& clouds, CorePoints& corePoints, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	CorePoints fileCorePoints;
+	if (!LoadFile(filename, &clouds, true, nullptr, nullptr, &fileCorePoints))
+	{
+		return false;
+	}
+
+	if (!fileCorePoints.origin || fileCorePoints.selectionMethod == CorePoints::NONE)
+	{
+		ccLog::Warning("[3DMASC] The classifier file doesn't define subsampled core points: all the points will be classified");
+		return true;
+	}
+	if (fileCorePoints.origin != corePoints.origin)
+	{
+		ccLog::Warning("[3DMASC] The core points are not defined on the classified cloud: all the points will be classified");
+		return true;
+	}
+
+	if (!fileCorePoints.prepare(progressCb))
+	{
+		return false;
+	}
+
+	corePoints = fileCorePoints;
+	ccLog::Print(QString("[3DMASC] %1 core points will be classified (out of %2 points)").arg(corePoints.size()).arg(corePoints.origin->size()));
+
+	return true;
+}
+
+bool Tools::LoadTrainingFile(	QString filename,
+								Feature::Set& rawFeatures,
+								std::vector<double>& rawScales,
+								NamedClouds& loadedClouds,
+								TrainParameters& parameters,
+								CorePoints* corePoints/*=nullptr*/,
+								QWidget* parentWidget/*=nullptr*/)
+{
+	bool cloudsWereProvided = !loadedClouds.empty();
+	if (LoadFile(filename, &loadedClouds, cloudsWereProvided, &rawFeatures, &rawScales, corePoints, nullptr, &parameters, parentWidget))
+	{
+		return true;
+	}
+	else
+	{
+		if (!cloudsWereProvided)
+		{
+			//delete the already loaded clouds (if any)
+			for (NamedClouds::iterator it = loadedClouds.begin(); it != loadedClouds.end(); ++it)
+				delete it.value();
+		}
+		return false;
+	}
+}
+
+CCCoreLib::ScalarField* Tools::RetrieveSF(const ccPointCloud* cloud, const QString& sfName, bool caseSensitive/*=true*/)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return nullptr;
+	}
+	int sfIdx = -1;
+	if (caseSensitive)
+	{
+		sfIdx = cloud->getScalarFieldIndexByName(qPrintable(sfName));
+	}
+	else
+	{
+		QString sfNameUpper = sfName.toUpper();
+		for (unsigned i = 0; i < cloud->getNumberOfScalarFields(); ++i)
+		{
+			if (QString(cloud->getScalarField(i)->getName()).toUpper() == sfNameUpper)
+			{
+				sfIdx = static_cast<int>(i);
+				break;
+			}
+		}
+	}
+	
+	if (sfIdx >= 0)
+	{
+		return cloud->getScalarField(sfIdx);
+	}
+	else
+	{
+		return nullptr;
+	}
+}
+
+bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& errorStr,
+							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/)
+{
+	if (features.empty() || !corePoints.origin)
+	{
+		//invalid input parameters
+		assert(false);
+		return false;
+	}
+
+	//the features not used by the classifier are not computed
+	Feature::Set usedFeatures;
+	usedFeatures.reserve(features.size());
+	for (const Feature::Shared& feature : features)
+	{
+		if (feature->unused)
+		{
+			//placeholder column (doesn't change the predictions)
+			feature->source = Feature::Source(Feature::Source::Placeholder, feature->toString());
+		}
+		else
+		{
+			usedFeatures.push_back(feature);
+		}
+	}
+	if (usedFeatures.empty())
+	{
+		return true;
+	}
+
+	//build the execution plan (this also prepares the features)
+	FeaturePlan plan(corePoints);
+	if (!plan.build(usedFeatures, errorStr, progressCb, generatedScalarFields))
+	{
+		//something failed (error should be up to date)
+		return false;
+	}
+
+	//compute the scaled features
+	bool success = plan.execute(errorStr, progressCb);
+
+	for (const Feature::Shared& feature : usedFeatures)
+	{
+		//we have to 'finish' the process for scaled features
+		if (feature->scaled() && !feature->finish(corePoints, errorStr))
+		{
+			return false;
+		}
+	}
+
+	return success;
+}
+
+//! Removes the classification results from a cloud (typically a partial clone that will be classified again)
+static void RemoveClassificationSFs(ccPointCloud* cloud)
+{
+	for (const char* sfName : { "Classification_backup", "Classification_confidence", "Classification_margin", "Classification_tree_count" })
+	{
+		int sfIdx = cloud->getScalarFieldIndexByName(sfName);
+		if (sfIdx >= 0)
+			cloud->deleteScalarField(sfIdx);
+	}
+	if (CCCoreLib::ScalarField* classificationSF = Tools::GetClassificationSF(cloud))
+	{
+		cloud->deleteScalarField(cloud->getScalarFieldIndexByName(classificationSF->getName()));
+	}
+}
+
+std::vector<int> Tools::CascadeFeatures(const Feature::Set& features, double maxScale)
+{
+	std::vector<int> indexes;
+	for (size_t i = 0; i < features.size(); ++i)
+	{
+		const Feature::Shared& feature = features[i];
+		switch (feature->getType())
+		{
+		case Feature::Type::PointFeature:
+		case Feature::Type::NeighborhoodFeature:
+			if (!feature->scaled() || feature->scale <= maxScale)
+			{
+				indexes.push_back(static_cast<int>(i));
+			}
+			break;
+		default:
+			//context based and dual cloud features are considered as expensive
+			break;
+		}
+	}
+
+	return indexes;
+}
+
+bool Tools::ClassifyCascade(const CorePoints& corePoints,
+							Feature::Set& features,
+							masc::Classifier& classifier,
+							QString& error,
+							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+							SFCollector* generatedScalarFields/*=nullptr*/,
+							QWidget* parent/*=nullptr*/)
+{
+	if (!corePoints.cloud || !classifier.hasCascade())
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	//split the features
+	Feature::Set cheapFeatures, expensiveFeatures;
+	std::vector<bool> isCheap(features.size(), false);
+	for (int index : classifier.cascadeFeatures())
+	{
+		if (index < 0 || index >= static_cast<int>(features.size()))
+		{
+			error = "Invalid cascade feature index";
+			return false;
+		}
+		isCheap[index] = true;
+		cheapFeatures.push_back(features[index]);
+	}
+	for (size_t i = 0; i < features.size(); ++i)
+	{
+		if (!isCheap[i])
+		{
+			expensiveFeatures.push_back(features[i]);
+		}
+	}
+
+	//first stage: cheap features, on all the core points
+	if (!PrepareFeatures(corePoints, cheapFeatures, error, progressCb, generatedScalarFields))
+	{
+		return false;
+	}
+	{
+		Feature::Source::Set cheapSources;
+		Feature::ExtractSources(cheapFeatures, cheapSources);
+		if (!classifier.cascadeStage()->classify(cheapSources, corePoints.cloud, error, parent))
+		{
+			return false;
+		}
+	}
+
+	CCCoreLib::ScalarField* classificationSF = GetClassificationSF(corePoints.cloud);
+	int confidenceSFIdx = corePoints.cloud->getScalarFieldIndexByName("Classification_confidence");
+	int marginSFIdx = corePoints.cloud->getScalarFieldIndexByName("Classification_margin");
+	if (!classificationSF || confidenceSFIdx < 0)
+	{
+		assert(false);
+		error = "Missing first stage classification";
+		return false;
+	}
+	CCCoreLib::ScalarField* confidenceSF = corePoints.cloud->getScalarField(confidenceSFIdx);
+	CCCoreLib::ScalarField* marginSF = (marginSFIdx >= 0 ? corePoints.cloud->getScalarField(marginSFIdx) : nullptr);
+
+	//look for the points with a low confidence
+	unsigned pointCount = corePoints.size();
+	QSharedPointer<CCCoreLib::ReferenceCloud> uncertain(new CCCoreLib::ReferenceCloud(corePoints.cloud));
+	QSharedPointer<CCCoreLib::ReferenceCloud> uncertainOrigin(new CCCoreLib::ReferenceCloud(corePoints.origin));
+	for (unsigned i = 0; i < pointCount; ++i)
+	{
+		ScalarType confidence = confidenceSF->getValue(i);
+		if (!(confidence >= classifier.cascadeThreshold()))
+		{
+			if (!uncertain->addPointIndex(i) || !uncertainOrigin->addPointIndex(corePoints.originIndex(i)))
+			{
+				error = "Not enough memory";
+				return false;
+			}
+		}
+	}
+
+	unsigned escalatedCount = uncertain->size();
+	ccLog::Print(QString("[3DMASC] Cascade: %1 / %2 points escalated to the full classifier (%3%)")
+					.arg(escalatedCount)
+					.arg(pointCount)
+					.arg(pointCount != 0 ? (100.0 * escalatedCount) / pointCount : 0.0, 0, 'f', 1));
+	if (escalatedCount == 0)
+	{
+		return true;
+	}
+
+	//second stage: all the features, only on the uncertain points
+	CorePoints escalated;
+	escalated.origin = corePoints.origin;
+	escalated.role = corePoints.role;
+	escalated.selection = uncertainOrigin;
+	escalated.cloud = corePoints.cloud->partialClone(uncertain.data());
+	if (!escalated.cloud)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	//the clone shouldn't carry the first stage results
+	RemoveClassificationSFs(escalated.cloud);
+
+	//(the cheap features have been copied with the points)
+	bool success = (expensiveFeatures.empty() || PrepareFeatures(escalated, expensiveFeatures, error, progressCb));
+	if (success)
+	{
+		Feature::Source::Set sources;
+		Feature::ExtractSources(features, sources);
+		success = classifier.classify(sources, escalated.cloud, error, parent);
+	}
+
+	if (success)
+	{
+		CCCoreLib::ScalarField* escalatedClassificationSF = GetClassificationSF(escalated.cloud);
+		CCCoreLib::ScalarField* escalatedConfidenceSF = RetrieveSF(escalated.cloud, "Classification_confidence");
+		CCCoreLib::ScalarField* escalatedMarginSF = RetrieveSF(escalated.cloud, "Classification_margin");
+		if (escalatedClassificationSF && escalatedConfidenceSF)
+		{
+			for (unsigned j = 0; j < escalatedCount; ++j)
+			{
+				unsigned pointIndex = uncertain->getPointGlobalIndex(j);
+				classificationSF->setValue(pointIndex, escalatedClassificationSF->getValue(j));
+				confidenceSF->setValue(pointIndex, escalatedConfidenceSF->getValue(j));
+				if (marginSF && escalatedMarginSF)
+				{
+					marginSF->setValue(pointIndex, escalatedMarginSF->getValue(j));
+				}
+			}
+			classificationSF->computeMinAndMax();
+			confidenceSF->computeMinAndMax();
+			if (marginSF)
+				marginSF->computeMinAndMax();
+		}
+		else
+		{
+			assert(false);
+			error = "Missing second stage classification";
+			success = false;
+		}
+	}
+
+	delete escalated.cloud;
+	escalated.cloud = nullptr;
+
+	return success;
+}
+
+bool Tools::CreateClassificationSFs(ccPointCloud* cloud, CCCoreLib::ScalarField*& classificationSF, CCCoreLib::ScalarField*& confidenceSF)
+{
+	if (!cloud)
+	{
+		assert(false);
+		return false;
+	}
+
+	//save the classification field (if any) as done by the classifier
+	classificationSF = GetClassificationSF(cloud);
+	if (classificationSF)
+	{
+		ccLog::Warning("Classification SF found: copy it in Classification_backup");
+		int sfIdx = cloud->getScalarFieldIndexByName("Classification_backup");
+		if (sfIdx >= 0)
+			cloud->deleteScalarField(sfIdx);
+		classificationSF->setName("Classification_backup");
+	}
+	{
+		int sfIdx = cloud->getScalarFieldIndexByName("Classification_confidence");
+		if (sfIdx >= 0)
+			cloud->deleteScalarField(sfIdx);
+	}
+
+	ccScalarField* _classificationSF = new ccScalarField(LAS_FIELD_NAMES[LAS_CLASSIFICATION]);
+	ccScalarField* _confidenceSF = new ccScalarField("Classification_confidence");
+	if (!_classificationSF->resizeSafe(cloud->size(), true, CCCoreLib::NAN_VALUE) || !_confidenceSF->resizeSafe(cloud->size(), true, CCCoreLib::NAN_VALUE))
+	{
+		_classificationSF->release();
+		_confidenceSF->release();
+		classificationSF = confidenceSF = nullptr;
+		return false;
+	}
+	cloud->addScalarField(_classificationSF);
+	cloud->addScalarField(_confidenceSF);
+	classificationSF = _classificationSF;
+	confidenceSF = _confidenceSF;
+
+	return true;
+}
+
+bool Tools::ClassifySelection(	ccPointCloud* cloud,
+								const QString& role,
+								const std::vector<unsigned>& pointIndexes,
+								Feature::Set& features,
+								masc::Classifier& classifier,
+								std::vector<ScalarType>& labels,
+								std::vector<ScalarType>& confidences,
+								QString& error,
+								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+								QWidget* parent/*=nullptr*/)
+{
+	labels.clear();
+	confidences.clear();
+	if (!cloud || features.empty() || !classifier.isValid())
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+	if (pointIndexes.empty())
+	{
+		return true;
+	}
+	unsigned count = static_cast<unsigned>(pointIndexes.size());
+
+	CorePoints selection;
+	selection.origin = cloud;
+	selection.role = role;
+	selection.selection.reset(new CCCoreLib::ReferenceCloud(cloud));
+	if (!selection.selection->reserve(count))
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	for (unsigned pointIndex : pointIndexes)
+	{
+		selection.selection->addPointIndex(pointIndex);
+	}
+
+	selection.cloud = cloud->partialClone(selection.selection.data());
+	if (!selection.cloud)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	//the clone shouldn't carry the classification results of the cloud
+	RemoveClassificationSFs(selection.cloud);
+
+	bool success = PrepareFeatures(selection, features, error, progressCb);
+	if (success)
+	{
+		Feature::Source::Set sources;
+		Feature::ExtractSources(features, sources);
+		success = classifier.classify(sources, selection.cloud, error, parent);
+	}
+
+	if (success)
+	{
+		CCCoreLib::ScalarField* selectionClassificationSF = GetClassificationSF(selection.cloud);
+		CCCoreLib::ScalarField* selectionConfidenceSF = RetrieveSF(selection.cloud, "Classification_confidence");
+		if (selectionClassificationSF && selectionConfidenceSF)
+		{
+			try
+			{
+				labels.resize(count);
+				confidences.resize(count);
+				for (unsigned j = 0; j < count; ++j)
+				{
+					labels[j] = selectionClassificationSF->getValue(j);
+					confidences[j] = selectionConfidenceSF->getValue(j);
+				}
+			}
+			catch (const std::bad_alloc&)
+			{
+				error = "Not enough memory";
+				success = false;
+			}
+		}
+		else
+		{
+			assert(false);
+			error = "Missing classification";
+			success = false;
+		}
+	}
+
+	delete selection.cloud;
+	selection.cloud = nullptr;
+
+	return success;
+}
+
+bool Tools::PropagateClassification(	const CorePoints& corePoints,
+										const PropagationParameters& params,
+										QString& error,
+										Feature::Set* refinementFeatures/*=nullptr*/,
+										masc::Classifier* classifier/*=nullptr*/,
+										CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+										QWidget* parent/*=nullptr*/)
+{
+	if (!corePoints.origin || !corePoints.cloud || !corePoints.selection || corePoints.cloud == corePoints.origin || params.k < 1)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+	if (params.refineBoundaries && (!refinementFeatures || refinementFeatures->empty() || !classifier || !classifier->isValid()))
+	{
+		assert(false);
+		error = "Refinement requires the features and the classifier";
+		return false;
+	}
+
+	ccPointCloud* origin = corePoints.origin;
+	unsigned pointCount = origin->size();
+	unsigned corePointCount = corePoints.size();
+
+	CCCoreLib::ScalarField* coreClassificationSF = GetClassificationSF(corePoints.cloud);
+	CCCoreLib::ScalarField* coreConfidenceSF = RetrieveSF(corePoints.cloud, "Classification_confidence");
+	if (!coreClassificationSF || !coreConfidenceSF)
+	{
+		error = "Core points are not classified";
+		return false;
+	}
+
+	//we need an octree on the core points
+	ccOctree::Shared octree = corePoints.cloud->getOctree();
+	if (!octree)
+	{
+		octree = corePoints.cloud->computeOctree(progressCb);
+		if (!octree)
+		{
+			error = "Failed to compute the core points octree";
+			return false;
+		}
+	}
+
+	int neighborCount = (params.refineBoundaries ? std::max(params.k, params.boundaryNeighborCount) : params.k);
+	neighborCount = std::min(neighborCount, static_cast<int>(corePointCount));
+	unsigned char octreeLevel = octree->findBestLevelForAGivenPopulationPerCell(std::max(3, neighborCount));
+
+	//flag the core points (they keep their own class)
+	std::vector<char> isCorePoint;
+	try
+	{
+		isCorePoint.resize(pointCount, 0);
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	for (unsigned i = 0; i < corePointCount; ++i)
+	{
+		isCorePoint[corePoints.originIndex(i)] = 1;
+	}
+
+	CCCoreLib::ScalarField* classificationSF = nullptr;
+	CCCoreLib::ScalarField* confidenceSF = nullptr;
+	if (!CreateClassificationSFs(origin, classificationSF, confidenceSF))
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Propagate classification");
+		progressCb->setInfo(qPrintable(QString("Propagating the classes of %1 core points to %2 points").arg(corePointCount).arg(pointCount)));
+		progressCb->start();
+	}
+	ccLog::Print(QString("[3DMASC] Propagating the classes of %1 core points to %2 points (k = %3)").arg(corePointCount).arg(pointCount).arg(params.k));
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	//points close to a class boundary
+	std::vector<unsigned> boundaryIndexes;
+
+	QMutex mutex;
+	bool success = true;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(Tools::MaxThreadCount())
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
+	{
+		if (!success)
+		{
+			continue;
+		}
+
+		if (!isCorePoint[i])
+		{
+			const CCVector3* P = origin->getPoint(i);
+			CCCoreLib::ReferenceCloud Yk(corePoints.cloud);
+			double maxSquareDist = 0;
+			int found = static_cast<int>(octree->findPointNeighbourhood(P, &Yk, neighborCount, octreeLevel, maxSquareDist));
+
+			ScalarType label = CCCoreLib::NAN_VALUE;
+			ScalarType confidence = CCCoreLib::NAN_VALUE;
+			bool boundary = false;
+			if (found > 0)
+			{
+				//majority vote of the k nearest core points
+				int voterCount = std::min(found, params.k);
+				std::vector<std::pair<ScalarType, int>> votes;
+				votes.reserve(voterCount);
+				for (int j = 0; j < voterCount; ++j)
+				{
+					ScalarType neighborLabel = coreClassificationSF->getValue(Yk.getPointGlobalIndex(j));
+					auto it = std::find_if(votes.begin(), votes.end(), [&](const std::pair<ScalarType, int>& v) { return v.first == neighborLabel; });
+					if (it != votes.end())
+						++it->second;
+					else
+						votes.push_back({ neighborLabel, 1 });
+				}
+				//(ties are broken by the closest core point)
+				auto best = votes.begin();
+				for (auto it = votes.begin(); it != votes.end(); ++it)
+				{
+					if (it->second > best->second)
+						best = it;
+				}
+				label = best->first;
 
-				//we extract the point's neighbors
-				unsigned kNN = octree->findNeighborsInASphereStartingFromCell(nNSS, largestRadius, true);
-				if (kNN != 0)
+				//mean confidence of the voters of the winning class, weighted by their ratio
+				double confidenceSum = 0.0;
+				for (int j = 0; j < voterCount; ++j)
 				{
-					nNSS.pointsInNeighbourhood.resize(kNN);
+					unsigned coreIndex = Yk.getPointGlobalIndex(j);
+					if (coreClassificationSF->getValue(coreIndex) == label)
+						confidenceSum += coreConfidenceSF->getValue(coreIndex);
+				}
+				confidence = static_cast<ScalarType>(confidenceSum / voterCount);
 
-					//for each scale (from the largest to the smallest)
-					for (size_t scaleIndex = 0; scaleIndex < fas.scales.size(); ++scaleIndex)
+				if (params.refineBoundaries)
+				{
+					for (int j = 0; j < found; ++j)
 					{
-						double currentScale = fas.scales[fas.scales.size() - 1 - scaleIndex]; //from the biggest to the smallest!
-
-						if (scaleIndex != 0)
+						if (coreClassificationSF->getValue(Yk.getPointGlobalIndex(j)) != label)
 						{
-							double radius = currentScale / 2; //scale is the diameter!
-							double sqRadius = radius * radius;
-							//remove the farthest points
-							for (; kNN > 0; --kNN)
-							{
-								if (nNSS.pointsInNeighbourhood[kNN - 1].squareDistd <= sqRadius)
-								{
-									break;
-								}
-							}
-
-							if (kNN == 0)
-							{
-								//no need to go further
-								break;
-							}
-							nNSS.pointsInNeighbourhood.resize(kNN);
+							boundary = true;
+							break;
 						}
+					}
+				}
+			}
 
-						//Point features
-						for (PointFeature::Shared& feature : fas.pointFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->statSF1 && feature->field1)
-							{
-								double outputValue = 0;
-								if (!feature->computeStat(nNSS.pointsInNeighbourhood, feature->field1, outputValue))
-								{
-									//an error occurred
-									success = false;
-									break;
-								}
+			classificationSF->setValue(i, label);
+			confidenceSF->setValue(i, confidence);
 
-								ScalarType v1 = static_cast<ScalarType>(outputValue);
-								feature->statSF1->setValue(i, v1);
-							}
+			if (boundary)
+			{
+				mutex.lock();
+				try
+				{
+					boundaryIndexes.push_back(static_cast<unsigned>(i));
+				}
+				catch (const std::bad_alloc&)
+				{
+					error = "Not enough memory";
+					success = false;
+				}
+				mutex.unlock();
+			}
+		}
 
-							if (feature->cloud2 == sourceCloud && feature->statSF2 && feature->field2)
-							{
-								assert(feature->op != Feature::NO_OPERATION);
-								double outputValue = 0;
-								if (!feature->computeStat(nNSS.pointsInNeighbourhood, feature->field2, outputValue))
-								{
-									//an error occurred
-									success = false;
-									break;
-								}
+		if (progressCb && (i % 1024) == 0)
+		{
+			mutex.lock();
+			if (!nProgress.steps(1024))
+			{
+				//process cancelled by the user
+				error = "Process cancelled";
+				success = false;
+			}
+			mutex.unlock();
+		}
+	}
 
-								ScalarType v2 = static_cast<ScalarType>(outputValue);
-								feature->statSF2->setValue(i, v2);
-							}
-						}
+	if (!success)
+	{
+		return false;
+	}
 
-						//Neighborhood features
-						for (NeighborhoodFeature::Shared& feature : fas.neighborhoodFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->sf1)
-							{
-								double outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
-								{
-									//an error occurred
-									errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud1->getName();
-									success = false;
-									break;
-								}
+	//the core points keep their own class
+	for (unsigned i = 0; i < corePointCount; ++i)
+	{
+		unsigned pointIndex = corePoints.originIndex(i);
+		classificationSF->setValue(pointIndex, coreClassificationSF->getValue(i));
+		confidenceSF->setValue(pointIndex, coreConfidenceSF->getValue(i));
+	}
 
-								ScalarType v1 = static_cast<ScalarType>(outputValue);
-								feature->sf1->setValue(i, v1);
-							}
+	//refine the points close to a class boundary
+	if (params.refineBoundaries && !boundaryIndexes.empty())
+	{
+		ccLog::Print(QString("[3DMASC] Refining %1 points close to a class boundary (%2%)")
+						.arg(boundaryIndexes.size())
+						.arg((100.0 * boundaryIndexes.size()) / pointCount, 0, 'f', 1));
 
-							if (feature->cloud2 == sourceCloud && feature->sf2)
-							{
-								assert(feature->op != Feature::NO_OPERATION);
-								double outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
-								{
-									//an error occurred
-									errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud2->getName();
-									success = false;
-									break;
-								}
+		//(sorted so that the selection has the same order as the origin cloud)
+		std::sort(boundaryIndexes.begin(), boundaryIndexes.end());
 
-								ScalarType v2 = static_cast<ScalarType>(outputValue);
-								feature->sf2->setValue(i, v2);
-							}
-						}
+		std::vector<ScalarType> labels, confidences;
+		success = ClassifySelection(origin, corePoints.role, boundaryIndexes, *refinementFeatures, *classifier, labels, confidences, error, progressCb, parent);
+		if (success)
+		{
+			for (size_t j = 0; j < boundaryIndexes.size(); ++j)
+			{
+				classificationSF->setValue(boundaryIndexes[j], labels[j]);
+				confidenceSF->setValue(boundaryIndexes[j], confidences[j]);
+			}
+		}
+	}
 
-						//Context-based features
-						for (ContextBasedFeature::Shared& feature : fas.contextBasedFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->sf)
-							{
-								ScalarType outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
-								{
-									//an error occurred
-									errorStr = "An error occurred during the computation of feature " + feature->toString() + "on cloud " + feature->cloud1->getName();
-									success = false;
-									break;
-								}
+	classificationSF->computeMinAndMax();
+	confidenceSF->computeMinAndMax();
+	origin->setCurrentDisplayedScalarField(origin->getScalarFieldIndexByName(LAS_FIELD_NAMES[LAS_CLASSIFICATION]));
 
-								feature->sf->setValue(i, outputValue);
-							}
-						}
+	return success;
+}
 
-						if (!success)
-						{
-							break;
-						}
-					} //for each scale
+ccPointCloud* Tools::LoadCloud(const QString& filename, QString& error, CCVector3d* coordinatesShift/*=nullptr*/, bool* coordinatesShiftEnabled/*=nullptr*/)
+{
+	CCVector3d localCoordinatesShift(0, 0, 0);
+	bool localCoordinatesShiftEnabled = false;
 
-				}
-			
-				if (progressCb)
-				{
-					mutex.lock();
-					bool cancelled = !nProgress.oneStep();
-					mutex.unlock();
-					if (cancelled)
-					{
-						//process cancelled by the user
-						ccLog::Warning("Process cancelled");
-						errorStr = "Process cancelled";
-						success = false;
-						break;
-					}
-				}
+	FileIOFilter::LoadParameters loadParameters;
+	loadParameters.alwaysDisplayLoadDialog = false;
+	loadParameters.autoComputeNormals = false;
+	loadParameters.shiftHandlingMode = ccGlobalShiftManager::NO_DIALOG_AUTO_SHIFT;
+	loadParameters._coordinatesShift = coordinatesShift ? coordinatesShift : &localCoordinatesShift;
+	loadParameters._coordinatesShiftEnabled = coordinatesShiftEnabled ? coordinatesShiftEnabled : &localCoordinatesShiftEnabled;
+	loadParameters.parentWidget = nullptr;
+
+	CC_FILE_ERROR result = CC_FERR_NO_ERROR;
+	ccHObject* object = FileIOFilter::LoadFromFile(filename, loadParameters, result);
+	if (result != CC_FERR_NO_ERROR || !object)
+	{
+		delete object;
+		error = "Failed to load " + filename;
+		return nullptr;
+	}
 
-			} //for each point
-		
-		} //for each cloud
+	ccHObject::Container cloudsInFile;
+	object->filterChildren(cloudsInFile, false, CC_TYPES::POINT_CLOUD, true);
+	if (cloudsInFile.empty())
+	{
+		delete object;
+		error = "File doesn't contain a single cloud: " + filename;
+		return nullptr;
+	}
+	else if (cloudsInFile.size() > 1)
+	{
+		ccLog::Warning(QString("File %1 contains more than one cloud, only the first one will be kept").arg(filename));
 	}
 
-	for (const Feature::Shared& feature : features)
+	ccPointCloud* cloud = static_cast<ccPointCloud*>(cloudsInFile.front());
+	if (cloud->getParent())
 	{
-		//we have to 'finish' the process for scaled features
-		if (feature->scaled() && !feature->finish(corePoints, errorStr))
-		{
-			return false;
-		}
+		cloud->getParent()->detachChild(cloud);
+	}
+	if (object != cloud)
+	{
+		delete object;
+	}
+
+	SpatialIndexCache::SetSource(cloud, filename); //the octree will be saved next to the file
+	return cloud;
+}
+
+bool Tools::SaveCloud(ccPointCloud* cloud, const QString& filename, QString& error)
+{
+	if (!cloud)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	FileIOFilter::Shared filter = FileIOFilter::FindBestFilterForExtension(QFileInfo(filename).suffix());
+	if (!filter)
+	{
+		error = "No I/O filter for " + filename;
+		return false;
+	}
+
+	FileIOFilter::SaveParameters saveParameters;
+	saveParameters.alwaysDisplaySaveDialog = false;
+	saveParameters.parentWidget = nullptr;
+	if (FileIOFilter::SaveToFile(cloud, filename, saveParameters, filter) != CC_FERR_NO_ERROR)
+	{
+		error = "Failed to save " + filename;
+		return false;
+	}
+
+	return true;
+}
+
+bool Tools::ClassifyCloud(	const QString& classifierFilename,
+							const NamedClouds& clouds,
+							const QString& mainRole,
+							masc::Classifier& classifier,
+							QString& error,
+							bool keepAttributes/*=false*/,
+							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+							QWidget* parent/*=nullptr*/)
+{
+	ccPointCloud* cloud = clouds.value(mainRole, nullptr);
+	if (!cloud || !classifier.isValid())
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	Feature::Set features;
+	NamedClouds featureClouds = clouds;
+	if (!LoadFile(classifierFilename, &featureClouds, true, &features))
+	{
+		error = "Failed to load the features";
+		return false;
+	}
+	FlagUnusedFeatures(features, classifier);
+
+	CorePoints corePoints;
+	corePoints.origin = corePoints.cloud = cloud;
+	corePoints.role = mainRole;
+
+	SFCollector generatedScalarFields;
+	bool success = false;
+	if (classifier.hasCascade())
+	{
+		success = ClassifyCascade(corePoints, features, classifier, error, progressCb, &generatedScalarFields, parent);
+	}
+	else if (PrepareFeatures(corePoints, features, error, progressCb, &generatedScalarFields))
+	{
+		Feature::Source::Set sources;
+		Feature::ExtractSources(features, sources);
+		success = classifier.classify(sources, cloud, error, parent);
 	}
+	generatedScalarFields.releaseSFs(success && keepAttributes);
 
 	return success;
 }
 
-bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset)
+bool Tools::CompressClassifier(	const QString& classifierFilename,
+								const NamedClouds& clouds,
+								const QString& mainRole,
+								const ForestCompression::Parameters& params,
+								const QString& outputFilename,
+								ForestCompression::Report& report,
+								masc::Classifier::AccuracyMetrics& metrics,
+								QString& error,
+								unsigned seed/*=0*/,
+								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+								QWidget* parent/*=nullptr*/)
+{
+	ccPointCloud* cloud = clouds.value(mainRole, nullptr);
+	if (!cloud)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+	if (!GetClassificationSF(cloud))
+	{
+		error = "Missing 'Classification' field on the labelled cloud";
+		return false;
+	}
+
+	//the core points definition is saved with the compressed classifier
+	QList<QString> cloudLabels;
+	QString corePointsLabel, corePointsDefinition;
+	bool filenamesSpecified = false;
+	if (!LoadClassifierCloudLabels(classifierFilename, cloudLabels, corePointsLabel, filenamesSpecified, &corePointsDefinition))
+	{
+		error = "Failed to read the classifier file";
+		return false;
+	}
+
+	//(the classifier is loaded at the same time so that the features it doesn't use are not computed)
+	masc::Classifier classifier;
+	Feature::Set features;
+	NamedClouds featureClouds = clouds;
+	if (!LoadFile(classifierFilename, &featureClouds, true, &features, nullptr, nullptr, &classifier, nullptr, parent) || !classifier.isValid())
+	{
+		error = "Failed to load the classifier";
+		return false;
+	}
+
+	CorePoints corePoints;
+	corePoints.origin = corePoints.cloud = cloud;
+	corePoints.role = mainRole;
+
+	SFCollector generatedScalarFields;
+	if (!PrepareFeatures(corePoints, features, error, progressCb, &generatedScalarFields))
+	{
+		generatedScalarFields.releaseSFs(false);
+		return false;
+	}
+	Feature::Source::Set sources;
+	Feature::ExtractSources(features, sources);
+
+	//half of the points to compress the forest, the other half to evaluate the compressed forest
+	CCCoreLib::ReferenceCloud validationSubset(cloud), evaluationSubset(cloud);
+	bool success = StratifiedSubsets(cloud, 0.5f, 0, seed, &evaluationSubset, &validationSubset);
+	if (!success)
+	{
+		error = "Failed to split the labelled points";
+	}
+	else
+	{
+		success =	classifier.compress(sources, cloud, params, report, error, &validationSubset, parent)
+				&&	classifier.evaluate(sources, cloud, metrics, error, nullptr, &evaluationSubset, QString(), parent);
+	}
+	generatedScalarFields.releaseSFs(false);
+	if (!success)
+	{
+		return false;
+	}
+
+	if (!SaveClassifier(outputFilename, features, corePointsDefinition.isEmpty() ? mainRole : corePointsDefinition, classifier, parent))
+	{
+		error = "Failed to save the compressed classifier";
+		return false;
+	}
+
+	return true;
+}
+
+bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset, unsigned seed/*=0*/)
 {
 	if (!cloud)
 	{
@@ -1435,20 +2653,11 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 	assert(inSampleCount <= cloud->size());
 	unsigned outSampleCount = cloud->size() - inSampleCount;
 
-	//we draw the smallest population (faster)
-	unsigned targetCount = inSampleCount;
-	bool defaultState = false;
-	if (outSampleCount < inSampleCount)
-	{
-		targetCount = outSampleCount;
-		defaultState = true;
-	}
-
 	//reserve memory
-	std::vector<bool> pointInsideRatio;
+	std::vector<unsigned> indexes;
 	try
 	{
-		pointInsideRatio.resize(cloud->size(), defaultState);
+		indexes.resize(cloud->size());
 	}
 	catch (const std::bad_alloc&)
 	{
@@ -1464,27 +2673,28 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 		return false;
 	}
 
-	//randomly choose the 'in' or 'out' indexes
-	int randIndex = 0;
-	unsigned randomCount = 0;
-	while (randomCount < targetCount)
+	//randomly choose the 'in' indexes (partial Fisher-Yates shuffle)
+	for (unsigned i = 0; i < cloud->size(); ++i)
 	{
-		randIndex = ((randIndex + std::rand()) % cloud->size());
-		if (pointInsideRatio[randIndex] == defaultState)
-		{
-			pointInsideRatio[randIndex] = !defaultState;
-			++randomCount;
-		}
+		indexes[i] = i;
 	}
+	std::mt19937 generator(seed);
+	for (unsigned i = 0; i < inSampleCount; ++i)
+	{
+		std::uniform_int_distribution<unsigned> distribution(i, cloud->size() - 1);
+		std::swap(indexes[i], indexes[distribution(generator)]);
+	}
+	std::sort(indexes.begin(), indexes.begin() + inSampleCount);
+	std::sort(indexes.begin() + inSampleCount, indexes.end());
 
 	//now dispatch the points
 	{
 		for (unsigned i = 0; i < cloud->size(); ++i)
 		{
-			if (pointInsideRatio[i])
-				inRatioSubset->addPointIndex(i);
+			if (i < inSampleCount)
+				inRatioSubset->addPointIndex(indexes[i]);
 			else
-				outRatioSubset->addPointIndex(i);
+				outRatioSubset->addPointIndex(indexes[i]);
 		}
 		assert(inRatioSubset->size() == inSampleCount);
 		assert(outRatioSubset->size() == outSampleCount);
@@ -1493,6 +2703,159 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 	return true;
 }
 
+bool Tools::StratifiedSubsets(	ccPointCloud* cloud,
+								float testRatio,
+								int maxTrainSamplesPerClass,
+								unsigned seed,
+								CCCoreLib::ReferenceCloud* testSubset,
+								CCCoreLib::ReferenceCloud* trainSubset,
+								const CCCoreLib::ReferenceCloud* sourceSubset/*=nullptr*/)
+{
+	if (!cloud)
+	{
+		ccLog::Warning("Invalid input cloud");
+		return false;
+	}
+	if (!trainSubset || (!testSubset && testRatio > 0.0f))
+	{
+		ccLog::Warning("Invalid input refence clouds");
+		return false;
+	}
+	if (	trainSubset->getAssociatedCloud() != cloud
+		||	(testSubset && testSubset->getAssociatedCloud() != cloud)
+		||	(sourceSubset && sourceSubset->getAssociatedCloud() != cloud))
+	{
+		ccLog::Warning("Invalid input reference clouds (associated cloud is wrong)");
+		return false;
+	}
+	if (testRatio < 0.0f || testRatio > 1.0f)
+	{
+		ccLog::Warning(QString("Invalid parameter (ratio: %1)").arg(testRatio));
+		return false;
+	}
+	const CCCoreLib::ScalarField* classifSF = GetClassificationSF(cloud);
+	if (!classifSF)
+	{
+		ccLog::Warning("Missing 'Classification' field on the core points");
+		return false;
+	}
+
+	//group the points per class
+	std::vector<int> classLabels;
+	std::vector<std::vector<unsigned>> classIndexes;
+	std::vector<unsigned> testCounts, trainCounts;
+	try
+	{
+		std::map<int, std::vector<unsigned>> classes;
+		unsigned invalidCount = 0;
+		unsigned pointCount = (sourceSubset ? sourceSubset->size() : cloud->size());
+		for (unsigned j = 0; j < pointCount; ++j)
+		{
+			unsigned i = (sourceSubset ? sourceSubset->getPointGlobalIndex(j) : j);
+			ScalarType value = classifSF->getValue(i);
+			if (	!std::isfinite(value)
+				||	value < static_cast<ScalarType>(std::numeric_limits<int>::min())
+				||	value >= static_cast<ScalarType>(std::numeric_limits<int>::max()))
+			{
+				//not a valid class
+				++invalidCount;
+				continue;
+			}
+			classes[static_cast<int>(value)].push_back(i);
+		}
+		if (invalidCount != 0)
+		{
+			ccLog::Warning(QString("[3DMASC] %1 core points have no valid class (they are ignored)").arg(invalidCount));
+		}
+		for (auto& it : classes)
+		{
+			classLabels.push_back(it.first);
+			classIndexes.push_back(std::move(it.second));
+		}
+		testCounts.resize(classLabels.size());
+		trainCounts.resize(classLabels.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		ccLog::Warning("Not enough memory");
+		return false;
+	}
+
+	//the test and training samples of each class are drawn independently (with a seed per class,
+	//so that the selection doesn't depend on the number of threads)
+	int classCount = static_cast<int>(classLabels.size());
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) num_threads(Tools::MaxThreadCount())
+#endif
+#endif
+	for (int c = 0; c < classCount; ++c)
+	{
+		std::vector<unsigned>& indexes = classIndexes[c];
+		unsigned count = static_cast<unsigned>(indexes.size());
+		unsigned testCount = static_cast<unsigned>(floor(count * testRatio));
+		unsigned trainCount = count - testCount;
+		if (maxTrainSamplesPerClass > 0)
+		{
+			trainCount = std::min(trainCount, static_cast<unsigned>(maxTrainSamplesPerClass));
+		}
+
+		//partial Fisher-Yates shuffle
+		std::mt19937 generator(seed ^ (static_cast<unsigned>(classLabels[c]) * 2654435761u));
+		for (unsigned i = 0; i < testCount + trainCount; ++i)
+		{
+			std::uniform_int_distribution<unsigned> distribution(i, count - 1);
+			std::swap(indexes[i], indexes[distribution(generator)]);
+		}
+
+		testCounts[c] = testCount;
+		trainCounts[c] = trainCount;
+	}
+
+	//now dispatch the points
+	unsigned testSampleCount = 0, trainSampleCount = 0;
+	for (int c = 0; c < classCount; ++c)
+	{
+		testSampleCount += testCounts[c];
+		trainSampleCount += trainCounts[c];
+	}
+	if ((testSubset && !testSubset->reserve(testSampleCount)) || !trainSubset->reserve(trainSampleCount))
+	{
+		ccLog::Warning("Not enough memory");
+		if (testSubset)
+			testSubset->clear();
+		trainSubset->clear();
+		return false;
+	}
+
+	for (int c = 0; c < classCount; ++c)
+	{
+		const std::vector<unsigned>& indexes = classIndexes[c];
+		for (unsigned i = 0; i < testCounts[c]; ++i)
+		{
+			testSubset->addPointIndex(indexes[i]);
+		}
+		for (unsigned i = testCounts[c]; i < testCounts[c] + trainCounts[c]; ++i)
+		{
+			trainSubset->addPointIndex(indexes[i]);
+		}
+
+		if (sourceSubset)
+		{
+			//the split of a subset is not worth a report
+			continue;
+		}
+		unsigned unusedCount = static_cast<unsigned>(indexes.size()) - testCounts[c] - trainCounts[c];
+		ccLog::Print(QString("[3DMASC] Class %1: %2 training / %3 test samples%4")
+			.arg(classLabels[c])
+			.arg(trainCounts[c])
+			.arg(testCounts[c])
+			.arg(unusedCount != 0 ? QString(" (%1 unused)").arg(unusedCount) : QString()));
+	}
+
+	return true;
+}
+
 CCCoreLib::ScalarField* Tools::GetClassificationSF(const ccPointCloud* cloud)
 {
 	if (!cloud)
@@ -1509,3 +2872,13 @@ CCCoreLib::ScalarField* Tools::GetClassificationSF(const ccPointCloud* cloud)
 	}
 	return cloud->getScalarField(classifSFIdx);
 }
+
+int Tools::MaxThreadCount()
+{
+#if defined(_OPENMP)
+	static const int s_maxThreadCount = std::max(1, omp_get_max_threads() - 2);
+	return s_maxThreadCount;
+#else
+	return 1;
+#endif
+}
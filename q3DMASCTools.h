@@ -20,6 +20,7 @@
 //Local
 #include "FeaturesInterface.h"
 #include "q3DMASCClassifier.h"
+#include "RegionOfInterest.h"
 
 //CCLib
 #include <GenericProgressCallback.h>
@@ -40,7 +41,7 @@ namespace masc
 
 		static bool LoadTrainingFile(QString filename, Feature::Set& rawFeatures, std::vector<double>& scales, NamedClouds& loadedClouds, TrainParameters& parameters, CorePoints* corePoints = nullptr, QWidget* parent = nullptr);
 
-		static bool LoadClassifierCloudLabels(QString filename, QList<QString>& labels, QString& corePointsLabel, bool& filenamesSpecified);
+		static bool LoadClassifierCloudLabels(QString filename, QList<QString>& labels, QString& corePointsLabel, bool& filenamesSpecified, QString* corePointsDefinition = nullptr);
 
 		static bool LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, QWidget* parent = nullptr);
 
@@ -54,17 +55,248 @@ namespace masc
 								TrainParameters* parameters = nullptr,
 								QWidget* parent = nullptr);
 
+		//! Reads the core points definition of a classifier file and subsamples the classified cloud accordingly
+		/** The core points are left untouched if the file doesn't define subsampled core points for the same cloud.
+			\return false if the core points couldn't be computed
+		**/
+		static bool LoadCorePointsSelection(const QString& filename, NamedClouds& clouds, CorePoints& corePoints, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
 		static bool SaveClassifier(QString filename, const Feature::Set& features, const QString corePointsRole, const masc::Classifier& classifier, QWidget* parent = nullptr);
 
+		//! Returns the indexes of the cheap features (first stage of a cascade classification)
+		/** Cheap features are the point features and the neighborhood features with a scale below 'maxScale'.
+		**/
+		static std::vector<int> CascadeFeatures(const Feature::Set& features, double maxScale);
+
+		//! Classifies the core points in two stages (cascade)
+		/** The cheap features are computed on all the core points and the first stage classifier
+			classifies them. The other features are only computed for the points with a low confidence,
+			and these points are classified by the main classifier.
+			\return success
+		**/
+		static bool ClassifyCascade(const CorePoints& corePoints,
+									Feature::Set& features,
+									masc::Classifier& classifier,
+									QString& error,
+									CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+									SFCollector* generatedScalarFields = nullptr,
+									QWidget* parent = nullptr);
+
+		//! Creates the 'Classification' and 'Classification_confidence' fields of a cloud (filled with NaN)
+		/** An existing 'Classification' field is renamed 'Classification_backup' (as done by the classifier).
+		**/
+		static bool CreateClassificationSFs(ccPointCloud* cloud, CCCoreLib::ScalarField*& classificationSF, CCCoreLib::ScalarField*& confidenceSF);
+
+		//! Classifies a selection of points of a cloud
+		/** The features are only computed for the selected points (on a temporary copy of them).
+			\param cloud cloud
+			\param role cloud role
+			\param pointIndexes indexes of the points to classify
+			\param features features (not prepared yet)
+			\param classifier classifier
+			\param labels output classes (one per selected point)
+			\param confidences output confidences (one per selected point)
+			\param error error message (if any)
+			\return success
+		**/
+		static bool ClassifySelection(	ccPointCloud* cloud,
+										const QString& role,
+										const std::vector<unsigned>& pointIndexes,
+										Feature::Set& features,
+										masc::Classifier& classifier,
+										std::vector<ScalarType>& labels,
+										std::vector<ScalarType>& confidences,
+										QString& error,
+										CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+										QWidget* parent = nullptr);
+
+		//! Propagates the classification of the (subsampled) core points to all the points of the origin cloud
+		/** Each point gets the class voted by its k nearest core points. If refinement is enabled,
+			the points with several classes among their nearest core points are classified directly
+			(the refinement features are then only computed for these points).
+			\param corePoints classified core points (with a selection)
+			\param params propagation parameters
+			\param error error message (if any)
+			\param refinementFeatures features used to classify the boundary points (not prepared yet, required for the refinement)
+			\param classifier classifier used to classify the boundary points (required for the refinement)
+			\return success
+		**/
+		static bool PropagateClassification(const CorePoints& corePoints,
+											const PropagationParameters& params,
+											QString& error,
+											Feature::Set* refinementFeatures = nullptr,
+											masc::Classifier* classifier = nullptr,
+											CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+											QWidget* parent = nullptr);
+
+		//! Change detection parameters (incremental classification)
+		struct ChangeParameters
+		{
+			//! Change field (e.g. M3C2 distance), or empty to use the distance to the previous epoch
+			QString sfName;
+			//! Change threshold (absolute value)
+			double threshold = 0.0;
+		};
+
+		//! Reclassifies a cloud incrementally, based on the classification of a previous epoch
+		/** Only the points closer than the largest scale of the features to a change are classified,
+			the others get the class of the nearest point of the previous epoch. If the classifier uses
+			scale-less features (kNN or nearest neighbor), all the points are classified.
+			\param classifierFilename classifier file (to load the features)
+			\param clouds clouds (per role)
+			\param mainRole role of the classified cloud
+			\param previousCloud classified cloud of the previous epoch
+			\param change change detection parameters
+			\param classifier classifier
+			\param error error message (if any)
+			\return success
+		**/
+		static bool ClassifyIncremental(const QString& classifierFilename,
+										const NamedClouds& clouds,
+										const QString& mainRole,
+										ccPointCloud* previousCloud,
+										const ChangeParameters& change,
+										masc::Classifier& classifier,
+										QString& error,
+										CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+										QWidget* parent = nullptr);
+
+		//! Classifies the points of a cloud inside a region of interest
+		/** Only the points inside the region are classified. The features are computed on copies of
+			the clouds restricted to the region enlarged by the largest scale of the features (halo).
+			The results are written in the 'Classification' and 'Classification_confidence' fields
+			of the full cloud (the other points are left untouched).
+			\param classifierFilename classifier file (to load the features)
+			\param roi region of interest
+			\param clouds clouds (per role)
+			\param mainRole role of the classified cloud
+			\param classifier classifier
+			\param error error message (if any)
+			\return success
+		**/
+		static bool ClassifyRegionOfInterest(	const QString& classifierFilename,
+												const RegionOfInterest& roi,
+												const NamedClouds& clouds,
+												const QString& mainRole,
+												masc::Classifier& classifier,
+												QString& error,
+												CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+												QWidget* parent = nullptr);
+
+		//! Adds the features of another classifier to a set of features (union)
+		/** The features already in the set (same description) are not duplicated: the
+			other set is updated so as to share the same instances. A shared feature is
+			only flagged as unused if neither classifier uses it.
+			\return the number of shared features
+		**/
+		static size_t MergeFeatures(Feature::Set& features, Feature::Set& otherFeatures);
+
+		//! Adds a suffix to the classification scalar fields of a cloud (Classification, Classification_confidence, etc.)
+		/** Existing fields with the same (final) names are replaced.
+		**/
+		static void RenameClassificationSFs(ccPointCloud* cloud, const QString& suffix);
+
+		//! Flags the features that are not used by the classifier (so that they are not computed)
+		/** \return the number of unused features
+		**/
+		static size_t FlagUnusedFeatures(Feature::Set& features, const masc::Classifier& classifier);
+
         static bool PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& error,
                                     CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr);
 
-		static bool RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset);
+		//! Loads the (first) cloud of a file (without any dialog)
+		/** \param filename cloud file
+			\param error error message (if any)
+			\param coordinatesShift global shift (input if 'coordinatesShiftEnabled' is true, output otherwise)
+			\param coordinatesShiftEnabled whether the global shift is already defined (the shift is automatic otherwise)
+			\return the cloud (or null on error)
+		**/
+		static ccPointCloud* LoadCloud(const QString& filename, QString& error, CCVector3d* coordinatesShift = nullptr, bool* coordinatesShiftEnabled = nullptr);
+
+		//! Saves a cloud (the format is deduced from the file extension)
+		static bool SaveCloud(ccPointCloud* cloud, const QString& filename, QString& error);
+
+		//! Computes the features and applies the classifier to a whole cloud
+		/** The cascade classification is used if the classifier has one.
+			\param classifierFilename classifier file (to load the features)
+			\param clouds clouds (per role)
+			\param mainRole role of the classified cloud
+			\param classifier classifier
+			\param error error message (if any)
+			\param keepAttributes whether to keep the features (as scalar fields)
+			\return success
+		**/
+		static bool ClassifyCloud(	const QString& classifierFilename,
+									const NamedClouds& clouds,
+									const QString& mainRole,
+									masc::Classifier& classifier,
+									QString& error,
+									bool keepAttributes = false,
+									CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+									QWidget* parent = nullptr);
+
+		//! Compresses a classifier and saves the compressed version (see Classifier::compress)
+		/** The features are computed on the labelled cloud. Half of its points are used to choose the
+			trees and the depth of the compressed forest, the other half to measure its accuracy (so that
+			the reported accuracy is not biased by this choice).
+			\param classifierFilename classifier file
+			\param clouds clouds (per role)
+			\param mainRole role of the labelled cloud (with a 'Classification' field)
+			\param params compression parameters
+			\param outputFilename compressed classifier file (see SaveClassifier)
+			\param report compression report
+			\param metrics accuracy of the compressed classifier (on the evaluation half)
+			\param error error message (if any)
+			\param seed seed of the random split
+			\return success
+		**/
+		static bool CompressClassifier(	const QString& classifierFilename,
+										const NamedClouds& clouds,
+										const QString& mainRole,
+										const ForestCompression::Parameters& params,
+										const QString& outputFilename,
+										ForestCompression::Report& report,
+										masc::Classifier::AccuracyMetrics& metrics,
+										QString& error,
+										unsigned seed = 0,
+										CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+										QWidget* parent = nullptr);
+
+		//! Randomly splits the points of a cloud in two subsets (the selection is reproducible)
+		static bool RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset, unsigned seed = 0);
+
+		//! Randomly splits the core points in test and training subsets, class by class
+		/** The test ratio is applied to each class (stratification). The number of training samples
+			per class can be limited (the remaining samples of the class are not used at all).
+			The selection is reproducible (seeded). The points without a valid class (NaN or out of
+			range values) are not used.
+			\param cloud core points (with a 'Classification' field)
+			\param testRatio ratio of test samples
+			\param maxTrainSamplesPerClass maximum number of training samples per class (0 = no limit)
+			\param seed seed of the random selection
+			\param testSubset test samples (may be null if the ratio is 0)
+			\param trainSubset training samples
+			\param sourceSubset only the points of this subset are split (optional)
+			\return success
+		**/
+		static bool StratifiedSubsets(	ccPointCloud* cloud,
+										float testRatio,
+										int maxTrainSamplesPerClass,
+										unsigned seed,
+										CCCoreLib::ReferenceCloud* testSubset,
+										CCCoreLib::ReferenceCloud* trainSubset,
+										const CCCoreLib::ReferenceCloud* sourceSubset = nullptr);
 
 		static CCCoreLib::ScalarField* RetrieveSF(const ccPointCloud* cloud, const QString& sfName, bool caseSensitive = true);
 
 		//! Helper: returns the classification SF associated to a cloud (if any)
 		static CCCoreLib::ScalarField* GetClassificationSF(const ccPointCloud* cloud);
+
+		//! Returns the number of threads of the parallel loops
+		/** Computed once (all the threads but 2), to be passed with 'num_threads': the
+			OpenMP state of the calling thread is left untouched.
+		**/
+		static int MaxThreadCount();
 	};
 
 }; //namespace masc
@@ -113,6 +113,9 @@ Classify3DMASCDialog::Classify3DMASCDialog(ccMainAppInterface* app, bool trainMo
 		label->setText(tr("Trainer file"));
 		warningLabel->setVisible(false);
 		warningLabel->setText("Assign each role to the right cloud, and select the cloud on which to train the classifier");
+		propagationFrame->setVisible(false);
+		progressiveFrame->setVisible(false);
+		roiFrame->setVisible(false);
 	}
 
 	onCloudChanged(0);
@@ -131,6 +134,13 @@ void Classify3DMASCDialog::readSettings()
 	settings.beginGroup("3DMASC");
 	bool keepAttributes = settings.value("keepAttributes", false).toBool();
 	this->keepAttributesCheckBox->setChecked(keepAttributes);
+	propagateCheckBox->setChecked(settings.value("propagate", false).toBool());
+	propagationKSpinBox->setValue(settings.value("propagationK", 1).toInt());
+	refineBoundariesCheckBox->setChecked(settings.value("refineBoundaries", false).toBool());
+	progressiveCheckBox->setChecked(settings.value("progressive", false).toBool());
+	progressiveRatioSpinBox->setValue(settings.value("progressiveRatio", 1.0).toDouble());
+	roiCheckBox->setChecked(settings.value("roi", false).toBool());
+	roiLineEdit->setText(settings.value("roiDescription", QString()).toString());
 }
 
 void Classify3DMASCDialog::writeSettings()
@@ -138,6 +148,22 @@ void Classify3DMASCDialog::writeSettings()
 	QSettings settings;
 	settings.beginGroup("3DMASC");
 	settings.setValue("keepAttributes", keepAttributesCheckBox->isChecked());
+	if (!propagationFrame->isHidden())
+	{
+		settings.setValue("propagate", propagateCheckBox->isChecked());
+		settings.setValue("propagationK", propagationKSpinBox->value());
+		settings.setValue("refineBoundaries", refineBoundariesCheckBox->isChecked());
+	}
+	if (!progressiveFrame->isHidden())
+	{
+		settings.setValue("progressive", progressiveCheckBox->isChecked());
+		settings.setValue("progressiveRatio", progressiveRatioSpinBox->value());
+	}
+	if (!roiFrame->isHidden())
+	{
+		settings.setValue("roi", roiCheckBox->isChecked());
+		settings.setValue("roiDescription", roiLineEdit->text());
+	}
 }
 
 void Classify3DMASCDialog::setCloudRoles(const QList<QString>& roles, QString corePointsLabel)
@@ -0,0 +1,111 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//! 3DMASC classification daemon client
+/** Usage:
+	- q3DMASC_daemon_client <server name> status
+	- q3DMASC_daemon_client <server name> shutdown
+	- q3DMASC_daemon_client <server name> <job.json>
+
+	Sends one request to a running daemon (see ClassificationDaemon), prints the reply
+	and returns 0 if the reply status is 'ok'. A job file contains the JSON object of
+	the job (e.g. {"classifier": "...", "input": "...", "output": "..."}).
+**/
+
+//Qt
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+
+//system
+#include <iostream>
+
+static const int s_connectionTimeout_ms = 5000;
+
+static int Error(const QString& message)
+{
+	std::cerr << qPrintable(message) << std::endl;
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication app(argc, argv);
+	QStringList args = app.arguments();
+	if (args.size() != 3)
+	{
+		return Error("Usage: q3DMASC_daemon_client <server name> <status | shutdown | job.json>");
+	}
+	QString serverName = args[1];
+
+	//build the request
+	QJsonObject request;
+	if (args[2] == "status" || args[2] == "shutdown")
+	{
+		request["command"] = args[2];
+	}
+	else
+	{
+		QFile file(args[2]);
+		if (!file.open(QFile::ReadOnly))
+		{
+			return Error(QString("Can't open job file '%1'").arg(args[2]));
+		}
+		QJsonParseError parseError;
+		QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+		if (!doc.isObject())
+		{
+			return Error(QString("Invalid job file '%1': %2").arg(args[2]).arg(parseError.errorString()));
+		}
+		request = doc.object();
+	}
+
+	QLocalSocket socket;
+	socket.connectToServer(serverName);
+	if (!socket.waitForConnected(s_connectionTimeout_ms))
+	{
+		return Error(QString("Can't connect to the daemon '%1': %2").arg(serverName).arg(socket.errorString()));
+	}
+
+	//one request per connection (a JSON object on a single line)
+	socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+	if (!socket.waitForBytesWritten(s_connectionTimeout_ms))
+	{
+		return Error(QString("Failed to send the request: %1").arg(socket.errorString()));
+	}
+
+	//the reply comes once the job is processed (no timeout)
+	while (!socket.canReadLine())
+	{
+		if (!socket.waitForReadyRead(-1) && !socket.canReadLine()) //the daemon closes the connection after replying
+		{
+			return Error(QString("No reply from the daemon: %1").arg(socket.errorString()));
+		}
+	}
+	QByteArray line = socket.readLine().trimmed();
+	std::cout << line.constData() << std::endl;
+
+	QJsonDocument reply = QJsonDocument::fromJson(line);
+	if (!reply.isObject())
+	{
+		return Error("Invalid reply");
+	}
+
+	return (reply.object().value("status").toString() == "ok" ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,346 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//! 3DMASC forest compiler
+/** Usage:
+	- q3DMASC_forest_compiler generate <classifier.yaml> <output.cpp>
+	- q3DMASC_forest_compiler check <classifier.yaml> <compiled forest module> <reference.csv>
+	- q3DMASC_forest_compiler compress <classifier.yaml> <validation.csv> <output.yaml> [tolerance]
+
+	The 'check' mode compares the predictions of the compiled forest with the ones of
+	OpenCV on a reference dataset (one sample per line, the first columns being the
+	features) and reports the inference speed of each engine (in points/s).
+
+	The 'compress' mode keeps only a subset of the trees and/or limits their depth, as
+	long as the accuracy on the validation dataset (features followed by the class of
+	each sample) doesn't drop by more than the tolerance (0.005 by default). It only
+	writes the forest data: use the -3DMASC_COMPRESS command of the plugin to compress
+	a classifier file from labelled clouds.
+**/
+
+//Local
+#include "../FlatForest.h"
+#include "../CompiledForest.h"
+#include "../ForestCompression.h"
+
+//Qt
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTextStream>
+
+//system
+#include <iostream>
+
+using namespace masc;
+
+static const int s_blockSize = 1024;
+
+static int Error(const QString& message)
+{
+	std::cerr << qPrintable(message) << std::endl;
+	return EXIT_FAILURE;
+}
+
+static cv::Ptr<cv::ml::RTrees> LoadForest(const QString& filename, QString& error)
+{
+	cv::Ptr<cv::ml::RTrees> rtrees;
+	try
+	{
+		rtrees = cv::ml::RTrees::load(filename.toStdString());
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+
+	if (!rtrees || rtrees->empty() || !rtrees->isClassifier() || !rtrees->isTrained())
+	{
+		error = QString("Invalid classifier file '%1'").arg(filename);
+		return cv::Ptr<cv::ml::RTrees>();
+	}
+
+	return rtrees;
+}
+
+//! Loads the reference samples (one per line)
+/** The class of each sample is read after the features if 'labels' is defined.
+**/
+static bool LoadSamples(const QString& filename, int featureCount, cv::Mat& samples, QString& error, std::vector<int>* labels = nullptr)
+{
+	QFile file(filename);
+	if (!file.open(QFile::ReadOnly | QFile::Text))
+	{
+		error = QString("Can't open file '%1'").arg(filename);
+		return false;
+	}
+
+	std::vector<float> values;
+	int rowCount = 0;
+	QTextStream stream(&file);
+	QRegularExpression separators("[,;\\s]+");
+	while (!stream.atEnd())
+	{
+		QStringList tokens = stream.readLine().split(separators, QString::SkipEmptyParts);
+		if (tokens.empty())
+		{
+			continue;
+		}
+		bool ok = false;
+		tokens.front().toFloat(&ok);
+		if (!ok)
+		{
+			//header
+			continue;
+		}
+		int columnCount = (labels ? featureCount + 1 : featureCount);
+		if (tokens.size() < columnCount)
+		{
+			error = QString("Line %1: not enough columns (%2/%3)").arg(rowCount + 1).arg(tokens.size()).arg(columnCount);
+			return false;
+		}
+		for (int i = 0; i < featureCount; ++i)
+		{
+			values.push_back(tokens[i].toFloat());
+		}
+		if (labels)
+		{
+			labels->push_back(static_cast<int>(tokens[featureCount].toFloat()));
+		}
+		++rowCount;
+	}
+
+	if (rowCount == 0)
+	{
+		error = "No sample";
+		return false;
+	}
+
+	samples = cv::Mat(rowCount, featureCount, CV_32FC1, values.data()).clone();
+	return true;
+}
+
+//! Returns the predicted class (max vote, same rule as cv::ml::RTrees)
+static int BestClass(const int* labels, const int* votes, int classCount)
+{
+	int bestIndex = 0;
+	for (int i = 1; i < classCount; ++i)
+	{
+		if (votes[i] > votes[bestIndex])
+			bestIndex = i;
+	}
+	return labels[bestIndex];
+}
+
+//! Predicts the samples with OpenCV
+static std::vector<int> PredictOpenCV(const cv::ml::RTrees& rtrees, const cv::Mat& samples, double& pointsPerSecond)
+{
+	std::vector<int> predictions(samples.rows);
+	cv::Mat votes;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int firstIndex = 0; firstIndex < samples.rows; firstIndex += s_blockSize)
+	{
+		int count = std::min(s_blockSize, samples.rows - firstIndex);
+		rtrees.getVotes(samples.rowRange(firstIndex, firstIndex + count), votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+		for (int i = 0; i < count; ++i)
+		{
+			predictions[firstIndex + i] = BestClass(votes.ptr<int>(0), votes.ptr<int>(i + 1), votes.cols);
+		}
+	}
+	pointsPerSecond = samples.rows / std::max(1.0e-9, timer.nsecsElapsed() / 1.0e9);
+
+	return predictions;
+}
+
+//! Predicts the samples with an inference engine
+static std::vector<int> PredictEngine(const ForestEngine& engine, const cv::Mat& samples, double& pointsPerSecond)
+{
+	std::vector<int> predictions(samples.rows);
+	std::vector<int> votes;
+	std::vector<uint8_t> buffer;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int firstIndex = 0; firstIndex < samples.rows; firstIndex += s_blockSize)
+	{
+		int count = std::min(s_blockSize, samples.rows - firstIndex);
+		engine.getVotes(samples.rowRange(firstIndex, firstIndex + count), votes, buffer);
+		for (int i = 0; i < count; ++i)
+		{
+			predictions[firstIndex + i] = BestClass(engine.classLabels().data(), votes.data() + static_cast<size_t>(i) * engine.classCount(), engine.classCount());
+		}
+	}
+	pointsPerSecond = samples.rows / std::max(1.0e-9, timer.nsecsElapsed() / 1.0e9);
+
+	return predictions;
+}
+
+static int Generate(const QString& classifierFilename, const QString& sourceFilename)
+{
+	QString error;
+	cv::Ptr<cv::ml::RTrees> rtrees = LoadForest(classifierFilename, error);
+	if (!rtrees)
+	{
+		return Error(error);
+	}
+
+	FlatForest forest;
+	if (!forest.build(*rtrees, rtrees->getVarCount(), error))
+	{
+		return Error(error);
+	}
+
+	if (!CompiledForest::GenerateSource(forest, sourceFilename, error))
+	{
+		return Error(error);
+	}
+
+	std::cout << "Compiled forest source generated: " << qPrintable(sourceFilename) << " (" << forest.treeCount() << " trees, " << forest.nodeCount() << " nodes)" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+static int Check(const QString& classifierFilename, const QString& moduleFilename, const QString& samplesFilename)
+{
+	QString error;
+	cv::Ptr<cv::ml::RTrees> rtrees = LoadForest(classifierFilename, error);
+	if (!rtrees)
+	{
+		return Error(error);
+	}
+
+	FlatForest flatForest;
+	if (!flatForest.build(*rtrees, rtrees->getVarCount(), error))
+	{
+		return Error(error);
+	}
+	flatForest.setQuantization(flatForest.bestQuantization());
+
+	CompiledForest compiledForest;
+	if (!compiledForest.load(moduleFilename, error))
+	{
+		return Error(error.isEmpty() ? QString("Failed to load module '%1'").arg(moduleFilename) : error);
+	}
+	if (compiledForest.signature() != flatForest.signature())
+	{
+		return Error("The compiled forest was generated from another classifier");
+	}
+
+	cv::Mat samples;
+	if (!LoadSamples(samplesFilename, flatForest.featureCount(), samples, error))
+	{
+		return Error(error);
+	}
+
+	double cvSpeed = 0, flatSpeed = 0, compiledSpeed = 0;
+	std::vector<int> cvPredictions = PredictOpenCV(*rtrees, samples, cvSpeed);
+	std::vector<int> flatPredictions = PredictEngine(flatForest, samples, flatSpeed);
+	std::vector<int> compiledPredictions = PredictEngine(compiledForest, samples, compiledSpeed);
+
+	int flatMismatches = 0, compiledMismatches = 0;
+	for (int i = 0; i < samples.rows; ++i)
+	{
+		if (flatPredictions[i] != cvPredictions[i])
+			++flatMismatches;
+		if (compiledPredictions[i] != cvPredictions[i])
+			++compiledMismatches;
+	}
+
+	std::cout << samples.rows << " reference samples" << std::endl;
+	std::cout << "OpenCV:     " << static_cast<qint64>(cvSpeed) << " points/s" << std::endl;
+	std::cout << "Flattened:  " << static_cast<qint64>(flatSpeed) << " points/s (" << flatMismatches << " mismatch(es))" << std::endl;
+	std::cout << "Compiled:   " << static_cast<qint64>(compiledSpeed) << " points/s (" << compiledMismatches << " mismatch(es))" << std::endl;
+
+	return (flatMismatches == 0 && compiledMismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static int Compress(const QString& classifierFilename, const QString& samplesFilename, const QString& outputFilename, double tolerance)
+{
+	QString error;
+	cv::Ptr<cv::ml::RTrees> rtrees = LoadForest(classifierFilename, error);
+	if (!rtrees)
+	{
+		return Error(error);
+	}
+
+	cv::Mat samples;
+	std::vector<int> labels;
+	if (!LoadSamples(samplesFilename, rtrees->getVarCount(), samples, error, &labels))
+	{
+		return Error(error);
+	}
+
+	ForestCompression::Parameters params;
+	params.tolerance = tolerance;
+	ForestCompression::Report report;
+	cv::Ptr<cv::ml::RTrees> compressed;
+	if (!ForestCompression::Compress(*rtrees, samples, labels, params, compressed, report, error))
+	{
+		return Error(error);
+	}
+
+	try
+	{
+		compressed->save(outputFilename.toStdString());
+	}
+	catch (const cv::Exception& cvex)
+	{
+		return Error(cvex.msg.c_str());
+	}
+
+	std::cout << qPrintable(report.toString()) << std::endl;
+	std::cout << "Compressed classifier saved to " << qPrintable(outputFilename) << std::endl;
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	QCoreApplication app(argc, argv);
+	QStringList arguments = app.arguments();
+
+	if (arguments.size() == 4 && arguments[1] == "generate")
+	{
+		return Generate(arguments[2], arguments[3]);
+	}
+	else if (arguments.size() == 5 && arguments[1] == "check")
+	{
+		return Check(arguments[2], arguments[3], arguments[4]);
+	}
+	else if ((arguments.size() == 5 || arguments.size() == 6) && arguments[1] == "compress")
+	{
+		double tolerance = 0.005;
+		if (arguments.size() == 6)
+		{
+			bool ok = false;
+			tolerance = arguments[5].toDouble(&ok);
+			if (!ok || tolerance < 0.0 || tolerance > 1.0)
+			{
+				return Error("Invalid tolerance (should be in [0 ; 1])");
+			}
+		}
+		return Compress(arguments[2], arguments[3], arguments[4], tolerance);
+	}
+
+	return Error(	"Usage:\n"
+					"  q3DMASC_forest_compiler generate <classifier.yaml> <output.cpp>\n"
+					"  q3DMASC_forest_compiler check <classifier.yaml> <compiled forest module> <reference.csv>\n"
+					"  q3DMASC_forest_compiler compress <classifier.yaml> <validation.csv> <output.yaml> [tolerance]");
+}